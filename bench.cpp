@@ -0,0 +1,580 @@
+#include <cstring>
+#include <vector>
+
+#include "mp.hpp"
+#include "mp_parallel.hpp"
+#include "benchmark/benchmark.h"
+
+#if __has_include( <msgpack.hpp> )
+#include <msgpack.hpp>
+#define MP_BENCH_MSGPACK_C
+#endif
+
+namespace
+{
+    /* Values written per iteration, so the per-call overhead of the loop is amortised. */
+    constexpr auto batch = 0x100;
+
+    struct Stream
+    {
+        std::vector< mp::mp_u8 > buffer;
+        mp::MessagePack mpack { };
+
+        explicit Stream( const size_t size ) : buffer( size )
+        {
+            mpack.initialize_streams( 0, static_cast< mp::mp_u32 >( size ), buffer.data( ) );
+        }
+    };
+
+    /*
+     * One value on each side of every unsigned width boundary: fixint, 8, 16, 32 and 64 bits.
+     */
+    void width_arguments( benchmark::internal::Benchmark *bench )
+    {
+        for ( const auto value : { 0x7fll, 0x80ll, 0xffll, 0x100ll, 0xffffll, 0x10000ll,
+                                   0xffffffffll, 0x100000000ll } )
+            bench->Arg( value );
+    }
+
+    /*
+     * The same for negative values at the NegFixInt, 8, 16, 32 and 64-bit bounds. `write_int` has
+     * no fixint form, so the first pair are both Int8; `write_fixint` covers NegFixInt.
+     */
+    void signed_width_arguments( benchmark::internal::Benchmark *bench )
+    {
+        for ( const auto value : { -0x20ll, -0x21ll, -0x80ll, -0x81ll, -0x8000ll, -0x8001ll,
+                                   -0x80000000ll, -0x80000001ll } )
+            bench->Arg( value );
+    }
+
+    void size_arguments( benchmark::internal::Benchmark *bench )
+    {
+        for ( const auto size : { 8, 64, 1024, 0x10000 } )
+            bench->Arg( size );
+    }
+
+    /*
+     * { "id": uint, "name": str, "score": float, "tags": [ str, str, str ], "blob": bin }
+     */
+    void write_record( mp::MessagePack &mpack, const mp::mp_u32 seed )
+    {
+        static const unsigned char keys[ ] = "idnamescoretagsblob";
+        static const unsigned char text[ 96 ] { };
+
+        mpack.start_map( 5 );
+        mpack.write_cstr( keys, 2 ).write_uint( seed * 977u );
+        mpack.write_cstr( keys + 2, 4 ).write_cstr( text, 12 + seed % 20 );
+        mpack.write_cstr( keys + 6, 5 ).write_float( seed * 0.5 );
+        mpack.write_cstr( keys + 11, 4 ).start_array( 3 );
+        mpack.write_cstr( text, 3 ).write_cstr( text, 7 ).write_cstr( text, 40 );
+        mpack.write_cstr( keys + 15, 4 ).write_bytes( text, sizeof( text ) );
+    }
+
+    /*
+     * An 8 field message, described with and without a compiled `Layout`.
+     */
+    template < bool fixed > struct Tick
+    {
+        mp::mp_u32 id;
+        mp::mp_i16 delta;
+        double price;
+        float weight;
+        bool live;
+        mp::mp_u8 level;
+        mp::mp_i8 side;
+        mp::mp_u64 volume;
+    };
+}
+
+#define MP_BENCH_TICK_FIELDS( type )                                                               \
+    mp::reflect::fields( MP_FIELD( type, id ), MP_FIELD( type, delta ), MP_FIELD( type, price ),  \
+                         MP_FIELD( type, weight ), MP_FIELD( type, live ), MP_FIELD( type, level ),\
+                         MP_FIELD( type, side ), MP_FIELD( type, volume ) )
+
+template < > struct mp::reflect::Schema< Tick< false > >
+{
+    static constexpr auto fields = MP_BENCH_TICK_FIELDS( Tick< false > );
+};
+
+template < > struct mp::reflect::Schema< Tick< true > >
+{
+    static constexpr auto fields = MP_BENCH_TICK_FIELDS( Tick< true > );
+
+    using layout = mp::reflect::Layout< mp::MPMarker::Uint32, mp::MPMarker::Int16,
+        mp::MPMarker::Float64, mp::MPMarker::Float32, mp::MPMarker::True, mp::MPMarker::PosFixInt,
+        mp::MPMarker::NegFixInt, mp::MPMarker::Uint64 >;
+};
+
+static void BM_WriteUint( benchmark::State &state )
+{
+    Stream stream { batch * 9 + 1 };
+    const auto value = static_cast< mp::mp_u64 >( state.range( 0 ) );
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+
+        for ( auto index = 0; index < batch; index++ )
+            stream.mpack.write_uint( value );
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * batch );
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK( BM_WriteUint )->Apply( width_arguments );
+
+static void BM_WriteInt( benchmark::State &state )
+{
+    Stream stream { batch * 9 + 1 };
+    const auto value = static_cast< mp::mp_i64 >( state.range( 0 ) );
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+
+        for ( auto index = 0; index < batch; index++ )
+            stream.mpack.write_int( value );
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * batch );
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK( BM_WriteInt )->Apply( signed_width_arguments );
+
+static void BM_WriteCstr( benchmark::State &state )
+{
+    const auto size = static_cast< mp::mp_u64 >( state.range( 0 ) );
+    const std::vector< mp::mp_u8 > text( size, 'a' );
+    Stream stream { size + 0x10 };
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+        stream.mpack.write_cstr( text.data( ), size );
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK( BM_WriteCstr )->Apply( size_arguments );
+
+static void BM_WriteBytes( benchmark::State &state )
+{
+    const auto size = static_cast< mp::mp_u64 >( state.range( 0 ) );
+    const std::vector< mp::mp_u8 > bytes( size, 0x5a );
+    Stream stream { size + 0x10 };
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+        stream.mpack.write_bytes( bytes.data( ), size );
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK( BM_WriteBytes )->Apply( size_arguments );
+
+/*
+ * Same payloads through `GatherMessagePack`: bodies from 1 KB up are referenced, only the header is
+ * written.
+ */
+static void BM_WriteBytesGather( benchmark::State &state )
+{
+    const auto size = static_cast< mp::mp_u64 >( state.range( 0 ) );
+    const std::vector< mp::mp_u8 > bytes( size, 0x5a );
+    std::vector< mp::mp_u8 > buffer( size + 0x10 );
+    stream::Segment segments[ 4 ] { };
+    mp::GatherMessagePack mpack { };
+
+    mpack.initialize_streams( 0, static_cast< mp::mp_u32 >( buffer.size( ) ), buffer.data( ) );
+    mpack.writer( ).set_segments( segments, 4 ).set_threshold( 1024 );
+
+    for ( auto _ : state )
+    {
+        mpack.reset_cursors( );
+        mpack.write_bytes( bytes.data( ), size );
+
+        benchmark::DoNotOptimize( mpack.writer( ).segments( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetBytesProcessed( state.iterations( ) * mpack.write_cursor( ) );
+}
+BENCHMARK( BM_WriteBytesGather )->Apply( size_arguments )->Arg( 1 << 20 );
+
+/*
+ * `depth` levels of { "k": [ ... ] }, closed by a single integer.
+ */
+static void BM_NestedContainers( benchmark::State &state )
+{
+    const auto depth = state.range( 0 );
+    const unsigned char key[ ] = "k";
+    Stream stream { static_cast< size_t >( depth ) * 8 + 0x10 };
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+
+        for ( auto level = 0; level < depth; level++ )
+            stream.mpack.start_map( 1 ).write_cstr( key, 1 ).start_array( 1 );
+
+        stream.mpack.write_uint( 1 );
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * depth * 2 );
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK( BM_NestedContainers )->Arg( 1 )->Arg( 8 )->Arg( 64 );
+
+static void BM_DecodeMixed( benchmark::State &state )
+{
+    const auto records = static_cast< mp::mp_u32 >( state.range( 0 ) );
+    Stream stream { records * 0x100u + 0x10 };
+
+    stream.mpack.start_array( records );
+
+    for ( mp::mp_u32 record = 0; record < records; record++ )
+        write_record( stream.mpack, record );
+
+    const auto end = stream.mpack.write_cursor( );
+    mp::mp_u64 values = 0;
+
+    for ( auto _ : state )
+    {
+        stream.mpack.seek_read_cursor( 0 );
+
+        while ( stream.mpack.read_cursor( ) < end )
+        {
+            const auto dr = stream.mpack.decode_view( );
+
+            benchmark::DoNotOptimize( dr );
+            values++;
+        }
+    }
+
+    state.SetItemsProcessed( static_cast< mp::mp_i64 >( values ) );
+    state.SetBytesProcessed( state.iterations( ) * end );
+}
+BENCHMARK( BM_DecodeMixed )->Arg( 1 )->Arg( 64 );
+
+/*
+ * The same document walked by `parse`, with a visitor counting values.
+ */
+struct CountingVisitor : mp::NullVisitor
+{
+    mp::mp_u64 values { 0 };
+
+    bool on_uint( mp::mp_u64 ) { values++; return true; }
+    bool on_float( mp::mp_f64 ) { values++; return true; }
+    bool on_str( const mp::mp_u8 *, mp::mp_u32 ) { values++; return true; }
+    bool on_bin( const mp::mp_u8 *, mp::mp_u32 ) { values++; return true; }
+    bool on_array_begin( mp::mp_u32 ) { values++; return true; }
+    bool on_map_begin( mp::mp_u32 ) { values++; return true; }
+};
+
+static void BM_ParseMixed( benchmark::State &state )
+{
+    const auto records = static_cast< mp::mp_u32 >( state.range( 0 ) );
+    Stream stream { records * 0x100u + 0x10 };
+
+    stream.mpack.start_array( records );
+
+    for ( mp::mp_u32 record = 0; record < records; record++ )
+        write_record( stream.mpack, record );
+
+    const auto end = stream.mpack.write_cursor( );
+    CountingVisitor visitor { };
+
+    for ( auto _ : state )
+    {
+        mp::Decoder decoder { stream.buffer.data( ), end };
+
+        benchmark::DoNotOptimize( decoder.parse( visitor ) );
+    }
+
+    state.SetItemsProcessed( static_cast< mp::mp_i64 >( visitor.values ) );
+    state.SetBytesProcessed( state.iterations( ) * end );
+}
+BENCHMARK( BM_ParseMixed )->Arg( 1 )->Arg( 64 );
+
+/*
+ * Validating the same document once, then walking it through the check-free reader.
+ */
+static void BM_ValidateAndParse( benchmark::State &state )
+{
+    const auto records = static_cast< mp::mp_u32 >( state.range( 0 ) );
+    Stream stream { records * 0x100u + 0x10 };
+
+    stream.mpack.start_array( records );
+
+    for ( mp::mp_u32 record = 0; record < records; record++ )
+        write_record( stream.mpack, record );
+
+    const auto end = stream.mpack.write_cursor( );
+    CountingVisitor visitor { };
+
+    for ( auto _ : state )
+    {
+        const auto token = mp::validate( stream.buffer.data( ), end );
+        mp::TrustedDecoder decoder { token };
+
+        benchmark::DoNotOptimize( token && decoder.parse( visitor ) );
+    }
+
+    state.SetItemsProcessed( static_cast< mp::mp_i64 >( visitor.values ) );
+    state.SetBytesProcessed( state.iterations( ) * end );
+}
+BENCHMARK( BM_ValidateAndParse )->Arg( 1 )->Arg( 64 );
+
+/*
+ * The same fixed record, written call by call and through a single `WriteReservation`.
+ */
+template < bool reserved > static void BM_WriteRecord( benchmark::State &state )
+{
+    static const unsigned char keys[ ] = "idxyz";
+    Stream stream { batch * 0x20 };
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+
+        for ( mp::mp_u32 index = 0; index < batch; index++ )
+        {
+            const auto negative = -static_cast< mp::mp_i64 >( index );
+
+            if constexpr ( reserved )
+            {
+                auto record = stream.mpack.reserve( 0x20 );
+
+                record.start_map( 3 ).write_cstr( keys, 2 ).write_uint( index );
+                record.write_cstr( keys + 2, 1 ).write_int( negative );
+                record.write_cstr( keys + 3, 1 ).write_f32( 0.5f );
+            }
+            else
+            {
+                stream.mpack.start_map( 3 ).write_cstr( keys, 2 ).write_uint( index );
+                stream.mpack.write_cstr( keys + 2, 1 ).write_int( negative );
+                stream.mpack.write_cstr( keys + 3, 1 ).write_f32( 0.5f );
+            }
+        }
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * batch );
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK_TEMPLATE( BM_WriteRecord, false );
+BENCHMARK_TEMPLATE( BM_WriteRecord, true );
+
+/*
+ * A map key written with `write_cstr` every time, and as a fragment interned once.
+ */
+template < bool cached > static void BM_WriteKey( benchmark::State &state )
+{
+    static const unsigned char key[ ] = "request_id";
+    mp::FragmentCache< > cache { };
+    const auto fragment = cache.str( key, 10 );
+    Stream stream { batch * 0x10 };
+
+    for ( auto _ : state )
+    {
+        stream.mpack.reset_cursors( );
+
+        for ( auto index = 0; index < batch; index++ )
+        {
+            if constexpr ( cached )
+                stream.mpack.write_encoded( fragment );
+            else
+                stream.mpack.write_cstr( key, 10 );
+        }
+
+        benchmark::DoNotOptimize( stream.buffer.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * batch );
+    state.SetBytesProcessed( state.iterations( ) * stream.mpack.write_cursor( ) );
+}
+BENCHMARK_TEMPLATE( BM_WriteKey, false );
+BENCHMARK_TEMPLATE( BM_WriteKey, true );
+
+/*
+ * A batch of `Tick` messages through `reflect::decode`: key by key, or checked against the
+ * compiled layout in one compare.
+ */
+template < bool fixed > static void BM_DecodeSchema( benchmark::State &state )
+{
+    Stream stream { batch * 0x80 };
+
+    for ( mp::mp_u32 index = 0; index < batch; index++ )
+    {
+        const Tick< fixed > tick { index * 977u, static_cast< mp::mp_i16 >( index - 0x80 ),
+                                   index * 0.25, 0.5f, index % 2 == 0,
+                                   static_cast< mp::mp_u8 >( index % 100 ),
+                                   static_cast< mp::mp_i8 >( -1 - index % 32 ), index * 65537ull };
+
+        mp::reflect::encode( stream.mpack, tick );
+    }
+
+    const auto end = stream.mpack.write_cursor( );
+    Tick< fixed > tick { };
+
+    for ( auto _ : state )
+    {
+        mp::Decoder decoder { stream.buffer.data( ), end };
+
+        for ( auto index = 0; index < batch; index++ )
+            benchmark::DoNotOptimize( mp::reflect::decode( decoder, tick ) );
+
+        benchmark::DoNotOptimize( tick );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * batch );
+    state.SetBytesProcessed( state.iterations( ) * end );
+}
+BENCHMARK_TEMPLATE( BM_DecodeSchema, false );
+BENCHMARK_TEMPLATE( BM_DecodeSchema, true );
+
+/*
+ * A batch of `write_record` messages: boundary pass with `split_batch`, then every value decoded
+ * by `decode_batch` on 1, 2 and 4 threads.
+ */
+static void BM_DecodeBatch( benchmark::State &state )
+{
+    constexpr mp::mp_u32 records = 0x1000;
+    const auto workers = static_cast< mp::mp_u32 >( state.range( 0 ) );
+
+    Stream stream { records * 0x100u };
+
+    for ( mp::mp_u32 record = 0; record < records; record++ )
+        write_record( stream.mpack, record );
+
+    const auto end = stream.mpack.write_cursor( );
+    std::vector< mp::mp_size > offsets( records );
+
+    for ( auto _ : state )
+    {
+        const auto batch = mp::split_batch( stream.buffer.data( ), end, offsets.data( ), records );
+
+        mp::decode_batch(
+            batch,
+            [ ]( mp::mp_size, mp::Decoder &decoder )
+            {
+                while ( decoder.read_cursor( ) < decoder.stream_size( ) )
+                    benchmark::DoNotOptimize( decoder.decode_view( ) );
+
+                return true;
+            },
+            workers
+        );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * records );
+    state.SetBytesProcessed( state.iterations( ) * end );
+}
+BENCHMARK( BM_DecodeBatch )->Arg( 1 )->Arg( 2 )->Arg( 4 )->UseRealTime( );
+
+/*
+ * Upper bound for the string/bin benchmarks above: copying the same payload with no framing.
+ */
+static void BM_MemcpyBaseline( benchmark::State &state )
+{
+    const auto size = static_cast< size_t >( state.range( 0 ) );
+    const std::vector< mp::mp_u8 > source( size, 0x5a );
+    std::vector< mp::mp_u8 > destination( size );
+
+    for ( auto _ : state )
+    {
+        std::memcpy( destination.data( ), source.data( ), size );
+
+        benchmark::DoNotOptimize( destination.data( ) );
+        benchmark::ClobberMemory( );
+    }
+
+    state.SetBytesProcessed( state.iterations( ) * static_cast< mp::mp_i64 >( size ) );
+}
+BENCHMARK( BM_MemcpyBaseline )->Apply( size_arguments );
+
+#ifdef MP_BENCH_MSGPACK_C
+static void BM_MsgpackCWriteUint( benchmark::State &state )
+{
+    const auto value = static_cast< uint64_t >( state.range( 0 ) );
+    msgpack::sbuffer buffer { batch * 9 + 1 };
+    msgpack::packer< msgpack::sbuffer > packer { buffer };
+
+    for ( auto _ : state )
+    {
+        buffer.clear( );
+
+        for ( auto index = 0; index < batch; index++ )
+            packer.pack_uint64( value );
+
+        benchmark::DoNotOptimize( buffer.data( ) );
+    }
+
+    state.SetItemsProcessed( state.iterations( ) * batch );
+    state.SetBytesProcessed( state.iterations( ) * static_cast< int64_t >( buffer.size( ) ) );
+}
+BENCHMARK( BM_MsgpackCWriteUint )->Apply( width_arguments );
+
+static void BM_MsgpackCWriteBytes( benchmark::State &state )
+{
+    const auto size = static_cast< uint32_t >( state.range( 0 ) );
+    const std::vector< char > bytes( size, 0x5a );
+    msgpack::sbuffer buffer { size + 0x10u };
+    msgpack::packer< msgpack::sbuffer > packer { buffer };
+
+    for ( auto _ : state )
+    {
+        buffer.clear( );
+        packer.pack_bin( size ).pack_bin_body( bytes.data( ), size );
+
+        benchmark::DoNotOptimize( buffer.data( ) );
+    }
+
+    state.SetBytesProcessed( state.iterations( ) * static_cast< int64_t >( buffer.size( ) ) );
+}
+BENCHMARK( BM_MsgpackCWriteBytes )->Apply( size_arguments );
+
+static void BM_MsgpackCDecodeMixed( benchmark::State &state )
+{
+    const auto records = static_cast< mp::mp_u32 >( state.range( 0 ) );
+    Stream stream { records * 0x100u + 0x10 };
+
+    stream.mpack.start_array( records );
+
+    for ( mp::mp_u32 record = 0; record < records; record++ )
+        write_record( stream.mpack, record );
+
+    const auto end = stream.mpack.write_cursor( );
+    const auto data = reinterpret_cast< const char * >( stream.buffer.data( ) );
+
+    for ( auto _ : state )
+    {
+        auto handle = msgpack::unpack( data, end );
+
+        benchmark::DoNotOptimize( handle.get( ) );
+    }
+
+    state.SetBytesProcessed( state.iterations( ) * end );
+}
+BENCHMARK( BM_MsgpackCDecodeMixed )->Arg( 1 )->Arg( 64 );
+#endif
+
+BENCHMARK_MAIN( );
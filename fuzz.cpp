@@ -0,0 +1,394 @@
+/*
+ * Fuzz target for `decode_single`, `decode_view`, `peek_marker`, `skip_value`, `parse`,
+ * `validate`, `IncrementalDecoder` and the stream read/write paths.
+ *
+ * With Clang, `-DMP_BUILD_FUZZERS=ON` builds `mp_fuzz` for libFuzzer, with ASan and UBSan. Built
+ * with `MP_FUZZ_REPLAY` instead (target `mp_fuzz_replay`), `main` runs the same checks on the
+ * files given on the command line, or, without arguments, on a built-in corpus of reference
+ * documents together with every truncation and a set of single byte mutations of each.
+ *
+ * Besides what the sanitizers catch, every input is checked for consistency between the backends:
+ * `Decoder` and `MessagePack` must agree value for value, views must stay inside the input, and a
+ * buffer `validate` accepts must be walked to its end by `skip_value` and by `TrustedDecoder`.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "mp.hpp"
+
+namespace
+{
+    void check( const bool condition, const char *what )
+    {
+        if ( condition )
+            return;
+
+        std::fprintf( stderr, "mp_fuzz: %s\n", what );
+        std::abort( );
+    }
+
+    /*
+     * `Decoder` and `MessagePack` (`StreamReader`) decoding the input value by value.
+     */
+    void decode_both( const mp::mp_u8 *data, const mp::mp_u32 size )
+    {
+        std::vector< mp::mp_u8 > copy( data, data + size );
+        mp::MessagePack mpack { };
+        mp::Decoder decoder { data, size };
+
+        mpack.initialize_streams( 0, size, copy.data( ) );
+
+        while ( decoder.good( ) && decoder.read_cursor( ) < size )
+        {
+            const auto lead = data[ decoder.read_cursor( ) ];
+
+            check( decoder.peek_marker( ) == mp::marker_info( lead ).marker, "peek_marker" );
+            check( mpack.peek_marker( ) == decoder.peek_marker( ), "peek_marker backends" );
+
+            const auto start = decoder.read_cursor( );
+            const auto expected = decoder.decode_single( );
+            const auto actual = mpack.decode_single( );
+
+            check( actual.marker == expected.marker, "decode_single marker" );
+            check( actual.size == expected.size, "decode_single size" );
+            check( actual.truncated == expected.truncated, "decode_single truncated" );
+            check( mpack.read_cursor( ) == decoder.read_cursor( ), "decode_single cursor" );
+            check( decoder.read_cursor( ) > start || !decoder.good( ), "decode_single progress" );
+
+            if ( expected.truncated )
+                check( !decoder.good( ), "truncated value left the stream good" );
+        }
+    }
+
+    /*
+     * `decode_view` views point into the input or are `nullptr`.
+     */
+    void decode_views( const mp::mp_u8 *data, const mp::mp_u32 size )
+    {
+        mp::Decoder decoder { data, size };
+
+        while ( decoder.good( ) && decoder.read_cursor( ) < size )
+        {
+            const auto dr = decoder.decode_view( );
+            const auto family = mp::marker_info( dr.marker ).family;
+            const auto viewed = family == mp::MPFamily::Str || family == mp::MPFamily::Bin ||
+                                family == mp::MPFamily::Ext;
+
+            if ( !viewed || !dr.result.as_view.data )
+                continue;
+
+            check( dr.result.as_view.data >= data, "view before the input" );
+            check( dr.result.as_view.data + dr.size <= data + size, "view past the input" );
+        }
+    }
+
+    /*
+     * `skip_value`, `parse` and `validate` agree on where well-formed input ends.
+     */
+    void walk( const mp::mp_u8 *data, const mp::mp_u32 size )
+    {
+        mp::Decoder skipper { data, size };
+        mp::mp_u64 skipped = 0;
+
+        while ( skipper.read_cursor( ) < size && skipper.skip_value( ) )
+            skipped++;
+
+        mp::Decoder parser { data, size };
+        mp::NullVisitor visitor { };
+
+        while ( parser.read_cursor( ) < size && parser.parse( visitor ) )
+            ;
+
+        const auto token = mp::validate( data, size );
+
+        if ( !token )
+        {
+            check( token.offset( ) <= size, "validate offset" );
+            return;
+        }
+
+        check( token.values( ) == skipped, "validate and skip_value count" );
+        check( skipper.read_cursor( ) == size && skipper.good( ), "skip_value on valid input" );
+
+        mp::TrustedDecoder trusted { token };
+
+        for ( mp::mp_u64 index = 0; index < token.values( ); index++ )
+            check( trusted.parse( visitor ), "parse on valid input" );
+
+        check( trusted.read_cursor( ) == size, "TrustedDecoder end" );
+    }
+
+    /*
+     * `IncrementalDecoder` over the input split in two at an input dependent offset.
+     */
+    void decode_chunks( const mp::mp_u8 *data, const mp::mp_u32 size )
+    {
+        if ( !size )
+            return;
+
+        const auto split = data[ 0 ] % size;
+        const mp::mp_u32 pieces[ ][ 2 ] = { { 0, split }, { split, size } };
+
+        mp::IncrementalDecoder decoder { };
+        mp::MPDecodeResult dr { };
+        mp::mp_u8 payload[ 0x40 ];
+
+        for ( const auto &piece : pieces )
+        {
+            decoder.feed( data + piece[ 0 ], piece[ 1 ] - piece[ 0 ] );
+
+            while ( decoder.next( dr ) == mp::DecodeStatus::Ok )
+            {
+                if ( dr.is_bin( ) )
+                    decoder.read_payload( payload, sizeof( payload ) );
+
+                check( decoder.remaining( ) <= piece[ 1 ] - piece[ 0 ], "chunk overrun" );
+            }
+        }
+    }
+
+    mp::mp_u64 unsigned_value( const mp::MPDecodeResult &dr, const mp::mp_u32 width )
+    {
+        switch ( width )
+        {
+        case 1:
+            return dr.result.as_u8;
+        case 2:
+            return dr.result.as_u16;
+        case 4:
+            return dr.result.as_u32;
+        default:
+            return dr.result.as_u64;
+        }
+    }
+
+    mp::mp_i64 signed_value( const mp::MPDecodeResult &dr, const mp::mp_u32 width )
+    {
+        switch ( width )
+        {
+        case 1:
+            return dr.result.as_i8;
+        case 2:
+            return dr.result.as_i16;
+        case 4:
+            return dr.result.as_i32;
+        default:
+            return dr.result.as_i64;
+        }
+    }
+
+    /*
+     * Re-encode every decoded value into a buffer of input dependent size, which is usually too
+     * small: `Encoder` (`SpanWriter`) and `MessagePack` (`StreamWriter`) must write the same
+     * bytes and fail the same way.
+     */
+    void encode_both( const mp::mp_u8 *data, const mp::mp_u32 size )
+    {
+        if ( !size )
+            return;
+
+        const auto capacity = static_cast< mp::mp_u32 >( data[ size - 1 ] % 0x41 );
+
+        std::vector< mp::mp_u8 > span_buffer( capacity + 1 );
+        std::vector< mp::mp_u8 > stream_buffer( capacity + 1 );
+        mp::Encoder encoder { span_buffer.data( ), capacity };
+        mp::MessagePack mpack { };
+        mp::Decoder decoder { data, size };
+
+        mpack.initialize_streams( 0, capacity, stream_buffer.data( ) );
+
+        const auto both = [ & ]( const auto &write )
+        {
+            write( encoder );
+            write( mpack );
+        };
+
+        while ( decoder.good( ) && decoder.read_cursor( ) < size )
+        {
+            const auto dr = decoder.decode_view( );
+            const auto &info = mp::marker_info( dr.marker );
+
+            const auto view = dr.result.as_view;
+
+            switch ( info.family )
+            {
+            case mp::MPFamily::Uint:
+            {
+                const auto value = unsigned_value( dr, info.size );
+                both( [ & ]( auto &out ) { out.write_uint( value ); } );
+                break;
+            }
+            case mp::MPFamily::Int:
+            {
+                const auto value = signed_value( dr, info.size );
+                both( [ & ]( auto &out ) { out.write_int( value ); } );
+                break;
+            }
+            case mp::MPFamily::Float:
+            {
+                const auto value = info.size == 4 ? dr.result.as_f32 : dr.result.as_f64;
+                both( [ & ]( auto &out ) { out.write_float( value ); } );
+                break;
+            }
+            case mp::MPFamily::Str:
+            case mp::MPFamily::Bin:
+                if ( view.data )
+                    both( [ & ]( auto &out ) { out.write_bytes( view.data, dr.size ); } );
+                break;
+            case mp::MPFamily::Ext:
+                if ( view.data )
+                    both( [ & ]( auto &out ) { out.write_ext( view.type, view.data, dr.size ); } );
+                break;
+            case mp::MPFamily::Array:
+                both( [ & ]( auto &out ) { out.start_array( dr.size ); } );
+                break;
+            case mp::MPFamily::Map:
+                both( [ & ]( auto &out ) { out.start_map( dr.size ); } );
+                break;
+            default:
+                both( [ & ]( auto &out ) { out.write_nil( ); } );
+                break;
+            }
+
+            check( encoder.write_cursor( ) == mpack.write_cursor( ), "encode cursor" );
+            check( encoder.error( ) == mpack.writer( ).error( ), "encode error" );
+        }
+
+        check( encoder.write_cursor( ) <= capacity, "encode past the buffer" );
+        check( !std::memcmp( span_buffer.data( ), stream_buffer.data( ), encoder.write_cursor( ) ),
+               "encoded bytes" );
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput( const unsigned char *data, const size_t size )
+{
+    // Streams address at most 4 GB by default; no fuzzer input comes close.
+    const auto length = static_cast< mp::mp_u32 >( size );
+
+    decode_both( data, length );
+    decode_views( data, length );
+    walk( data, length );
+    decode_chunks( data, length );
+    encode_both( data, length );
+
+    return 0;
+}
+
+#ifdef MP_FUZZ_REPLAY
+namespace
+{
+    /*
+     * Reference documents covering every family and width.
+     */
+    std::vector< std::vector< mp::mp_u8 > > reference_corpus( )
+    {
+        std::vector< std::vector< mp::mp_u8 > > corpus;
+        mp::mp_u8 buffer[ 0x400 ];
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        static const mp::mp_u8 text[ 0x120 ] { 'm', 'p' };
+        const auto keep = [ & ]( )
+        {
+            corpus.emplace_back( buffer, buffer + encoder.write_cursor( ) );
+            encoder.reset( );
+        };
+
+        encoder.start_map( 3 ).write_cstr( text, 2 ).write_uint( 0xfedcba98 );
+        encoder.write_cstr( text, 1 ).start_array( 4 ).write_int( -1 ).write_int( -0x80 );
+        encoder.write_int( -0x8000 ).write_int( -0x80000000ll );
+        encoder.write_cstr( text, 0x30 ).write_bytes( text, 0x120 );
+        keep( );
+
+        encoder.start_array( 5 ).write_f32( 1.5f ).write_f64( -2.25 ).write_nil( ).write_true( );
+        encoder.write_uint( ~0ull );
+        keep( );
+
+        encoder.write_ext( 7, text, 1 ).write_ext( 7, text, 16 ).write_ext( -3, text, 20 );
+        encoder.write_timestamp( { 1, 0 } ).write_timestamp( { 0x400000000ll, 5 } );
+        encoder.write_timestamp( { -1, 999999999 } );
+        keep( );
+
+        // Deep nesting and a run of fixints for the SIMD path of `validate`.
+        for ( auto depth = 0; depth < 0x20; depth++ )
+            encoder.start_array( 1 );
+        encoder.start_array( 0x40 );
+        for ( auto index = 0; index < 0x40; index++ )
+            encoder.write_int( index % 3 ? index : -index % 32 );
+        keep( );
+
+        return corpus;
+    }
+
+    void run( const std::vector< mp::mp_u8 > &input )
+    {
+        LLVMFuzzerTestOneInput( input.data( ), input.size( ) );
+    }
+
+    int replay_builtin( )
+    {
+        static const mp::mp_u8 replacements[ ] = { 0x00, 0x7f, 0x8f, 0x9f, 0xbf, 0xc1, 0xc7,
+                                                   0xca, 0xcf, 0xd8, 0xdb, 0xdd, 0xdf, 0xff };
+        mp::mp_u64 runs = 0;
+
+        for ( const auto &document : reference_corpus( ) )
+        {
+            for ( size_t cut = 0; cut <= document.size( ); cut++, runs++ )
+                run( std::vector< mp::mp_u8 >( document.begin( ), document.begin( ) + cut ) );
+
+            auto mutated = document;
+
+            for ( size_t index = 0; index < mutated.size( ); index++ )
+            {
+                for ( const auto replacement : replacements )
+                {
+                    mutated[ index ] = replacement;
+                    run( mutated );
+                    runs++;
+                }
+
+                mutated[ index ] = document[ index ];
+            }
+        }
+
+        std::printf( "mp_fuzz: %llu built-in inputs passed\n", runs );
+        return 0;
+    }
+
+    int replay_file( const char *path )
+    {
+        const auto file = std::fopen( path, "rb" );
+
+        if ( !file )
+        {
+            std::fprintf( stderr, "mp_fuzz: cannot open %s\n", path );
+            return 1;
+        }
+
+        std::vector< mp::mp_u8 > input;
+        mp::mp_u8 block[ 0x1000 ];
+
+        for ( size_t count; ( count = std::fread( block, 1, sizeof( block ), file ) ); )
+            input.insert( input.end( ), block, block + count );
+
+        std::fclose( file );
+        run( input );
+        return 0;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 )
+        return replay_builtin( );
+
+    int failures = 0;
+
+    for ( int index = 1; index < argc; index++ )
+        failures += replay_file( argv[ index ] );
+
+    return failures ? 1 : 0;
+}
+#endif
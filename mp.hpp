@@ -1,17 +1,51 @@
 #pragma once
 
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
 #ifdef _MSC_VER
 #include <intrin.h>
 #define bswap_intrin16( v ) ( _byteswap_ushort( v ) )
 #define bswap_intrin32( v ) ( _byteswap_ulong( v ) )
 #define bswap_intrin64( v ) ( _byteswap_uint64( v ) )
 #pragma intrinsic( memset )
+#pragma intrinsic( memcpy )
 #define mmset( ptr, value, size ) ( memset( ( ptr ), ( value ), ( size ) ) )
+#define mmcpy( dst, src, size ) ( memcpy( ( dst ), ( src ), ( size ) ) )
+#define mp_unlikely( condition ) ( condition )
 #elif defined( __GNUC__ ) || defined( __clang__ )
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+/*
+ * MessagePack is big-endian already, values go through untouched.
+ */
+#define MP_BIG_ENDIAN
+#define bswap_intrin16( v ) ( static_cast< unsigned short >( v ) )
+#define bswap_intrin32( v ) ( static_cast< unsigned int >( v ) )
+#define bswap_intrin64( v ) ( static_cast< unsigned long long >( v ) )
+#else
 #define bswap_intrin16( v ) ( __builtin_bswap16( v ) )
 #define bswap_intrin32( v ) ( __builtin_bswap32( v ) )
 #define bswap_intrin64( v ) ( __builtin_bswap64( v ) )
-#define mmset( ptr, value, size ) ( memset( ( ptr ), ( value ), ( size ) ) )
+#endif
+#define mmset( ptr, value, size ) ( __builtin_memset( ( ptr ), ( value ), ( size ) ) )
+#define mmcpy( dst, src, size ) ( __builtin_memcpy( ( dst ), ( src ), ( size ) ) )
+#define mp_unlikely( condition ) ( __builtin_expect( !!( condition ), 0 ) )
+#endif
+
+/*
+ * Define `_MP_NO_SIMD` to force the scalar fallbacks of the bulk array routines. The vector kernels
+ * assume a little-endian host.
+ */
+#if !defined( _MP_NO_SIMD ) && !defined( MP_BIG_ENDIAN )
+#if defined( __SSSE3__ ) || defined( __AVX__ )
+#include <tmmintrin.h>
+#define MP_SIMD_SSSE3
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#define MP_SIMD_NEON
+#endif
 #endif
 
 namespace mp {
@@ -27,6 +61,19 @@ using mp_i16 = signed short;
 using mp_u8 = unsigned char;
 using mp_i8 = signed char;
 
+using mp_f32 = float;
+using mp_f64 = double;
+
+/*
+ * Type of stream positions and sizes. Define `MP_LARGE_STREAMS` to address buffers over 4 GB; the
+ * default keeps them 32-bit. Every translation unit of a program must agree on the setting.
+ */
+#ifdef MP_LARGE_STREAMS
+using mp_size = mp_u64;
+#else
+using mp_size = mp_u32;
+#endif
+
 // Ensure type size assumptions hold
 static_assert( sizeof( mp_u32 ) == 4, "incorrectly sized `int` type." );
 
@@ -35,8 +82,264 @@ static_assert( sizeof( mp_u64 ) == 8, "incorrectly sized `unsigned long long` ty
 static_assert( sizeof( mp_u16 ) == 2, "incorrectly sized `unsigned short` type." );
 
 static_assert( sizeof( mp_u8 ) == 1, "incorrectly sized `unsigned long long` type." );
+
+static_assert( sizeof( mp_f32 ) == 4, "incorrectly sized `float` type." );
+
+static_assert( sizeof( mp_f64 ) == 8, "incorrectly sized `double` type." );
 } // namespace mp
 
+/*
+ * Optional instrumentation. Define `MP_STATS` in every translation unit to count, per thread,
+ * values per marker, payload sizes, stream failures and dropped bytes, container depths and the
+ * time spent decoding. Without it every hook below is an empty inline function and compiles out.
+ */
+#ifdef MP_STATS
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#endif
+
+namespace mp::stats {
+#ifdef MP_STATS
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+/**
+ * @brief Counter values, as returned by `snapshot` and `thread_snapshot`. Markers are counted by
+ * leading byte; use `marker_info( byte ).marker` to group the fix* ranges.
+ */
+struct Counters {
+  mp_u64 decoded[ 0x100 ];       // Values decoded by `decode_single`/`decode_view`/`parse`
+  mp_u64 encoded[ 0x100 ];       // Values encoded, containers and typed array elements included
+  mp_u64 payloads[ 33 ];         // Str/Bin/Ext bodies encoded, by bit length: [n] < 2^n bytes
+  mp_u64 read_failures[ 4 ];     // Failed reads, by `stream::error` bit
+  mp_u64 write_failures[ 4 ];    // Failed writes, by `stream::error` bit
+  mp_u64 read_dropped;           // Bytes failed reads did not deliver
+  mp_u64 write_dropped;          // Bytes failed writes did not store
+  mp_u64 depths[ 0x41 ];         // Containers opened by `parse`, by nesting depth (64 and deeper)
+  mp_u64 decode_ns;              // Time spent in `decode_single`/`decode_view`/`parse`
+
+  Counters &operator+=( const Counters &other ) {
+    auto       *cells = reinterpret_cast< mp_u64 * >( this );
+    const auto *add = reinterpret_cast< const mp_u64 * >( &other );
+
+    for ( mp_u64 index = 0; index < sizeof( Counters ) / sizeof( mp_u64 ); ++index )
+      cells[ index ] += add[ index ];
+
+    return *this;
+  }
+};
+
+static_assert( sizeof( Counters ) % sizeof( mp_u64 ) == 0, "Counters is a flat array of cells" );
+
+#ifdef MP_STATS
+namespace detail {
+constexpr mp_u64 cell_count = sizeof( Counters ) / sizeof( mp_u64 );
+
+/**
+ * @brief Counters of one thread. Only the owner writes them, with plain relaxed load/store pairs
+ * (no locked instructions); other threads may read them at any time for a snapshot.
+ */
+struct Block {
+  std::atomic< mp_u64 > cells[ cell_count ]{ };
+  Block                *next{ nullptr };
+  Block                *prev{ nullptr };
+
+  Block( );
+  ~Block( );
+
+  void add( const mp_u64 cell, const mp_u64 count ) {
+    cells[ cell ].store( cells[ cell ].load( std::memory_order_relaxed ) + count,
+                         std::memory_order_relaxed );
+  }
+
+  void read( Counters &out ) const {
+    auto *values = reinterpret_cast< mp_u64 * >( &out );
+
+    for ( mp_u64 index = 0; index < cell_count; ++index )
+      values[ index ] += cells[ index ].load( std::memory_order_relaxed );
+  }
+};
+
+/**
+ * @brief Live blocks, plus the sum of the blocks of threads that exited.
+ */
+struct Registry {
+  std::mutex lock;
+  Block     *head{ nullptr };
+  Counters   retired{ };
+};
+
+inline Registry &registry( ) {
+  static Registry instance;
+  return instance;
+}
+
+inline Block::Block( ) {
+  auto                        &all = registry( );
+  std::lock_guard< std::mutex > guard{ all.lock };
+
+  next = all.head;
+  if ( next ) next->prev = this;
+  all.head = this;
+}
+
+inline Block::~Block( ) {
+  auto                        &all = registry( );
+  std::lock_guard< std::mutex > guard{ all.lock };
+
+  read( all.retired );
+
+  if ( prev ) prev->next = next;
+  if ( next ) next->prev = prev;
+  if ( all.head == this ) all.head = next;
+}
+
+inline Block &local( ) {
+  thread_local Block block;
+  return block;
+}
+
+#define MP_STATS_CELL( field ) ( offsetof( ::mp::stats::Counters, field ) / sizeof( mp_u64 ) )
+} // namespace detail
+#endif
+
+inline void decoded( [[maybe_unused]] const mp_u8 lead ) {
+#ifdef MP_STATS
+  detail::local( ).add( MP_STATS_CELL( decoded ) + lead, 1 );
+#endif
+}
+
+inline void encoded( [[maybe_unused]] const mp_u8 lead, [[maybe_unused]] const mp_u64 count = 1 ) {
+#ifdef MP_STATS
+  detail::local( ).add( MP_STATS_CELL( encoded ) + lead, count );
+#endif
+}
+
+inline void payload( [[maybe_unused]] const mp_u64 size ) {
+#ifdef MP_STATS
+  mp_u64 bits = 0;
+
+  while ( bits < 32 && size >> bits ) ++bits;
+
+  detail::local( ).add( MP_STATS_CELL( payloads ) + bits, 1 );
+#endif
+}
+
+/**
+ * @brief Record a failure on the read side, `bytes` being the size of the rejected access.
+ */
+inline void read_failed(
+    [[maybe_unused]] const mp_u8 flags, [[maybe_unused]] const mp_u64 bytes
+) {
+#ifdef MP_STATS
+  auto &block = detail::local( );
+
+  for ( mp_u64 bit = 0; bit < 4; ++bit )
+    if ( flags >> bit & 1 ) block.add( MP_STATS_CELL( read_failures ) + bit, 1 );
+
+  block.add( MP_STATS_CELL( read_dropped ), bytes );
+#endif
+}
+
+/**
+ * @brief Record a failure on the write side, `bytes` being the size of the dropped write.
+ */
+inline void write_failed(
+    [[maybe_unused]] const mp_u8 flags, [[maybe_unused]] const mp_u64 bytes
+) {
+#ifdef MP_STATS
+  auto &block = detail::local( );
+
+  for ( mp_u64 bit = 0; bit < 4; ++bit )
+    if ( flags >> bit & 1 ) block.add( MP_STATS_CELL( write_failures ) + bit, 1 );
+
+  block.add( MP_STATS_CELL( write_dropped ), bytes );
+#endif
+}
+
+inline void depth( [[maybe_unused]] const mp_u32 level ) {
+#ifdef MP_STATS
+  detail::local( ).add( MP_STATS_CELL( depths ) + ( level < 0x40 ? level : 0x40 ), 1 );
+#endif
+}
+
+/**
+ * @brief Adds its lifetime to `Counters::decode_ns`. Empty unless `MP_STATS` is defined.
+ */
+struct DecodeTimer {
+#ifdef MP_STATS
+  std::chrono::steady_clock::time_point start{ std::chrono::steady_clock::now( ) };
+
+  ~DecodeTimer( ) {
+    const auto elapsed = std::chrono::steady_clock::now( ) - start;
+
+    detail::local( ).add(
+        MP_STATS_CELL( decode_ns ),
+        static_cast< mp_u64 >(
+            std::chrono::duration_cast< std::chrono::nanoseconds >( elapsed ).count( ) )
+    );
+  }
+#endif
+};
+
+/**
+ * @brief Counters of the calling thread. All zero unless `MP_STATS` is defined.
+ */
+inline Counters thread_snapshot( ) {
+  Counters out{ };
+
+#ifdef MP_STATS
+  detail::local( ).read( out );
+#endif
+
+  return out;
+}
+
+/**
+ * @brief Sum of the counters of every thread, including threads that exited. Counters of running
+ * threads are read while they may still change. All zero unless `MP_STATS` is defined.
+ */
+inline Counters snapshot( ) {
+  Counters out{ };
+
+#ifdef MP_STATS
+  auto                        &all = detail::registry( );
+  std::lock_guard< std::mutex > guard{ all.lock };
+
+  out = all.retired;
+
+  for ( auto block = all.head; block; block = block->next )
+    block->read( out );
+#endif
+
+  return out;
+}
+
+/**
+ * @brief Zero the counters of the calling thread and those kept for threads that exited. Counters
+ * of other running threads are left alone, as only their owner may write them.
+ */
+inline void reset( ) {
+#ifdef MP_STATS
+  auto &block = detail::local( ); // Registers itself, so not under the lock
+  auto &all = detail::registry( );
+
+  std::lock_guard< std::mutex > guard{ all.lock };
+
+  all.retired = Counters{ };
+
+  for ( auto &cell : block.cells )
+    cell.store( 0, std::memory_order_relaxed );
+#endif
+}
+
+#undef MP_STATS_CELL
+} // namespace mp::stats
+
 /*
  * Note: Neither Stream interface takes ownership of the underlying memory.
  * It *always* the caller's responsibility to clean up.
@@ -52,27 +355,89 @@ static_assert( sizeof( mp_u8 ) == 1, "incorrectly sized `unsigned long long` typ
  *      4.4) Stream is now unusable
  *
  *  Notes:
- *      1) Not thread safe by default. User must provide their own locking mechanisms;
- *      2) Overflows are handled silently and internally, no exceptions or invalid memory access are
- * reported to the user.
+ *      1) Not thread safe by default. User must provide their own locking mechanisms, or encode
+ * from several threads through `EncoderRing` (`mp_parallel.hpp`);
+ *      2) No exceptions are thrown and no access goes past the buffer. A failing operation instead
+ * sets a sticky `stream::error` flag, readable through `error( )`/`good( )` on the streams and the
+ * encoders/decoders built on them; a decoded value that runs past the end of the input is
+ * reported by `MPDecodeResult::truncated`.
  */
 
 namespace stream {
 using MemoryReader = void ( * )( void *dst, const void *src, mp::mp_u64 size );
 using MemoryWriter = MemoryReader;
 
+/*
+ * Copy policies decide how bytes move between the stream buffer and the caller. A policy exposes:
+ *
+ *  - `bind( fn )`:  receive the `MemoryReader`/`MemoryWriter` passed to `set( )`;
+ *  - `valid( )`:    whether the policy is able to copy memory at all;
+ *  - `copy( dst, src, size )`: perform the copy.
+ *
+ * `InlineCopy` is the default and lets the compiler see the copy, so fixed-size reads and writes
+ * of `Ty` collapse into a single load/store. `FunctionCopy` keeps the function pointer behaviour
+ * for callers that need to read from or write to foreign or remote memory.
+ */
+
+/**
+ * @brief Default copy policy. Copies through the compiler's own `memcpy` so that fixed-size
+ * transfers are inlined. Any function pointer handed to `bind` is ignored.
+ */
+struct InlineCopy {
+  /* The stream buffer is plain local memory and may be accessed directly. */
+  static constexpr bool direct = true;
+
+  void bind( const MemoryReader ) { }
+
+  bool valid( ) const { return true; }
+
+  void copy( void *dst, const void *src, const mp::mp_u64 size ) const { mmcpy( dst, src, size ); }
+};
+
+/**
+ * @brief Opt-in copy policy. Every copy goes through the user provided `MemoryReader` or
+ * `MemoryWriter` function pointer.
+ */
+struct FunctionCopy {
+  /* The stream buffer may only be accessed through `fn_`. */
+  static constexpr bool direct = false;
+
+  void bind( const MemoryReader fn ) { fn_ = fn; }
+
+  bool valid( ) const { return fn_ != nullptr; }
+
+  void copy( void *dst, const void *src, const mp::mp_u64 size ) const { fn_( dst, src, size ); }
+
+private:
+  MemoryReader fn_{ nullptr };
+};
+
+/*
+ * Sticky error flags reported by `error( )` on streams and `BasicMessagePack`. Like the bits of
+ * `std::ios_base::iostate` they accumulate: the first failing operation sets its flag, later
+ * operations keep failing the same way, and the flags stay set until `clear_error( )` or a reset of
+ * the stream. Check them once after a batch instead of after every call.
+ */
+namespace error {
+constexpr mp::mp_u8 none = 0;
+constexpr mp::mp_u8 overflow = 1 << 0;    // A read or write ran past the end of the stream
+constexpr mp::mp_u8 unavailable = 1 << 1; // No buffer, or the copy policy has no function to use
+constexpr mp::mp_u8 no_memory = 1 << 2;   // The allocator could not provide a chunk
+constexpr mp::mp_u8 malformed = 1 << 3;   // The decoder met the reserved marker 0xc1
+} // namespace error
+
 struct Stream {
   /**
    * @brief Current cursor position.
-   * @return mp::mp_u32
+   * @return mp::mp_size
    */
-  mp::mp_u32 position( ) const { return position_; }
+  mp::mp_size position( ) const { return position_; }
 
   /**
    * @brief Total size of the stream. Does not take into account the current cursor position.
-   * @return mp::mp_u32
+   * @return mp::mp_size
    */
-  mp::mp_u32 stream_size( ) const { return stream_size_; }
+  mp::mp_size stream_size( ) const { return stream_size_; }
 
   /**
    * @brief End address of the buffer managed by this stream.
@@ -86,34 +451,86 @@ struct Stream {
    */
   mp::mp_u8 *start( ) const { return buffer_; }
 
+  /**
+   * @brief Sticky error flags, see `stream::error`.
+   * @return mp::mp_u8
+   */
+  mp::mp_u8 error( ) const { return error_; }
+
+  /**
+   * @brief `true` if no operation failed since the last reset or `clear_error( )`.
+   */
+  bool good( ) const { return error_ == error::none; }
+
+  void clear_error( ) { error_ = error::none; }
+
+  /**
+   * @brief Raise `flags` as if an operation had failed, e.g. on a decoding error.
+   */
+  void fail( const mp::mp_u8 flags ) { error_ |= flags; }
+
 protected:
-  mp::mp_u32 position_{ 0 };
-  mp::mp_u32 stream_size_{ 0 };
-  mp::mp_u8 *buffer_{ nullptr };
+  mp::mp_size position_{ 0 };
+  mp::mp_size stream_size_{ 0 };
+  mp::mp_u8  *buffer_{ nullptr };
+  mp::mp_u8   error_{ error::none };
+
+  /**
+   * @brief Record a failed access: `error::overflow` if the stream was `usable` and simply too
+   * short, `error::unavailable` otherwise. `count` bytes are reported dropped to `mp::stats`.
+   */
+  void _fail_access( const bool usable, const mp::mp_u64 count, const bool write ) {
+    const mp::mp_u8 flags = usable ? error::overflow : error::unavailable;
+
+    if ( write )
+      mp::stats::write_failed( flags, count );
+    else
+      mp::stats::read_failed( flags, count );
+
+    error_ |= flags;
+  }
+
+  /**
+   * @brief `true` if `count` bytes remain past the cursor.
+   */
+  bool _fits( const mp::mp_size count ) const {
+    return position_ <= stream_size_ && count <= stream_size_ - position_;
+  }
 };
 
-struct StreamReader : Stream {
+template < typename CopyPolicy = InlineCopy > struct BasicStreamReader : Stream {
 private:
-  MemoryReader reader_{ nullptr };
+  CopyPolicy reader_{ };
 
 public:
-  explicit StreamReader(
-      const mp::mp_u32   position = 0,
-      const mp::mp_u32   stream_size = 0,
+  /* Whether the buffer may be accessed directly, see the copy policies. */
+  static constexpr bool direct = CopyPolicy::direct;
+
+  explicit BasicStreamReader(
+      const mp::mp_size  position = 0,
+      const mp::mp_size  stream_size = 0,
       mp::mp_u8         *buffer = nullptr,
       const MemoryReader reader = nullptr
   ) {
     position_ = position;
     stream_size_ = stream_size;
     buffer_ = buffer;
-    reader_ = reader;
+    reader_.bind( reader );
   }
 
-  explicit operator bool( ) const { return reader_ != nullptr && buffer_ != nullptr; }
+  explicit operator bool( ) const { return reader_.valid( ) && buffer_ != nullptr; }
 
   /* Disallow copies. */
-  StreamReader( StreamReader &other ) = delete;
-  StreamReader &operator=( StreamReader &other ) = delete;
+  BasicStreamReader( BasicStreamReader &other ) = delete;
+  BasicStreamReader &operator=( BasicStreamReader &other ) = delete;
+
+  /**
+   * @brief Raise `flags` as if an operation had failed, e.g. on a decoding error.
+   */
+  void fail( const mp::mp_u8 flags ) {
+    mp::stats::read_failed( flags, 0 );
+    Stream::fail( flags );
+  }
 
   /**
    * @brief Reset the internal stream state for this object.
@@ -122,7 +539,8 @@ public:
     position_ = 0;
     stream_size_ = 0;
     buffer_ = nullptr;
-    reader_ = nullptr;
+    error_ = error::none;
+    reader_.bind( nullptr );
   }
 
   /**
@@ -133,12 +551,16 @@ public:
     position_ = 0;
     stream_size_ = 0;
     buffer_ = nullptr;
+    error_ = error::none;
   }
 
   /**
-   * @brief Reset the stream cursor back to the start
+   * @brief Reset the stream cursor back to the start and clear the error flags
    */
-  void reset_cursor( ) { position_ = 0; }
+  void reset_cursor( ) {
+    position_ = 0;
+    error_ = error::none;
+  }
 
   /**
    * @brief Set the internal fields of the `StreamWriter` object. Required calling if object was
@@ -147,12 +569,12 @@ public:
    * @param stream_size Total size, in bytes, of `buffer`
    * @param buffer Pointer of at least `stream_size` bytes to be managed by `StreamWriter`
    * @param reader Function pointer of type `void ( * ) ( void *src, void *dst, size_t size )` to be
-   * used for writing memory
-   * @return StreamReader&
+   * used for writing memory. Only used by the `FunctionCopy` policy.
+   * @return BasicStreamReader&
    */
-  StreamReader &
-  set( const mp::mp_u32   position = 0,
-       const mp::mp_u32   stream_size = 0,
+  BasicStreamReader &
+  set( const mp::mp_size  position = 0,
+       const mp::mp_size  stream_size = 0,
        mp::mp_u8         *buffer = nullptr,
        const MemoryReader reader = nullptr ) {
     reset( );
@@ -160,7 +582,7 @@ public:
     position_ = position;
     stream_size_ = stream_size;
     buffer_ = buffer;
-    reader_ = reader;
+    reader_.bind( reader );
 
     return *this;
   }
@@ -171,11 +593,11 @@ public:
    * @param position Position to set the stream at
    * @param stream_size Total size, in bytes, of `buffer`
    * @param buffer Pointer of at least `stream_size` bytes to be managed by `StreamReader`
-   * @return StreamReader&
+   * @return BasicStreamReader&
    */
-  StreamReader &set_temporal(
-      const mp::mp_u32 position = 0,
-      const mp::mp_u32 stream_size = 0,
+  BasicStreamReader &set_temporal(
+      const mp::mp_size position = 0,
+      const mp::mp_size stream_size = 0,
       mp::mp_u8       *buffer = nullptr
   ) {
     reset_temporal( );
@@ -190,8 +612,9 @@ public:
 private:
   /**
    * @brief The core of the `StreamReader` interface. Copies `count` bytes from the stream using the
-   * internal reader function and writes into `dst`.
-   * @remarks Define `_UNSAFE` to remove NULL and overflow checks.
+   * copy policy and writes into `dst`.
+   * @remarks Define `_MP_UNSAFE` to remove NULL and overflow checks. Otherwise a failing read
+   * leaves `dst` untouched and raises `error::overflow` or `error::unavailable`.
    * @param count Number of bytes in `src` to read from the stream.
    * @param dst Buffer of at least `count` bytes to copy into.
    * @param peek Read without advancing the cursor
@@ -200,12 +623,15 @@ private:
     const auto read_pos = buffer_ + position_;
 
 #ifndef _MP_UNSAFE
-    if ( !count || !dst || count >= stream_size_ || read_pos + count > end( ) || !*this ) {
+    if ( !count ) return;
+
+    if ( mp_unlikely( !dst || !*this || !_fits( count ) ) ) {
+      _fail_access( dst && *this, count, false );
       return;
     }
 #endif
 
-    reader_( dst, read_pos, count );
+    reader_.copy( dst, read_pos, count );
 
     if ( !peek ) position_ += count;
   }
@@ -327,37 +753,87 @@ public:
    * amount.
    * @param count Size, in bytes, of the data pointed to by `src`.
    * @param dst Buffer containing at least `count` bytes.
-   * @return StreamReader&
+   * @return BasicStreamReader&
    */
-  StreamReader &read( const mp::mp_u32 count, mp::mp_u8 *dst ) {
+  BasicStreamReader &read( const mp::mp_u32 count, mp::mp_u8 *dst ) {
     _read_and_advance( count, dst );
 
     return *this;
   }
+
+  /**
+   * @brief Move the cursor to `position`.
+   * @param position Absolute position in the stream
+   * @return `false`, leaving the cursor untouched, if `position` lies past the end of the stream
+   */
+  bool seek( const mp::mp_size position ) {
+    if ( position > stream_size_ ) return false;
+
+    position_ = position;
+
+    return true;
+  }
+
+  /**
+   * @brief Return a pointer to the next `count` bytes of the stream and advance the internal cursor
+   * by the same amount. Nothing is copied; the copy policy is bypassed entirely.
+   * @remarks Define `_MP_UNSAFE` to remove NULL and overflow checks.
+   * @param count Number of bytes the caller intends to access through the returned pointer.
+   * @return Pointer into the stream buffer or `nullptr` if fewer than `count` bytes remain, in
+   * which case the cursor is left untouched and `error::overflow` is raised.
+   */
+  const mp::mp_u8 *view( const mp::mp_u32 count ) {
+    const auto read_pos = buffer_ + position_;
+
+#ifndef _MP_UNSAFE
+    if ( mp_unlikely( !buffer_ || !_fits( count ) ) ) {
+      _fail_access( buffer_ != nullptr, count, false );
+      return nullptr;
+    }
+#endif
+
+    position_ += count;
+
+    return read_pos;
+  }
 };
 
-struct StreamWriter : Stream {
+template < typename CopyPolicy = InlineCopy > struct BasicStreamWriter : Stream {
 private:
-  MemoryWriter writer_{ nullptr };
+  CopyPolicy writer_{ };
 
 public:
-  explicit StreamWriter(
-      const mp::mp_u32   position = 0,
-      const mp::mp_u32   stream_size = 0,
+  /* Bytes returned by `reserve` may be written later on, see `BasicEncoder::begin_array`. */
+  static constexpr bool stable = CopyPolicy::direct;
+
+  /* Everything written after a reservation directly follows it in the same buffer. */
+  static constexpr bool contiguous = CopyPolicy::direct;
+
+  explicit BasicStreamWriter(
+      const mp::mp_size  position = 0,
+      const mp::mp_size  stream_size = 0,
       mp::mp_u8         *buffer = nullptr,
       const MemoryWriter writer = nullptr
   ) {
     position_ = position;
     stream_size_ = stream_size;
     buffer_ = buffer;
-    writer_ = writer;
+    writer_.bind( writer );
   }
 
-  explicit operator bool( ) const { return writer_ != nullptr && buffer_ != nullptr; }
+  explicit operator bool( ) const { return writer_.valid( ) && buffer_ != nullptr; }
 
   /* Disallow copies. */
-  StreamWriter( StreamWriter &other ) = delete;
-  StreamWriter &operator=( StreamWriter &other ) = delete;
+  BasicStreamWriter( BasicStreamWriter &other ) = delete;
+  BasicStreamWriter &operator=( BasicStreamWriter &other ) = delete;
+
+  /**
+   * @brief Raise `flags` as if an operation had failed, e.g. on a decoding error.
+   */
+  void fail( const mp::mp_u8 flags ) {
+    mp::stats::write_failed( flags, 0 );
+    Stream::fail( flags );
+  }
 
   /**
    * @brief Reset the internal stream state for this object.
@@ -366,7 +842,8 @@ public:
     position_ = 0;
     stream_size_ = 0;
     buffer_ = nullptr;
-    writer_ = nullptr;
+    error_ = error::none;
+    writer_.bind( nullptr );
   }
 
   /**
@@ -377,12 +854,16 @@ public:
     position_ = 0;
     stream_size_ = 0;
     buffer_ = nullptr;
+    error_ = error::none;
   }
 
   /**
-   * @brief Reset the stream cursor back to the start
+   * @brief Reset the stream cursor back to the start and clear the error flags
    */
-  void reset_cursor( ) { position_ = 0; }
+  void reset_cursor( ) {
+    position_ = 0;
+    error_ = error::none;
+  }
 
   /*
    * @brief Clear the stream and reset the cursor
@@ -399,12 +880,12 @@ public:
    * @param stream_size Total size, in bytes, of `buffer`
    * @param buffer Pointer of at least `stream_size` bytes to be managed by `StreamWriter`
    * @param writer Function pointer of type `void ( * ) ( void *src, void *dst, size_t size )` to be
-   * used for writing memory
-   * @return StreamWriter&
+   * used for writing memory. Only used by the `FunctionCopy` policy.
+   * @return BasicStreamWriter&
    */
-  StreamWriter &
-  set( const mp::mp_u32   position = 0,
-       const mp::mp_u32   stream_size = 0,
+  BasicStreamWriter &
+  set( const mp::mp_size  position = 0,
+       const mp::mp_size  stream_size = 0,
        mp::mp_u8         *buffer = nullptr,
        const MemoryWriter writer = nullptr ) {
     reset( );
@@ -412,7 +893,7 @@ public:
     position_ = position;
     stream_size_ = stream_size;
     buffer_ = buffer;
-    writer_ = writer;
+    writer_.bind( writer );
 
     return *this;
   }
@@ -422,11 +903,11 @@ public:
    * @param position Position to set the stream at
    * @param stream_size Total size, in bytes, of `buffer`
    * @param buffer Pointer of at least `stream_size` bytes to be managed by `StreamWriter`
-   * @return StreamReader&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &set_temporal(
-      const mp::mp_u32 position = 0,
-      const mp::mp_u32 stream_size = 0,
+  BasicStreamWriter &set_temporal(
+      const mp::mp_size position = 0,
+      const mp::mp_size stream_size = 0,
       mp::mp_u8       *buffer = nullptr
   ) {
     reset_temporal( );
@@ -453,8 +934,9 @@ public:
 private:
   /**
    * @brief The core of the `StreamWriter` interface. Copies `count` bytes from `src` using the
-   * internal writer function and writes into the byte stream.
-   * @remarks Define `_UNSAFE` to remove NULL and overflow checks.
+   * copy policy and writes into the byte stream.
+   * @remarks Define `_MP_UNSAFE` to remove NULL and overflow checks. Otherwise a failing write is
+   * dropped and raises `error::overflow` or `error::unavailable`.
    * @param count Number of bytes in `src` to write into the stream.
    * @param src Buffer of at least `count` bytes to copy from.
    */
@@ -462,12 +944,15 @@ private:
     const auto write_pos = buffer_ + position_;
 
 #ifndef _MP_UNSAFE
-    if ( !count || !src || count >= stream_size_ || write_pos + count > end( ) || !*this ) {
+    if ( !count ) return;
+
+    if ( mp_unlikely( !src || !*this || !_fits( count ) ) ) {
+      _fail_access( src && *this, count, true );
       return;
     }
 #endif
 
-    writer_( write_pos, src, count );
+    writer_.copy( write_pos, src, count );
 
     position_ += count;
   }
@@ -477,9 +962,9 @@ public:
    * @brief Write a single unsigned 4 byte value to the stream and advance the cursor by 4 if the
    * stream has not reached its end.
    * @param value Unsigned 4 byte value to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_u32( const mp::mp_u32 value ) {
+  BasicStreamWriter &write_u32( const mp::mp_u32 value ) {
     write_pod< mp::mp_u32 >( value );
     return *this;
   }
@@ -488,9 +973,9 @@ public:
    * @brief Write a single unsigned 8 byte value to the stream and advance the cursor by 8 if the
    * stream has not reached its end.
    * @param value Unsigned 8 byte value to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_u64( const mp::mp_u64 value ) {
+  BasicStreamWriter &write_u64( const mp::mp_u64 value ) {
     write_pod< mp::mp_u64 >( value );
     return *this;
   }
@@ -500,9 +985,9 @@ public:
    * stream has not reached its end. The value will be cast to its unsigned counterpart before the
    * endianess change.
    * @param value Signed 4 byte value to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_i32( const mp::mp_i32 value ) {
+  BasicStreamWriter &write_i32( const mp::mp_i32 value ) {
     write_pod< mp::mp_i32 >( value );
     return *this;
   }
@@ -512,9 +997,9 @@ public:
    * stream has not reached its end. The value will be cast to its unsigned counterpart before the
    * endianess change.
    * @param value Signed 8 byte value to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_i64( const mp::mp_i64 value ) {
+  BasicStreamWriter &write_i64( const mp::mp_i64 value ) {
     write_pod< mp::mp_i64 >( value );
     return *this;
   }
@@ -523,9 +1008,9 @@ public:
    * @brief Write a single unsigned 2 byte value to the stream and advance the cursor by 2 if the
    * stream has not reached its end.
    * @param value Unsigned 2 byte value to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_u16( const mp::mp_u16 value ) {
+  BasicStreamWriter &write_u16( const mp::mp_u16 value ) {
     write_pod< mp::mp_u16 >( value );
     return *this;
   }
@@ -535,9 +1020,9 @@ public:
    * stream has not reached its end. The value will be cast to its unsigned counterpart before the
    * endianess change.
    * @param value Signed 2 byte value to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_i16( const mp::mp_i16 value ) {
+  BasicStreamWriter &write_i16( const mp::mp_i16 value ) {
     write_pod< mp::mp_i16 >( value );
     return *this;
   }
@@ -546,9 +1031,9 @@ public:
    * @brief Write a single unsigned byte to the stream and advance the cursor by 1 if the stream has
    * not reached its end.
    * @param value Unsigned byte to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_u8( const mp::mp_u8 value ) {
+  BasicStreamWriter &write_u8( const mp::mp_u8 value ) {
     write_pod< mp::mp_u8 >( value );
     return *this;
   }
@@ -557,9 +1042,9 @@ public:
    * @brief Write a single signed byte to the stream and advance the cursor by 1 if the stream has
    * not reached its end.
    * @param value Signed byte to write to the stream
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write_i8( const mp::mp_i8 value ) {
+  BasicStreamWriter &write_i8( const mp::mp_i8 value ) {
     write_pod< mp::mp_i8 >( value );
     return *this;
   }
@@ -569,1246 +1054,6204 @@ public:
    * amount.
    * @param count Size, in bytes, of the data pointed to by `src`.
    * @param src Buffer containing at least `count` bytes.
-   * @return StreamWriter&
+   * @return BasicStreamWriter&
    */
-  StreamWriter &write( const mp::mp_u32 count, mp::mp_u8 *src ) {
+  BasicStreamWriter &write( const mp::mp_u32 count, mp::mp_u8 *src ) {
     _write_and_advance( count, src );
     return *this;
   }
-};
-} // namespace stream
 
-namespace limits {
-/*
- * Taken from the MSVC standard library and converted to constexpr instead of C macros.
- */
-constexpr auto int8_min = ( -127i8 - 1 );
-constexpr auto int16_min = ( -32767i16 - 1 );
-constexpr auto int32_min = ( -2147483647i32 - 1 );
-constexpr auto int64_min = ( -9223372036854775807i64 - 1 );
-constexpr auto int8_max = 127i8;
-constexpr auto int16_max = 32767i16;
-constexpr auto int32_max = 2147483647i32;
-constexpr auto int64_max = 9223372036854775807i64;
-constexpr auto uint8_max = 0xffui8;
-constexpr auto uint16_max = 0xffffui16;
-constexpr auto uint32_max = 0xffffffffui32;
-constexpr auto uint64_max = 0xffffffffffffffffui64;
-} // namespace limits
+  /**
+   * @brief Claim the next `count` bytes of the stream for direct writing and advance the cursor
+   * past them. See `mp::WriteReservation`.
+   * @param count Number of bytes to claim
+   * @return Pointer to the first claimed byte or `nullptr`, leaving the cursor untouched, if fewer
+   * than `count` bytes remain
+   */
+  mp::mp_u8 *reserve( const mp::mp_u32 count ) {
+    if ( mp_unlikely( !*this || !_fits( count ) ) ) {
+      _fail_access( static_cast< bool >( *this ), count, true );
+      return nullptr;
+    }
 
-namespace mp {
-namespace value_limits {
-// - (2 ^ 63)
-constexpr auto IntMin = -9223372036854775807i64 - 1;
+    const auto start = buffer_ + position_;
 
-// ( 2^64 ) - 1
-constexpr auto IntMax = 18446744073709551615llu;
+    position_ += count;
 
-//  ( 2^32 ) - 1
-constexpr auto BinMax = 4294967295LU;
+    return start;
+  }
 
-//  ( 2^32 ) - 1
-constexpr auto StringMax = 4294967295LU;
+  /**
+   * @brief Give back the last `count` bytes claimed by `reserve`, which must not have been followed
+   * by any other write.
+   * @param count Number of unused bytes at the end of the latest reservation
+   */
+  void unreserve( const mp::mp_u32 count ) { position_ -= count; }
 
-//  ( 2^32 ) - 1
-constexpr auto ArrayMax = 4294967295LU;
+  /**
+   * @brief Drop the last `count` bytes written, whatever wrote them, e.g. once the caller moved the
+   * bytes after a header down by `count`. Only offered by contiguous writers.
+   * @param count Number of bytes to drop, at most `position( )`
+   */
+  void retract( const mp::mp_u32 count ) { position_ -= count; }
+};
+using StreamReader = BasicStreamReader< InlineCopy >;
+using StreamWriter = BasicStreamWriter< InlineCopy >;
+
+/**
+ * @brief Read cursor over a caller provided buffer, for `Decoder`. Holds nothing but the bounds,
+ * the cursor and the error flags: it is trivially copyable, resets in O(1) and copying it forks an
+ * independent cursor, e.g. for lookahead. Reads go straight to memory, like `InlineCopy`.
+ * @tparam Checked `false` drops the NULL and overflow checks for this reader only, which is safe on
+ * a buffer `mp::validate` accepted as long as reads follow its structure, see `TrustedDecoder`.
+ * @remarks Define `_MP_UNSAFE` to remove NULL and overflow checks from every reader.
+ */
+template < bool Checked > struct BasicSpanReader {
+private:
+  const mp::mp_u8 *start_{ nullptr };
+  const mp::mp_u8 *end_{ nullptr };
+  const mp::mp_u8 *cursor_{ nullptr };
+  mp::mp_u8        error_{ error::none };
 
-//  ( 2^32 ) - 1
-constexpr auto KVMax = 4294967295LU;
+  bool _fits( const mp::mp_size count ) const {
+    return count <= static_cast< mp::mp_size >( end_ - cursor_ );
+  }
 
-constexpr auto FixArrayMax = 15LU;
-constexpr auto Array16Max = 65535LU;
-constexpr auto Array32Max = 4294967295LU;
+  template < typename Ty > Ty _read_pod( const bool peek = false ) {
+    Ty pod{ };
 
-constexpr auto FixMapMax = 15LU;
-constexpr auto Map16Max = 65535LU;
-constexpr auto Map32Max = 4294967295LU;
+#ifndef _MP_UNSAFE
+    if constexpr ( Checked ) {
+      if ( mp_unlikely( !_fits( sizeof( Ty ) ) ) ) {
+        const mp::mp_u8 error_flags = start_ ? error::overflow : error::unavailable;
 
-constexpr auto PosFixIntMax = 127LU;
-} // namespace value_limits
+        mp::stats::read_failed( error_flags, sizeof( Ty ) );
+        error_ |= error_flags;
+        return pod;
+      }
+    }
+#endif
 
-namespace type {
-enum class TypeValue : mp_u32 {
-  Integer,
-  Nil,
-  Boolean,
-  Float, /* unsupported */
-  Raw,
-  String,
-  Binary,
-  Array,
-  Map,
-  Extension
-};
+    mmcpy( &pod, cursor_, sizeof( Ty ) );
 
-struct MPInteger {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Integer ); }
-};
+    if ( !peek ) cursor_ += sizeof( Ty );
 
-struct MPNil {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Nil ); }
-};
+    return pod;
+  }
 
-struct MPBoolean {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Boolean ); }
-};
+public:
+  static constexpr bool direct = true;
 
-struct MPRaw {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Raw ); }
-};
-
-struct MPString {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::String ); }
-};
+  /* Whether reads are bounds checked. */
+  static constexpr bool checked = Checked;
 
-struct MPBinary {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Binary ); }
-};
+  BasicSpanReader( ) = default;
 
-struct MPArray {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Array ); }
-};
+  BasicSpanReader( const mp::mp_u8 *buffer, const mp::mp_size size ) { set( 0, size, buffer ); }
 
-struct MPMap {
-  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Map ); }
-};
-} // namespace type
+  explicit operator bool( ) const { return start_ != nullptr; }
 
-enum class MPMarker : mp::mp_u8 {
-  PosFixInt,
-  FixMap = 0x80,
-  FixArray = 0x90,
-  FixStr = 0xa0,
-  Nil = 0xc0,
-  Unused = 0xc1,
-  False = 0xc2,
-  True = 0xc3,
-  Bin8 = 0xc4,
-  Bin16 = 0xc5,
-  Bin32 = 0xc6,
-  Ext8 = 0xc7,
-  Ext16 = 0xc8,
-  Ext32 = 0xc9,
-  Float32 = 0xca,
-  Float64 = 0xcb,
-  Uint8 = 0xcc,
-  Uint16 = 0xcd,
-  Uint32 = 0xce,
-  Uint64 = 0xcf,
-  Int8 = 0xd0,
-  Int16 = 0xd1,
-  Int32 = 0xd2,
-  Int64 = 0xd3,
-  FixExt1 = 0xd4,
-  FixExt2 = 0xd5,
-  FixExt4 = 0xd6,
-  FixExt8 = 0xd7,
-  FixExt16 = 0xd8,
-  Str8 = 0xd9,
-  Str16 = 0xda,
-  Str32 = 0xdb,
-  Array16 = 0xdc,
-  Array32 = 0xdd,
-  Map16 = 0xde,
-  Map32 = 0xdf,
-  NegFixInt = 0xe0
-};
+  /**
+   * @brief Point the cursor at `position` within the `stream_size` bytes of `buffer`.
+   * @return BasicSpanReader&
+   */
+  BasicSpanReader &
+  set( const mp::mp_size position, const mp::mp_size stream_size, const mp::mp_u8 *buffer ) {
+    start_ = buffer;
+    end_ = buffer ? buffer + stream_size : nullptr;
+    cursor_ = buffer && position <= stream_size ? buffer + position : end_;
+    error_ = error::none;
 
-struct MPFixExt1 {
-  mp_u8 type;
-  mp_u8 data;
-};
+    return *this;
+  }
 
-struct MPFixExt2 {
-  mp_u8 type;
-  mp_u8 data[ 2 ];
-};
+  /**
+   * @brief Reset the stream cursor back to the start and clear the error flags.
+   */
+  void reset_cursor( ) {
+    cursor_ = start_;
+    error_ = error::none;
+  }
 
-struct MPFixExt4 {
-  mp_u8 type;
-  mp_u8 data[ 4 ];
-};
+  mp::mp_size position( ) const { return static_cast< mp::mp_size >( cursor_ - start_ ); }
 
-struct MPFixExt8 {
-  mp_u8 type;
-  mp_u8 data[ 8 ];
-};
+  mp::mp_size stream_size( ) const { return static_cast< mp::mp_size >( end_ - start_ ); }
 
-struct MPFixExt16 {
-  mp_u8 type;
-  mp_u8 data[ 16 ];
-};
+  const mp::mp_u8 *start( ) const { return start_; }
 
-struct MPDecodeResult {
-  MPMarker marker; // Marker of the latest value decoded
-  mp_u32   size;   // Size of the value, in bytes. Mostly relevant for dynamically sized types.
+  const mp::mp_u8 *end( ) const { return end_; }
 
-  union {
-    bool as_bool;
+  mp::mp_u8 error( ) const { return error_; }
 
-    mp_u8 as_u8;
-    mp_i8 as_i8;
+  bool good( ) const { return error_ == error::none; }
 
-    mp_i16 as_i16;
-    mp_u16 as_u16;
+  void clear_error( ) { error_ = error::none; }
 
-    mp_i32 as_i32;
-    mp_u32 as_u32;
+  void fail( const mp::mp_u8 flags ) {
+    mp::stats::read_failed( flags, 0 );
+    error_ |= flags;
+  }
 
-    mp_i64 as_i64;
-    mp_u64 as_u64;
+  mp::mp_u64 read_u64( ) { return _read_pod< mp::mp_u64 >( ); }
+  mp::mp_u32 read_u32( ) { return _read_pod< mp::mp_u32 >( ); }
+  mp::mp_u16 read_u16( ) { return _read_pod< mp::mp_u16 >( ); }
+  mp::mp_u8  read_u8( ) { return _read_pod< mp::mp_u8 >( ); }
+  mp::mp_i64 read_i64( ) { return _read_pod< mp::mp_i64 >( ); }
+  mp::mp_i32 read_i32( ) { return _read_pod< mp::mp_i32 >( ); }
+  mp::mp_i16 read_i16( ) { return _read_pod< mp::mp_i16 >( ); }
+  mp::mp_i8  read_i8( ) { return _read_pod< mp::mp_i8 >( ); }
+  mp::mp_u8  peek_u8( ) { return _read_pod< mp::mp_u8 >( true ); }
 
-    MPFixExt1  as_fixext1;
-    MPFixExt2  as_fixext2;
-    MPFixExt4  as_fixext4;
-    MPFixExt8  as_fixext8;
-    MPFixExt16 as_fixext16;
+  /**
+   * @brief Copy `count` bytes into `dst` and advance the cursor. A failing read leaves `dst`
+   * untouched and raises `error::overflow` or `error::unavailable`.
+   * @return BasicSpanReader&
+   */
+  BasicSpanReader &read( const mp::mp_u32 count, mp::mp_u8 *dst ) {
+    if ( !count ) return *this;
 
-    mp_u8 as_fixstr[ 31 ];
-  } result; // Holds the result for statically sized types such as FixInt, NegFixInt,
-            // Uint8/16/32/64, Int8/16/32/64, FixExt1/2/4/8/16
+    if ( const auto src = view( count ) ) mmcpy( dst, src, count );
 
-  explicit operator bool( ) const { return marker != MPMarker::Unused; }
+    return *this;
+  }
 
   /**
-   * @brief Check if this result's marker denotes the start of a fixext type.
-   * @return bool
+   * @brief Move the cursor to `position`.
+   * @return `false`, leaving the cursor untouched, if `position` lies past the end of the stream
    */
-  bool is_fixext( ) const {
-    return (
-        marker == MPMarker::FixExt1 || marker == MPMarker::FixExt2 || marker == MPMarker::FixExt4 ||
-        marker == MPMarker::FixExt8 || marker == MPMarker::FixExt16
-    );
+  bool seek( const mp::mp_size position ) {
+    if ( position > stream_size( ) ) return false;
+
+    cursor_ = start_ + position;
+    return true;
   }
 
   /**
-   * @brief Check if this result's marker denotes the start of an array.
-   * @return bool
+   * @brief Return a pointer to the next `count` bytes and advance the cursor past them.
+   * @return Pointer into the buffer or `nullptr` if fewer than `count` bytes remain, in which case
+   * the cursor is left untouched and `error::overflow` is raised.
    */
-  bool is_array( ) const {
-    return (
-        marker == MPMarker::FixArray || marker == MPMarker::Array16 || marker == MPMarker::Array32
-    );
+  const mp::mp_u8 *view( const mp::mp_u32 count ) {
+    const auto read_pos = cursor_;
+
+#ifndef _MP_UNSAFE
+    if constexpr ( Checked ) {
+      if ( mp_unlikely( !start_ || !_fits( count ) ) ) {
+        const mp::mp_u8 error_flags = start_ ? error::overflow : error::unavailable;
+
+        mp::stats::read_failed( error_flags, count );
+        error_ |= error_flags;
+        return nullptr;
+      }
+    }
+#endif
+
+    cursor_ += count;
+
+    return read_pos;
   }
+};
 
-  /**
-   * @brief Check if this result's marker denotes any integer type.
-   * @return bool
-   */
-  bool is_integer( ) const {
-    return (
-        marker == MPMarker::PosFixInt || marker == MPMarker::NegFixInt ||
-        marker == MPMarker::Uint8 || marker == MPMarker::Int8 || marker == MPMarker::Uint16 ||
-        marker == MPMarker::Int16 || marker == MPMarker::Uint32 || marker == MPMarker::Int32 ||
-        marker == MPMarker::Uint64 || marker == MPMarker::Int64
-    );
+using SpanReader = BasicSpanReader< true >;
+using TrustedSpanReader = BasicSpanReader< false >;
+
+/**
+ * @brief Write cursor over a caller provided buffer, for `Encoder`. Like `SpanReader`, it holds
+ * only the bounds, the cursor and the error flags; resetting it never touches the buffer.
+ * @remarks Define `_MP_UNSAFE` to remove NULL and overflow checks.
+ */
+struct SpanWriter {
+private:
+  mp::mp_u8 *start_{ nullptr };
+  mp::mp_u8 *end_{ nullptr };
+  mp::mp_u8 *cursor_{ nullptr };
+  mp::mp_u8  error_{ error::none };
+
+  bool _fits( const mp::mp_size count ) const {
+    return count <= static_cast< mp::mp_size >( end_ - cursor_ );
   }
 
-  /**
-   * @brief Check if this result's marker denotes any string type.
-   * @return bool
-   */
-  bool is_str( ) const {
-    return (
-        marker == MPMarker::FixStr || marker == MPMarker::Str8 || marker == MPMarker::Str16 ||
-        marker == MPMarker::Str32
-    );
+  void _write_and_advance( const mp::mp_u32 count, const mp::mp_u8 *src ) {
+#ifndef _MP_UNSAFE
+    if ( !count ) return;
+
+    if ( mp_unlikely( !src || !start_ || !_fits( count ) ) ) {
+      const mp::mp_u8 error_flags = src && start_ ? error::overflow : error::unavailable;
+
+      mp::stats::write_failed( error_flags, count );
+      error_ |= error_flags;
+      return;
+    }
+#endif
+
+    mmcpy( cursor_, src, count );
+    cursor_ += count;
   }
 
+  template < typename Ty > SpanWriter &_write_pod( const Ty value ) {
+    _write_and_advance( sizeof( Ty ), reinterpret_cast< const mp::mp_u8 * >( &value ) );
+    return *this;
+  }
+
+public:
+  static constexpr bool stable = true;
+  static constexpr bool contiguous = true;
+
+  SpanWriter( ) = default;
+
+  SpanWriter( mp::mp_u8 *buffer, const mp::mp_size size ) { set( 0, size, buffer ); }
+
+  explicit operator bool( ) const { return start_ != nullptr; }
+
   /**
-   * @brief Check if this result's marker denotes the start of any binary type.
-   * @return bool
+   * @brief Point the cursor at `position` within the `stream_size` bytes of `buffer`.
+   * @return SpanWriter&
    */
-  bool is_bin( ) const {
-    return ( marker == MPMarker::Bin8 || marker == MPMarker::Bin16 || marker == MPMarker::Bin32 );
+  SpanWriter &set( const mp::mp_size position, const mp::mp_size stream_size, mp::mp_u8 *buffer ) {
+    start_ = buffer;
+    end_ = buffer ? buffer + stream_size : nullptr;
+    cursor_ = buffer && position <= stream_size ? buffer + position : end_;
+    error_ = error::none;
+
+    return *this;
   }
 
   /**
-   * @brief Check if this result's marker denotes the start of any non-fixed extension type.
-   * @return bool
+   * @brief Move the cursor back to the start and clear the error flags. The buffer is untouched.
    */
-  bool is_ext( ) const {
-    return ( marker == MPMarker::Ext8 || marker == MPMarker::Ext16 || marker == MPMarker::Ext32 );
+  void reset_cursor( ) {
+    cursor_ = start_;
+    error_ = error::none;
+  }
+
+  mp::mp_size position( ) const { return static_cast< mp::mp_size >( cursor_ - start_ ); }
+
+  mp::mp_size stream_size( ) const { return static_cast< mp::mp_size >( end_ - start_ ); }
+
+  mp::mp_u8 *start( ) const { return start_; }
+
+  mp::mp_u8 error( ) const { return error_; }
+
+  bool good( ) const { return error_ == error::none; }
+
+  void clear_error( ) { error_ = error::none; }
+
+  void fail( const mp::mp_u8 flags ) {
+    mp::stats::write_failed( flags, 0 );
+    error_ |= flags;
+  }
+
+  SpanWriter &write_u64( const mp::mp_u64 value ) { return _write_pod( value ); }
+  SpanWriter &write_u32( const mp::mp_u32 value ) { return _write_pod( value ); }
+  SpanWriter &write_u16( const mp::mp_u16 value ) { return _write_pod( value ); }
+  SpanWriter &write_u8( const mp::mp_u8 value ) { return _write_pod( value ); }
+  SpanWriter &write_i64( const mp::mp_i64 value ) { return _write_pod( value ); }
+  SpanWriter &write_i32( const mp::mp_i32 value ) { return _write_pod( value ); }
+  SpanWriter &write_i16( const mp::mp_i16 value ) { return _write_pod( value ); }
+  SpanWriter &write_i8( const mp::mp_i8 value ) { return _write_pod( value ); }
+
+  SpanWriter &write( const mp::mp_u32 count, mp::mp_u8 *src ) {
+    _write_and_advance( count, src );
+    return *this;
   }
 
   /**
-   * @brief Check if this result's marker denotes the start of any boolean type.
-   * @return bool
+   * @brief Claim the next `count` bytes for direct writing. See `WriteReservation`.
+   * @return Pointer to the first claimed byte or `nullptr` if fewer than `count` bytes remain
    */
-  bool is_bool( ) const { return ( marker == MPMarker::True || marker == MPMarker::False ); }
+  mp::mp_u8 *reserve( const mp::mp_u32 count ) {
+    if ( mp_unlikely( !start_ || !_fits( count ) ) ) {
+      const mp::mp_u8 error_flags = start_ ? error::overflow : error::unavailable;
+
+      mp::stats::write_failed( error_flags, count );
+      error_ |= error_flags;
+      return nullptr;
+    }
+
+    const auto start = cursor_;
+
+    cursor_ += count;
+
+    return start;
+  }
+
+  void unreserve( const mp::mp_u32 count ) { cursor_ -= count; }
 
   /**
-   * @brief Check if this result's marker denotes a `Nil` value
-   * @return bool
+   * @brief Drop the last `count` bytes written, whatever wrote them. See `StreamWriter::retract`.
    */
-  bool is_nil( ) const { return marker == MPMarker::Nil; }
+  void retract( const mp::mp_u32 count ) { cursor_ -= count; }
+};
+
+/**
+ * @brief Contiguous region of encoded output handed back by `ChunkedStreamWriter::segments`. Maps
+ * one-to-one onto a `struct iovec` for `writev`/`sendmsg`.
+ */
+struct Segment {
+  mp::mp_u8 *base;
+  mp::mp_u64 length;
+};
+
+/**
+ * @brief Default allocator for `ChunkedStreamWriter`. Any type exposing the same two member
+ * functions, typically a thin handle to an arena or pool, can be used in its place.
+ */
+struct HeapAllocator {
+  void *allocate( const mp::mp_u64 size ) { return malloc( size ); }
+
+  void deallocate( void *ptr, const mp::mp_u64 ) { free( ptr ); }
 };
 
-struct MessagePack {
+/**
+ * @brief Growable writer backend. Bytes are first written into the (optional) caller provided
+ * buffer and, once it is exhausted, into chunks of at least `chunk_size( )` bytes requested from
+ * `Allocator`. Chunks are only returned to the allocator on `clear( )`, `reset*( )` or destruction.
+ * @remark Exposes the same writing interface as `BasicStreamWriter` so it can be plugged into
+ * `BasicMessagePack`. Allocation failures are handled like overflows: the write is dropped and
+ * `error::no_memory` is raised.
+ * @tparam Allocator Type providing `void *allocate( mp_u64 )` and
+ * `void deallocate( void *, mp_u64 )`
+ * @tparam CopyPolicy See `InlineCopy` and `FunctionCopy`
+ */
+template < typename Allocator = HeapAllocator, typename CopyPolicy = InlineCopy >
+struct ChunkedStreamWriter {
 private:
-  /**
-   * @brief Internal object used for reading from the byte stream.
-   */
-  stream::StreamReader sr_{ };
+  struct Chunk {
+    Chunk     *next;
+    mp::mp_u8 *data;
+    mp::mp_u64 capacity;
+    mp::mp_u64 used;
+  };
+
+  Chunk      head_{ };
+  Chunk     *tail_{ &head_ };
+  mp::mp_u64 size_{ 0 };
+  mp::mp_u64 chunk_size_{ 0x1000 };
+  Allocator  allocator_{ };
+  CopyPolicy writer_{ };
+  mp::mp_u8  error_{ error::none };
 
-  /**
-   * @brief Internal object used for writing to the byte stream.
-   */
-  stream::StreamWriter wr_{ };
+public:
+  /* Chunks never move, but a write may continue in the next one. */
+  static constexpr bool stable = CopyPolicy::direct;
+  static constexpr bool contiguous = false;
+
+  explicit ChunkedStreamWriter( const Allocator &allocator = Allocator{ } )
+      : allocator_( allocator ) { }
+
+  ~ChunkedStreamWriter( ) { _release( ); }
+
+  explicit operator bool( ) const { return writer_.valid( ); }
+
+  /* Disallow copies. */
+  ChunkedStreamWriter( ChunkedStreamWriter &other ) = delete;
+  ChunkedStreamWriter &operator=( ChunkedStreamWriter &other ) = delete;
 
   /**
-   * @brief Pointer to the user allocated buffer used by `StreamReader` and `StreamReader`. Call
-   * `reset_all( )` before releasing this memory.
+   * @brief Total number of bytes written, across all segments, truncated to `mp_size`.
+   * @return mp::mp_size
    */
-  mp::mp_u8 *buffer_{ nullptr };
+  mp::mp_size position( ) const { return static_cast< mp::mp_size >( size_ ); }
 
   /**
-   * @brief Local copy of the memory reader function. Used in decoding operations for copying larger
-   * types from the stream.
+   * @brief Total number of bytes written, across all segments.
+   * @return mp::mp_u64
    */
-  stream::MemoryReader reader_{ nullptr };
+  mp::mp_u64 size( ) const { return size_; }
 
-public:
   /**
-   * @brief Initialize the `StreamReader` and `StreamWriter` object with `buffer` of size
-   * `stream_size` at cursor `position`.
-   * @param position Position in the stream buffer to start operations at
-   * @param stream_size Total size, in bytes, of the stream buffer
-   * @param buffer Pointer to the underlying stream buffer
-   * @param reader Function pointer of type `void ( * ) ( void *src, void *dst, size_t size )` to be
-   * used for reading memory
-   * @param writer Function pointer of type `void ( * ) ( void *src, void *dst, size_t size )` to be
-   * used for writing memory
+   * @brief Sticky error flags, see `stream::error`. Cleared by `reset*( )`.
+   * @return mp::mp_u8
    */
-  void initialize_streams(
-      const mp::mp_u32           position = 0,
-      const mp::mp_u32           stream_size = 0,
-      mp::mp_u8                 *buffer = nullptr,
-      const stream::MemoryReader reader = nullptr,
-      const stream::MemoryWriter writer = nullptr
-  ) {
-    sr_.set( position, stream_size, buffer, reader );
-    wr_.set( position, stream_size, buffer, writer );
+  mp::mp_u8 error( ) const { return error_; }
 
-    buffer_ = buffer;
-    reader_ = reader;
+  bool good( ) const { return error_ == error::none; }
+
+  void clear_error( ) { error_ = error::none; }
+
+  void fail( const mp::mp_u8 flags ) {
+    mp::stats::write_failed( flags, 0 );
+    error_ |= flags;
   }
 
   /**
-   * @brief Retrieve a pointer to the underlying buffer.
-   * @return mp::mp_u8
+   * @brief Minimum size, in bytes, of the chunks requested from the allocator.
+   * @return mp::mp_u64
    */
-  mp::mp_u8 *stream_buffer( ) const { return buffer_; }
+  mp::mp_u64 chunk_size( ) const { return chunk_size_; }
 
   /**
-   * @brief Return the previously set stream size
-   * @return The size, in bytes, of the underlying buffer
+   * @brief Set the minimum size, in bytes, of the chunks requested from the allocator. Writes
+   * larger than this get a chunk of their own so their payload stays contiguous.
+   * @param chunk_size Chunk size in bytes, must not be zero
+   * @return ChunkedStreamWriter&
    */
-  mp::mp_u32 stream_size( ) const { return sr_.stream_size( ); }
+  ChunkedStreamWriter &set_chunk_size( const mp::mp_u64 chunk_size ) {
+    if ( chunk_size ) chunk_size_ = chunk_size;
+    return *this;
+  }
 
   /**
-   * @brief Position of the read cursor in the stream.
-   * @return mp::mp_up32
+   * @brief Replace the allocator. Chunks allocated by the previous allocator are released first.
+   * @param allocator Allocator to take chunks from
+   * @return ChunkedStreamWriter&
    */
-  mp::mp_u32 read_cursor( ) const { return sr_.position( ); }
+  ChunkedStreamWriter &set_allocator( const Allocator &allocator ) {
+    reset_cursor( );
+    allocator_ = allocator;
+    return *this;
+  }
 
   /**
-   * @brief Position of the write cursor in the stream.
-   * @return mp::mp_u32
+   * @brief Number of non-empty segments making up the encoded output.
+   * @return mp::mp_u64
    */
-  mp::mp_u32 write_cursor( ) const { return wr_.position( ); }
+  mp::mp_u64 segment_count( ) const {
+    mp::mp_u64 count = 0;
+
+    for ( auto chunk = &head_; chunk; chunk = chunk->next )
+      if ( chunk->used ) count++;
+
+    return count;
+  }
 
   /**
-   * @brief Reset both streams and zero the stream. Required calling before releasing the underlying
-   * memory.
+   * @brief Copy at most `max_segments` segment descriptors, in stream order, into `out`.
+   * @param out Array of at least `max_segments` elements
+   * @param max_segments Capacity of `out`
+   * @return Number of descriptors written into `out`
    */
-  void reset_all( ) {
-    wr_.clear( );
-    sr_.reset( );
-    wr_.reset( );
+  mp::mp_u64 segments( Segment *out, const mp::mp_u64 max_segments ) const {
+    mp::mp_u64 count = 0;
+
+    for ( auto chunk = &head_; chunk && count < max_segments; chunk = chunk->next ) {
+      if ( !chunk->used ) continue;
+
+      out[ count++ ] = Segment{ chunk->data, chunk->used };
+    }
+
+    return count;
   }
 
   /**
-   * @brief Reset the temporal state for this object. Use this when reusing the stream object
-   * without losing the previously registered memory readers function.
+   * @brief Reset the internal stream state for this object and release every allocated chunk.
    */
-  void reset_temporal( ) {
-    wr_.clear( );
-
-    sr_.reset_temporal( );
-    wr_.reset_temporal( );
-    buffer_ = nullptr;
+  void reset( ) {
+    reset_temporal( );
+    writer_.bind( nullptr );
   }
 
   /**
-   * @brief Reset cursors for both streams managed by this object.
+   * @brief Reset the temporal state for this object and release every allocated chunk. Use this
+   * when reusing the stream without losing the previously registered `writer` function.
    */
-  void reset_cursors( ) {
-    sr_.reset_cursor( );
-    wr_.reset_cursor( );
+  void reset_temporal( ) {
+    _release( );
+    head_ = Chunk{ };
+    size_ = 0;
+    error_ = error::none;
   }
 
   /**
-   * @brief Reset both stream cursors and zero the underlying buffer.
+   * @brief Release every allocated chunk and move the cursor back to the start of the caller
+   * provided buffer.
    */
-  void reset_and_clear( ) {
-    wr_.clear( );
-    reset_cursors( );
+  void reset_cursor( ) {
+    _release( );
+    head_.used = 0;
+    size_ = 0;
+    error_ = error::none;
+  }
+
+  /*
+   * @brief Clear the caller provided buffer, release every allocated chunk and reset the cursor
+   */
+  void clear( ) {
+    if ( head_.data ) mmset( head_.data, 0, head_.capacity );
+    reset_cursor( );
   }
 
   /**
-   * @brief
-   * @param marker Value of type `MPMarker` denoting the start of a MessagePack value.
+   * @brief Set the internal fields of the `ChunkedStreamWriter` object.
+   * @param position Position to set the stream at, relative to `buffer`
+   * @param stream_size Total size, in bytes, of `buffer`. May be zero
+   * @param buffer Optional caller provided buffer used as the first segment
+   * @param writer Function pointer used for writing memory. Only used by the `FunctionCopy` policy.
+   * @return ChunkedStreamWriter&
    */
-  void write_marker( MPMarker marker ) { wr_.write_u8( static_cast< mp::mp_u8 >( marker ) ); }
+  ChunkedStreamWriter &
+  set( const mp::mp_size  position = 0,
+       const mp::mp_size  stream_size = 0,
+       mp::mp_u8         *buffer = nullptr,
+       const MemoryWriter writer = nullptr ) {
+    reset( );
+    set_temporal( position, stream_size, buffer );
+    writer_.bind( writer );
+
+    return *this;
+  }
 
   /**
-   * @brief Peek a byte from the stream and attempt to decode it as MessagePack type.
-   * @return An `MPMarker` value if the peeked byte corresponds to a valid MessagePack type or
-   * `MPMarker::Unused`
+   * @brief Set the internal fields of the `ChunkedStreamWriter` object.
+   * @param position Position to set the stream at, relative to `buffer`
+   * @param stream_size Total size, in bytes, of `buffer`. May be zero
+   * @param buffer Optional caller provided buffer used as the first segment
+   * @return ChunkedStreamWriter&
    */
-  MPMarker peek_marker( ) {
-    const auto byte = sr_.peek_u8( );
-
-    switch ( static_cast< MPMarker >( byte ) ) {
-    case MPMarker::PosFixInt:
-    case MPMarker::FixMap:
-    case MPMarker::FixArray:
-    case MPMarker::FixStr:
-    case MPMarker::Nil:
-    case MPMarker::False:
-    case MPMarker::True:
-    case MPMarker::Bin8:
-    case MPMarker::Bin16:
-    case MPMarker::Bin32:
-    case MPMarker::Ext8:
-    case MPMarker::Ext16:
-    case MPMarker::Ext32:
-    case MPMarker::Float32:
-    case MPMarker::Float64:
-    case MPMarker::Uint8:
-    case MPMarker::Uint16:
-    case MPMarker::Uint32:
-    case MPMarker::Uint64:
-    case MPMarker::Int8:
-    case MPMarker::Int16:
-    case MPMarker::Int32:
-    case MPMarker::Int64:
-    case MPMarker::FixExt1:
-    case MPMarker::FixExt2:
-    case MPMarker::FixExt4:
-    case MPMarker::FixExt8:
-    case MPMarker::FixExt16:
-    case MPMarker::Str8:
-    case MPMarker::Str16:
-    case MPMarker::Str32:
-    case MPMarker::Array16:
-    case MPMarker::Array32:
-    case MPMarker::Map16:
-    case MPMarker::Map32:
-    case MPMarker::NegFixInt:
-      return static_cast< MPMarker >( byte );
-    case MPMarker::Unused:
-      return MPMarker::Unused;
-    }
-
-    return MPMarker::Unused;
-  }
-
-  MessagePack &write_negfixint( const mp_i8 value ) {
-    wr_.write_u8( 0xe0 | static_cast< mp_u8 >( value & 0x1F ) );
+  ChunkedStreamWriter &set_temporal(
+      const mp::mp_size position = 0,
+      const mp::mp_size stream_size = 0,
+      mp::mp_u8       *buffer = nullptr
+  ) {
+    reset_temporal( );
+
+    if ( buffer && position <= stream_size ) {
+      head_ = Chunk{ nullptr, buffer, stream_size, position };
+      size_ = position;
+    }
 
     return *this;
   }
 
   /**
-   * @brief Handles the writing of a [type marker] [value] to the byte stream
-   * @note This function is opportunistic and will always opt for the smallest data type, in some
-   * cases overwriting user choice. This behaviour cannot be overriden.
-   * @remark For arrays, including `FixArray`, call `array( )` first to denote the start of an
-   * array.
-   * @remark For maps, including `FixMap`, call `map( )` first to denote the start of the map.
-   * @param data Treated as a value or a pointer to a value depending on `kind`
-   * @param size Size of `data` or the buffer pointed to by `data`
-   * @param kind Marker describing the type in the MessagePack type system
-   * @return MessagePack&
+   * @brief Write a plain old data (POD) value to the byte stream and advance the internal cursor.
+   * @tparam Ty Plain old data (POD) type
+   * @param value Value to write to the stream.
    */
-  template < MPMarker kind > MessagePack &write_raw_value( const mp_u64 data, const mp_u64 size ) {
-    /*
-     * Start with all the edge cases.
-     */
+  template < typename Ty > void write_pod( Ty value ) {
+    Ty pod{ value };
 
-    if constexpr ( kind == MPMarker::NegFixInt ) {
-      wr_.write_u8( 0xe0 | static_cast< mp_u8 >( static_cast< mp_i8 >( data & 0x1F ) ) );
+    _write_and_advance( sizeof( Ty ), reinterpret_cast< mp::mp_u8 * >( &pod ) );
+  }
 
-      return *this;
+private:
+  /**
+   * @brief Link a new chunk of at least `min_capacity` bytes after the current tail.
+   * @return `false` if the allocator could not satisfy the request
+   */
+  bool _grow( const mp::mp_u64 min_capacity ) {
+    const auto capacity = min_capacity > chunk_size_ ? min_capacity : chunk_size_;
+    const auto memory = allocator_.allocate( sizeof( Chunk ) + capacity );
+
+    if ( mp_unlikely( !memory ) ) {
+      mp::stats::write_failed( error::no_memory, min_capacity );
+      error_ |= error::no_memory;
+      return false;
     }
 
-    if constexpr ( kind == MPMarker::PosFixInt ) {
-      wr_.write_u8( data & 0x7f );
+    const auto chunk = static_cast< Chunk * >( memory );
 
-      return *this;
-    }
+    *chunk = Chunk{ nullptr, reinterpret_cast< mp::mp_u8 * >( chunk + 1 ), capacity, 0 };
 
-    if constexpr ( kind == MPMarker::FixStr ) {
-      const auto length = static_cast< mp::mp_u8 >( size & 0x1f );
+    tail_->next = chunk;
+    tail_ = chunk;
 
-      wr_.write_u8( static_cast< mp::mp_u8 >( kind ) | ( length ) )
-          .write( length, reinterpret_cast< mp::mp_u8 * >( data ) );
+    return true;
+  }
 
-      return *this;
+  /**
+   * @brief Return every allocated chunk to the allocator. The caller provided buffer is kept.
+   */
+  void _release( ) {
+    auto chunk = head_.next;
+
+    while ( chunk ) {
+      const auto next = chunk->next;
+
+      allocator_.deallocate( chunk, sizeof( Chunk ) + chunk->capacity );
+      chunk = next;
     }
 
-    if constexpr ( kind == MPMarker::Nil || kind == MPMarker::False || kind == MPMarker::True ) {
-      /*
-       * The value of these data types is their marker.
-       */
-      write_marker( kind );
-      return *this;
+    head_.next = nullptr;
+    tail_ = &head_;
+  }
+
+  /**
+   * @brief The core of the `ChunkedStreamWriter` interface. Copies `count` bytes from `src` into
+   * the current chunk, growing the chunk list on demand.
+   * @remarks Define `_MP_UNSAFE` to remove NULL checks.
+   * @param count Number of bytes in `src` to write into the stream.
+   * @param src Buffer of at least `count` bytes to copy from.
+   */
+  void _write_and_advance( mp::mp_u32 count, mp::mp_u8 *src ) {
+#ifndef _MP_UNSAFE
+    if ( !count ) return;
+
+    if ( mp_unlikely( !src || !*this ) ) {
+      mp::stats::write_failed( error::unavailable, count );
+      error_ |= error::unavailable;
+      return;
     }
+#endif
 
-    if constexpr ( kind == MPMarker::Bin8 || kind == MPMarker::Bin16 || kind == MPMarker::Bin32 ) {
-      mp_u32 length = static_cast< mp_u32 >( size );
+    while ( count ) {
+      auto available = tail_->capacity - tail_->used;
 
-      if ( size <= limits::uint8_max ) {
-        length &= 0xff;
-        write_marker( MPMarker::Bin8 );
-        wr_.write_u8( static_cast< mp::mp_u8 >( length ) );
-      } else if ( size <= limits::uint16_max ) {
-        length &= 0xffff;
-        write_marker( MPMarker::Bin16 );
-        wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( length ) ) );
-      } else if ( size <= limits::uint32_max ) {
-        length &= 0xffffffff;
-        write_marker( MPMarker::Bin32 );
-        wr_.write_u32( bswap_intrin32( length ) );
+      if ( !available ) {
+        if ( !_grow( count ) ) return;
+
+        available = tail_->capacity;
       }
 
-      wr_.write( length, reinterpret_cast< mp::mp_u8 * >( data ) );
+      const auto length = count < available ? count : static_cast< mp::mp_u32 >( available );
 
-      return *this;
+      writer_.copy( tail_->data + tail_->used, src, length );
+
+      tail_->used += length;
+      size_ += length;
+      src += length;
+      count -= length;
     }
+  }
 
-    if constexpr ( kind == MPMarker::Str8 || kind == MPMarker::Str16 || kind == MPMarker::Str32 ) {
-      mp_u32 length = static_cast< mp_u32 >( size );
+public:
+  /*
+   * Fixed-size writers. Same semantics as their `BasicStreamWriter` counterparts, except that they
+   * never run out of room as long as the allocator can provide more memory.
+   */
 
-      if ( size <= limits::uint8_max ) {
-        length &= 0xff;
-        write_marker( MPMarker::Str8 );
-        wr_.write_u8( static_cast< mp::mp_u8 >( length ) );
-      } else if ( size <= limits::uint16_max ) {
-        length &= 0xffff;
-        write_marker( MPMarker::Str16 );
-        wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( length ) ) );
-      } else if ( size <= limits::uint32_max ) {
-        length &= 0xffffffff;
-        write_marker( MPMarker::Str32 );
-        wr_.write_u32( bswap_intrin32( length ) );
-      }
+  ChunkedStreamWriter &write_u32( const mp::mp_u32 value ) {
+    write_pod< mp::mp_u32 >( value );
+    return *this;
+  }
 
-      wr_.write( length, reinterpret_cast< mp::mp_u8 * >( data ) );
+  ChunkedStreamWriter &write_u64( const mp::mp_u64 value ) {
+    write_pod< mp::mp_u64 >( value );
+    return *this;
+  }
 
-      return *this;
-    }
+  ChunkedStreamWriter &write_i32( const mp::mp_i32 value ) {
+    write_pod< mp::mp_i32 >( value );
+    return *this;
+  }
 
-    write_marker( kind );
+  ChunkedStreamWriter &write_i64( const mp::mp_i64 value ) {
+    write_pod< mp::mp_i64 >( value );
+    return *this;
+  }
 
-    if constexpr ( kind == MPMarker::Uint8 || kind == MPMarker::Int8 ) {
-      wr_.write_u8( static_cast< mp::mp_u8 >( data & 0xff ) );
+  ChunkedStreamWriter &write_u16( const mp::mp_u16 value ) {
+    write_pod< mp::mp_u16 >( value );
+    return *this;
+  }
 
-      return *this;
-    }
+  ChunkedStreamWriter &write_i16( const mp::mp_i16 value ) {
+    write_pod< mp::mp_i16 >( value );
+    return *this;
+  }
 
-    if constexpr ( kind == MPMarker::Uint16 ) {
-      wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( data ) ) );
+  ChunkedStreamWriter &write_u8( const mp::mp_u8 value ) {
+    write_pod< mp::mp_u8 >( value );
+    return *this;
+  }
 
-      return *this;
-    }
+  ChunkedStreamWriter &write_i8( const mp::mp_i8 value ) {
+    write_pod< mp::mp_i8 >( value );
+    return *this;
+  }
 
-    if constexpr ( kind == MPMarker::Int16 ) {
-      wr_.write_i16( bswap_intrin16( static_cast< mp::mp_u16 >( data ) ) );
+  /**
+   * @brief Write `count` bytes to the stream, spilling into new chunks as necessary.
+   * @param count Size, in bytes, of the data pointed to by `src`.
+   * @param src Buffer containing at least `count` bytes.
+   * @return ChunkedStreamWriter&
+   */
+  ChunkedStreamWriter &write( const mp::mp_u32 count, mp::mp_u8 *src ) {
+    _write_and_advance( count, src );
+    return *this;
+  }
 
-      return *this;
+  /**
+   * @brief Claim the next `count` bytes for direct writing. The bytes are always contiguous: if
+   * they do not fit in the current chunk, a new one is started and the current one ends early.
+   * @param count Number of bytes to claim
+   * @return Pointer to the first claimed byte or `nullptr` if the allocator failed
+   */
+  mp::mp_u8 *reserve( const mp::mp_u32 count ) {
+    if ( mp_unlikely( !*this ) ) {
+      mp::stats::write_failed( error::unavailable, count );
+      error_ |= error::unavailable;
+      return nullptr;
     }
 
-    if constexpr ( kind == MPMarker::Uint32 || kind == MPMarker::Int32 ) {
-      wr_.write_u32( bswap_intrin32( static_cast< mp_u32 >( data & 0xffffffff ) ) );
+    if ( tail_->capacity - tail_->used < count && !_grow( count ) ) return nullptr;
 
-      return *this;
-    }
+    const auto start = tail_->data + tail_->used;
 
-    if constexpr ( kind == MPMarker::Uint64 || kind == MPMarker::Int64 ) {
-      wr_.write_u64( bswap_intrin64( data ) );
-    }
+    tail_->used += count;
+    size_ += count;
 
-    if constexpr ( kind == MPMarker::FixExt1 ) {
-      /* one byte for the type + 1 for the byte array */
-      wr_.write( sizeof( MPFixExt1 ), reinterpret_cast< mp::mp_u8 * >( data ) );
-    }
+    return start;
+  }
 
-    if constexpr ( kind == MPMarker::FixExt2 ) {
-      /* one byte for the type + 2 bytes for the byte array */
-      wr_.write( sizeof( MPFixExt2 ), reinterpret_cast< mp::mp_u8 * >( data ) );
-    }
+  /**
+   * @brief Give back the last `count` bytes claimed by `reserve`, which must not have been followed
+   * by any other write.
+   * @param count Number of unused bytes at the end of the latest reservation
+   */
+  void unreserve( const mp::mp_u32 count ) {
+    tail_->used -= count;
+    size_ -= count;
+  }
+};
 
-    if constexpr ( kind == MPMarker::FixExt4 ) {
-      /* one byte for the type + 4 bytes for the byte array */
-      wr_.write( sizeof( MPFixExt4 ), reinterpret_cast< mp::mp_u8 * >( data ) );
-    }
+/**
+ * @brief Called once for every payload a `GatherStreamWriter` references instead of copying, so the
+ * caller can retain the memory (e.g. take a reference count) until the segments have been sent.
+ */
+using PayloadPin = void ( * )( void *context, const mp::mp_u8 *data, mp::mp_u64 size );
+
+/**
+ * @brief Scatter-gather writer backend. Markers, lengths and small values are written into the
+ * caller provided buffer, but `Bin`/`Str` bodies of at least `threshold( )` bytes are recorded as
+ * references to the caller's memory. The output is a list of `Segment`s, alternating between runs
+ * of the buffer and referenced payloads, ready for `writev`/`sendmsg`.
+ * @remark Referenced payloads must outlive the segments; see `set_pin`. When the segment table is
+ * full, payloads are copied into the buffer instead, so the output is always complete. The buffer
+ * alone is not a valid stream and must not be decoded in place.
+ * @remarks Define `_MP_UNSAFE` to remove NULL and overflow checks.
+ */
+struct GatherStreamWriter {
+private:
+  mp::mp_u8  *start_{ nullptr };
+  mp::mp_u8  *end_{ nullptr };
+  mp::mp_u8  *cursor_{ nullptr };
+  mp::mp_u8  *run_{ nullptr };
+  Segment    *segments_{ nullptr };
+  mp::mp_u64  capacity_{ 0 };
+  mp::mp_u64  count_{ 0 };
+  mp::mp_u64  size_{ 0 };
+  mp::mp_u64  threshold_{ 0x1000 };
+  PayloadPin  pin_{ nullptr };
+  void       *context_{ nullptr };
+  mp::mp_u8   error_{ error::none };
+
+  bool _fits( const mp::mp_u64 count ) const {
+    return count <= static_cast< mp::mp_u64 >( end_ - cursor_ );
+  }
 
-    if constexpr ( kind == MPMarker::FixExt8 ) {
-      /* one byte for the type + 8 bytes for the byte array */
-      wr_.write( sizeof( MPFixExt8 ), reinterpret_cast< mp::mp_u8 * >( data ) );
-    }
+  void _write_and_advance( const mp::mp_u32 count, const mp::mp_u8 *src ) {
+#ifndef _MP_UNSAFE
+    if ( !count ) return;
 
-    if constexpr ( kind == MPMarker::FixExt16 ) {
-      /* one byte for the type + 16 bytes for the byte array */
-      wr_.write( sizeof( MPFixExt16 ), reinterpret_cast< mp::mp_u8 * >( data ) );
+    if ( mp_unlikely( !src || !start_ || !_fits( count ) ) ) {
+      const mp::mp_u8 error_flags = src && start_ ? error::overflow : error::unavailable;
+
+      mp::stats::write_failed( error_flags, count );
+      error_ |= error_flags;
+      return;
     }
+#endif
+
+    mmcpy( cursor_, src, count );
+    cursor_ += count;
+    size_ += count;
+  }
 
+  template < typename Ty > GatherStreamWriter &_write_pod( const Ty value ) {
+    _write_and_advance( sizeof( Ty ), reinterpret_cast< const mp::mp_u8 * >( &value ) );
     return *this;
   }
 
+public:
+  /* Referenced payloads are not in the buffer, so the output is not contiguous. */
+  static constexpr bool stable = true;
+  static constexpr bool contiguous = false;
+
+  explicit operator bool( ) const { return start_ != nullptr; }
+
   /**
-   * @brief Mark the start of a `Array` object in the byte stream. The chosen array type depends on
-   * the `num_elem` parameter.
-   * @param num_elem Number of key-value pairs in this map. Both keys and values can be any
-   * MessagePack type.
-   * @return MessagePack&
+   * @brief Set the buffer headers are written into; the segment table and threshold are kept.
+   * @param position Position to set the stream at, relative to `buffer`
+   * @param stream_size Total size, in bytes, of `buffer`
+   * @param buffer Buffer for everything but referenced payloads
+   * @return GatherStreamWriter&
    */
-  MessagePack &start_array( const mp::mp_u64 num_elem ) {
-    if ( num_elem <= mp::value_limits::FixArrayMax ) {
-      wr_.write_u8(
-          static_cast< mp::mp_u8 >( mp::MPMarker::FixArray ) |
-          static_cast< mp::mp_u8 >( num_elem & 0xf )
-      );
-    } else if ( num_elem <= mp::value_limits::Array16Max ) {
-      write_marker( MPMarker::Array16 );
-      wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( num_elem & 0xffff ) ) );
-    } else {
-      write_marker( MPMarker::Array32 );
-      wr_.write_u32( bswap_intrin32( static_cast< mp::mp_u32 >( num_elem & 0xffffffff ) ) );
-    }
+  GatherStreamWriter &
+  set( const mp::mp_size  position = 0,
+       const mp::mp_size  stream_size = 0,
+       mp::mp_u8         *buffer = nullptr,
+       const MemoryWriter = nullptr ) {
+    start_ = buffer;
+    end_ = buffer ? buffer + stream_size : nullptr;
+    cursor_ = buffer && position <= stream_size ? buffer + position : end_;
+    run_ = start_;
+    count_ = 0;
+    size_ = static_cast< mp::mp_u64 >( cursor_ - start_ );
+    error_ = error::none;
 
     return *this;
   }
 
   /**
-   * @brief Mark the start of a `Map` object in the byte stream. The map type chosen depends on the
-   * `num_pairs` parameter.
-   * @param num_pairs Number of key-value pairs in this map. Both keys and values can be any
-   * MessagePack type.
-   * @remark Not every language-specific decoder supports arbitrary key types. Keep this in mind
-   * when writing values to the map. Using the recommended Python decoder, for instance, requires
-   * you to explicitly allow integer keys.
-   * @return MessagePack&
+   * @brief Provide the table segments are recorded into. One entry is always kept free for the
+   * trailing run of the buffer, so `capacity` must be at least one.
+   * @param segments Array of at least `capacity` elements
+   * @param capacity Number of elements in `segments`
+   * @return GatherStreamWriter&
    */
-  MessagePack &start_map( const mp::mp_u64 num_pairs ) {
-    if ( num_pairs <= mp::value_limits::Map16Max ) {
-      wr_.write_u8(
-          static_cast< mp::mp_u8 >( mp::MPMarker::FixMap ) |
-          static_cast< mp::mp_u8 >( num_pairs & 0xf )
-      );
-    } else if ( num_pairs <= mp::value_limits::Map32Max ) {
-      write_marker( MPMarker::Map16 );
-      wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( num_pairs & 0xffff ) ) );
-    } else {
-      write_marker( MPMarker::Map32 );
-      wr_.write_u32( bswap_intrin32( static_cast< mp::mp_u32 >( num_pairs & 0xffffffff ) ) );
-    }
+  GatherStreamWriter &set_segments( Segment *segments, const mp::mp_u64 capacity ) {
+    segments_ = segments;
+    capacity_ = segments ? capacity : 0;
+    count_ = 0;
+    run_ = start_;
 
     return *this;
   }
 
   /**
-   * @brief Read an 8 byte unsigned integer from the byte stream and advance the cursor by 8 bytes.
-   * @return mp::mp_u64
+   * @brief Payloads of at least `threshold` bytes are referenced instead of copied.
+   * @return GatherStreamWriter&
    */
-  mp::mp_u64 read_u64( ) { return bswap_intrin64( sr_.read_u64( ) ); }
+  GatherStreamWriter &set_threshold( const mp::mp_u64 threshold ) {
+    threshold_ = threshold;
+    return *this;
+  }
 
-  /**
-   * @brief Read a 4 byte unsigned integer from the byte stream and advance the cursor by 4 bytes.
-   * @return mp::mp_u32
-   */
-  mp::mp_u32 read_u32( ) { return bswap_intrin32( sr_.read_u32( ) ); }
+  mp::mp_u64 threshold( ) const { return threshold_; }
 
   /**
-   * @brief Read a 2 byte unsigned integer from the byte stream and advance the cursor by 2 bytes.
-   * @return mp::mp_u16
+   * @brief Register a callback invoked for every referenced payload, see `PayloadPin`.
+   * @return GatherStreamWriter&
    */
-  mp::mp_u16 read_u16( ) { return bswap_intrin16( sr_.read_u16( ) ); }
+  GatherStreamWriter &set_pin( const PayloadPin pin, void *context = nullptr ) {
+    pin_ = pin;
+    context_ = context;
+    return *this;
+  }
 
   /**
-   * @brief Read an unsigned byte integer from the byte stream and advance the cursor by 1 byte.
-   * @return mp::mp_u8
+   * @brief Total number of bytes written, copied or referenced, truncated to `mp_size`.
+   * @return mp::mp_size
    */
-  mp::mp_u8 read_u8( ) { return sr_.read_u8( ); }
+  mp::mp_size position( ) const { return static_cast< mp::mp_size >( size_ ); }
 
   /**
-   * @brief Read an 8 byte signed integer from the byte stream and advance the cursor by 8 bytes.
-   * @return mp::mp_i64
+   * @brief Total number of bytes written, copied or referenced.
+   * @return mp::mp_u64
    */
-  mp::mp_i64 read_i64( ) {
-    return static_cast< mp_i64 >( bswap_intrin64( static_cast< mp_u64 >( sr_.read_i64( ) ) ) );
-  }
+  mp::mp_u64 size( ) const { return size_; }
 
-  /**
-   * @brief Read a 4 byte signed integer from the byte stream and advance the cursor by 4 bytes.
-   * @return mp::mp_i32
-   */
-  mp::mp_i32 read_i32( ) {
-    return static_cast< mp_i32 >( bswap_intrin32( static_cast< mp_u32 >( sr_.read_i32( ) ) ) );
+  mp::mp_u8 error( ) const { return error_; }
+
+  bool good( ) const { return error_ == error::none; }
+
+  void clear_error( ) { error_ = error::none; }
+
+  void fail( const mp::mp_u8 flags ) {
+    mp::stats::write_failed( flags, 0 );
+    error_ |= flags;
   }
 
   /**
-   * @brief Read a 2 byte signed integer from the byte stream and advance the cursor by 2 bytes.
-   * @return mp::mp_i16
+   * @brief Number of segments making up the encoded output, including the trailing run.
+   * @return mp::mp_u64
    */
-  mp::mp_i16 read_i16( ) { return bswap_intrin16( sr_.read_i16( ) ); }
+  mp::mp_u64 segment_count( ) const { return count_ + ( cursor_ != run_ ? 1 : 0 ); }
 
   /**
-   * @brief Read a signed byte integer from the byte stream and advance the cursor by 1 byte.
-   * @return mp::mp_i8
+   * @brief Close the trailing run of the buffer and return the segment table, `segment_count( )`
+   * entries long. Writing may continue afterwards; call again to refresh the last entry.
+   * @return Pointer to the table passed to `set_segments`, or `nullptr` if there is none
    */
-  mp::mp_i8 read_i8( ) { return sr_.read_i8( ); }
+  const Segment *segments( ) {
+    if ( segments_ && cursor_ != run_ )
+      segments_[ count_ ] = Segment{ run_, static_cast< mp::mp_u64 >( cursor_ - run_ ) };
 
-  /**
-   * @brief Write a single unsigned 4 byte value to the stream and advance the cursor by 4 if the
-   * stream has not reached its end.
-   * @param value Unsigned 4 byte value to write to the stream
-   * @return MessagePack&
-   */
-  MessagePack &write_u32( const mp::mp_u32 value ) {
-    write_raw_value< MPMarker::Uint32 >( value, sizeof( mp::mp_u32 ) );
-    return *this;
+    return segments_;
   }
 
   /**
-   * @brief Write a single unsigned 8 byte value to the stream and advance the cursor by 8 if the
-   * stream has not reached its end.
-   * @param value Unsigned 8 byte value to write to the stream
-   * @return MessagePack&
+   * @brief Drop the buffer, the segments and the pin callback.
    */
-  MessagePack &write_u64( const mp::mp_u64 value ) {
-    write_raw_value< MPMarker::Uint64 >( value, sizeof( mp::mp_u64 ) );
-    return *this;
+  void reset( ) {
+    reset_temporal( );
+    pin_ = nullptr;
+    context_ = nullptr;
   }
 
   /**
-   * @brief Write a single signed 4 byte value to the stream and advance the cursor by 4 if the
-   * stream has not reached its end. The value will be cast to its unsigned counterpart before the
-   * endianess change.
-   * @param value Signed 4 byte value to write to the stream
-   * @return MessagePack&
+   * @brief Drop the buffer and the segments, keeping the configuration.
    */
-  MessagePack &write_i32( const mp::mp_i32 value ) {
-    write_raw_value< MPMarker::Int32 >( value, sizeof( mp::mp_i32 ) );
-    return *this;
-  }
+  void reset_temporal( ) { set( ); }
 
   /**
-   * @brief Write a single unsigned 8 byte value to the stream and advance the cursor by 8 if the
-   * stream has not reached its end. The value will be cast to its unsigned counterpart before the
-   * endianess change.
-   * @param value Signed 8 byte value to write to the stream
-   * @return MessagePack&
+   * @brief Move the cursor back to the start of the buffer and forget every segment.
    */
-  MessagePack &write_i64( const mp::mp_i64 value ) {
-    write_raw_value< MPMarker::Int64 >( value, sizeof( mp::mp_i64 ) );
+  void reset_cursor( ) {
+    cursor_ = start_;
+    run_ = start_;
+    count_ = 0;
+    size_ = 0;
+    error_ = error::none;
+  }
+
+  void clear( ) {
+    if ( start_ ) mmset( start_, 0, static_cast< mp::mp_u64 >( end_ - start_ ) );
+    reset_cursor( );
+  }
+
+  GatherStreamWriter &write_u64( const mp::mp_u64 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_u32( const mp::mp_u32 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_u16( const mp::mp_u16 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_u8( const mp::mp_u8 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_i64( const mp::mp_i64 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_i32( const mp::mp_i32 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_i16( const mp::mp_i16 value ) { return _write_pod( value ); }
+  GatherStreamWriter &write_i8( const mp::mp_i8 value ) { return _write_pod( value ); }
+
+  GatherStreamWriter &write( const mp::mp_u32 count, mp::mp_u8 *src ) {
+    _write_and_advance( count, src );
     return *this;
   }
 
   /**
-   * @brief Write a single unsigned 2 byte value to the stream and advance the cursor by 2 if the
-   * stream has not reached its end.
-   * @param value Unsigned 2 byte value to write to the stream
-   * @return MessagePack&
+   * @brief Write the body of a `Bin`/`Str` value. Bodies of at least `threshold( )` bytes are
+   * referenced, and pinned, when the segment table has room; everything else is copied.
+   * @param count Size, in bytes, of the body
+   * @param src Caller memory holding the body
+   * @return GatherStreamWriter&
    */
-  MessagePack &write_u16( const mp::mp_u16 value ) {
-    write_raw_value< MPMarker::Uint16 >( value, sizeof( mp::mp_u16 ) );
+  GatherStreamWriter &write_payload( const mp::mp_u32 count, const mp::mp_u8 *src ) {
+    /* The closed run, the payload and the trailing run that may follow it. */
+    const mp::mp_u64 needed = ( cursor_ != run_ ? 1 : 0 ) + 2;
+
+    if ( count < threshold_ || !src || !start_ || count_ + needed > capacity_ ) {
+      _write_and_advance( count, src );
+      return *this;
+    }
+
+    if ( cursor_ != run_ )
+      segments_[ count_++ ] = Segment{ run_, static_cast< mp::mp_u64 >( cursor_ - run_ ) };
+
+    segments_[ count_++ ] = Segment{ const_cast< mp::mp_u8 * >( src ), count };
+    run_ = cursor_;
+    size_ += count;
+
+    if ( pin_ ) pin_( context_, src, count );
+
     return *this;
   }
 
   /**
-   * @brief Write a single signed 2 byte value to the stream and advance the cursor by 2 if the
-   * stream has not reached its end. The value will be cast to its unsigned counterpart before the
-   * endianess change.
-   * @param value Signed 2 byte value to write to the stream
-   * @return MessagePack&
+   * @brief Claim the next `count` bytes of the buffer for direct writing. See `WriteReservation`.
+   * @return Pointer to the first claimed byte or `nullptr` if fewer than `count` bytes remain
    */
-  MessagePack &write_i16( const mp::mp_i16 value ) {
-    write_raw_value< MPMarker::Int16 >( value, sizeof( mp::mp_i16 ) );
-    return *this;
+  mp::mp_u8 *reserve( const mp::mp_u32 count ) {
+    if ( mp_unlikely( !start_ || !_fits( count ) ) ) {
+      const mp::mp_u8 error_flags = start_ ? error::overflow : error::unavailable;
+
+      mp::stats::write_failed( error_flags, count );
+      error_ |= error_flags;
+      return nullptr;
+    }
+
+    const auto start = cursor_;
+
+    cursor_ += count;
+    size_ += count;
+
+    return start;
   }
 
-  MessagePack &write_posfixint( const mp::mp_u8 value ) {
-    write_raw_value< MPMarker::PosFixInt >( value, sizeof( mp::mp_u8 ) );
-    return *this;
+  void unreserve( const mp::mp_u32 count ) {
+    cursor_ -= count;
+    size_ -= count;
   }
+};
 
-  MessagePack &write_fixint( const mp::mp_i8 value ) {
-    if ( value > 0 )
-      write_posfixint( value );
-    else
-      write_negfixint( value );
+/**
+ * @brief Detects writer backends that can take `Bin`/`Str` bodies by reference, see
+ * `GatherStreamWriter::write_payload`.
+ */
+template < typename Writer, typename = void > struct has_write_payload : std::false_type { };
 
-    return *this;
-  }
+template < typename Writer >
+struct has_write_payload<
+    Writer,
+    std::void_t< decltype( std::declval< Writer & >( ).write_payload(
+        mp::mp_u32{ }, static_cast< const mp::mp_u8 * >( nullptr ) ) ) > > : std::true_type { };
+} // namespace stream
 
-  /**
-   * @brief Write an unsigned integer to the stream using the smallest possible representation.
-   * @param value Integer value to write to the stream
-   * @return MessagePack&
-   */
-  MessagePack &write_uint( const mp::mp_u64 value ) {
-    if ( value <= limits::uint8_max )
-      write_u8( static_cast< mp::mp_u8 >( value ) );
-    else if ( value <= limits::uint16_max )
-      write_u16( static_cast< mp::mp_u16 >( value ) );
-    else if ( value <= limits::uint32_max )
-      write_u32( static_cast< mp::mp_u32 >( value ) );
-    else
-      write_u64( value );
+namespace limits {
+/*
+ * Taken from the MSVC standard library and converted to constexpr instead of C macros. Typed
+ * explicitly rather than through the MSVC-only `i8`/`ui64`/... literal suffixes.
+ */
+constexpr mp::mp_i8  int8_min = -127 - 1;
+constexpr mp::mp_i16 int16_min = -32767 - 1;
+constexpr mp::mp_i32 int32_min = -2147483647 - 1;
+constexpr mp::mp_i64 int64_min = -9223372036854775807ll - 1;
+constexpr mp::mp_i8  int8_max = 127;
+constexpr mp::mp_i16 int16_max = 32767;
+constexpr mp::mp_i32 int32_max = 2147483647;
+constexpr mp::mp_i64 int64_max = 9223372036854775807ll;
+constexpr mp::mp_u8  uint8_max = 0xffu;
+constexpr mp::mp_u16 uint16_max = 0xffffu;
+constexpr mp::mp_u32 uint32_max = 0xffffffffu;
+constexpr mp::mp_u64 uint64_max = 0xffffffffffffffffull;
+constexpr auto float32_max = 3.402823466e+38;
+constexpr auto float64_max = 1.7976931348623158e+308;
+} // namespace limits
+
+namespace mp {
+namespace value_limits {
+// - (2 ^ 63)
+constexpr auto IntMin = -9223372036854775807ll - 1;
+
+// ( 2^64 ) - 1
+constexpr auto IntMax = 18446744073709551615llu;
+
+//  ( 2^32 ) - 1
+constexpr auto BinMax = 4294967295LU;
+
+//  ( 2^32 ) - 1
+constexpr auto StringMax = 4294967295LU;
+
+//  ( 2^32 ) - 1
+constexpr auto ArrayMax = 4294967295LU;
+
+//  ( 2^32 ) - 1
+constexpr auto KVMax = 4294967295LU;
+
+constexpr auto FixArrayMax = 15LU;
+constexpr auto Array16Max = 65535LU;
+constexpr auto Array32Max = 4294967295LU;
+
+constexpr auto FixMapMax = 15LU;
+constexpr auto Map16Max = 65535LU;
+constexpr auto Map32Max = 4294967295LU;
+
+constexpr auto PosFixIntMax = 127LU;
+} // namespace value_limits
+
+namespace type {
+enum class TypeValue : mp_u32 {
+  Integer,
+  Nil,
+  Boolean,
+  Float,
+  Raw,
+  String,
+  Binary,
+  Array,
+  Map,
+  Extension
+};
+
+struct MPInteger {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Integer ); }
+};
+
+struct MPNil {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Nil ); }
+};
+
+struct MPBoolean {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Boolean ); }
+};
+
+struct MPRaw {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Raw ); }
+};
+
+struct MPString {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::String ); }
+};
+
+struct MPBinary {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Binary ); }
+};
+
+struct MPArray {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Array ); }
+};
+
+struct MPMap {
+  static mp_u32 value( ) { return static_cast< mp_u32 >( TypeValue::Map ); }
+};
+} // namespace type
+
+enum class MPMarker : mp::mp_u8 {
+  PosFixInt,
+  FixMap = 0x80,
+  FixArray = 0x90,
+  FixStr = 0xa0,
+  Nil = 0xc0,
+  Unused = 0xc1,
+  False = 0xc2,
+  True = 0xc3,
+  Bin8 = 0xc4,
+  Bin16 = 0xc5,
+  Bin32 = 0xc6,
+  Ext8 = 0xc7,
+  Ext16 = 0xc8,
+  Ext32 = 0xc9,
+  Float32 = 0xca,
+  Float64 = 0xcb,
+  Uint8 = 0xcc,
+  Uint16 = 0xcd,
+  Uint32 = 0xce,
+  Uint64 = 0xcf,
+  Int8 = 0xd0,
+  Int16 = 0xd1,
+  Int32 = 0xd2,
+  Int64 = 0xd3,
+  FixExt1 = 0xd4,
+  FixExt2 = 0xd5,
+  FixExt4 = 0xd6,
+  FixExt8 = 0xd7,
+  FixExt16 = 0xd8,
+  Str8 = 0xd9,
+  Str16 = 0xda,
+  Str32 = 0xdb,
+  Array16 = 0xdc,
+  Array32 = 0xdd,
+  Map16 = 0xde,
+  Map32 = 0xdf,
+  NegFixInt = 0xe0
+};
+
+struct MPFixExt1 {
+  mp_u8 type;
+  mp_u8 data;
+};
+
+struct MPFixExt2 {
+  mp_u8 type;
+  mp_u8 data[ 2 ];
+};
+
+struct MPFixExt4 {
+  mp_u8 type;
+  mp_u8 data[ 4 ];
+};
+
+struct MPFixExt8 {
+  mp_u8 type;
+  mp_u8 data[ 8 ];
+};
+
+struct MPFixExt16 {
+  mp_u8 type;
+  mp_u8 data[ 16 ];
+};
+
+/**
+ * @brief Coarse type class of a marker. Several markers map onto the same family, e.g. `Uint8`,
+ * `Uint64` and `PosFixInt` all belong to `MPFamily::Uint`.
+ */
+enum class MPFamily : mp_u8 {
+  Invalid, // `MPMarker::Unused`
+  Nil,
+  Boolean,
+  Uint,
+  Int,
+  Float,
+  Str,
+  Bin,
+  Ext,
+  FixExt,
+  Array,
+  Map
+};
+
+/**
+ * @brief Everything the decoder needs to know about a leading byte.
+ */
+struct MPMarkerInfo {
+  MPMarker marker; // Canonical marker, e.g. `MPMarker::FixMap` for every byte in [0x80, 0x8f]
+  MPFamily family; // Type class of the marker
+  mp_u8    header; // Bytes `decode_single` consumes: marker, value/length, ext type, fix* payload
+  mp_u8    width;  // Bytes following the marker that hold the value, length or fixext data
+  mp_u8    mask;   // For fix* markers, mask extracting the inline value or length from the marker
+  mp_u8    size;   // Constant `MPDecodeResult::size`, zero if it is read from the stream or marker
+};
+
+/**
+ * @brief Classify a single leading byte. Used to build `marker_table` at compile time; prefer
+ * `marker_info` at runtime.
+ * @param raw First byte of a MessagePack value
+ * @return MPMarkerInfo
+ */
+constexpr MPMarkerInfo describe_marker( const mp_u8 raw ) {
+  if ( raw <= 0x7f ) return { MPMarker::PosFixInt, MPFamily::Uint, 1, 0, 0x7f, 1 };
+  if ( raw <= 0x8f ) return { MPMarker::FixMap, MPFamily::Map, 1, 0, 0x0f, 0 };
+  if ( raw <= 0x9f ) return { MPMarker::FixArray, MPFamily::Array, 1, 0, 0x0f, 0 };
+  if ( raw <= 0xbf ) {
+    const auto header = static_cast< mp_u8 >( 1 + ( raw & 0x1f ) );
+
+    return { MPMarker::FixStr, MPFamily::Str, header, 0, 0x1f, 0 };
+  }
+  if ( raw >= 0xe0 ) return { MPMarker::NegFixInt, MPFamily::Int, 1, 0, 0xff, 1 };
+
+  const auto marker = static_cast< MPMarker >( raw );
+
+  MPFamily family = MPFamily::Invalid;
+  mp_u8    width = 0;
+
+  switch ( marker ) {
+  case MPMarker::Nil:
+    family = MPFamily::Nil;
+    break;
+  case MPMarker::False:
+  case MPMarker::True:
+    family = MPFamily::Boolean;
+    break;
+  case MPMarker::Bin8:
+  case MPMarker::Bin16:
+  case MPMarker::Bin32:
+    family = MPFamily::Bin;
+    width = static_cast< mp_u8 >( 1u << ( raw - 0xc4 ) );
+    break;
+  case MPMarker::Ext8:
+  case MPMarker::Ext16:
+  case MPMarker::Ext32:
+    // The extension type follows the length and belongs to the header.
+    return { marker, MPFamily::Ext, static_cast< mp_u8 >( 2u + ( 1u << ( raw - 0xc7 ) ) ),
+             static_cast< mp_u8 >( 1u << ( raw - 0xc7 ) ), 0, 0 };
+  case MPMarker::Float32:
+  case MPMarker::Float64:
+    family = MPFamily::Float;
+    width = static_cast< mp_u8 >( 4u << ( raw - 0xca ) );
+    break;
+  case MPMarker::Uint8:
+  case MPMarker::Uint16:
+  case MPMarker::Uint32:
+  case MPMarker::Uint64:
+    family = MPFamily::Uint;
+    width = static_cast< mp_u8 >( 1u << ( raw - 0xcc ) );
+    break;
+  case MPMarker::Int8:
+  case MPMarker::Int16:
+  case MPMarker::Int32:
+  case MPMarker::Int64:
+    family = MPFamily::Int;
+    width = static_cast< mp_u8 >( 1u << ( raw - 0xd0 ) );
+    break;
+  case MPMarker::FixExt1:
+  case MPMarker::FixExt2:
+  case MPMarker::FixExt4:
+  case MPMarker::FixExt8:
+  case MPMarker::FixExt16:
+    // spec: fixext N stores an integer and a byte array whose length is N bytes
+    return { marker, MPFamily::FixExt, static_cast< mp_u8 >( 2u + ( 1u << ( raw - 0xd4 ) ) ),
+             static_cast< mp_u8 >( 1u << ( raw - 0xd4 ) ), 0,
+             static_cast< mp_u8 >( 1u + ( 1u << ( raw - 0xd4 ) ) ) };
+  case MPMarker::Str8:
+  case MPMarker::Str16:
+  case MPMarker::Str32:
+    family = MPFamily::Str;
+    width = static_cast< mp_u8 >( 1u << ( raw - 0xd9 ) );
+    break;
+  case MPMarker::Array16:
+  case MPMarker::Array32:
+    family = MPFamily::Array;
+    width = static_cast< mp_u8 >( 2u << ( raw - 0xdc ) );
+    break;
+  case MPMarker::Map16:
+  case MPMarker::Map32:
+    family = MPFamily::Map;
+    width = static_cast< mp_u8 >( 2u << ( raw - 0xde ) );
+    break;
+  default:
+    break;
+  }
+
+  // Numbers report their width as size, nil and booleans report a single byte.
+  mp_u8 size = 0;
+
+  if ( family == MPFamily::Uint || family == MPFamily::Int || family == MPFamily::Float )
+    size = width;
+  if ( family == MPFamily::Nil || family == MPFamily::Boolean ) size = 1;
+
+  return { marker, family, static_cast< mp_u8 >( 1u + width ), width, 0, size };
+}
+
+/**
+ * @brief 256 entry lookup table indexed by the leading byte of a value.
+ */
+struct MPMarkerTable {
+  MPMarkerInfo entries[ 0x100 ];
+};
+
+constexpr MPMarkerTable make_marker_table( ) {
+  MPMarkerTable table{ };
+
+  for ( mp_u32 raw = 0; raw < 0x100; raw++ )
+    table.entries[ raw ] = describe_marker( static_cast< mp_u8 >( raw ) );
+
+  return table;
+}
+
+inline constexpr MPMarkerTable marker_table = make_marker_table( );
+
+/**
+ * @brief Look up the classification of a leading byte.
+ * @param raw First byte of a MessagePack value
+ * @return const MPMarkerInfo&
+ */
+constexpr const MPMarkerInfo &marker_info( const mp_u8 raw ) { return marker_table.entries[ raw ]; }
+
+/**
+ * @brief Look up the classification of a marker, as returned by `decode_single` or `peek_marker`.
+ * @param marker MessagePack marker
+ * @return const MPMarkerInfo&
+ */
+constexpr const MPMarkerInfo &marker_info( const MPMarker marker ) {
+  return marker_table.entries[ static_cast< mp_u8 >( marker ) ];
+}
+
+/**
+ * @brief Number of bytes taking part in the header of the value introduced by `raw`: the marker
+ * itself plus any length, count, extension type or inline value that follows it. For FixStr and
+ * FixExt1/2/4/8/16 the payload is included, as `decode_single` copies it into `MPDecodeResult`.
+ * Str8/16/32, Bin8/16/32 and Ext8/16/32 payloads are not included.
+ * @param raw First byte of a MessagePack value
+ * @return mp_u32
+ */
+constexpr mp_u32 header_size( const mp_u8 raw ) { return marker_info( raw ).header; }
+
+static_assert( header_size( 0xa5 ) == 6 && header_size( 0xd8 ) == 18 && header_size( 0xdb ) == 5 );
+static_assert( header_size( 0xc7 ) == 3 && header_size( 0xc9 ) == 6 );
+static_assert( marker_info( 0x8a ).marker == MPMarker::FixMap && marker_info( 0xff ).mask == 0xff );
+
+/**
+ * @brief Non-owning view into the stream buffer. The length of the view is held by
+ * `MPDecodeResult::size`. Only valid for as long as the underlying buffer is.
+ */
+struct MPView {
+  const mp_u8 *data; // Start of the payload inside the stream buffer, `nullptr` if truncated
+  mp_i8        type; // Extension type. Only set for Ext8/16/32
+};
+
+/**
+ * @brief Extension value returned by `read_ext`, FixExt or Ext. `data` points into the stream
+ * buffer and is only valid for as long as it is.
+ */
+struct MPExt {
+  const mp_u8 *data{ nullptr };
+  mp_u32       size{ 0 };
+  mp_i8        type{ 0 };
+};
+
+/**
+ * @brief Value of the MessagePack timestamp extension (type -1): seconds since the Unix epoch and
+ * nanoseconds within that second.
+ */
+struct MPTimestamp {
+  mp_i64 seconds{ 0 };
+  mp_u32 nanoseconds{ 0 };
+};
+
+namespace ext {
+/**
+ * @brief Extension type reserved by the MessagePack specification for timestamps.
+ */
+constexpr mp_i8 timestamp = -1;
+
+/**
+ * @brief Decode the payload of a timestamp extension: timestamp 32 (4 bytes), 64 (8 bytes) or 96
+ * (12 bytes).
+ * @param value Extension value, typically from `read_ext`
+ * @param out Receives the timestamp
+ * @return `false` if `value` is not a timestamp or its payload has none of the three sizes
+ */
+inline bool decode_timestamp( const MPExt &value, MPTimestamp &out ) {
+  if ( value.type != timestamp || !value.data ) return false;
+
+  mp_u32 low = 0;
+  mp_u64 wide = 0;
+
+  switch ( value.size ) {
+  case 4:
+    mmcpy( &low, value.data, sizeof( low ) );
+    out = { bswap_intrin32( low ), 0 };
+    return true;
+  case 8:
+    mmcpy( &wide, value.data, sizeof( wide ) );
+    wide = bswap_intrin64( wide );
+    out = { static_cast< mp_i64 >( wide & 0x3ffffffffull ), static_cast< mp_u32 >( wide >> 34 ) };
+    return true;
+  case 12:
+    mmcpy( &low, value.data, sizeof( low ) );
+    mmcpy( &wide, value.data + sizeof( low ), sizeof( wide ) );
+    out = { static_cast< mp_i64 >( bswap_intrin64( wide ) ), bswap_intrin32( low ) };
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace ext
+
+/**
+ * @brief Exact MessagePack bytes of a key, header or constant subtree, emitted with a single copy
+ * by `write_encoded`. Usually handed out by a `FragmentCache`; does not own its bytes.
+ */
+struct PreEncoded {
+  const mp_u8 *data{ nullptr };
+  mp_u32       size{ 0 };
+
+  explicit operator bool( ) const { return data != nullptr; }
+};
+
+struct MPDecodeResult {
+  MPMarker marker;    // Marker of the latest value decoded
+  bool     truncated; // The value, payload included, runs past the end of the stream
+  mp_u32   size;      // Size of the value, in bytes. Mostly relevant for dynamically sized types.
+
+  union {
+    bool as_bool;
+
+    mp_u8 as_u8;
+    mp_i8 as_i8;
+
+    mp_i16 as_i16;
+    mp_u16 as_u16;
+
+    mp_i32 as_i32;
+    mp_u32 as_u32;
+
+    mp_i64 as_i64;
+    mp_u64 as_u64;
+
+    mp_f32 as_f32;
+    mp_f64 as_f64;
+
+    MPFixExt1  as_fixext1;
+    MPFixExt2  as_fixext2;
+    MPFixExt4  as_fixext4;
+    MPFixExt8  as_fixext8;
+    MPFixExt16 as_fixext16;
+
+    mp_u8 as_fixstr[ 31 ];
+
+    MPView as_view;
+  } result; // Holds the result for statically sized types such as FixInt, NegFixInt,
+            // Uint8/16/32/64, Int8/16/32/64, FixExt1/2/4/8/16. `as_view` is only set by
+            // `decode_view( )` for FixStr, Str8/16/32, Bin8/16/32 and Ext8/16/32, except for
+            // `as_view.type`, which `decode_single( )` sets for Ext8/16/32 as well
+
+  explicit operator bool( ) const { return marker != MPMarker::Unused; }
+
+  /**
+   * @brief Type class of this result's marker.
+   * @return MPFamily
+   */
+  MPFamily family( ) const { return marker_info( marker ).family; }
+
+  /**
+   * @brief Check if this result's marker denotes the start of a fixext type.
+   * @return bool
+   */
+  bool is_fixext( ) const { return family( ) == MPFamily::FixExt; }
+
+  /**
+   * @brief Check if this result's marker denotes the start of an array.
+   * @return bool
+   */
+  bool is_array( ) const { return family( ) == MPFamily::Array; }
+
+  /**
+   * @brief Check if this result's marker denotes the start of a map.
+   * @return bool
+   */
+  bool is_map( ) const { return family( ) == MPFamily::Map; }
+
+  /**
+   * @brief Check if this result's marker denotes any integer type.
+   * @return bool
+   */
+  bool is_integer( ) const { return family( ) == MPFamily::Uint || family( ) == MPFamily::Int; }
+
+  /**
+   * @brief Check if this result's marker denotes any string type.
+   * @return bool
+   */
+  bool is_str( ) const { return family( ) == MPFamily::Str; }
+
+  /**
+   * @brief Check if this result's marker denotes the start of any binary type.
+   * @return bool
+   */
+  bool is_bin( ) const { return family( ) == MPFamily::Bin; }
+
+  /**
+   * @brief Check if this result's marker denotes the start of any non-fixed extension type.
+   * @return bool
+   */
+  bool is_ext( ) const { return family( ) == MPFamily::Ext; }
+
+  /**
+   * @brief Check if this result's marker denotes a single or double precision float.
+   * @return bool
+   */
+  bool is_float( ) const { return family( ) == MPFamily::Float; }
+
+  /**
+   * @brief Check if this result's marker denotes the start of any boolean type.
+   * @return bool
+   */
+  bool is_bool( ) const { return family( ) == MPFamily::Boolean; }
+
+  /**
+   * @brief Check if this result's marker denotes a `Nil` value
+   * @return bool
+   */
+  bool is_nil( ) const { return family( ) == MPFamily::Nil; }
+
+  /**
+   * @brief Store the integer held by this result into `out` if it is representable by `Ty`.
+   * @tparam Ty Any integer type
+   * @param out Receives the value
+   * @return `false` if this result is not an integer or its value does not fit into `Ty`
+   */
+  template < typename Ty > bool as_integer( Ty &out ) const {
+    const auto &info = marker_info( marker );
+
+    if ( info.family == MPFamily::Uint ) {
+      mp_u64 value = 0;
+
+      switch ( info.width ) {
+      case 0:
+      case 1:
+        value = result.as_u8;
+        break;
+      case 2:
+        value = result.as_u16;
+        break;
+      case 4:
+        value = result.as_u32;
+        break;
+      default:
+        value = result.as_u64;
+        break;
+      }
+
+      const auto narrowed = static_cast< Ty >( value );
+
+      if ( static_cast< mp_u64 >( narrowed ) != value ) return false;
+
+      if constexpr ( std::is_signed_v< Ty > ) {
+        if ( narrowed < 0 ) return false;
+      }
+
+      out = narrowed;
+      return true;
+    }
+
+    if ( info.family == MPFamily::Int ) {
+      mp_i64 value = 0;
+
+      switch ( info.width ) {
+      case 0:
+      case 1:
+        value = result.as_i8;
+        break;
+      case 2:
+        value = result.as_i16;
+        break;
+      case 4:
+        value = result.as_i32;
+        break;
+      default:
+        value = result.as_i64;
+        break;
+      }
+
+      const auto narrowed = static_cast< Ty >( value );
+
+      if ( static_cast< mp_i64 >( narrowed ) != value ) return false;
+
+      if constexpr ( !std::is_signed_v< Ty > ) {
+        if ( value < 0 ) return false;
+      }
+
+      out = narrowed;
+      return true;
+    }
+
+    return false;
+  }
+};
+
+/*
+ * Kernels for arrays whose elements all use the same fixed-width integer marker, i.e.
+ * [marker][big-endian value] repeated. Each 16 byte block of native values maps onto `block` bytes
+ * of encoded data; a pair of byte shuffles moves every value into place, swapping its bytes, and
+ * the marker bytes are either OR-ed in (encoding) or compared in bulk (decoding).
+ */
+namespace simd {
+template < typename Ty > Ty byteswap( const Ty value ) {
+  if constexpr ( sizeof( Ty ) == 2 ) {
+    return static_cast< Ty >( bswap_intrin16( static_cast< mp_u16 >( value ) ) );
+  } else if constexpr ( sizeof( Ty ) == 4 ) {
+    return static_cast< Ty >( bswap_intrin32( static_cast< mp_u32 >( value ) ) );
+  } else if constexpr ( sizeof( Ty ) == 8 ) {
+    return static_cast< Ty >( bswap_intrin64( static_cast< mp_u64 >( value ) ) );
+  } else {
+    return value;
+  }
+}
+
+template < mp_u32 width > struct FixedLayout {
+  static constexpr mp_u32 stride = width + 1;      // Encoded bytes per element
+  static constexpr mp_u32 lanes = 16 / width;      // Elements per 16 byte block of native values
+  static constexpr mp_u32 block = lanes * stride;  // Encoded bytes per block
+  static constexpr mp_u32 tail = block - 16;       // Encoded bytes past the first 16 of a block
+};
+
+struct ShuffleMask {
+  mp_u8 bytes[ 16 ];
+};
+
+/**
+ * @brief Shuffle producing encoded bytes [base, base + 16) of a block from its native values.
+ * Marker positions are zeroed.
+ */
+template < mp_u32 width > constexpr ShuffleMask encode_shuffle( const mp_u32 base ) {
+  using L = FixedLayout< width >;
+  ShuffleMask mask{ };
+
+  for ( mp_u32 q = 0; q < 16; q++ ) {
+    const auto p = base + q, element = p / L::stride, offset = p % L::stride;
+
+    mask.bytes[ q ] = ( p >= L::block || !offset )
+                          ? 0x80
+                          : static_cast< mp_u8 >( element * width + ( width - offset ) );
+  }
+
+  return mask;
+}
+
+/**
+ * @brief 0xff at every marker position of encoded bytes [base, base + 16) of a block.
+ */
+template < mp_u32 width > constexpr ShuffleMask encode_markers( const mp_u32 base ) {
+  using L = FixedLayout< width >;
+  ShuffleMask mask{ };
+
+  for ( mp_u32 q = 0; q < 16; q++ ) {
+    const auto p = base + q;
+
+    mask.bytes[ q ] = ( p < L::block && !( p % L::stride ) ) ? 0xff : 0x00;
+  }
+
+  return mask;
+}
+
+/**
+ * @brief Shuffle producing the native values of a block out of the 16 encoded bytes loaded at
+ * offset 0 (`low`), or at offset `tail` (`!low`). OR both results together.
+ */
+template < mp_u32 width > constexpr ShuffleMask decode_shuffle( const bool low ) {
+  using L = FixedLayout< width >;
+  ShuffleMask mask{ };
+
+  for ( mp_u32 q = 0; q < 16; q++ ) {
+    const auto element = q / width, byte = q % width;
+    const auto p = element * L::stride + 1 + ( width - 1 - byte );
+
+    if ( low )
+      mask.bytes[ q ] = p < 16 ? static_cast< mp_u8 >( p ) : 0x80;
+    else
+      mask.bytes[ q ] = p >= 16 ? static_cast< mp_u8 >( p - L::tail ) : 0x80;
+  }
+
+  return mask;
+}
+
+/**
+ * @brief Shuffle gathering the marker of every element of a block into lanes [0, lanes).
+ */
+template < mp_u32 width > constexpr ShuffleMask check_shuffle( const bool low ) {
+  using L = FixedLayout< width >;
+  ShuffleMask mask{ };
+
+  for ( mp_u32 q = 0; q < 16; q++ ) {
+    const auto p = q * L::stride;
+
+    if ( q >= L::lanes )
+      mask.bytes[ q ] = 0x80;
+    else if ( low )
+      mask.bytes[ q ] = p < 16 ? static_cast< mp_u8 >( p ) : 0x80;
+    else
+      mask.bytes[ q ] = p >= 16 ? static_cast< mp_u8 >( p - L::tail ) : 0x80;
+  }
+
+  return mask;
+}
+
+/**
+ * @brief 0xff in lanes [0, lanes).
+ */
+template < mp_u32 width > constexpr ShuffleMask check_lanes( ) {
+  ShuffleMask mask{ };
+
+  for ( mp_u32 q = 0; q < 16; q++ )
+    mask.bytes[ q ] = q < FixedLayout< width >::lanes ? 0xff : 0x00;
+
+  return mask;
+}
+
+/**
+ * @brief Encode `count` values as [marker][big-endian value] into `dst`.
+ * @param dst Buffer of at least `count * ( sizeof( Ty ) + 1 )` bytes
+ * @param src Values to encode
+ * @param count Number of values in `src`
+ * @param marker Marker byte written in front of every value
+ */
+template < typename Ty >
+void encode_fixed( mp_u8 *dst, const Ty *src, const mp_u64 count, const mp_u8 marker ) {
+  using L = FixedLayout< sizeof( Ty ) >;
+
+  mp_u64 index = 0;
+
+#if defined( MP_SIMD_SSSE3 )
+  static constexpr auto shuffle_low = encode_shuffle< sizeof( Ty ) >( 0 );
+  static constexpr auto shuffle_high = encode_shuffle< sizeof( Ty ) >( 16 );
+  static constexpr auto markers_low = encode_markers< sizeof( Ty ) >( 0 );
+  static constexpr auto markers_high = encode_markers< sizeof( Ty ) >( 16 );
+
+  const auto fill = _mm_set1_epi8( static_cast< char >( marker ) );
+  const auto sl = _mm_loadu_si128( reinterpret_cast< const __m128i * >( shuffle_low.bytes ) );
+  const auto sh = _mm_loadu_si128( reinterpret_cast< const __m128i * >( shuffle_high.bytes ) );
+  const auto ml = _mm_and_si128(
+      fill, _mm_loadu_si128( reinterpret_cast< const __m128i * >( markers_low.bytes ) )
+  );
+  const auto mh = _mm_and_si128(
+      fill, _mm_loadu_si128( reinterpret_cast< const __m128i * >( markers_high.bytes ) )
+  );
+
+  for ( ; index + L::lanes <= count; index += L::lanes, dst += L::block ) {
+    const auto in = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + index ) );
+    alignas( 16 ) mp_u8 tail[ 16 ];
+
+    _mm_storeu_si128(
+        reinterpret_cast< __m128i * >( dst ), _mm_or_si128( _mm_shuffle_epi8( in, sl ), ml )
+    );
+    _mm_store_si128(
+        reinterpret_cast< __m128i * >( tail ), _mm_or_si128( _mm_shuffle_epi8( in, sh ), mh )
+    );
+
+    mmcpy( dst + 16, tail, L::tail );
+  }
+#elif defined( MP_SIMD_NEON )
+  static constexpr auto shuffle_low = encode_shuffle< sizeof( Ty ) >( 0 );
+  static constexpr auto shuffle_high = encode_shuffle< sizeof( Ty ) >( 16 );
+  static constexpr auto markers_low = encode_markers< sizeof( Ty ) >( 0 );
+  static constexpr auto markers_high = encode_markers< sizeof( Ty ) >( 16 );
+
+  const auto fill = vdupq_n_u8( marker );
+  const auto sl = vld1q_u8( shuffle_low.bytes );
+  const auto sh = vld1q_u8( shuffle_high.bytes );
+  const auto ml = vandq_u8( fill, vld1q_u8( markers_low.bytes ) );
+  const auto mh = vandq_u8( fill, vld1q_u8( markers_high.bytes ) );
+
+  for ( ; index + L::lanes <= count; index += L::lanes, dst += L::block ) {
+    const auto in = vld1q_u8( reinterpret_cast< const mp_u8 * >( src + index ) );
+    mp_u8      tail[ 16 ];
+
+    vst1q_u8( dst, vorrq_u8( vqtbl1q_u8( in, sl ), ml ) );
+    vst1q_u8( tail, vorrq_u8( vqtbl1q_u8( in, sh ), mh ) );
+
+    mmcpy( dst + 16, tail, L::tail );
+  }
+#endif
+
+  for ( ; index < count; index++, dst += L::stride ) {
+    const auto value = byteswap( src[ index ] );
+
+    dst[ 0 ] = marker;
+    mmcpy( dst + 1, &value, sizeof( Ty ) );
+  }
+}
+
+/**
+ * @brief Decode at most `count` values encoded as [marker][big-endian value] from `src`, stopping
+ * at the first element whose marker differs from `marker`.
+ * @param dst Buffer of at least `count` values
+ * @param src Buffer of at least `count * ( sizeof( Ty ) + 1 )` bytes
+ * @param count Maximum number of values to decode
+ * @param marker Expected marker byte
+ * @return Number of values decoded into `dst`
+ */
+template < typename Ty >
+mp_u64 decode_fixed( Ty *dst, const mp_u8 *src, const mp_u64 count, const mp_u8 marker ) {
+  using L = FixedLayout< sizeof( Ty ) >;
+
+  mp_u64 index = 0;
+
+#if defined( MP_SIMD_SSSE3 )
+  static constexpr auto values_low = decode_shuffle< sizeof( Ty ) >( true );
+  static constexpr auto values_high = decode_shuffle< sizeof( Ty ) >( false );
+  static constexpr auto markers_low = check_shuffle< sizeof( Ty ) >( true );
+  static constexpr auto markers_high = check_shuffle< sizeof( Ty ) >( false );
+  static constexpr auto lanes = check_lanes< sizeof( Ty ) >( );
+
+  const auto vl = _mm_loadu_si128( reinterpret_cast< const __m128i * >( values_low.bytes ) );
+  const auto vh = _mm_loadu_si128( reinterpret_cast< const __m128i * >( values_high.bytes ) );
+  const auto ml = _mm_loadu_si128( reinterpret_cast< const __m128i * >( markers_low.bytes ) );
+  const auto mh = _mm_loadu_si128( reinterpret_cast< const __m128i * >( markers_high.bytes ) );
+  const auto expected = _mm_and_si128(
+      _mm_set1_epi8( static_cast< char >( marker ) ),
+      _mm_loadu_si128( reinterpret_cast< const __m128i * >( lanes.bytes ) )
+  );
+
+  for ( ; index + L::lanes <= count; index += L::lanes, src += L::block ) {
+    const auto low = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src ) );
+    const auto high = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + L::tail ) );
+    const auto found = _mm_or_si128( _mm_shuffle_epi8( low, ml ), _mm_shuffle_epi8( high, mh ) );
+
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( found, expected ) ) != 0xffff ) break;
+
+    _mm_storeu_si128(
+        reinterpret_cast< __m128i * >( dst + index ),
+        _mm_or_si128( _mm_shuffle_epi8( low, vl ), _mm_shuffle_epi8( high, vh ) )
+    );
+  }
+#elif defined( MP_SIMD_NEON )
+  static constexpr auto values_low = decode_shuffle< sizeof( Ty ) >( true );
+  static constexpr auto values_high = decode_shuffle< sizeof( Ty ) >( false );
+  static constexpr auto markers_low = check_shuffle< sizeof( Ty ) >( true );
+  static constexpr auto markers_high = check_shuffle< sizeof( Ty ) >( false );
+  static constexpr auto lanes = check_lanes< sizeof( Ty ) >( );
+
+  const auto vl = vld1q_u8( values_low.bytes );
+  const auto vh = vld1q_u8( values_high.bytes );
+  const auto ml = vld1q_u8( markers_low.bytes );
+  const auto mh = vld1q_u8( markers_high.bytes );
+  const auto expected = vandq_u8( vdupq_n_u8( marker ), vld1q_u8( lanes.bytes ) );
+
+  for ( ; index + L::lanes <= count; index += L::lanes, src += L::block ) {
+    const auto low = vld1q_u8( src );
+    const auto high = vld1q_u8( src + L::tail );
+    const auto found = vorrq_u8( vqtbl1q_u8( low, ml ), vqtbl1q_u8( high, mh ) );
+
+    if ( vminvq_u8( vceqq_u8( found, expected ) ) != 0xff ) break;
+
+    vst1q_u8(
+        reinterpret_cast< mp_u8 * >( dst + index ),
+        vorrq_u8( vqtbl1q_u8( low, vl ), vqtbl1q_u8( high, vh ) )
+    );
+  }
+#endif
+
+  for ( ; index < count && src[ 0 ] == marker; index++, src += L::stride ) {
+    Ty value;
+
+    mmcpy( &value, src + 1, sizeof( Ty ) );
+    dst[ index ] = byteswap( value );
+  }
+
+  return index;
+}
+/**
+ * @brief Fixed-width marker matching `Ty`, e.g. `Uint32` for `mp_u32` or `Int16` for `mp_i16`.
+ */
+template < typename Ty > constexpr mp_u8 fixed_marker( ) {
+  constexpr mp_u8 base = std::is_signed_v< Ty > ? 0xd0 : 0xcc;
+
+  return sizeof( Ty ) == 1   ? base
+         : sizeof( Ty ) == 2 ? base + 1
+         : sizeof( Ty ) == 4 ? base + 2
+                             : base + 3;
+}
+
+/**
+ * @brief Length, in whole blocks of 16 bytes, of the run of PosFixInt and NegFixInt values at the
+ * start of `src`: each byte below 0x80 or from 0xe0 up is a complete value on its own.
+ * @param src Buffer of at least `count` bytes
+ * @param count Maximum number of bytes to scan
+ * @return A multiple of 16, always 0 without SIMD
+ */
+inline mp_u64 fixint_run( [[maybe_unused]] const mp_u8 *src, [[maybe_unused]] const mp_u64 count ) {
+  mp_u64 index = 0;
+
+#if defined( MP_SIMD_SSSE3 )
+  // Signed, both ranges are exactly the bytes above -33.
+  const auto floor = _mm_set1_epi8( -33 );
+
+  for ( ; index + 16 <= count; index += 16 ) {
+    const auto in = _mm_loadu_si128( reinterpret_cast< const __m128i * >( src + index ) );
+
+    if ( _mm_movemask_epi8( _mm_cmpgt_epi8( in, floor ) ) != 0xffff ) break;
+  }
+#elif defined( MP_SIMD_NEON )
+  const auto floor = vdupq_n_s8( -33 );
+
+  for ( ; index + 16 <= count; index += 16 ) {
+    const auto in = vld1q_s8( reinterpret_cast< const mp_i8 * >( src + index ) );
+
+    if ( vminvq_u8( vcgtq_s8( in, floor ) ) != 0xff ) break;
+  }
+#endif
+
+  return index;
+}
+} // namespace simd
+
+/**
+ * @brief Element encoding used by the `write_array_*` family.
+ */
+enum class MPArrayEncoding : mp_u8 {
+  Compact,   // Every element uses its smallest representation, like `write_uint`/`write_int`
+  FixedWidth // Every element uses the marker matching its C++ type, e.g. `Uint32` for `mp_u32`
+};
+
+/**
+ * @brief Scoped, bounds-checked-once write window obtained from `BasicMessagePack::reserve`. The
+ * capacity of the whole window is checked when it is taken; every write after that is a plain
+ * store through a bumped pointer. Each method produces exactly the bytes its `BasicMessagePack`
+ * counterpart would.
+ *
+ * Whatever part of the window was not written is handed back to the writer when the reservation
+ * is committed or destroyed, so reserving the worst case of a record is cheap.
+ *
+ * @remark Writing past the reserved size is undefined behaviour; `remaining( )` tells how much room
+ * is left. Do not write to the `MessagePack` itself while a reservation is open.
+ * @tparam Writer Writer backend of the `BasicMessagePack` the window was taken from
+ */
+template < typename Writer > struct WriteReservation {
+private:
+  Writer *writer_{ nullptr };
+  mp_u8  *cursor_{ nullptr };
+  mp_u8  *end_{ nullptr };
+
+  template < typename Ty > void _store( const Ty value ) {
+    mmcpy( cursor_, &value, sizeof( Ty ) );
+    cursor_ += sizeof( Ty );
+  }
+
+  void _marker( const MPMarker marker ) { _lead( static_cast< mp_u8 >( marker ) ); }
+
+  void _lead( const mp_u8 lead ) {
+    stats::encoded( lead );
+    *cursor_++ = lead;
+  }
+
+  /**
+   * @brief Header shared by `write_cstr` and `write_bytes`, `base` being the 8-bit marker.
+   */
+  void _length( const MPMarker base, const mp_u32 length ) {
+    stats::payload( length );
+
+    if ( length <= limits::uint8_max ) {
+      _marker( base );
+      *cursor_++ = static_cast< mp_u8 >( length );
+    } else if ( length <= limits::uint16_max ) {
+      _lead( static_cast< mp_u8 >( static_cast< mp_u8 >( base ) + 1 ) );
+      _store( bswap_intrin16( static_cast< mp_u16 >( length ) ) );
+    } else {
+      _lead( static_cast< mp_u8 >( static_cast< mp_u8 >( base ) + 2 ) );
+      _store( bswap_intrin32( length ) );
+    }
+  }
+
+public:
+  WriteReservation( ) = default;
+
+  WriteReservation( Writer &writer, mp_u8 *start, const mp_u32 size )
+      : writer_( start ? &writer : nullptr ), cursor_( start ),
+        end_( start ? start + size : nullptr ) { }
+
+  WriteReservation( WriteReservation &&other ) noexcept
+      : writer_( other.writer_ ), cursor_( other.cursor_ ), end_( other.end_ ) {
+    other.writer_ = nullptr;
+  }
+
+  /* Disallow copies. */
+  WriteReservation( const WriteReservation &other ) = delete;
+  WriteReservation &operator=( const WriteReservation &other ) = delete;
+
+  ~WriteReservation( ) { commit( ); }
+
+  /**
+   * @brief `false` if the writer could not provide the requested number of bytes.
+   */
+  explicit operator bool( ) const { return writer_ != nullptr; }
+
+  /**
+   * @brief Number of reserved bytes not written yet.
+   */
+  mp_u32 remaining( ) const { return static_cast< mp_u32 >( end_ - cursor_ ); }
+
+  /**
+   * @brief Close the window and return the unwritten bytes to the writer. Called by the destructor.
+   */
+  void commit( ) {
+    if ( !writer_ ) return;
+
+    writer_->unreserve( remaining( ) );
+    writer_ = nullptr;
+    end_ = cursor_;
+  }
+
+  WriteReservation &write_u8( const mp_u8 value ) {
+    _marker( MPMarker::Uint8 );
+    *cursor_++ = value;
+    return *this;
+  }
+
+  WriteReservation &write_u16( const mp_u16 value ) {
+    _marker( MPMarker::Uint16 );
+    _store( bswap_intrin16( value ) );
+    return *this;
+  }
+
+  WriteReservation &write_u32( const mp_u32 value ) {
+    _marker( MPMarker::Uint32 );
+    _store( bswap_intrin32( value ) );
+    return *this;
+  }
+
+  WriteReservation &write_u64( const mp_u64 value ) {
+    _marker( MPMarker::Uint64 );
+    _store( bswap_intrin64( value ) );
+    return *this;
+  }
+
+  WriteReservation &write_i8( const mp_i8 value ) {
+    _marker( MPMarker::Int8 );
+    *cursor_++ = static_cast< mp_u8 >( value );
+    return *this;
+  }
+
+  WriteReservation &write_i16( const mp_i16 value ) {
+    _marker( MPMarker::Int16 );
+    _store( bswap_intrin16( static_cast< mp_u16 >( value ) ) );
+    return *this;
+  }
+
+  WriteReservation &write_i32( const mp_i32 value ) {
+    _marker( MPMarker::Int32 );
+    _store( bswap_intrin32( static_cast< mp_u32 >( value ) ) );
+    return *this;
+  }
+
+  WriteReservation &write_i64( const mp_i64 value ) {
+    _marker( MPMarker::Int64 );
+    _store( bswap_intrin64( static_cast< mp_u64 >( value ) ) );
+    return *this;
+  }
+
+  /**
+   * @brief Same selection as `BasicMessagePack::write_uint`. Takes at most 9 bytes.
+   */
+  WriteReservation &write_uint( const mp_u64 value ) {
+    if ( value <= limits::uint8_max )
+      write_u8( static_cast< mp_u8 >( value ) );
+    else if ( value <= limits::uint16_max )
+      write_u16( static_cast< mp_u16 >( value ) );
+    else if ( value <= limits::uint32_max )
+      write_u32( static_cast< mp_u32 >( value ) );
+    else
+      write_u64( value );
+
+    return *this;
+  }
+
+  /**
+   * @brief Same selection as `BasicMessagePack::write_int`. Takes at most 9 bytes.
+   */
+  WriteReservation &write_int( const mp_i64 value ) {
+    if ( value >= limits::int8_min && value <= limits::int8_max )
+      write_i8( static_cast< mp_i8 >( value ) );
+    else if ( value >= limits::int16_min && value <= limits::int16_max )
+      write_i16( static_cast< mp_i16 >( value ) );
+    else if ( value >= limits::int32_min && value <= limits::int32_max )
+      write_i32( static_cast< mp_i32 >( value ) );
+    else
+      write_i64( value );
+
+    return *this;
+  }
+
+  WriteReservation &write_f32( const mp_f32 value ) {
+    mp_u32 bits;
+
+    mmcpy( &bits, &value, sizeof( bits ) );
+    _marker( MPMarker::Float32 );
+    _store( bswap_intrin32( bits ) );
+
+    return *this;
+  }
+
+  WriteReservation &write_f64( const mp_f64 value ) {
+    mp_u64 bits;
+
+    mmcpy( &bits, &value, sizeof( bits ) );
+    _marker( MPMarker::Float64 );
+    _store( bswap_intrin64( bits ) );
+
+    return *this;
+  }
+
+  WriteReservation &write_boolean( const bool value ) {
+    _marker( value ? MPMarker::True : MPMarker::False );
+    return *this;
+  }
+
+  /**
+   * @brief Takes at most 5 bytes.
+   */
+  WriteReservation &start_array( const mp_u32 num_elem ) {
+    if ( num_elem <= value_limits::FixArrayMax ) {
+      _lead( static_cast< mp_u8 >( static_cast< mp_u8 >( MPMarker::FixArray ) | num_elem ) );
+    } else if ( num_elem <= value_limits::Array16Max ) {
+      _marker( MPMarker::Array16 );
+      _store( bswap_intrin16( static_cast< mp_u16 >( num_elem ) ) );
+    } else {
+      _marker( MPMarker::Array32 );
+      _store( bswap_intrin32( num_elem ) );
+    }
+
+    return *this;
+  }
+
+  /**
+   * @brief Takes at most 5 bytes.
+   */
+  WriteReservation &start_map( const mp_u32 num_pairs ) {
+    if ( num_pairs <= value_limits::FixMapMax ) {
+      _lead( static_cast< mp_u8 >( static_cast< mp_u8 >( MPMarker::FixMap ) | num_pairs ) );
+    } else if ( num_pairs <= value_limits::Map16Max ) {
+      _marker( MPMarker::Map16 );
+      _store( bswap_intrin16( static_cast< mp_u16 >( num_pairs ) ) );
+    } else {
+      _marker( MPMarker::Map32 );
+      _store( bswap_intrin32( num_pairs ) );
+    }
+
+    return *this;
+  }
+
+  /**
+   * @brief Same encoding as `BasicMessagePack::write_cstr`. Takes at most `length + 5` bytes.
+   */
+  WriteReservation &write_cstr( const mp_u8 *string, const mp_u32 length ) {
+    _length( MPMarker::Str8, length );
+    return write_encoded( string, length );
+  }
+
+  /**
+   * @brief Same encoding as `BasicMessagePack::write_bytes`. Takes at most `count + 5` bytes.
+   */
+  WriteReservation &write_bytes( const mp_u8 *bytes, const mp_u32 count ) {
+    _length( MPMarker::Bin8, count );
+    return write_encoded( bytes, count );
+  }
+
+  /**
+   * @brief Copy `count` already encoded bytes, e.g. precomputed keys.
+   */
+  WriteReservation &write_encoded( const mp_u8 *bytes, const mp_u32 count ) {
+    if ( count ) mmcpy( cursor_, bytes, count );
+
+    cursor_ += count;
+    return *this;
+  }
+
+  WriteReservation &write_encoded( const PreEncoded &fragment ) {
+    return write_encoded( fragment.data, fragment.size );
+  }
+};
+
+/**
+ * @brief Visitor accepting every event of `BasicDecoder::parse` and doing nothing. Derive from it
+ * and hide only the handlers of interest; `parse` is instantiated for the derived type, so calls
+ * are resolved, and usually inlined, at compile time. Every handler returns `false` to stop.
+ * @remark Strings, binaries and extension payloads are views into the stream buffer.
+ */
+struct NullVisitor {
+  bool on_nil( ) { return true; }
+  bool on_bool( bool ) { return true; }
+  bool on_uint( mp_u64 ) { return true; }
+  bool on_int( mp_i64 ) { return true; }
+  bool on_float( mp_f64 ) { return true; }
+  bool on_str( const mp_u8 *, mp_u32 ) { return true; }
+  bool on_bin( const mp_u8 *, mp_u32 ) { return true; }
+  bool on_ext( const MPExt & ) { return true; }
+  bool on_array_begin( mp_u32 ) { return true; }
+  bool on_array_end( ) { return true; }
+  bool on_map_begin( mp_u32 ) { return true; }
+  bool on_map_end( ) { return true; }
+};
+
+/**
+ * @brief Decoding half of `BasicMessagePack`, over any reader exposing the `BasicStreamReader`
+ * interface. See `Decoder` for a standalone, trivially copyable decoder.
+ * @tparam Reader `stream::BasicStreamReader` or `stream::SpanReader`
+ */
+template < typename Reader > struct BasicDecoder {
+protected:
+  /**
+   * @brief Internal object used for reading from the byte stream.
+   */
+  Reader sr_{ };
+
+public:
+  /**
+   * @brief Return the previously set stream size
+   * @return The size, in bytes, of the underlying buffer
+   */
+  mp::mp_size stream_size( ) const { return sr_.stream_size( ); }
+
+  /**
+   * @brief Sticky error flags of the reader, see `stream::error`.
+   * @return mp::mp_u8
+   */
+  mp::mp_u8 error( ) const { return sr_.error( ); }
+
+  bool good( ) const { return sr_.good( ); }
+
+  void clear_error( ) { sr_.clear_error( ); }
+
+  /**
+   * @brief Position of the read cursor in the stream.
+   * @return mp::mp_size
+   */
+  mp::mp_size read_cursor( ) const { return sr_.position( ); }
+
+  /**
+   * @brief Move the read cursor to `position`, e.g. the offset of a `TapeEntry`.
+   * @return `false`, leaving the cursor untouched, if `position` lies past the end of the stream
+   */
+  bool seek_read_cursor( const mp::mp_size position ) { return sr_.seek( position ); }
+
+  /**
+   * @brief Peek a byte from the stream and attempt to decode it as MessagePack type.
+   * @return An `MPMarker` value if the peeked byte corresponds to a valid MessagePack type or
+   * `MPMarker::Unused`
+   */
+  MPMarker peek_marker( ) { return marker_info( sr_.peek_u8( ) ).marker; }
+
+  /**
+   * @brief Read an 8 byte unsigned integer from the byte stream and advance the cursor by 8 bytes.
+   * @return mp::mp_u64
+   */
+  mp::mp_u64 read_u64( ) { return bswap_intrin64( sr_.read_u64( ) ); }
+
+  /**
+   * @brief Read a 4 byte unsigned integer from the byte stream and advance the cursor by 4 bytes.
+   * @return mp::mp_u32
+   */
+  mp::mp_u32 read_u32( ) { return bswap_intrin32( sr_.read_u32( ) ); }
+
+  /**
+   * @brief Read a 2 byte unsigned integer from the byte stream and advance the cursor by 2 bytes.
+   * @return mp::mp_u16
+   */
+  mp::mp_u16 read_u16( ) { return bswap_intrin16( sr_.read_u16( ) ); }
+
+  /**
+   * @brief Read an unsigned byte integer from the byte stream and advance the cursor by 1 byte.
+   * @return mp::mp_u8
+   */
+  mp::mp_u8 read_u8( ) { return sr_.read_u8( ); }
+
+  /**
+   * @brief Read an 8 byte signed integer from the byte stream and advance the cursor by 8 bytes.
+   * @return mp::mp_i64
+   */
+  mp::mp_i64 read_i64( ) {
+    return static_cast< mp_i64 >( bswap_intrin64( static_cast< mp_u64 >( sr_.read_i64( ) ) ) );
+  }
+
+  /**
+   * @brief Read a 4 byte signed integer from the byte stream and advance the cursor by 4 bytes.
+   * @return mp::mp_i32
+   */
+  mp::mp_i32 read_i32( ) {
+    return static_cast< mp_i32 >( bswap_intrin32( static_cast< mp_u32 >( sr_.read_i32( ) ) ) );
+  }
+
+  /**
+   * @brief Read a 2 byte signed integer from the byte stream and advance the cursor by 2 bytes.
+   * @return mp::mp_i16
+   */
+  mp::mp_i16 read_i16( ) { return bswap_intrin16( sr_.read_i16( ) ); }
+
+  /**
+   * @brief Read a signed byte integer from the byte stream and advance the cursor by 1 byte.
+   * @return mp::mp_i8
+   */
+  mp::mp_i8 read_i8( ) { return sr_.read_i8( ); }
+
+  /**
+   * @brief Read a single precision float from the byte stream and advance the cursor by 4 bytes.
+   * @return mp::mp_f32
+   */
+  mp::mp_f32 read_f32( ) {
+    const auto bits = read_u32( );
+    mp::mp_f32 value;
+
+    mmcpy( &value, &bits, sizeof( value ) );
+
+    return value;
+  }
+
+  /**
+   * @brief Read a double precision float from the byte stream and advance the cursor by 8 bytes.
+   * @return mp::mp_f64
+   */
+  mp::mp_f64 read_f64( ) {
+    const auto bits = read_u64( );
+    mp::mp_f64 value;
+
+    mmcpy( &value, &bits, sizeof( value ) );
+
+    return value;
+  }
+
+  /**
+   * @brief Check if a marker, typically returned by `decode_single`, denotes the start of a fixext
+   * type.
+   * @param marker MessagePack marker
+   * @return `true` if `marker` is any MessagePack fixext type, `false` otherwise
+   */
+  bool is_fixext( const MPMarker marker ) const {
+    return marker_info( marker ).family == MPFamily::FixExt;
+  }
+
+  /**
+   * @brief Check if a marker, typically returned by `decode_single`, denotes the start of an array.
+   * @param marker MessagePack marker
+   * @return `true` if `marker` is any MessagePack array type, `false` otherwise
+   */
+  bool is_array( const MPMarker marker ) const {
+    return marker_info( marker ).family == MPFamily::Array;
+  }
+
+  /**
+   * @brief Check if a marker, typically returned by `decode_single`, denotes an integer.
+   * @param marker MessagePack marker
+   * @return `true` if `marker` is any MessagePack array type, `false` otherwise
+   */
+  bool is_integer( const MPMarker marker ) const {
+    const auto family = marker_info( marker ).family;
+
+    return family == MPFamily::Uint || family == MPFamily::Int;
+  }
+
+  /**
+   * @brief Attempt to read `size` bytes from the stream into `dst`.
+   * @remark Out-of-bounds reads are silently ignored/not reported.
+   * @param dst Buffer of at least `size` bytes to write into
+   * @param size Size, in bytes, of `dst`
+   */
+  void read_bytes( mp::mp_u8 *dst, const mp_u32 size ) { sr_.read( size, dst ); }
+
+  /**
+   * @brief Zero-copy counterpart of `read_bytes`. Return a pointer to the next `size` bytes of the
+   * stream and advance the cursor past them.
+   * @param size Size, in bytes, of the region to view
+   * @return Pointer into the stream buffer or `nullptr` if fewer than `size` bytes remain
+   */
+  const mp::mp_u8 *read_view( const mp_u32 size ) { return sr_.view( size ); }
+
+  /**
+   * @brief Decode an array of integers into `dst`. Runs of elements using the fixed-width marker
+   * matching `Ty` are decoded in bulk, anything else element by element. Every element must be an
+   * integer whose value fits into `Ty`.
+   * @remark If the next value is not an array or holds more than `capacity` elements the cursor is
+   * left untouched and 0 is returned. On a non-convertible element decoding stops right after it.
+   * @tparam Ty One of `mp_u8`, `mp_i8`, `mp_u16`, `mp_i16`, `mp_u32`, `mp_i32`, `mp_u64`, `mp_i64`
+   * @param dst Buffer of at least `capacity` values
+   * @param capacity Maximum number of elements accepted
+   * @return Number of elements decoded into `dst`
+   */
+  template < typename Ty > mp::mp_u64 read_typed_array( Ty *dst, const mp::mp_u64 capacity ) {
+    const auto start = sr_.position( );
+
+    if ( !is_array( peek_marker( ) ) ) return 0;
+
+    const auto header = decode_single( );
+
+    if ( header.size > capacity ) {
+      sr_.seek( start );
+      return 0;
+    }
+
+    constexpr auto stride = simd::FixedLayout< sizeof( Ty ) >::stride;
+    constexpr auto marker = simd::fixed_marker< Ty >( );
+
+    mp::mp_u64 index = 0;
+
+    while ( index < header.size ) {
+      if constexpr ( Reader::direct ) {
+        if ( sr_.peek_u8( ) == marker ) {
+          const auto available = ( sr_.stream_size( ) - sr_.position( ) ) / stride;
+          const auto wanted = header.size - index;
+          const auto decoded = simd::decode_fixed(
+              dst + index, sr_.start( ) + sr_.position( ), wanted < available ? wanted : available,
+              marker
+          );
+
+          if ( decoded ) {
+            sr_.view( static_cast< mp::mp_u32 >( decoded * stride ) );
+            index += decoded;
+            continue;
+          }
+        }
+      }
+
+      if ( !decode_single( ).as_integer( dst[ index ] ) ) break;
+
+      index++;
+    }
+
+    return index;
+  }
+
+  /**
+   * @brief Decode an array of unsigned 2 byte integers. See `read_typed_array`.
+   * @return Number of elements decoded into `dst`
+   */
+  mp::mp_u64 read_array_u16( mp::mp_u16 *dst, const mp::mp_u64 capacity ) {
+    return read_typed_array( dst, capacity );
+  }
+
+  /**
+   * @brief Decode an array of signed 2 byte integers. See `read_typed_array`.
+   * @return Number of elements decoded into `dst`
+   */
+  mp::mp_u64 read_array_i16( mp::mp_i16 *dst, const mp::mp_u64 capacity ) {
+    return read_typed_array( dst, capacity );
+  }
+
+  /**
+   * @brief Decode an array of unsigned 4 byte integers. See `read_typed_array`.
+   * @return Number of elements decoded into `dst`
+   */
+  mp::mp_u64 read_array_u32( mp::mp_u32 *dst, const mp::mp_u64 capacity ) {
+    return read_typed_array( dst, capacity );
+  }
+
+  /**
+   * @brief Decode an array of signed 4 byte integers. See `read_typed_array`.
+   * @return Number of elements decoded into `dst`
+   */
+  mp::mp_u64 read_array_i32( mp::mp_i32 *dst, const mp::mp_u64 capacity ) {
+    return read_typed_array( dst, capacity );
+  }
+
+  /**
+   * @brief Decode an array of unsigned 8 byte integers. See `read_typed_array`.
+   * @return Number of elements decoded into `dst`
+   */
+  mp::mp_u64 read_array_u64( mp::mp_u64 *dst, const mp::mp_u64 capacity ) {
+    return read_typed_array( dst, capacity );
+  }
+
+  /**
+   * @brief Decode an array of signed 8 byte integers. See `read_typed_array`.
+   * @return Number of elements decoded into `dst`
+   */
+  mp::mp_u64 read_array_i64( mp::mp_i64 *dst, const mp::mp_u64 capacity ) {
+    return read_typed_array( dst, capacity );
+  }
+
+  /**
+   * @brief Decode a single value from the stream, advance the cursor and return the marker denoting
+   * its type. If the value cannot be decoded, the destination buffer is too small or the stream is
+   * exhausted return `MPMarker::Unused`
+   * @remark For any dynamically sized type such as Ext8/16/32, Array16/32 and Map16/32 call this
+   * function first to retrieve the marker, size and advance the cursor to the start of the data.
+   * Afterwards call the respective handlers. For Ext8/16/32 the extension type is consumed too and
+   * stored in `result.as_view.type`.
+   * @return MPMarker denoting the type of the latest value decoded from the stream and its size
+   */
+  MPDecodeResult decode_single( ) { return _decode_single< false >( ); }
+
+  /**
+   * @brief Same as `decode_single`, except that FixStr, Str8/16/32, Bin8/16/32 and Ext8/16/32
+   * payloads are not copied nor left in the stream. `result.as_view` points at the payload inside
+   * the stream buffer, `size` holds its length and the cursor is advanced past it. For Ext8/16/32
+   * the extension type is stored in `result.as_view.type`.
+   * @remark If the payload runs past the end of the stream `result.as_view.data` is `nullptr` and
+   * the cursor is left at the start of the payload.
+   * @return MPDecodeResult
+   */
+  MPDecodeResult decode_view( ) { return _decode_single< true >( ); }
+
+  /**
+   * @brief Move the read cursor past the next value, including every element of nested arrays and
+   * maps, without decoding or copying anything. Only headers are inspected; the traversal keeps a
+   * single count of values still to be skipped instead of recursing, so nesting depth costs
+   * neither stack nor memory.
+   * @return `false`, leaving the cursor untouched, if the value is malformed or truncated
+   */
+  bool skip_value( ) {
+    const auto start = sr_.position( );
+
+    mp::mp_u64 pending = 1;
+
+    while ( pending ) {
+      const auto lead = sr_.view( 1 );
+
+      if ( !lead ) break;
+
+      const auto &info = marker_info( *lead );
+
+      if ( info.family == MPFamily::Invalid ) break;
+
+      mp::mp_u64 payload = 0;
+      mp::mp_u64 count = 0;
+
+      if ( info.mask ) {
+        count = *lead & info.mask;
+      } else if ( info.header > 1 ) {
+        const auto bytes = sr_.view( info.header - 1u );
+
+        if ( !bytes ) break;
+
+        // Only lengths and counts remain; everything of fixed size is already covered by `header`.
+        if ( info.size == 0 ) {
+          for ( mp::mp_u8 index = 0; index < info.width; ++index )
+            count = count << 8 | bytes[ index ];
+        }
+      }
+
+      switch ( info.family ) {
+      case MPFamily::Str:
+      case MPFamily::Bin:
+      case MPFamily::Ext:
+        payload = count;
+        break;
+      case MPFamily::Array:
+        pending += count;
+        break;
+      case MPFamily::Map:
+        pending += count * 2;
+        break;
+      default:
+        break;
+      }
+
+      if ( payload > stream_size( ) ) break;
+      if ( payload && !sr_.view( static_cast< mp_u32 >( payload ) ) ) break;
+
+      --pending;
+    }
+
+    if ( pending ) {
+      sr_.seek( start );
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief Position the read cursor on the value stored under `key` in the map starting at the
+   * cursor. Keys that are not strings, and the values of non-matching keys, are skipped with
+   * `skip_value`. For nested lookups, call again once positioned on an inner map.
+   * @param key Key bytes, without null terminator
+   * @param length Length of `key`, in bytes
+   * @return `false`, leaving the cursor untouched, if the next value is not a map, `key` is absent
+   * or the map is malformed
+   */
+  bool find_key( const mp::mp_u8 *key, const mp::mp_u32 length ) {
+    const auto start = sr_.position( );
+    const auto map = decode_single( );
+
+    if ( map.is_map( ) ) {
+      for ( mp::mp_u32 pair = 0; pair < map.size; ++pair ) {
+        const auto position = sr_.position( );
+        const auto dr = decode_view( );
+
+        if ( dr.is_str( ) ) {
+          if ( !dr.result.as_view.data ) break;
+
+          if ( dr.size == length && std::memcmp( dr.result.as_view.data, key, length ) == 0 )
+            return true;
+        } else if ( !sr_.seek( position ) || !skip_value( ) ) {
+          break;
+        }
+
+        if ( !skip_value( ) ) break;
+      }
+    }
+
+    sr_.seek( start );
+    return false;
+  }
+
+  /**
+   * @brief Decode the next FixExt1/2/4/8/16 or Ext8/16/32 value without copying its payload.
+   * @param out Receives the extension type and a view of the payload inside the stream buffer
+   * @return `false`, leaving the cursor untouched, if the next value is not an extension or is
+   * truncated
+   */
+  bool read_ext( MPExt &out ) {
+    const auto  start = sr_.position( );
+    const auto &info = marker_info( peek_marker( ) );
+
+    if ( info.family == MPFamily::FixExt ) {
+      sr_.read_u8( );
+
+      const auto type = read_i8( );
+      const auto data = sr_.view( info.width );
+
+      if ( data ) {
+        out = { data, info.width, type };
+        return true;
+      }
+    } else if ( info.family == MPFamily::Ext ) {
+      const auto dr = decode_view( );
+
+      if ( !dr.truncated ) {
+        out = { dr.result.as_view.data, dr.size, dr.result.as_view.type };
+        return true;
+      }
+    } else {
+      return false;
+    }
+
+    sr_.seek( start );
+    return false;
+  }
+
+  /**
+   * @brief Decode the next value as a timestamp extension, see `ext::decode_timestamp`.
+   * @param out Receives the timestamp
+   * @return `false`, leaving the cursor untouched, if the next value is not a timestamp
+   */
+  bool read_timestamp( MPTimestamp &out ) {
+    const auto start = sr_.position( );
+
+    MPExt value{ };
+
+    if ( read_ext( value ) && ext::decode_timestamp( value, out ) ) return true;
+
+    sr_.seek( start );
+    return false;
+  }
+
+  /**
+   * @brief Maximum container nesting accepted by `parse`.
+   */
+  static constexpr mp_u32 max_parse_depth = 0x40;
+
+  /**
+   * @brief Walk the next value, nested arrays and maps included, calling the matching handler of
+   * `visitor` for every element: `on_uint( mp_u64 )`, `on_str( data, size )`, `on_map_begin( n )`,
+   * ..., `on_map_end( )`; see `NullVisitor`. Map keys and values are visited in stream order.
+   * Containers are tracked on a fixed stack and scalars are decoded straight from the marker
+   * table, so no `MPDecodeResult` is built.
+   * @tparam Visitor Any type with the handlers of `NullVisitor`
+   * @param visitor Receives the events
+   * @return `false` if a handler returned `false`, or the value is malformed, truncated or nests
+   * deeper than `max_parse_depth`. The cursor is then left where parsing stopped.
+   */
+  template < typename Visitor > bool parse( Visitor &visitor ) {
+    [[maybe_unused]] const stats::DecodeTimer timer;
+
+    mp_u64 stack[ max_parse_depth ];
+    mp_u32 depth = 0;
+
+    do {
+      const auto lead = sr_.view( 1 );
+
+      if ( mp_unlikely( !lead ) ) return false;
+
+      const auto  raw = *lead;
+      const auto &info = marker_info( raw );
+
+      if ( mp_unlikely( info.family == MPFamily::Invalid ) ) {
+        sr_.fail( stream::error::malformed );
+        return false;
+      }
+
+      stats::decoded( raw );
+
+      if ( mp_unlikely( sr_.stream_size( ) - sr_.position( ) < info.header - 1u ) ) {
+        sr_.fail( stream::error::overflow );
+        return false;
+      }
+
+      mp_u64 count = 0;
+      bool   accepted = true;
+
+      switch ( info.family ) {
+      case MPFamily::Invalid:
+        return false;
+      case MPFamily::Nil:
+        accepted = visitor.on_nil( );
+        break;
+      case MPFamily::Boolean:
+        accepted = visitor.on_bool( info.marker == MPMarker::True );
+        break;
+      case MPFamily::Uint:
+        accepted = visitor.on_uint( info.mask ? raw & info.mask : _read_uint( info.width ) );
+        break;
+      case MPFamily::Int:
+        accepted = visitor.on_int( info.mask ? mp_i64{ static_cast< mp_i8 >( raw ) }
+                                             : _read_int( info.width ) );
+        break;
+      case MPFamily::Float:
+        accepted = visitor.on_float( info.width == sizeof( mp_f32 ) ? read_f32( ) : read_f64( ) );
+        break;
+      case MPFamily::Str:
+      case MPFamily::Bin: {
+        const auto length = info.mask ? raw & info.mask : _read_length( info.width );
+        const auto data = sr_.view( length );
+
+        if ( mp_unlikely( !data ) ) return false;
+
+        accepted = info.family == MPFamily::Str ? visitor.on_str( data, length )
+                                                : visitor.on_bin( data, length );
+        break;
+      }
+      case MPFamily::FixExt:
+      case MPFamily::Ext: {
+        const auto length = info.family == MPFamily::Ext ? _read_length( info.width ) : info.width;
+        const auto type = read_i8( );
+        const auto data = sr_.view( length );
+
+        if ( mp_unlikely( !data ) ) return false;
+
+        accepted = visitor.on_ext( MPExt{ data, length, type } );
+        break;
+      }
+      case MPFamily::Array:
+      case MPFamily::Map: {
+        const auto size = info.mask ? raw & info.mask : _read_length( info.width );
+        const auto map = info.family == MPFamily::Map;
+
+        if ( mp_unlikely( depth == max_parse_depth ) ) return false;
+
+        stats::depth( depth );
+
+        accepted = map ? visitor.on_map_begin( size ) : visitor.on_array_begin( size );
+
+        // Empty containers end right away; the others are pushed, the low bit telling maps apart
+        // and the rest counting the values left.
+        if ( !size )
+          accepted = accepted && ( map ? visitor.on_map_end( ) : visitor.on_array_end( ) );
+        else
+          count = ( map ? mp_u64{ size } * 2 : size ) << 1 | map;
+        break;
+      }
+      }
+
+      if ( !accepted ) return false;
+
+      if ( count ) {
+        stack[ depth++ ] = count;
+        continue;
+      }
+
+      // Close every container completed by this value.
+      while ( depth ) {
+        auto &top = stack[ depth - 1 ];
+
+        top -= 2;
+        if ( top >> 1 ) break;
+
+        --depth;
+
+        if ( !( top & 1 ? visitor.on_map_end( ) : visitor.on_array_end( ) ) ) return false;
+      }
+    } while ( depth );
+
+    return true;
+  }
+
+private:
+  /**
+   * @brief Read a big-endian unsigned integer of `width` bytes.
+   */
+  mp_u64 _read_uint( const mp_u8 width ) {
+    switch ( width ) {
+    case 1:
+      return read_u8( );
+    case 2:
+      return read_u16( );
+    case 4:
+      return read_u32( );
+    default:
+      return read_u64( );
+    }
+  }
+
+  /**
+   * @brief Read a big-endian signed integer of `width` bytes.
+   */
+  mp_i64 _read_int( const mp_u8 width ) {
+    switch ( width ) {
+    case 1:
+      return read_i8( );
+    case 2:
+      return read_i16( );
+    case 4:
+      return read_i32( );
+    default:
+      return read_i64( );
+    }
+  }
+
+  /**
+   * @brief Read a big-endian length or count of `width` bytes.
+   */
+  mp_u32 _read_length( const mp_u8 width ) {
+    switch ( width ) {
+    case 1:
+      return read_u8( );
+    case 2:
+      return read_u16( );
+    case 4:
+      return read_u32( );
+    default:
+      return 0;
+    }
+  }
+
+  /**
+   * @brief Decode the next value and flag it as truncated if its header or payload lies past the
+   * end of the stream. Truncation raises `error::overflow` and the reserved marker
+   * `error::malformed` on the reader.
+   */
+  template < bool view > MPDecodeResult _decode_single( ) {
+    [[maybe_unused]] const stats::DecodeTimer timer;
+
+    const auto start = sr_.position( );
+
+    auto dr = _decode_value< view >( );
+
+    const auto &info = marker_info( dr.marker );
+    auto        end = mp_u64{ start } + info.header;
+
+    if ( !info.mask && ( info.family == MPFamily::Str || info.family == MPFamily::Bin ||
+                         info.family == MPFamily::Ext ) )
+      end += dr.size;
+
+    if ( mp_unlikely( info.family == MPFamily::Invalid ) ) sr_.fail( stream::error::malformed );
+
+    if ( mp_unlikely( end > sr_.stream_size( ) ) ) {
+      dr.truncated = true;
+      sr_.fail( stream::error::overflow );
+    }
+
+    return dr;
+  }
+
+  template < bool view > MPDecodeResult _decode_value( ) {
+    const auto  raw = read_u8( );
+    const auto &info = marker_info( raw );
+
+    stats::decoded( raw );
+
+    MPDecodeResult dr{ };
+
+    dr.marker = info.marker;
+    dr.size = info.size;
+    dr.result.as_u64 = 0;
+
+    if ( info.mask ) {
+      /*
+       * fix* markers carry their value (PosFixInt, NegFixInt) or their length (FixMap, FixArray,
+       * FixStr) in the marker itself.
+       */
+      const auto fixed = static_cast< mp_u8 >( raw & info.mask );
+
+      dr.result.as_u8 = fixed;
+
+      if ( !info.size ) dr.size = fixed;
+
+      if ( info.family == MPFamily::Str ) {
+        if constexpr ( view )
+          dr.result.as_view.data = sr_.view( dr.size );
+        else
+          sr_.read( dr.size, dr.result.as_fixstr );
+      }
+
+      return dr;
+    }
+
+    switch ( info.family ) {
+    case MPFamily::Invalid:
+    case MPFamily::Nil:
+      break;
+    case MPFamily::Float: {
+      if ( info.width == sizeof( mp_f32 ) )
+        dr.result.as_f32 = read_f32( );
+      else
+        dr.result.as_f64 = read_f64( );
+      break;
+    }
+    case MPFamily::Boolean:
+      dr.result.as_bool = info.marker == MPMarker::True;
+      break;
+    case MPFamily::Uint: {
+      switch ( info.width ) {
+      case 1:
+        dr.result.as_u8 = read_u8( );
+        break;
+      case 2:
+        dr.result.as_u16 = read_u16( );
+        break;
+      case 4:
+        dr.result.as_u32 = read_u32( );
+        break;
+      default:
+        dr.result.as_u64 = read_u64( );
+        break;
+      }
+      break;
+    }
+    case MPFamily::Int: {
+      switch ( info.width ) {
+      case 1:
+        dr.result.as_i8 = read_i8( );
+        break;
+      case 2:
+        dr.result.as_i16 = read_i16( );
+        break;
+      case 4:
+        dr.result.as_i32 = read_i32( );
+        break;
+      default:
+        dr.result.as_i64 = read_i64( );
+        break;
+      }
+      break;
+    }
+    case MPFamily::FixExt: {
+      // All fixext layouts share the `type` byte followed by `data`.
+      dr.result.as_fixext16.type = read_u8( );
+
+      sr_.read( info.width, dr.result.as_fixext16.data );
+      break;
+    }
+    case MPFamily::Ext: {
+      dr.size = _read_length( info.width );
+      dr.result.as_view.type = read_i8( );
+      break;
+    }
+    case MPFamily::Str:
+    case MPFamily::Bin:
+    case MPFamily::Array:
+    case MPFamily::Map:
+      dr.size = _read_length( info.width );
+      break;
+    }
+
+    if constexpr ( view ) {
+      if ( info.family == MPFamily::Str || info.family == MPFamily::Bin ||
+           info.family == MPFamily::Ext ) {
+        dr.result.as_view.data = sr_.view( dr.size );
+      }
+    }
+
+    return dr;
+  }
+};
+
+/**
+ * @brief Reserved header of a container opened by `begin_array`/`begin_map`, completed by the
+ * matching `end_array`/`end_map`.
+ */
+struct OpenContainer {
+  mp_u8  *header{ nullptr }; // Start of the reserved header, `nullptr` if it could not be reserved
+  mp_size position{ 0 };     // Write cursor at the start of the header
+
+  explicit operator bool( ) const { return header != nullptr; }
+};
+
+/**
+ * @brief Encoding half of `BasicMessagePack`, over any writer backend. Every `write_*` returns the
+ * most derived encoder so calls chain. See `Encoder` for a standalone, trivially copyable encoder.
+ * @tparam Writer `stream::BasicStreamWriter`, `stream::ChunkedStreamWriter`, `stream::SpanWriter`
+ * or any type exposing the same interface
+ * @tparam Self The encoder type deriving from this one
+ */
+template < typename Writer, typename Self > struct BasicEncoder {
+protected:
+  /**
+   * @brief Internal object used for writing to the byte stream.
+   */
+  Writer wr_{ };
+
+  Self &_self( ) { return static_cast< Self & >( *this ); }
+
+  /**
+   * @brief Reserve the 32-bit header of a container whose size is patched in by `_end`.
+   */
+  OpenContainer _begin( const MPMarker marker ) {
+    static_assert( Writer::stable, "Back-patching needs reservations that stay valid" );
+
+    const auto position = wr_.position( );
+    const auto header = wr_.reserve( 5 );
+
+    if ( header ) *header = static_cast< mp_u8 >( marker );
+
+    return { header, position };
+  }
+
+  void _end(
+      const OpenContainer &open,
+      const MPMarker       fixed,
+      const MPMarker       wide,
+      const mp_u32         count,
+      const bool           compact
+  ) {
+    if ( !open.header ) return;
+
+    if constexpr ( Writer::contiguous ) {
+      if ( compact && count <= limits::uint16_max ) {
+        const auto body = static_cast< mp_u64 >( wr_.position( ) - open.position ) - 5u;
+        const auto size = count <= 15 ? 1u : 3u;
+
+        if ( size == 1 ) {
+          open.header[ 0 ] = static_cast< mp_u8 >( static_cast< mp_u8 >( fixed ) | count );
+        } else {
+          const auto length = bswap_intrin16( static_cast< mp_u16 >( count ) );
+
+          open.header[ 0 ] = static_cast< mp_u8 >( wide );
+          mmcpy( open.header + 1, &length, sizeof( length ) );
+        }
+
+        // The body slides down behind the smaller header; its last bytes are now stale.
+        if ( body ) std::memmove( open.header + size, open.header + 5, body );
+
+        wr_.retract( 5u - size );
+        stats::encoded( open.header[ 0 ] );
+        return;
+      }
+    }
+
+    const auto length = bswap_intrin32( count );
+
+    mmcpy( open.header + 1, &length, sizeof( length ) );
+    stats::encoded( open.header[ 0 ] );
+  }
+
+  /**
+   * @brief Write the leading byte of a value.
+   */
+  void _write_lead( const mp_u8 lead ) {
+    stats::encoded( lead );
+    wr_.write_u8( lead );
+  }
+
+  /**
+   * @brief Body of a `Bin`/`Str` value: referenced by writers supporting it, copied otherwise.
+   */
+  void _write_payload( const mp_u32 length, const mp_u64 data ) {
+    stats::payload( length );
+
+    if constexpr ( stream::has_write_payload< Writer >::value )
+      wr_.write_payload( length, reinterpret_cast< const mp::mp_u8 * >( data ) );
+    else
+      wr_.write( length, reinterpret_cast< mp::mp_u8 * >( data ) );
+  }
+
+public:
+  /**
+   * @brief Sticky error flags of the writer, see `stream::error`.
+   * @return mp::mp_u8
+   */
+  mp::mp_u8 error( ) const { return wr_.error( ); }
+
+  bool good( ) const { return wr_.good( ); }
+
+  void clear_error( ) { wr_.clear_error( ); }
+
+  /**
+   * @brief Position of the write cursor in the stream.
+   * @return mp::mp_size
+   */
+  mp::mp_size write_cursor( ) const { return wr_.position( ); }
+
+  /**
+   * @brief
+   * @param marker Value of type `MPMarker` denoting the start of a MessagePack value.
+   */
+  void write_marker( MPMarker marker ) { _write_lead( static_cast< mp::mp_u8 >( marker ) ); }
+
+  Self &write_negfixint( const mp_i8 value ) {
+    _write_lead( 0xe0 | static_cast< mp_u8 >( value & 0x1F ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Handles the writing of a [type marker] [value] to the byte stream
+   * @note This function is opportunistic and will always opt for the smallest data type, in some
+   * cases overwriting user choice. This behaviour cannot be overriden.
+   * @remark For arrays, including `FixArray`, call `array( )` first to denote the start of an
+   * array.
+   * @remark For maps, including `FixMap`, call `map( )` first to denote the start of the map.
+   * @param data Treated as a value or a pointer to a value depending on `kind`
+   * @param size Size of `data` or the buffer pointed to by `data`
+   * @param kind Marker describing the type in the MessagePack type system
+   * @return Self&
+   */
+  template < MPMarker kind >
+  Self &write_raw_value( const mp_u64 data, const mp_u64 size ) {
+    /*
+     * Start with all the edge cases.
+     */
+
+    if constexpr ( kind == MPMarker::NegFixInt ) {
+      _write_lead( 0xe0 | static_cast< mp_u8 >( static_cast< mp_i8 >( data & 0x1F ) ) );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::PosFixInt ) {
+      _write_lead( data & 0x7f );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::FixStr ) {
+      const auto length = static_cast< mp::mp_u8 >( size & 0x1f );
+
+      stats::payload( length );
+
+      _write_lead( static_cast< mp::mp_u8 >( kind ) | ( length ) );
+      wr_.write( length, reinterpret_cast< mp::mp_u8 * >( data ) );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Nil || kind == MPMarker::False || kind == MPMarker::True ) {
+      /*
+       * The value of these data types is their marker.
+       */
+      write_marker( kind );
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Bin8 || kind == MPMarker::Bin16 || kind == MPMarker::Bin32 ) {
+      mp_u32 length = static_cast< mp_u32 >( size );
+
+      if ( size <= limits::uint8_max ) {
+        length &= 0xff;
+        write_marker( MPMarker::Bin8 );
+        wr_.write_u8( static_cast< mp::mp_u8 >( length ) );
+      } else if ( size <= limits::uint16_max ) {
+        length &= 0xffff;
+        write_marker( MPMarker::Bin16 );
+        wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( length ) ) );
+      } else if ( size <= limits::uint32_max ) {
+        length &= 0xffffffff;
+        write_marker( MPMarker::Bin32 );
+        wr_.write_u32( bswap_intrin32( length ) );
+      } else {
+        // Not representable in MessagePack: write nothing rather than a truncated length.
+        wr_.fail( stream::error::overflow );
+        return _self( );
+      }
+
+      _write_payload( length, data );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Str8 || kind == MPMarker::Str16 || kind == MPMarker::Str32 ) {
+      mp_u32 length = static_cast< mp_u32 >( size );
+
+      if ( size <= limits::uint8_max ) {
+        length &= 0xff;
+        write_marker( MPMarker::Str8 );
+        wr_.write_u8( static_cast< mp::mp_u8 >( length ) );
+      } else if ( size <= limits::uint16_max ) {
+        length &= 0xffff;
+        write_marker( MPMarker::Str16 );
+        wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( length ) ) );
+      } else if ( size <= limits::uint32_max ) {
+        length &= 0xffffffff;
+        write_marker( MPMarker::Str32 );
+        wr_.write_u32( bswap_intrin32( length ) );
+      } else {
+        // Not representable in MessagePack: write nothing rather than a truncated length.
+        wr_.fail( stream::error::overflow );
+        return _self( );
+      }
+
+      _write_payload( length, data );
+
+      return _self( );
+    }
+
+    write_marker( kind );
+
+    if constexpr ( kind == MPMarker::Uint8 || kind == MPMarker::Int8 ) {
+      wr_.write_u8( static_cast< mp::mp_u8 >( data & 0xff ) );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Uint16 ) {
+      wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( data ) ) );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Int16 ) {
+      wr_.write_i16( bswap_intrin16( static_cast< mp::mp_u16 >( data ) ) );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Uint32 || kind == MPMarker::Int32 ||
+                   kind == MPMarker::Float32 ) {
+      /* For `Float32`, `data` holds the bit pattern of the value. */
+      wr_.write_u32( bswap_intrin32( static_cast< mp_u32 >( data & 0xffffffff ) ) );
+
+      return _self( );
+    }
+
+    if constexpr ( kind == MPMarker::Uint64 || kind == MPMarker::Int64 ||
+                   kind == MPMarker::Float64 ) {
+      /* For `Float64`, `data` holds the bit pattern of the value. */
+      wr_.write_u64( bswap_intrin64( data ) );
+    }
+
+    if constexpr ( kind == MPMarker::FixExt1 ) {
+      /* one byte for the type + 1 for the byte array */
+      wr_.write( sizeof( MPFixExt1 ), reinterpret_cast< mp::mp_u8 * >( data ) );
+    }
+
+    if constexpr ( kind == MPMarker::FixExt2 ) {
+      /* one byte for the type + 2 bytes for the byte array */
+      wr_.write( sizeof( MPFixExt2 ), reinterpret_cast< mp::mp_u8 * >( data ) );
+    }
+
+    if constexpr ( kind == MPMarker::FixExt4 ) {
+      /* one byte for the type + 4 bytes for the byte array */
+      wr_.write( sizeof( MPFixExt4 ), reinterpret_cast< mp::mp_u8 * >( data ) );
+    }
+
+    if constexpr ( kind == MPMarker::FixExt8 ) {
+      /* one byte for the type + 8 bytes for the byte array */
+      wr_.write( sizeof( MPFixExt8 ), reinterpret_cast< mp::mp_u8 * >( data ) );
+    }
+
+    if constexpr ( kind == MPMarker::FixExt16 ) {
+      /* one byte for the type + 16 bytes for the byte array */
+      wr_.write( sizeof( MPFixExt16 ), reinterpret_cast< mp::mp_u8 * >( data ) );
+    }
+
+    return _self( );
+  }
+
+  /**
+   * @brief Mark the start of a `Array` object in the byte stream. The chosen array type depends on
+   * the `num_elem` parameter.
+   * @param num_elem Number of key-value pairs in this map. Both keys and values can be any
+   * MessagePack type.
+   * @remark Counts above `uint32_max` write nothing and raise `error::overflow`.
+   * @return Self&
+   */
+  Self &start_array( const mp::mp_u64 num_elem ) {
+    if ( num_elem <= mp::value_limits::FixArrayMax ) {
+      _write_lead(
+          static_cast< mp::mp_u8 >( mp::MPMarker::FixArray ) |
+          static_cast< mp::mp_u8 >( num_elem & 0xf )
+      );
+    } else if ( num_elem <= mp::value_limits::Array16Max ) {
+      write_marker( MPMarker::Array16 );
+      wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( num_elem & 0xffff ) ) );
+    } else if ( num_elem <= limits::uint32_max ) {
+      write_marker( MPMarker::Array32 );
+      wr_.write_u32( bswap_intrin32( static_cast< mp::mp_u32 >( num_elem & 0xffffffff ) ) );
+    } else {
+      wr_.fail( stream::error::overflow );
+    }
+
+    return _self( );
+  }
+
+  /**
+   * @brief Mark the start of a `Map` object in the byte stream. The map type chosen depends on the
+   * `num_pairs` parameter.
+   * @param num_pairs Number of key-value pairs in this map. Both keys and values can be any
+   * MessagePack type.
+   * @remark Not every language-specific decoder supports arbitrary key types. Keep this in mind
+   * when writing values to the map. Using the recommended Python decoder, for instance, requires
+   * you to explicitly allow integer keys.
+   * @remark Counts above `uint32_max` write nothing and raise `error::overflow`.
+   * @return Self&
+   */
+  Self &start_map( const mp::mp_u64 num_pairs ) {
+    if ( num_pairs <= mp::value_limits::FixMapMax ) {
+      _write_lead(
+          static_cast< mp::mp_u8 >( mp::MPMarker::FixMap ) |
+          static_cast< mp::mp_u8 >( num_pairs & 0xf )
+      );
+    } else if ( num_pairs <= mp::value_limits::Map16Max ) {
+      write_marker( MPMarker::Map16 );
+      wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( num_pairs & 0xffff ) ) );
+    } else if ( num_pairs <= limits::uint32_max ) {
+      write_marker( MPMarker::Map32 );
+      wr_.write_u32( bswap_intrin32( static_cast< mp::mp_u32 >( num_pairs & 0xffffffff ) ) );
+    } else {
+      wr_.fail( stream::error::overflow );
+    }
+
+    return _self( );
+  }
+
+  /**
+   * @brief Start an array whose length is not known yet. A 5 byte Array32 header is reserved and
+   * completed by `end_array`; write the elements in between as usual.
+   * @remark Requires a writer whose reservations stay valid (`Writer::stable`).
+   * @return Handle to pass to `end_array`. Converts to `false`, with the writer's error set, if the
+   * header could not be reserved
+   */
+  OpenContainer begin_array( ) { return _begin( MPMarker::Array32 ); }
+
+  /**
+   * @brief Complete the header reserved by `begin_array`.
+   * @param open Handle returned by `begin_array`
+   * @param num_elem Number of elements written since
+   * @param compact Replace the Array32 header by the smallest one that fits, sliding the elements
+   * down. Only done by contiguous writers (`Writer::contiguous`); the others keep the Array32
+   * header, which is valid if not minimal MessagePack.
+   * @return Self&
+   */
+  Self &end_array( const OpenContainer &open, const mp_u32 num_elem, const bool compact = false ) {
+    _end( open, MPMarker::FixArray, MPMarker::Array16, num_elem, compact );
+    return _self( );
+  }
+
+  /**
+   * @brief Start a map whose length is not known yet. See `begin_array`.
+   * @return Handle to pass to `end_map`
+   */
+  OpenContainer begin_map( ) { return _begin( MPMarker::Map32 ); }
+
+  /**
+   * @brief Complete the header reserved by `begin_map`. See `end_array`.
+   * @param open Handle returned by `begin_map`
+   * @param num_pairs Number of key-value pairs written since
+   * @param compact Replace the Map32 header by the smallest one that fits
+   * @return Self&
+   */
+  Self &end_map( const OpenContainer &open, const mp_u32 num_pairs, const bool compact = false ) {
+    _end( open, MPMarker::FixMap, MPMarker::Map16, num_pairs, compact );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single unsigned 4 byte value to the stream and advance the cursor by 4 if the
+   * stream has not reached its end.
+   * @param value Unsigned 4 byte value to write to the stream
+   * @return Self&
+   */
+  Self &write_u32( const mp::mp_u32 value ) {
+    write_raw_value< MPMarker::Uint32 >( value, sizeof( mp::mp_u32 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single unsigned 8 byte value to the stream and advance the cursor by 8 if the
+   * stream has not reached its end.
+   * @param value Unsigned 8 byte value to write to the stream
+   * @return Self&
+   */
+  Self &write_u64( const mp::mp_u64 value ) {
+    write_raw_value< MPMarker::Uint64 >( value, sizeof( mp::mp_u64 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single signed 4 byte value to the stream and advance the cursor by 4 if the
+   * stream has not reached its end. The value will be cast to its unsigned counterpart before the
+   * endianess change.
+   * @param value Signed 4 byte value to write to the stream
+   * @return Self&
+   */
+  Self &write_i32( const mp::mp_i32 value ) {
+    write_raw_value< MPMarker::Int32 >( value, sizeof( mp::mp_i32 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single unsigned 8 byte value to the stream and advance the cursor by 8 if the
+   * stream has not reached its end. The value will be cast to its unsigned counterpart before the
+   * endianess change.
+   * @param value Signed 8 byte value to write to the stream
+   * @return Self&
+   */
+  Self &write_i64( const mp::mp_i64 value ) {
+    write_raw_value< MPMarker::Int64 >( value, sizeof( mp::mp_i64 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single unsigned 2 byte value to the stream and advance the cursor by 2 if the
+   * stream has not reached its end.
+   * @param value Unsigned 2 byte value to write to the stream
+   * @return Self&
+   */
+  Self &write_u16( const mp::mp_u16 value ) {
+    write_raw_value< MPMarker::Uint16 >( value, sizeof( mp::mp_u16 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single signed 2 byte value to the stream and advance the cursor by 2 if the
+   * stream has not reached its end. The value will be cast to its unsigned counterpart before the
+   * endianess change.
+   * @param value Signed 2 byte value to write to the stream
+   * @return Self&
+   */
+  Self &write_i16( const mp::mp_i16 value ) {
+    write_raw_value< MPMarker::Int16 >( value, sizeof( mp::mp_i16 ) );
+    return _self( );
+  }
+
+  Self &write_posfixint( const mp::mp_u8 value ) {
+    write_raw_value< MPMarker::PosFixInt >( value, sizeof( mp::mp_u8 ) );
+    return _self( );
+  }
+
+  Self &write_fixint( const mp::mp_i8 value ) {
+    if ( value > 0 )
+      write_posfixint( value );
+    else
+      write_negfixint( value );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write an unsigned integer to the stream using the smallest possible representation.
+   * @param value Integer value to write to the stream
+   * @return Self&
+   */
+  Self &write_uint( const mp::mp_u64 value ) {
+    if ( value <= limits::uint8_max )
+      write_u8( static_cast< mp::mp_u8 >( value ) );
+    else if ( value <= limits::uint16_max )
+      write_u16( static_cast< mp::mp_u16 >( value ) );
+    else if ( value <= limits::uint32_max )
+      write_u32( static_cast< mp::mp_u32 >( value ) );
+    else
+      write_u64( value );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single precision float to the stream as `Float32`.
+   * @param value Value to write to the stream
+   * @return Self&
+   */
+  Self &write_f32( const mp::mp_f32 value ) {
+    mp::mp_u32 bits;
+
+    mmcpy( &bits, &value, sizeof( bits ) );
+    write_raw_value< MPMarker::Float32 >( bits, sizeof( mp::mp_f32 ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a double precision float to the stream as `Float64`.
+   * @param value Value to write to the stream
+   * @return Self&
+   */
+  Self &write_f64( const mp::mp_f64 value ) {
+    mp::mp_u64 bits;
+
+    mmcpy( &bits, &value, sizeof( bits ) );
+    write_raw_value< MPMarker::Float64 >( bits, sizeof( mp::mp_f64 ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a float to the stream using the smallest lossless representation: `Float32` if
+   * `value` survives a round trip through single precision (so do both infinities), `Float64`
+   * otherwise (including NaN).
+   * @param value Value to write to the stream
+   * @return Self&
+   */
+  Self &write_float( const mp::mp_f64 value ) {
+    const auto magnitude = value < 0 ? -value : value;
+
+    // Finite doubles beyond the single precision range would overflow the conversion.
+    if ( ( magnitude <= limits::float32_max || magnitude > limits::float64_max ) &&
+         static_cast< mp::mp_f64 >( static_cast< mp::mp_f32 >( value ) ) == value )
+      write_f32( static_cast< mp::mp_f32 >( value ) );
+    else
+      write_f64( value );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a signed integer to the stream using the smallest possible representation.
+   * @param value Integer value to write to the stream
+   * @return Self&
+   */
+  Self &write_int( const mp::mp_i64 value ) {
+    if ( value >= limits::int8_min && value <= limits::int8_max )
+      write_i8( static_cast< mp::mp_i8 >( value ) );
+    else if ( value >= limits::int16_min && value <= limits::int16_max )
+      write_i16( static_cast< mp::mp_i16 >( value ) );
+    else if ( value >= limits::int32_min && value <= limits::int32_max )
+      write_i32( static_cast< mp::mp_i32 >( value ) );
+    else
+      write_i64( value );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single unsigned byte to the stream and advance the cursor by 1 if the stream has
+   * not reached its end.
+   * @param value Unsigned byte to write to the stream
+   * @return Self&
+   */
+  Self &write_u8( const mp::mp_u8 value ) {
+    write_raw_value< MPMarker::Uint8 >( value, sizeof( mp::mp_u8 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a single signed byte to the stream and advance the cursor by 1 if the stream has
+   * not reached its end.
+   * @param value Signed byte to write to the stream
+   * @return Self&
+   */
+  Self &write_i8( const mp::mp_i8 value ) {
+    write_raw_value< MPMarker::Int8 >( value, sizeof( mp::mp_i8 ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a `string` of `length` into the MessagePack byte stream.
+   * @remark Subtract one to remove the null terminator from the total length
+   * @param string Pointer to a C string of `length` characters
+   * @param length Size, in bytes, of the string in memory
+   * @remark Lengths above `uint32_max` write nothing and raise `error::overflow`.
+   * @return Self&
+   */
+  Self &write_cstr( const mp::mp_u8 *string, const mp::mp_u64 length ) {
+    write_raw_value< MPMarker::Str8 >( reinterpret_cast< mp::mp_u64 >( string ), length );
+    return _self( );
+  }
+
+  /**
+   * @brief Write a byte array `bytes` of `count` into the MessagePack byte stream.
+   * @remark Subtract one to remove the null terminator from the total length
+   * @param bytes Pointer to a byte array of `count` bytes
+   * @param count Size, in bytes, of the byte array
+   * @remark Lengths above `uint32_max` write nothing and raise `error::overflow`.
+   * @return Self&
+   */
+  Self &write_bytes( const mp::mp_u8 *bytes, const mp::mp_u64 count ) {
+    write_raw_value< MPMarker::Bin8 >( reinterpret_cast< mp::mp_u64 >( bytes ), count );
+    return _self( );
+  }
+
+  /**
+   * @brief Copy `count` bytes that are already MessagePack encoded, e.g. precomputed headers or
+   * keys, into the stream verbatim.
+   * @param bytes Pointer to `count` encoded bytes
+   * @param count Number of bytes to copy
+   * @return Self&
+   */
+  Self &write_encoded( const mp::mp_u8 *bytes, const mp::mp_u32 count ) {
+    wr_.write( count, const_cast< mp::mp_u8 * >( bytes ) );
+    return _self( );
+  }
+
+  /**
+   * @brief Emit a fragment, e.g. from a `FragmentCache`, with a single copy.
+   * @param fragment Fragment to write. Writing an empty fragment does nothing
+   * @return Self&
+   */
+  Self &write_encoded( const PreEncoded &fragment ) {
+    return write_encoded( fragment.data, fragment.size );
+  }
+
+  /**
+   * @brief Write a marker representing `true` to the stream.
+   * @return Self&
+   */
+  Self &write_true( ) {
+    /*
+     * `data` parameter can be ignored in this instance, because the marker represents the value.
+     */
+    write_raw_value< MPMarker::True >( 0, sizeof( mp_u8 ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a marker representing `false` to the stream.
+   * @return Self&
+   */
+  Self &write_false( ) {
+    /*
+     * `data` parameter can be ignored in this instance, because the marker represents the value.
+     */
+    write_raw_value< MPMarker::False >( 0, sizeof( mp_u8 ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write `true` or `false` to the stream depending on `value`.
+   * @param value Boolean value to write
+   * @return Self&
+   */
+  Self &write_boolean( const bool value ) {
+    if ( value )
+      write_true( );
+    else
+      write_false( );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a marker representing `nil` to the stream.
+   * @return Self&
+   */
+  Self &write_nil( ) {
+    write_raw_value< MPMarker::Nil >( 0, sizeof( mp_u8 ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Copy exactly 2 bytes from `byte_array` into the stream. If the length of `byte_array` is
+   * less than 2 the behaviour is undefined.
+   * @param byte_array A byte array at least 2 bytes long
+   * @return Self&
+   */
+  Self &write_fix_ext1( const mp::mp_u8 *byte_array ) {
+    write_raw_value< MPMarker::FixExt1 >(
+        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt1 )
+    );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Copy exactly 3 bytes from `byte_array` into the stream. If the length of `byte_array` is
+   * less than 3 the behaviour is undefined.
+   * @param byte_array A byte array at least 3 bytes long
+   * @return Self&
+   */
+  Self &write_fix_ext2( const mp::mp_u8 *byte_array ) {
+    write_raw_value< MPMarker::FixExt2 >(
+        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt2 )
+    );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Copy exactly 5 bytes from `byte_array` into the stream. If the length of `byte_array` is
+   * less than 5 the behaviour is undefined.
+   * @param byte_array A byte array at least 5 bytes long
+   * @return Self&
+   */
+  Self &write_fix_ext4( const mp::mp_u8 *byte_array ) {
+    write_raw_value< MPMarker::FixExt4 >(
+        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt4 )
+    );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Copy exactly 9 bytes from `byte_array` into the stream. If the length of `byte_array` is
+   * less than 9 the behaviour is undefined.
+   * @param byte_array A byte array at least 9 bytes long
+   * @return Self&
+   */
+  Self &write_fix_ext8( const mp::mp_u8 *byte_array ) {
+    write_raw_value< MPMarker::FixExt8 >(
+        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt8 )
+    );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Copy exactly 17 bytes from `byte_array` into the stream. If the length of `byte_array`
+   * is less than 17 the behaviour is undefined.
+   * @param byte_array A byte array at least 17 bytes long
+   * @return Self&
+   */
+  Self &write_fix_ext16( const mp::mp_u8 *byte_array ) {
+    write_raw_value< MPMarker::FixExt16 >(
+        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt16 )
+    );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write an extension value of `type` with a `size` byte payload. Payloads of 1, 2, 4, 8
+   * or 16 bytes use FixExt1/2/4/8/16, anything else the smallest of Ext8/16/32.
+   * @param type Extension type; negative types are reserved by the specification
+   * @param data Pointer to `size` bytes of payload
+   * @param size Size, in bytes, of the payload
+   * @remark Sizes above `uint32_max` write nothing and raise `error::overflow`.
+   * @return Self&
+   */
+  Self &write_ext( const mp::mp_i8 type, const mp::mp_u8 *data, const mp::mp_u64 size ) {
+    switch ( size ) {
+    case 1:
+      write_marker( MPMarker::FixExt1 );
+      break;
+    case 2:
+      write_marker( MPMarker::FixExt2 );
+      break;
+    case 4:
+      write_marker( MPMarker::FixExt4 );
+      break;
+    case 8:
+      write_marker( MPMarker::FixExt8 );
+      break;
+    case 16:
+      write_marker( MPMarker::FixExt16 );
+      break;
+    default:
+      if ( size <= limits::uint8_max ) {
+        write_marker( MPMarker::Ext8 );
+        wr_.write_u8( static_cast< mp::mp_u8 >( size ) );
+      } else if ( size <= limits::uint16_max ) {
+        write_marker( MPMarker::Ext16 );
+        wr_.write_u16( bswap_intrin16( static_cast< mp::mp_u16 >( size ) ) );
+      } else if ( size <= limits::uint32_max ) {
+        write_marker( MPMarker::Ext32 );
+        wr_.write_u32( bswap_intrin32( static_cast< mp::mp_u32 >( size ) ) );
+      } else {
+        // Not representable in MessagePack: write nothing rather than a truncated length.
+        wr_.fail( stream::error::overflow );
+        return _self( );
+      }
+    }
+
+    wr_.write_i8( type );
+    _write_payload( static_cast< mp_u32 >( size ), reinterpret_cast< mp_u64 >( data ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write a timestamp extension in the smallest of its three layouts: timestamp 32 for whole
+   * seconds in [0, 2^32), timestamp 64 for seconds in [0, 2^34) and timestamp 96 for the rest.
+   * @param value Timestamp to write
+   * @remark Nanoseconds above 999999999 write nothing and raise `error::overflow`.
+   * @return Self&
+   */
+  Self &write_timestamp( const MPTimestamp &value ) {
+    if ( mp_unlikely( value.nanoseconds > 999999999u ) ) {
+      wr_.fail( stream::error::overflow );
+      return _self( );
+    }
+
+    const auto seconds = static_cast< mp_u64 >( value.seconds );
+
+    if ( value.seconds >= 0 && !( seconds >> 34 ) ) {
+      const auto packed = mp_u64{ value.nanoseconds } << 34 | seconds;
+
+      if ( !( packed >> 32 ) ) {
+        write_marker( MPMarker::FixExt4 );
+        wr_.write_i8( ext::timestamp );
+        wr_.write_u32( bswap_intrin32( static_cast< mp_u32 >( packed ) ) );
+      } else {
+        write_marker( MPMarker::FixExt8 );
+        wr_.write_i8( ext::timestamp );
+        wr_.write_u64( bswap_intrin64( packed ) );
+      }
+
+      return _self( );
+    }
+
+    write_marker( MPMarker::Ext8 );
+    wr_.write_u8( 12 );
+    wr_.write_i8( ext::timestamp );
+    wr_.write_u32( bswap_intrin32( value.nanoseconds ) );
+    wr_.write_u64( bswap_intrin64( seconds ) );
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write `count` integers as a single array. With `MPArrayEncoding::FixedWidth`, every
+   * element is written with the marker matching `Ty` and blocks of values are byte-swapped with
+   * SIMD shuffles where available.
+   * @tparam Ty One of `mp_u8`, `mp_i8`, `mp_u16`, `mp_i16`, `mp_u32`, `mp_i32`, `mp_u64`, `mp_i64`
+   * @param values Array of at least `count` values
+   * @param count Number of values to write
+   * @param encoding How every element is represented
+   * @return Self&
+   */
+  template < typename Ty >
+  Self &write_typed_array(
+      const Ty             *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    start_array( count );
+
+    if ( encoding == MPArrayEncoding::Compact ) {
+      for ( mp::mp_u64 index = 0; index < count; index++ ) {
+        if constexpr ( std::is_signed_v< Ty > )
+          write_int( values[ index ] );
+        else
+          write_uint( values[ index ] );
+      }
+
+      return _self( );
+    }
+
+    constexpr auto stride = simd::FixedLayout< sizeof( Ty ) >::stride;
+
+    /*
+     * Encode into a small stack block first and hand every block to the writer in one go, so this
+     * works for every writer backend and copy policy.
+     */
+    mp::mp_u8      block[ 0x200 ];
+    constexpr auto per_block = sizeof( block ) / stride;
+
+    for ( mp::mp_u64 index = 0; index < count; ) {
+      const auto n = count - index < per_block ? count - index : per_block;
+
+      simd::encode_fixed( block, values + index, n, simd::fixed_marker< Ty >( ) );
+      wr_.write( static_cast< mp::mp_u32 >( n * stride ), block );
+      stats::encoded( simd::fixed_marker< Ty >( ), n );
+
+      index += n;
+    }
+
+    return _self( );
+  }
+
+  /**
+   * @brief Write an array of unsigned 2 byte integers. See `write_typed_array`.
+   * @return Self&
+   */
+  Self &write_array_u16(
+      const mp::mp_u16     *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    return write_typed_array( values, count, encoding );
+  }
+
+  /**
+   * @brief Write an array of signed 2 byte integers. See `write_typed_array`.
+   * @return Self&
+   */
+  Self &write_array_i16(
+      const mp::mp_i16     *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    return write_typed_array( values, count, encoding );
+  }
+
+  /**
+   * @brief Write an array of unsigned 4 byte integers. See `write_typed_array`.
+   * @return Self&
+   */
+  Self &write_array_u32(
+      const mp::mp_u32     *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    return write_typed_array( values, count, encoding );
+  }
+
+  /**
+   * @brief Write an array of signed 4 byte integers. See `write_typed_array`.
+   * @return Self&
+   */
+  Self &write_array_i32(
+      const mp::mp_i32     *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    return write_typed_array( values, count, encoding );
+  }
+
+  /**
+   * @brief Write an array of unsigned 8 byte integers. See `write_typed_array`.
+   * @return Self&
+   */
+  Self &write_array_u64(
+      const mp::mp_u64     *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    return write_typed_array( values, count, encoding );
+  }
+
+  /**
+   * @brief Write an array of signed 8 byte integers. See `write_typed_array`.
+   * @return Self&
+   */
+  Self &write_array_i64(
+      const mp::mp_i64     *values,
+      const mp::mp_u64      count,
+      const MPArrayEncoding encoding = MPArrayEncoding::Compact
+  ) {
+    return write_typed_array( values, count, encoding );
+  }
+};
+
+/**
+ * @brief MessagePack encoder/decoder over a single user provided buffer.
+ * @tparam CopyPolicy Copy policy used by both internal streams. See `stream::InlineCopy` and
+ * `stream::FunctionCopy`.
+ * @tparam Writer Writer backend: `stream::BasicStreamWriter` (fixed buffer),
+ * `stream::ChunkedStreamWriter` (growable) or `stream::GatherStreamWriter` (scatter-gather).
+ */
+template <
+    typename CopyPolicy = stream::InlineCopy,
+    typename Writer = stream::BasicStreamWriter< CopyPolicy > >
+struct BasicMessagePack
+    : BasicDecoder< stream::BasicStreamReader< CopyPolicy > >,
+      BasicEncoder< Writer, BasicMessagePack< CopyPolicy, Writer > > {
+private:
+  using Decoding = BasicDecoder< stream::BasicStreamReader< CopyPolicy > >;
+  using Encoding = BasicEncoder< Writer, BasicMessagePack< CopyPolicy, Writer > >;
+
+  using Decoding::sr_;
+  using Encoding::wr_;
+
+  /**
+   * @brief Pointer to the user allocated buffer used by `StreamReader` and `StreamReader`. Call
+   * `reset_all( )` before releasing this memory.
+   */
+  mp::mp_u8 *buffer_{ nullptr };
+
+  /**
+   * @brief Local copy of the memory reader function. Used in decoding operations for copying larger
+   * types from the stream.
+   */
+  stream::MemoryReader reader_{ nullptr };
+
+public:
+  /**
+   * @brief Initialize the `StreamReader` and `StreamWriter` object with `buffer` of size
+   * `stream_size` at cursor `position`.
+   * @param position Position in the stream buffer to start operations at
+   * @param stream_size Total size, in bytes, of the stream buffer
+   * @param buffer Pointer to the underlying stream buffer
+   * @param reader Function pointer of type `void ( * ) ( void *src, void *dst, size_t size )` to be
+   * used for reading memory. Only used by the `FunctionCopy` policy.
+   * @param writer Function pointer of type `void ( * ) ( void *src, void *dst, size_t size )` to be
+   * used for writing memory. Only used by the `FunctionCopy` policy.
+   */
+  void initialize_streams(
+      const mp::mp_size          position = 0,
+      const mp::mp_size          stream_size = 0,
+      mp::mp_u8                 *buffer = nullptr,
+      const stream::MemoryReader reader = nullptr,
+      const stream::MemoryWriter writer = nullptr
+  ) {
+    sr_.set( position, stream_size, buffer, reader );
+    wr_.set( position, stream_size, buffer, writer );
+
+    buffer_ = buffer;
+    reader_ = reader;
+  }
+
+  /**
+   * @brief Reserve `size` bytes of output, checking capacity once, for a record written through the
+   * returned `WriteReservation`. Size the reservation for the worst case; the unused part is given
+   * back when the reservation ends.
+   * @remark Only available with copy policies that write the buffer directly, e.g. `InlineCopy`.
+   * @param size Number of bytes to reserve
+   * @return A reservation that converts to `false` if the stream cannot hold `size` more bytes
+   */
+  WriteReservation< Writer > reserve( const mp::mp_u32 size ) {
+    static_assert( CopyPolicy::direct, "Reservations write the stream buffer directly" );
+
+    return { wr_, wr_.reserve( size ), size };
+  }
+
+  /**
+   * @brief Access the writer backend, e.g. to configure a `stream::ChunkedStreamWriter` or to
+   * collect its segments once a message is complete.
+   * @return Writer&
+   */
+  Writer &writer( ) { return wr_; }
+
+  /**
+   * @brief Retrieve a pointer to the underlying buffer.
+   * @return mp::mp_u8
+   */
+  mp::mp_u8 *stream_buffer( ) const { return buffer_; }
+
+  /**
+   * @brief Sticky error flags of both streams, see `stream::error`. Cleared by `clear_error( )`,
+   * `reset_cursors( )` and the other resets.
+   * @return mp::mp_u8
+   */
+  mp::mp_u8 error( ) const { return sr_.error( ) | wr_.error( ); }
+
+  /**
+   * @brief `true` if no read, write or decode failed since the last reset or `clear_error( )`.
+   */
+  bool good( ) const { return sr_.good( ) && wr_.good( ); }
+
+  void clear_error( ) {
+    sr_.clear_error( );
+    wr_.clear_error( );
+  }
+
+  /**
+   * @brief Reset both streams and zero the stream. Required calling before releasing the underlying
+   * memory.
+   */
+  void reset_all( ) {
+    wr_.clear( );
+    sr_.reset( );
+    wr_.reset( );
+  }
+
+  /**
+   * @brief Reset the temporal state for this object. Use this when reusing the stream object
+   * without losing the previously registered memory readers function.
+   */
+  void reset_temporal( ) {
+    wr_.clear( );
+
+    sr_.reset_temporal( );
+    wr_.reset_temporal( );
+    buffer_ = nullptr;
+  }
+
+  /**
+   * @brief Reset cursors for both streams managed by this object.
+   */
+  void reset_cursors( ) {
+    sr_.reset_cursor( );
+    wr_.reset_cursor( );
+  }
+
+  /**
+   * @brief Reset both stream cursors and zero the underlying buffer.
+   */
+  void reset_and_clear( ) {
+    wr_.clear( );
+    reset_cursors( );
+  }
+};
+
+using MessagePack = BasicMessagePack< stream::InlineCopy >;
+
+/**
+ * @brief Encoder whose output grows in chunks taken from `Allocator`. The buffer passed to
+ * `initialize_streams`, if any, is used as the first segment.
+ */
+template < typename Allocator = stream::HeapAllocator >
+using ChunkedMessagePack =
+    BasicMessagePack< stream::InlineCopy, stream::ChunkedStreamWriter< Allocator > >;
+
+/**
+ * @brief Encoder producing scatter-gather output: large `Bin`/`Str` bodies are referenced rather
+ * than copied, see `stream::GatherStreamWriter`. Collect the output through
+ * `writer( ).segments( )`.
+ */
+using GatherMessagePack = BasicMessagePack< stream::InlineCopy, stream::GatherStreamWriter >;
+
+/**
+ * @brief Standalone decoder: `MessagePack`'s decoding interface over a `stream::SpanReader`, with
+ * no writer state. It is trivially copyable, so a copy forks an independent cursor for free, and
+ * resetting it is O(1) whatever the size of the buffer.
+ */
+struct Decoder : BasicDecoder< stream::SpanReader > {
+  Decoder( ) = default;
+
+  /**
+   * @param buffer Encoded data, not owned
+   * @param size Size, in bytes, of `buffer`
+   * @param position Offset to start decoding at
+   */
+  Decoder( const mp_u8 *buffer, const mp_size size, const mp_size position = 0 ) {
+    reset( buffer, size, position );
+  }
+
+  /**
+   * @brief Point the decoder at another buffer.
+   */
+  void reset( const mp_u8 *buffer, const mp_size size, const mp_size position = 0 ) {
+    sr_.set( position, size, buffer );
+  }
+
+  /**
+   * @brief Move the cursor back to the start of the buffer and clear the error flags.
+   */
+  void reset( ) { sr_.reset_cursor( ); }
+
+  const mp_u8 *stream_buffer( ) const { return sr_.start( ); }
+};
+
+/**
+ * @brief Standalone encoder: `MessagePack`'s encoding interface over a `stream::SpanWriter`, with
+ * no reader state. Trivially copyable; resetting it is O(1) and leaves the buffer untouched.
+ */
+struct Encoder : BasicEncoder< stream::SpanWriter, Encoder > {
+  Encoder( ) = default;
+
+  /**
+   * @param buffer Output buffer, not owned
+   * @param size Size, in bytes, of `buffer`
+   */
+  Encoder( mp_u8 *buffer, const mp_size size ) { reset( buffer, size ); }
+
+  /**
+   * @brief Point the encoder at another buffer.
+   */
+  void reset( mp_u8 *buffer, const mp_size size ) { wr_.set( 0, size, buffer ); }
+
+  /**
+   * @brief Move the cursor back to the start of the buffer and clear the error flags.
+   */
+  void reset( ) { wr_.reset_cursor( ); }
+
+  mp_u8 *stream_buffer( ) const { return wr_.start( ); }
+
+  /**
+   * @brief Same as `BasicMessagePack::reserve`.
+   */
+  WriteReservation< stream::SpanWriter > reserve( const mp_u32 size ) {
+    return { wr_, wr_.reserve( size ), size };
+  }
+};
+
+static_assert( std::is_trivially_copyable_v< Decoder >, "Decoders fork by copy" );
+static_assert( std::is_trivially_copyable_v< Encoder >, "Encoders fork by copy" );
+
+/**
+ * @brief Bounds `mp::validate` enforces on top of well-formedness.
+ */
+struct ValidationLimits {
+  mp_u32 max_depth{ 0x40 };                     // Nesting levels of arrays and maps, at most 0x100
+  mp_u32 max_elements{ limits::uint32_max };    // Elements of an array or pairs of a map
+};
+
+/**
+ * @brief Proof that a buffer holds nothing but complete, well-formed values within a set of
+ * `ValidationLimits`. Only `mp::validate` creates non-empty ones; on failure the token is empty
+ * and tells why and where.
+ */
+struct ValidatedBuffer {
+private:
+  const mp_u8 *data_{ nullptr };
+  mp_size      size_{ 0 };
+  mp_u64       values_{ 0 };
+  mp_size      offset_{ 0 };
+  mp_u8        error_{ stream::error::none };
+
+  friend ValidatedBuffer validate( const mp_u8 *, mp_size, const ValidationLimits & );
+
+public:
+  ValidatedBuffer( ) = default;
+
+  explicit operator bool( ) const { return data_ != nullptr; }
+
+  const mp_u8 *data( ) const { return data_; }
+
+  mp_size size( ) const { return size_; }
+
+  /**
+   * @brief Number of top-level values, i.e. concatenated messages, in the buffer.
+   */
+  mp_u64 values( ) const { return values_; }
+
+  /**
+   * @brief `error::overflow` if a value ran past the end of the buffer, `error::malformed` for the
+   * reserved marker or a limit that was exceeded, `error::unavailable` without a buffer.
+   */
+  mp_u8 error( ) const { return error_; }
+
+  /**
+   * @brief Offset of the leading byte of the value that failed validation.
+   */
+  mp_size offset( ) const { return offset_; }
+};
+
+/**
+ * @brief Check all of `data` in a single pass: every marker is valid, every declared length fits
+ * in the bytes left (including array and map counts, at one byte per element at least), nesting
+ * stays within `limits.max_depth` and containers within `limits.max_elements`. Runs of
+ * PosFixInt/NegFixInt values are skipped 16 bytes at a time with SIMD where available.
+ * @param data Encoded data, possibly several concatenated messages. Must outlive the token
+ * @param size Size, in bytes, of `data`
+ * @return A token for `TrustedDecoder`, empty if `data` is not valid
+ */
+inline ValidatedBuffer
+validate( const mp_u8 *data, const mp_size size, const ValidationLimits &limits = { } ) {
+  constexpr mp_u32 max_depth = 0x100;
+
+  ValidatedBuffer out{ };
+
+  if ( !data ) {
+    out.error_ = stream::error::unavailable;
+    return out;
+  }
+
+  const auto depth_limit = limits.max_depth < max_depth ? limits.max_depth : max_depth;
+  const auto end = data + size;
+
+  mp_u64       stack[ max_depth ];
+  mp_u32       depth = 0;
+  mp_u64       left = 0; // Values left in the innermost open container
+  mp_u64       values = 0;
+  const mp_u8 *cursor = data;
+
+  const auto fail = [ & ]( const mp_u8 flags ) {
+    out.error_ = flags;
+    out.offset_ = static_cast< mp_size >( cursor - data );
+    return out;
+  };
+
+  while ( cursor != end ) {
+    // Never let a run close a container: the last value goes through the regular path.
+    auto room = static_cast< mp_u64 >( end - cursor );
+
+    if ( depth && left - 1 < room ) room = left - 1;
+
+    if ( room >= 16 ) {
+      const auto run = simd::fixint_run( cursor, room );
+
+      cursor += run;
+      if ( depth )
+        left -= run;
+      else
+        values += run;
+
+      if ( cursor == end ) break;
+    }
+
+    const auto  raw = *cursor;
+    const auto &info = marker_info( raw );
+    const auto  available = static_cast< mp_u64 >( end - cursor );
+
+    if ( mp_unlikely( info.family == MPFamily::Invalid ) ) return fail( stream::error::malformed );
+    if ( mp_unlikely( info.header > available ) ) return fail( stream::error::overflow );
+
+    const auto container = info.family == MPFamily::Array || info.family == MPFamily::Map;
+    const auto payload = info.family == MPFamily::Str || info.family == MPFamily::Bin ||
+                         info.family == MPFamily::Ext;
+    const auto sized = payload && !info.mask;
+
+    // Length or count, in the marker or in the `info.width` big-endian bytes after it.
+    mp_u64 length = raw & info.mask;
+
+    if ( ( container && !info.mask ) || sized ) {
+      for ( mp_u32 index = 1; index <= info.width; ++index )
+        length = length << 8 | cursor[ index ];
+    }
+
+    if ( container ) {
+      const auto entries = info.family == MPFamily::Map ? length * 2 : length;
+
+      if ( mp_unlikely( length > limits.max_elements ) ) return fail( stream::error::malformed );
+      if ( mp_unlikely( entries > available - info.header ) )
+        return fail( stream::error::overflow );
+
+      if ( entries ) {
+        if ( mp_unlikely( depth == depth_limit ) ) return fail( stream::error::malformed );
+
+        stack[ depth++ ] = left;
+        left = entries;
+        cursor += info.header;
+        continue;
+      }
+    } else if ( sized ) {
+      if ( mp_unlikely( length > available - info.header ) )
+        return fail( stream::error::overflow );
+
+      cursor += length;
+    }
+
+    cursor += info.header;
+
+    // Close every container completed by this value.
+    for ( ;; ) {
+      if ( !depth ) {
+        ++values;
+        break;
+      }
+
+      if ( --left ) break;
+
+      left = stack[ --depth ];
+    }
+  }
+
+  if ( mp_unlikely( depth ) ) return fail( stream::error::overflow );
+
+  out.data_ = data;
+  out.size_ = size;
+  out.values_ = values;
+
+  return out;
+}
+
+/**
+ * @brief Decoder over a `ValidatedBuffer`: the same interface as `Decoder`, over a
+ * `stream::TrustedSpanReader` that skips every NULL and bounds check, like `_MP_UNSAFE` for this
+ * buffer only. Decoding must follow the structure validated (`decode_single`, `parse`,
+ * `skip_value`, reads matching the marker just decoded) and stop after `values( )` top-level
+ * values; anything else reads out of bounds.
+ */
+struct TrustedDecoder : BasicDecoder< stream::TrustedSpanReader > {
+  TrustedDecoder( ) = default;
+
+  explicit TrustedDecoder( const ValidatedBuffer &buffer ) { reset( buffer ); }
+
+  /**
+   * @brief Point the decoder at another validated buffer. An empty token leaves nothing to read.
+   */
+  void reset( const ValidatedBuffer &buffer ) { sr_.set( 0, buffer.size( ), buffer.data( ) ); }
+
+  /**
+   * @brief Move the cursor back to the start of the buffer and clear the error flags.
+   */
+  void reset( ) { sr_.reset_cursor( ); }
+
+  const mp_u8 *stream_buffer( ) const { return sr_.start( ); }
+};
+
+/**
+ * @brief Compile-time registry of extension handlers. Decoding an extension value dispatches
+ * through a 256 entry table indexed by the extension type, built when the registry is
+ * instantiated, so there is no lookup at run time.
+ *
+ * Every handler is a type exposing:
+ *  - `static constexpr mp_i8 type`: the extension type it decodes;
+ *  - `static bool decode( Context &, const MPExt & )`: the decoder, returning `false` on bad input.
+ *
+ * @tparam Context State handed to every handler, e.g. the object being decoded into
+ * @tparam Handlers Handler types, each with a distinct `type`
+ */
+template < typename Context, typename... Handlers > struct ExtRegistry {
+  using Function = bool ( * )( Context &, const MPExt & );
+
+private:
+  struct Table {
+    Function entries[ 0x100 ];
+    bool     handled[ 0x100 ]; // Separate, so that `handles` stays a constant expression
+  };
+
+  static constexpr Table _make( ) {
+    Table table{ };
+
+    ( ( table.entries[ static_cast< mp_u8 >( Handlers::type ) ] = &Handlers::decode ), ... );
+    ( ( table.handled[ static_cast< mp_u8 >( Handlers::type ) ] = true ), ... );
+
+    return table;
+  }
+
+  static constexpr bool _unique( ) {
+    const mp_i8 types[ sizeof...( Handlers ) + 1 ] = { Handlers::type..., 0 };
+
+    for ( mp_u64 first = 0; first < sizeof...( Handlers ); ++first )
+      for ( mp_u64 second = first + 1; second < sizeof...( Handlers ); ++second )
+        if ( types[ first ] == types[ second ] ) return false;
+
+    return true;
+  }
+
+  static_assert( _unique( ), "Every extension type can only have a single handler" );
+
+  static constexpr Table table_ = _make( );
+
+public:
+  /**
+   * @brief `true` if a handler is registered for `type`.
+   */
+  static constexpr bool handles( const mp_i8 type ) {
+    return table_.handled[ static_cast< mp_u8 >( type ) ];
+  }
+
+  /**
+   * @brief Hand `value` to the handler registered for its type.
+   * @return `false` if no handler is registered for the type or the handler failed
+   */
+  static bool dispatch( Context &context, const MPExt &value ) {
+    const auto handler = table_.entries[ static_cast< mp_u8 >( value.type ) ];
+
+    return handler && handler( context, value );
+  }
+
+  /**
+   * @brief Read the next extension value with `read_ext` and dispatch it.
+   * @param decoder Any decoder, e.g. `MessagePack` or `Decoder`
+   * @param context Passed on to the handler
+   * @return `false`, leaving the cursor untouched, if the next value is not an extension, has no
+   * handler or the handler failed
+   */
+  template < typename Decoding > static bool decode( Decoding &decoder, Context &context ) {
+    const auto start = decoder.read_cursor( );
+
+    MPExt value{ };
+
+    if ( decoder.read_ext( value ) && dispatch( context, value ) ) return true;
+
+    decoder.seek_read_cursor( start );
+    return false;
+  }
+};
+
+enum class DecodeStatus : mp_u8 {
+  Ok,      // A value was decoded
+  NeedMore // The current chunk was exhausted. See `IncrementalDecoder::missing( )`
+};
+
+/**
+ * @brief Resumable decoder for values arriving in arbitrarily split chunks, e.g. from partial TCP
+ * reads. Header bytes that straddle a chunk boundary are staged internally, so no byte is ever
+ * parsed twice; once a header is complete it is decoded by `decode_single`.
+ *
+ * Usage:
+ *  1) `feed( )` a chunk;
+ *  2) Call `next( )` until it returns `DecodeStatus::NeedMore`;
+ *  3) Go back to 1) with the next chunk. At least `missing( )` more bytes are required.
+ *
+ * @remark Like `decode_single`, Str8/16/32, Bin8/16/32 and Ext8/16/32 payloads (for Ext, the data
+ * following the type byte) are not consumed by `next( )`. Read them with `read_payload( )`; any
+ * part left unread is skipped by the following call to `next( )`.
+ * @remark Chunks are not copied and must stay alive until they are exhausted or replaced.
+ */
+struct IncrementalDecoder {
+private:
+  /**
+   * @brief Staging area for the header of the value being decoded. Exactly the biggest header: a
+   * marker and a 31 byte FixStr. `StreamReader` reads up to its end and needs no slack beyond it.
+   */
+  mp_u8 header_[ 0x20 ]{ };
+
+  static_assert( sizeof( header_ ) == header_size( 0xbf ), "Staging area fits the largest header" );
+
+  mp_u32 header_used_{ 0 };
+  mp_u32 header_needed_{ 0 };
+
+  /**
+   * @brief Bytes belonging to the payload of the latest value that were not consumed yet.
+   */
+  mp_u64 payload_{ 0 };
+
+  mp_u32 missing_{ 0 };
+
+  const mp_u8 *chunk_{ nullptr };
+  mp_size      chunk_size_{ 0 };
+  mp_size      chunk_pos_{ 0 };
+
+  MessagePack decoder_{ };
+
+  mp_size _available( ) const { return chunk_size_ - chunk_pos_; }
+
+public:
+  IncrementalDecoder( ) { decoder_.initialize_streams( 0, sizeof( header_ ), header_ ); }
+
+  /* Disallow copies. */
+  IncrementalDecoder( IncrementalDecoder &other ) = delete;
+  IncrementalDecoder &operator=( IncrementalDecoder &other ) = delete;
+
+  /**
+   * @brief Make `chunk` the current input. Any unconsumed byte of the previous chunk is dropped.
+   * @param chunk Pointer to `size` bytes
+   * @param size Size, in bytes, of `chunk`; chunks over 4 GB need `MP_LARGE_STREAMS`
+   */
+  void feed( const mp_u8 *chunk, const mp_size size ) {
+    chunk_ = chunk;
+    chunk_size_ = chunk ? size : 0;
+    chunk_pos_ = 0;
+  }
+
+  /**
+   * @brief Discard any partially decoded value and the current chunk.
+   */
+  void reset( ) {
+    header_used_ = 0;
+    header_needed_ = 0;
+    payload_ = 0;
+    missing_ = 0;
+    feed( nullptr, 0 );
+  }
+
+  /**
+   * @brief Minimum number of bytes required to make progress after `next( )` returned
+   * `DecodeStatus::NeedMore`.
+   * @return mp_u32
+   */
+  mp_u32 missing( ) const { return missing_; }
+
+  /**
+   * @brief Number of bytes of the current chunk that were not consumed yet.
+   * @return mp_size
+   */
+  mp_size remaining( ) const { return _available( ); }
+
+  /**
+   * @brief Number of payload bytes of the latest value that were not read yet.
+   * @return mp_u64
+   */
+  mp_u64 payload_remaining( ) const { return payload_; }
+
+  /**
+   * @brief Decode the next value, resuming a partially received header if there is one.
+   * @param dr Receives the decoded value. Only written when `DecodeStatus::Ok` is returned
+   * @return DecodeStatus
+   */
+  DecodeStatus next( MPDecodeResult &dr ) {
+    if ( payload_ ) {
+      const auto skipped = payload_ < _available( ) ? static_cast< mp_size >( payload_ )
+                                                    : _available( );
+
+      chunk_pos_ += skipped;
+      payload_ -= skipped;
+
+      if ( payload_ ) {
+        missing_ = payload_ > 0xffffffff ? 0xffffffff : static_cast< mp_u32 >( payload_ );
+        return DecodeStatus::NeedMore;
+      }
+    }
+
+    if ( !header_used_ ) {
+      if ( !_available( ) ) {
+        missing_ = 1;
+        return DecodeStatus::NeedMore;
+      }
+
+      header_[ header_used_++ ] = chunk_[ chunk_pos_++ ];
+      header_needed_ = header_size( header_[ 0 ] );
+    }
+
+    const auto wanted = header_needed_ - header_used_;
+    const auto copied = wanted < _available( ) ? wanted : _available( );
+
+    if ( copied ) mmcpy( header_ + header_used_, chunk_ + chunk_pos_, copied );
+
+    header_used_ += copied;
+    chunk_pos_ += copied;
+
+    if ( header_used_ < header_needed_ ) {
+      missing_ = header_needed_ - header_used_;
+      return DecodeStatus::NeedMore;
+    }
+
+    decoder_.reset_cursors( );
+    dr = decoder_.decode_single( );
+
+    // The payload does not go through the staging area, so it always looks truncated there.
+    dr.truncated = false;
+
+    if ( dr.is_str( ) && dr.marker != MPMarker::FixStr ) payload_ = dr.size;
+    if ( dr.is_bin( ) ) payload_ = dr.size;
+    if ( dr.is_ext( ) ) payload_ = dr.size;
+
+    header_used_ = 0;
+    missing_ = 0;
+
+    return DecodeStatus::Ok;
+  }
+
+  /**
+   * @brief Copy at most `size` bytes of the latest value's payload from the current chunk into
+   * `dst`. Call again after feeding the next chunk if fewer bytes were returned than requested.
+   * @param dst Buffer of at least `size` bytes
+   * @param size Maximum number of bytes to read
+   * @return Number of bytes copied into `dst`
+   */
+  mp_u32 read_payload( mp_u8 *dst, const mp_u32 size ) {
+    auto count = size < _available( ) ? size : static_cast< mp_u32 >( _available( ) );
+
+    if ( count > payload_ ) count = static_cast< mp_u32 >( payload_ );
+
+    if ( count ) mmcpy( dst, chunk_ + chunk_pos_, count );
+
+    chunk_pos_ += count;
+    payload_ -= count;
+
+    return count;
+  }
+
+  /**
+   * @brief `read_payload` without the copy: consume the bytes of the latest value's payload that
+   * are in the current chunk and return where they are.
+   * @param size Receives the number of bytes, 0 if the chunk holds none
+   * @return Pointer into the current chunk, valid for as long as the chunk is
+   */
+  const mp_u8 *view_payload( mp_u32 &size ) {
+    const auto start = chunk_ + chunk_pos_;
+
+    // A payload never exceeds `mp_u32`, so neither does the part of it in the chunk.
+    size = static_cast< mp_u32 >( payload_ < _available( ) ? payload_ : _available( ) );
+    chunk_pos_ += size;
+    payload_ -= size;
+
+    return start;
+  }
+};
+
+/**
+ * @brief One value recorded by `Tape`.
+ */
+struct TapeEntry {
+  mp_size  offset; // Position of the marker in the indexed buffer
+  mp_u32   size;   // Payload length for Str/Bin/Ext, element count for Array, pair count for Map
+  mp_u32   first;  // Containers only: slot of the first child in the link table
+  MPMarker marker; // Marker of the value, as returned by `decode_single`
+};
+
+/**
+ * @brief Structural index over one encoded value, built in a single pass. Every value (keys
+ * included) becomes a `TapeEntry` in document order, and the children of each container are
+ * listed contiguously in a link table, so the k-th element of an array or the k-th pair of a map is
+ * found in O(1) and a path lookup costs one key scan per level.
+ *
+ * All memory comes from the caller supplied arena: entries are carved from its start and links from
+ * its end. Nothing is allocated and nothing is copied; the tape refers to the buffer it indexed,
+ * which must outlive it. Use `MessagePack::seek_read_cursor( offset )` to decode any entry.
+ */
+struct Tape {
+  static constexpr mp_u32 npos = 0xffffffff;
+
+  /**
+   * @brief Maximum container nesting accepted by `build`.
+   */
+  static constexpr mp_u32 max_depth = 0x40;
+
+private:
+  TapeEntry *entries_{ nullptr };
+  mp_u32    *links_end_{ nullptr };
+  mp_u64     capacity_{ 0 };
+
+  mp_u32 count_{ 0 };
+  mp_u64 links_{ 0 };
+
+  const mp_u8 *buffer_{ nullptr };
+  mp_size      end_{ 0 };
+
+  mp_u32  _link( const mp_u64 slot ) const { return *( links_end_ - 1 - slot ); }
+  mp_u32 &_link( const mp_u64 slot ) { return *( links_end_ - 1 - slot ); }
+
+  bool _fits( const mp_u64 entries, const mp_u64 links ) const {
+    return entries * sizeof( TapeEntry ) + links * sizeof( mp_u32 ) <= capacity_;
+  }
+
+public:
+  Tape( ) = default;
+
+  /**
+   * @brief Use `size` bytes at `arena` for the index. Each value takes `sizeof( TapeEntry )` bytes
+   * plus 4 bytes per array element or map key/value.
+   */
+  Tape( void *arena, const mp_u64 size ) { set_arena( arena, size ); }
+
+  void set_arena( void *arena, const mp_u64 size ) {
+    const auto begin = reinterpret_cast< mp_u64 >( arena );
+    const auto first = ( begin + alignof( TapeEntry ) - 1 ) & ~mp_u64{ alignof( TapeEntry ) - 1 };
+    const auto last = ( begin + size ) & ~mp_u64{ alignof( mp_u32 ) - 1 };
+
+    entries_ = reinterpret_cast< TapeEntry * >( first );
+    links_end_ = reinterpret_cast< mp_u32 * >( last );
+    capacity_ = arena && last > first ? last - first : 0;
+    count_ = 0;
+    links_ = 0;
+  }
+
+  /**
+   * @brief Index the value starting at `position` in `buffer`.
+   * @param buffer Encoded data, e.g. `MessagePack::stream_buffer( )`
+   * @param position Offset of the value to index
+   * @param size Size, in bytes, of `buffer`
+   * @return `false` if the value is malformed or truncated, nests deeper than `max_depth`, or the
+   * arena is too small. The tape is empty afterwards.
+   */
+  bool build( const mp_u8 *buffer, const mp_size position, const mp_size size ) {
+    struct Frame {
+      mp_u64 next; // Next free link slot of the container
+      mp_u64 end;  // One past its last slot
+    };
+
+    Frame  stack[ max_depth ];
+    mp_u32 depth = 0;
+    mp_u64 cursor = position;
+
+    buffer_ = buffer;
+    end_ = 0;
+    count_ = 0;
+    links_ = 0;
+
+    if ( !buffer ) return false;
+
+    do {
+      if ( cursor >= size || !_fits( count_ + 1, links_ ) ) break;
+
+      const auto &info = marker_info( buffer[ cursor ] );
+
+      if ( info.family == MPFamily::Invalid || info.header > size - cursor ) break;
+
+      mp_u64 count = 0;
+
+      if ( info.mask ) {
+        count = buffer[ cursor ] & info.mask;
+      } else if ( info.size == 0 ) {
+        for ( mp_u8 index = 0; index < info.width; ++index )
+          count = count << 8 | buffer[ cursor + 1 + index ];
+      }
+
+      const auto index = count_++;
+      auto      &entry = entries_[ index ];
+
+      entry.offset = static_cast< mp_size >( cursor );
+      entry.size = info.family == MPFamily::FixExt ? info.width : static_cast< mp_u32 >( count );
+      entry.first = 0;
+      entry.marker = info.marker;
+
+      if ( depth ) _link( stack[ depth - 1 ].next++ ) = index;
+
+      cursor += info.header;
+
+      if ( !info.mask && ( info.family == MPFamily::Str || info.family == MPFamily::Bin ||
+                           info.family == MPFamily::Ext ) )
+        cursor += count;
+
+      if ( cursor > size ) break;
+
+      const auto children = info.family == MPFamily::Map ? count * 2 : count;
+
+      if ( ( info.family == MPFamily::Array || info.family == MPFamily::Map ) && children ) {
+        if ( depth == max_depth || !_fits( count_, links_ + children ) ) break;
+
+        entry.first = static_cast< mp_u32 >( links_ );
+        stack[ depth++ ] = { links_, links_ + children };
+        links_ += children;
+      }
+
+      while ( depth && stack[ depth - 1 ].next == stack[ depth - 1 ].end )
+        --depth;
+
+      if ( !depth ) {
+        end_ = static_cast< mp_size >( cursor );
+        return true;
+      }
+    } while ( true );
+
+    count_ = 0;
+    links_ = 0;
+    return false;
+  }
+
+  /**
+   * @brief Index the value at the read cursor of `pack`. The cursor is not moved.
+   * @tparam Pack Any `BasicMessagePack` instantiation
+   */
+  template < typename Pack > bool build( const Pack &pack ) {
+    return build( pack.stream_buffer( ), pack.read_cursor( ), pack.stream_size( ) );
+  }
+
+  /**
+   * @brief Number of entries, 0 if the latest `build` failed.
+   */
+  mp_u32 size( ) const { return count_; }
+
+  /**
+   * @brief Offset one past the indexed value.
+   */
+  mp_size end( ) const { return end_; }
+
+  const TapeEntry &operator[]( const mp_u32 index ) const { return entries_[ index ]; }
+
+  /**
+   * @brief Entry index of the `k`-th child of `node`. Map children alternate key and value.
+   * @return `npos` if `node` is not a container or has fewer children
+   */
+  mp_u32 child( const mp_u32 node, const mp_u64 k ) const {
+    if ( node >= count_ ) return npos;
+
+    const auto &entry = entries_[ node ];
+    const auto  family = marker_info( entry.marker ).family;
+
+    mp_u64 children = 0;
+
+    if ( family == MPFamily::Array ) children = entry.size;
+    if ( family == MPFamily::Map ) children = mp_u64{ entry.size } * 2;
+
+    return k < children ? _link( entry.first + k ) : npos;
+  }
+
+  /**
+   * @brief Entry index of element `k` of the array `node`, or `npos`.
+   */
+  mp_u32 element( const mp_u32 node, const mp_u32 k ) const {
+    if ( node >= count_ || marker_info( entries_[ node ].marker ).family != MPFamily::Array )
+      return npos;
+
+    return child( node, k );
+  }
+
+  /**
+   * @brief Entry index of the value stored under the string `key` in the map `node`, or `npos`.
+   */
+  mp_u32 find( const mp_u32 node, const mp_u8 *key, const mp_u32 length ) const {
+    if ( node >= count_ || marker_info( entries_[ node ].marker ).family != MPFamily::Map )
+      return npos;
+
+    for ( mp_u64 pair = 0; pair < entries_[ node ].size; ++pair ) {
+      const auto &entry = entries_[ _link( entries_[ node ].first + pair * 2 ) ];
+
+      if ( marker_info( entry.marker ).family == MPFamily::Str && entry.size == length &&
+           std::memcmp( payload( entry ), key, length ) == 0 )
+        return _link( entries_[ node ].first + pair * 2 + 1 );
+    }
+
+    return npos;
+  }
+
+  /**
+   * @brief Resolve a JSON pointer such as `/users/3/name` from the root. Array tokens are decimal
+   * indices, map tokens are matched literally against string keys (`~0`/`~1` escapes are not
+   * interpreted). An empty pointer designates the root.
+   * @return Entry index or `npos`
+   */
+  mp_u32 pointer( const char *path, const mp_u32 length ) const {
+    mp_u32 node = count_ ? 0 : npos;
+    mp_u32 cursor = 0;
+
+    while ( node != npos && cursor < length ) {
+      if ( path[ cursor++ ] != '/' ) return npos;
+
+      const auto token = cursor;
+
+      while ( cursor < length && path[ cursor ] != '/' )
+        ++cursor;
+
+      if ( marker_info( entries_[ node ].marker ).family == MPFamily::Array ) {
+        mp_u64 k = 0;
+
+        if ( token == cursor ) return npos;
+
+        for ( auto index = token; index < cursor; ++index ) {
+          if ( path[ index ] < '0' || path[ index ] > '9' || k > npos ) return npos;
+          k = k * 10 + static_cast< mp_u64 >( path[ index ] - '0' );
+        }
+
+        node = k < npos ? element( node, static_cast< mp_u32 >( k ) ) : npos;
+      } else {
+        node = find( node, reinterpret_cast< const mp_u8 * >( path + token ), cursor - token );
+      }
+    }
+
+    return node;
+  }
+
+  /**
+   * @brief Start of the payload of a Str, Bin, Ext or FixExt entry (after the extension type), or
+   * of the encoded value itself for anything else.
+   */
+  const mp_u8 *payload( const TapeEntry &entry ) const {
+    const auto &info = marker_info( entry.marker );
+    const auto  start = entry.offset + 1u;
+
+    switch ( info.family ) {
+    case MPFamily::Str:
+    case MPFamily::Bin:
+      return buffer_ + start + ( info.mask ? 0 : info.width );
+    case MPFamily::Ext:
+      return buffer_ + start + info.width + 1;
+    case MPFamily::FixExt:
+      return buffer_ + start + 1;
+    default:
+      return buffer_ + entry.offset;
+    }
+  }
+};
+
+/**
+ * @brief Node of a `Document`: a tagged union over the MessagePack type families. FixExt values
+ * are folded into `MPFamily::Ext`. Containers point at their children, stored contiguously in the
+ * document's arena; a map holds its keys and values interleaved, so lookups scan one flat array.
+ */
+struct Value {
+  MPFamily family{ MPFamily::Nil };
+  mp_i8    type{ 0 }; // Extension type. Only set for Ext
+  mp_u32   size{ 0 }; // Payload length for Str/Bin/Ext, element count for Array, pair count for Map
+
+  union {
+    mp_u64       as_uint{ 0 };
+    mp_i64       as_int;
+    mp_f64       as_float;
+    bool         as_bool;
+    const mp_u8 *data;  // Payload of a Str, Bin or Ext
+    const Value *items; // Elements of an Array, or keys and values of a Map, interleaved
+  };
+
+  bool is_nil( ) const { return family == MPFamily::Nil; }
+  bool is_str( ) const { return family == MPFamily::Str; }
+  bool is_array( ) const { return family == MPFamily::Array; }
+  bool is_map( ) const { return family == MPFamily::Map; }
+
+  /**
+   * @brief Element `index` of an array.
+   * @return `nullptr` if this is not an array or `index` is out of range
+   */
+  const Value *at( const mp_u32 index ) const {
+    return family == MPFamily::Array && index < size ? items + index : nullptr;
+  }
+
+  /**
+   * @brief Key of pair `index` of a map.
+   * @return `nullptr` if this is not a map or `index` is out of range
+   */
+  const Value *key( const mp_u32 index ) const {
+    return family == MPFamily::Map && index < size ? items + index * 2ull : nullptr;
+  }
+
+  /**
+   * @brief Value of pair `index` of a map.
+   * @return `nullptr` if this is not a map or `index` is out of range
+   */
+  const Value *value( const mp_u32 index ) const {
+    return family == MPFamily::Map && index < size ? items + index * 2ull + 1 : nullptr;
+  }
+
+  /**
+   * @brief Value stored under the string `key` of a map; the first match wins.
+   * @param key Key bytes, without null terminator
+   * @param length Length of `key`, in bytes
+   * @return `nullptr` if this is not a map or `key` is absent
+   */
+  const Value *find( const mp_u8 *key, const mp_u32 length ) const {
+    if ( family != MPFamily::Map ) return nullptr;
+
+    for ( mp_u64 index = 0; index < size * 2ull; index += 2 ) {
+      const auto &candidate = items[ index ];
+
+      if ( candidate.family == MPFamily::Str && candidate.size == length &&
+           ( !length || !std::memcmp( candidate.data, key, length ) ) )
+        return items + index + 1;
+    }
+
+    return nullptr;
+  }
+};
+
+static_assert( sizeof( Value ) == 16, "Values are meant to pack four to a cache line" );
+
+/**
+ * @brief In-memory tree of a MessagePack value, built by `BasicDecoder::parse` in a single pass
+ * into a caller provided arena. Nodes are bump-allocated from the front of the arena and copied
+ * payloads, if any, from its back, so nothing is freed node by node: `clear( )` drops the whole
+ * tree in O(1).
+ * @remark Unless `parse` is asked to copy them, Str, Bin and Ext payloads are views into the
+ * source buffer, which must then outlive the document.
+ */
+struct Document {
+private:
+  Value *values_{ nullptr };
+  mp_u8 *bytes_end_{ nullptr };
+  mp_u64 capacity_{ 0 };
+  mp_u64 values_used_{ 0 };
+  mp_u64 bytes_used_{ 0 };
+  Value  root_{ };
+
+  bool _fits( const mp_u64 values, const mp_u64 bytes ) const {
+    return ( values_used_ + values ) * sizeof( Value ) + bytes_used_ + bytes <= capacity_;
+  }
+
+  Value *_values( const mp_u64 count ) {
+    if ( !_fits( count, 0 ) ) return nullptr;
+
+    const auto values = values_ + values_used_;
+
+    values_used_ += count;
+    return values;
+  }
+
+  const mp_u8 *_copy( const mp_u8 *data, const mp_u32 size ) {
+    if ( !_fits( 0, size ) ) return nullptr;
+
+    bytes_used_ += size;
+
+    const auto copy = bytes_end_ - bytes_used_;
+
+    if ( size ) mmcpy( copy, data, size );
+    return copy;
+  }
+
+  /**
+   * @brief Visitor filling the document from the events of `parse`.
+   */
+  template < mp_u32 Depth > struct Builder : NullVisitor {
+    Document &document;
+    bool      copy;
+    Value    *next[ Depth ]{ }; // Next free child slot of every open container
+    mp_u32    depth{ 0 };
+
+    Builder( Document &target, const bool copy_payloads )
+        : document( target ), copy( copy_payloads ) { }
+
+    Value &_slot( ) {
+      auto &slot = depth ? *next[ depth - 1 ]++ : document.root_;
+
+      slot = Value{ };
+      return slot;
+    }
+
+    bool _payload( const MPFamily family, const mp_u8 *data, const mp_u32 size, mp_i8 type = 0 ) {
+      auto &slot = _slot( );
+
+      slot.family = family;
+      slot.type = type;
+      slot.size = size;
+      slot.data = copy ? document._copy( data, size ) : data;
+
+      return slot.data != nullptr;
+    }
+
+    bool _container( const MPFamily family, const mp_u32 size, const mp_u64 children ) {
+      auto      &slot = _slot( );
+      const auto items = document._values( children );
+
+      slot.family = family;
+      slot.size = size;
+      slot.items = items;
+
+      next[ depth++ ] = items;
+      return items || !children;
+    }
+
+    bool on_nil( ) {
+      _slot( );
+      return true;
+    }
+
+    bool on_bool( const bool value ) {
+      auto &slot = _slot( );
+
+      slot.family = MPFamily::Boolean;
+      slot.as_bool = value;
+      return true;
+    }
+
+    bool on_uint( const mp_u64 value ) {
+      auto &slot = _slot( );
+
+      slot.family = MPFamily::Uint;
+      slot.as_uint = value;
+      return true;
+    }
+
+    bool on_int( const mp_i64 value ) {
+      auto &slot = _slot( );
+
+      slot.family = MPFamily::Int;
+      slot.as_int = value;
+      return true;
+    }
+
+    bool on_float( const mp_f64 value ) {
+      auto &slot = _slot( );
+
+      slot.family = MPFamily::Float;
+      slot.as_float = value;
+      return true;
+    }
+
+    bool on_str( const mp_u8 *data, const mp_u32 size ) {
+      return _payload( MPFamily::Str, data, size );
+    }
+
+    bool on_bin( const mp_u8 *data, const mp_u32 size ) {
+      return _payload( MPFamily::Bin, data, size );
+    }
+
+    bool on_ext( const MPExt &value ) {
+      return _payload( MPFamily::Ext, value.data, value.size, value.type );
+    }
+
+    bool on_array_begin( const mp_u32 size ) { return _container( MPFamily::Array, size, size ); }
+
+    bool on_map_begin( const mp_u32 size ) {
+      return _container( MPFamily::Map, size, size * 2ull );
+    }
+
+    bool on_array_end( ) {
+      --depth;
+      return true;
+    }
+
+    bool on_map_end( ) {
+      --depth;
+      return true;
+    }
+  };
+
+public:
+  Document( ) = default;
+
+  /**
+   * @brief Use `size` bytes at `arena` for the tree. Each node takes `sizeof( Value )` bytes, plus
+   * the payload size for copied Str, Bin and Ext values.
+   */
+  Document( void *arena, const mp_u64 size ) { set_arena( arena, size ); }
+
+  void set_arena( void *arena, const mp_u64 size ) {
+    const auto begin = reinterpret_cast< mp_u64 >( arena );
+    const auto first = ( begin + alignof( Value ) - 1 ) & ~mp_u64{ alignof( Value ) - 1 };
+    const auto last = begin + size;
+
+    values_ = reinterpret_cast< Value * >( first );
+    bytes_end_ = reinterpret_cast< mp_u8 * >( last );
+    capacity_ = arena && last > first ? last - first : 0;
+    clear( );
+  }
+
+  /**
+   * @brief Decode the next value of `decoder` into this document, replacing its previous tree.
+   * @param decoder Any decoder, e.g. `MessagePack` or `Decoder`
+   * @param copy Copy Str, Bin and Ext payloads into the arena instead of viewing the source buffer
+   * @return `false` if the value is malformed or truncated, nests deeper than the decoder's
+   * `max_parse_depth`, or the arena is too small. The document is empty afterwards.
+   */
+  template < typename Decoding > bool parse( Decoding &decoder, const bool copy = false ) {
+    clear( );
+
+    Builder< Decoding::max_parse_depth > builder{ *this, copy };
+
+    if ( decoder.parse( builder ) ) return true;
+
+    clear( );
+    return false;
+  }
+
+  /**
+   * @brief Root of the tree; `nil` while the document is empty.
+   */
+  const Value &root( ) const { return root_; }
+
+  /**
+   * @brief Drop the tree. O(1): the arena is reused as is.
+   */
+  void clear( ) {
+    values_used_ = 0;
+    bytes_used_ = 0;
+    root_ = Value{ };
+  }
+
+  /**
+   * @brief Number of arena bytes in use.
+   */
+  mp_u64 bytes_used( ) const { return values_used_ * sizeof( Value ) + bytes_used_; }
+};
+
+namespace reflect {
+/**
+ * @brief 32-bit FNV-1a hash of `length` bytes. Evaluated at compile time for field names and at
+ * run time for decoded keys. Pass the hash of preceding bytes as `hash` to continue it.
+ * @tparam Ch `char` or `mp_u8`
+ */
+template < typename Ch >
+constexpr mp_u32 fnv1a( const Ch *bytes, const mp_u32 length, mp_u32 hash = 0x811c9dc5u ) {
+  for ( mp_u32 index = 0; index < length; ++index ) {
+    hash ^= static_cast< mp_u8 >( bytes[ index ] );
+    hash *= 0x01000193u;
+  }
+
+  return hash;
+}
+
+/**
+ * @brief Descriptor of one serialized member: the member pointer, the key hash used by the decoder
+ * and the key already encoded as FixStr or Str8, so the encoder copies it verbatim.
+ * @tparam Owner Struct the member belongs to
+ * @tparam Member Type of the member
+ * @tparam Length Length of the key, without null terminator
+ */
+template < typename Owner, typename Member, mp_u32 Length > struct Field {
+  static_assert( Length <= 0xff, "Field names are limited to 255 bytes" );
+
+  static constexpr mp_u32 header = Length <= 0x1f ? 1 : 2;
+  static constexpr mp_u32 length = Length;
+
+  Member Owner::*member;
+  mp_u32         hash;
+  mp_u8          key[ header + Length ];
+
+  constexpr Field( const char ( &name )[ Length + 1 ], Member Owner::*pointer )
+      : member( pointer ), hash( fnv1a( name, Length ) ), key{ } {
+    if constexpr ( header == 1 ) {
+      key[ 0 ] = static_cast< mp_u8 >( static_cast< mp_u8 >( MPMarker::FixStr ) | Length );
+    } else {
+      key[ 0 ] = static_cast< mp_u8 >( MPMarker::Str8 );
+      key[ 1 ] = static_cast< mp_u8 >( Length );
+    }
+
+    for ( mp_u32 index = 0; index < Length; ++index )
+      key[ header + index ] = static_cast< mp_u8 >( name[ index ] );
+  }
+
+  /**
+   * @brief Compare a decoded key against this field. Only called once the hashes match.
+   */
+  bool matches( const mp_u8 *bytes, const mp_u32 size ) const {
+    return size == Length && std::memcmp( bytes, key + header, Length ) == 0;
+  }
+};
+
+/**
+ * @brief Build a `Field` from a string literal and a member pointer. See also `MP_FIELD`.
+ */
+template < typename Owner, typename Member, mp_u32 Size >
+constexpr Field< Owner, Member, Size - 1 >
+field( const char ( &name )[ Size ], Member Owner::*pointer ) {
+  return { name, pointer };
+}
+
+/**
+ * @brief Compile-time list of `Field` descriptors, stored head first.
+ */
+template < typename... Fields > struct FieldList {
+  static constexpr mp_u32 count = 0;
+};
+
+template < typename Head, typename... Tail > struct FieldList< Head, Tail... > {
+  static constexpr mp_u32 count = 1 + sizeof...( Tail );
+
+  Head                 head;
+  FieldList< Tail... > tail;
+
+  constexpr FieldList( const Head &first, const Tail &...rest ) : head( first ), tail( rest... ) { }
+};
+
+template < typename... Fields > constexpr FieldList< Fields... > fields( const Fields &...list ) {
+  return { list... };
+}
+
+/**
+ * @brief Field description of `Ty`. Specialise it for every serialized struct:
+ *
+ *   template <> struct mp::reflect::Schema< Point > {
+ *     static constexpr auto fields = mp::reflect::fields( MP_FIELD( Point, x ), ... );
+ *   };
+ *
+ * Members are encoded in declaration order, as a map keyed by field name.
+ */
+template < typename Ty > struct Schema;
+
+template < typename Ty, typename = void > struct has_schema : std::false_type { };
+
+template < typename Ty >
+struct has_schema< Ty, std::void_t< decltype( Schema< Ty >::fields ) > > : std::true_type { };
+
+/**
+ * @brief Encoded map header for `count` fields, FixMap or Map16.
+ */
+struct MapHeader {
+  mp_u8  bytes[ 3 ];
+  mp_u32 size;
+};
+
+constexpr MapHeader map_header( const mp_u32 count ) {
+  if ( count <= value_limits::FixMapMax )
+    return { { static_cast< mp_u8 >( static_cast< mp_u8 >( MPMarker::FixMap ) | count ), 0, 0 },
+             1 };
+
+  return { { static_cast< mp_u8 >( MPMarker::Map16 ),
+             static_cast< mp_u8 >( count >> 8 ),
+             static_cast< mp_u8 >( count & 0xff ) },
+           3 };
+}
+
+template < typename List > constexpr void _collect_hashes( const List &list, mp_u32 *out ) {
+  if constexpr ( List::count > 0 ) {
+    *out = list.head.hash;
+    _collect_hashes( list.tail, out + 1 );
+  }
+}
+
+/**
+ * @brief `true` if no two fields of `list` share a key hash. Checked on every schema in use, so
+ * the decoder never needs more than one string compare per key.
+ */
+template < typename List > constexpr bool unique_hashes( const List &list ) {
+  mp_u32 hashes[ List::count + 1 ] = { };
+
+  _collect_hashes( list, hashes );
+
+  for ( mp_u32 first = 0; first < List::count; ++first )
+    for ( mp_u32 second = first + 1; second < List::count; ++second )
+      if ( hashes[ first ] == hashes[ second ] ) return false;
+
+  return true;
+}
+
+template < typename Pack, typename Ty > void encode( Pack &pack, const Ty &value );
+template < typename Pack, typename Ty > bool decode( Pack &pack, Ty &value );
+
+/**
+ * @brief Value codec used for every member. Covers integers, `bool`, `float`, `double` and
+ * structs with a `Schema`; specialise it to support other member types.
+ */
+template < typename Ty, typename = void > struct Codec {
+  static_assert( has_schema< Ty >::value, "No Codec or Schema for this member type" );
+
+  template < typename Pack > static void encode( Pack &pack, const Ty &value ) {
+    reflect::encode( pack, value );
+  }
+
+  template < typename Pack > static bool decode( Pack &pack, Ty &value ) {
+    return reflect::decode( pack, value );
+  }
+};
+
+template < typename Ty >
+struct Codec< Ty, std::enable_if_t< std::is_integral_v< Ty > && !std::is_same_v< Ty, bool > > > {
+  template < typename Pack > static void encode( Pack &pack, const Ty value ) {
+    if constexpr ( std::is_signed_v< Ty > )
+      pack.write_int( value );
+    else
+      pack.write_uint( value );
+  }
+
+  template < typename Pack > static bool decode( Pack &pack, Ty &value ) {
+    const auto dr = pack.decode_single( );
+
+    return !dr.truncated && dr.as_integer( value );
+  }
+};
+
+template <> struct Codec< bool > {
+  template < typename Pack > static void encode( Pack &pack, const bool value ) {
+    pack.write_boolean( value );
+  }
+
+  template < typename Pack > static bool decode( Pack &pack, bool &value ) {
+    const auto dr = pack.decode_single( );
+
+    if ( !dr.is_bool( ) || dr.truncated ) return false;
+
+    value = dr.result.as_bool;
+    return true;
+  }
+};
+
+template <> struct Codec< mp_f32 > {
+  template < typename Pack > static void encode( Pack &pack, const mp_f32 value ) {
+    pack.write_f32( value );
+  }
+
+  template < typename Pack > static bool decode( Pack &pack, mp_f32 &value ) {
+    const auto dr = pack.decode_single( );
+
+    if ( dr.marker != MPMarker::Float32 || dr.truncated ) return false;
+
+    value = dr.result.as_f32;
+    return true;
+  }
+};
+
+template <> struct Codec< mp_f64 > {
+  template < typename Pack > static void encode( Pack &pack, const mp_f64 value ) {
+    pack.write_float( value );
+  }
+
+  template < typename Pack > static bool decode( Pack &pack, mp_f64 &value ) {
+    const auto dr = pack.decode_single( );
+
+    if ( dr.truncated ) return false;
+
+    if ( dr.marker == MPMarker::Float32 )
+      value = dr.result.as_f32;
+    else if ( dr.marker == MPMarker::Float64 )
+      value = dr.result.as_f64;
+    else
+      return false;
+
+    return true;
+  }
+};
+
+template < typename Pack, typename Ty, typename List >
+void _encode_fields( Pack &pack, const Ty &value, const List &list ) {
+  if constexpr ( List::count > 0 ) {
+    pack.write_encoded( list.head.key, sizeof( list.head.key ) );
+    Codec< std::decay_t< decltype( value.*list.head.member ) > >::encode(
+        pack, value.*list.head.member
+    );
+    _encode_fields( pack, value, list.tail );
+  }
+}
+
+/**
+ * @brief Decode the value of the field whose key hashes to `hash`.
+ * @return `false` if no field matches, otherwise `ok` is set to the result of the member codec
+ */
+template < typename Pack, typename Ty, typename List >
+bool _decode_field(
+    Pack &pack, Ty &value, const List &list, const MPDecodeResult &key, const mp_u32 hash,
+    bool &ok
+) {
+  if constexpr ( List::count > 0 ) {
+    if ( hash == list.head.hash && list.head.matches( key.result.as_view.data, key.size ) ) {
+      ok = Codec< std::decay_t< decltype( value.*list.head.member ) > >::decode(
+          pack, value.*list.head.member
+      );
+      return true;
+    }
+
+    return _decode_field( pack, value, list.tail, key, hash, ok );
+  }
+
+  return false;
+}
+
+/**
+ * @brief Fixed wire layout of a schema: the marker every field value is encoded with, in field
+ * order. Declare it next to the fields to compile a specialised codec for the schema:
+ *
+ *   template <> struct mp::reflect::Schema< Quote > {
+ *     static constexpr auto fields = mp::reflect::fields( MP_FIELD( Quote, id ), ... );
+ *     using layout = mp::reflect::Layout< mp::MPMarker::Uint32, ... >;
+ *   };
+ *
+ * Supported markers hold a scalar of fixed width: PosFixInt, NegFixInt, Uint8–64, Int8–64,
+ * Float32/64, and `True` (or `False`) for a `bool` of either value.
+ */
+template < MPMarker... Markers > struct Layout {
+  static constexpr mp_u32   count = sizeof...( Markers );
+  static constexpr MPMarker markers[ count + 1 ] = { Markers..., MPMarker::Nil };
+};
+
+template < typename Ty, typename = void > struct has_layout : std::false_type { };
+
+template < typename Ty >
+struct has_layout< Ty, std::void_t< typename Schema< Ty >::layout > > : std::true_type { };
+
+/**
+ * @brief `true` for the markers a `Layout` may use.
+ */
+constexpr bool layout_marker( const MPMarker marker ) {
+  const auto family = marker_info( marker ).family;
+
+  return family == MPFamily::Uint || family == MPFamily::Int || family == MPFamily::Float ||
+         family == MPFamily::Boolean;
+}
+
+/**
+ * @brief Bits of the leading byte that are fixed by `marker`; the others hold the inline value.
+ */
+constexpr mp_u8 layout_mask( const MPMarker marker ) {
+  switch ( marker ) {
+  case MPMarker::PosFixInt:
+    return 0x80;
+  case MPMarker::NegFixInt:
+    return 0xe0;
+  case MPMarker::False:
+  case MPMarker::True:
+    return 0xfe;
+  default:
+    return 0xff;
+  }
+}
+
+/**
+ * @brief Every byte of a message encoded with a `Layout`, with the bits of each that are known at
+ * compile time: the map header, the keys and the value markers. Value bytes are masked out.
+ */
+template < mp_u32 Size, mp_u32 Count > struct LayoutImage {
+  mp_u8  bytes[ Size ]{ };         // Expected bytes, zero where masked out
+  mp_u8  mask[ Size ]{ };          // Bits of each byte that must match `bytes`
+  mp_u32 offsets[ Count + 1 ]{ }; // Offset of the leading byte of every field value
+};
+
+template < typename List > constexpr mp_u32 _key_bytes( const List &list ) {
+  if constexpr ( List::count > 0 )
+    return static_cast< mp_u32 >( sizeof( list.head.key ) ) + _key_bytes( list.tail );
+  else
+    return 0;
+}
+
+template < typename Image, typename List >
+constexpr void
+_fill_image( Image &image, const List &list, const MPMarker *markers, mp_u32 at, mp_u32 index ) {
+  if constexpr ( List::count > 0 ) {
+    for ( mp_u32 byte = 0; byte < sizeof( list.head.key ); ++byte, ++at ) {
+      image.bytes[ at ] = list.head.key[ byte ];
+      image.mask[ at ] = 0xff;
+    }
+
+    const auto mask = layout_mask( markers[ index ] );
+
+    image.offsets[ index ] = at;
+    image.bytes[ at ] = static_cast< mp_u8 >( static_cast< mp_u8 >( markers[ index ] ) & mask );
+    image.mask[ at ] = mask;
+
+    _fill_image( image, list.tail, markers, at + 1 + marker_info( markers[ index ] ).width,
+                 index + 1 );
+  }
+}
+
+/**
+ * @brief Codec compiled from `Schema< Ty >::fields` and `Schema< Ty >::layout`.
+ */
+template < typename Ty > struct CompiledLayout {
+  using List = std::decay_t< decltype( Schema< Ty >::fields ) >;
+  using Markers = typename Schema< Ty >::layout;
+
+  static_assert( Markers::count == List::count, "The layout needs one marker per field" );
+
+  static constexpr bool supported( ) {
+    for ( mp_u32 index = 0; index < Markers::count; ++index )
+      if ( !layout_marker( Markers::markers[ index ] ) ) return false;
+
+    return true;
+  }
+
+  static_assert( supported( ), "Layout markers must be fixed width scalars" );
+
+  static constexpr MapHeader header = map_header( List::count );
+
+  static constexpr mp_u32 values( ) {
+    mp_u32 bytes = 0;
+
+    for ( mp_u32 index = 0; index < Markers::count; ++index )
+      bytes += 1 + marker_info( Markers::markers[ index ] ).width;
+
+    return bytes;
+  }
+
+  /**
+   * @brief Size, in bytes, of every message in this layout.
+   */
+  static constexpr mp_u32 size = header.size + _key_bytes( Schema< Ty >::fields ) + values( );
+
+  static constexpr LayoutImage< size, List::count > build( ) {
+    LayoutImage< size, List::count > image{ };
+
+    for ( mp_u32 at = 0; at < header.size; ++at ) {
+      image.bytes[ at ] = header.bytes[ at ];
+      image.mask[ at ] = 0xff;
+    }
+
+    _fill_image( image, Schema< Ty >::fields, Markers::markers, header.size, 0 );
+    return image;
+  }
+
+  static constexpr LayoutImage< size, List::count > image = build( );
+};
+
+/**
+ * @brief Compare `Size` bytes against an image, eight at a time. The last word overlaps the one
+ * before it when `Size` is not a multiple of eight.
+ */
+template < mp_u32 Size >
+bool _matches_image(
+    const mp_u8 *data, const mp_u8 ( &bytes )[ Size ], const mp_u8 ( &mask )[ Size ]
+) {
+  if constexpr ( Size < 8 ) {
+    mp_u8 diff = 0;
+
+    for ( mp_u32 at = 0; at < Size; ++at )
+      diff |= static_cast< mp_u8 >( ( data[ at ] & mask[ at ] ) ^ bytes[ at ] );
+
+    return !diff;
+  } else {
+    const auto word = [ & ]( const mp_u32 at ) {
+      mp_u64 actual, wanted, bits;
+
+      mmcpy( &actual, data + at, sizeof( actual ) );
+      mmcpy( &wanted, bytes + at, sizeof( wanted ) );
+      mmcpy( &bits, mask + at, sizeof( bits ) );
+
+      return ( actual & bits ) ^ wanted;
+    };
+
+    mp_u64 diff = 0;
+
+    for ( mp_u32 at = 0; at + 8 <= Size; at += 8 )
+      diff |= word( at );
+
+    if constexpr ( Size % 8 != 0 ) diff |= word( Size - 8 );
+
+    return !diff;
+  }
+}
+
+/**
+ * @brief Big-endian scalar of `sizeof( Ty )` bytes at `at`.
+ */
+template < typename Ty > Ty _load_be( const mp_u8 *at ) {
+  Ty value;
+
+  mmcpy( &value, at, sizeof( value ) );
+
+  if constexpr ( sizeof( Ty ) == 2 ) return static_cast< Ty >( bswap_intrin16( value ) );
+  if constexpr ( sizeof( Ty ) == 4 ) return static_cast< Ty >( bswap_intrin32( value ) );
+  if constexpr ( sizeof( Ty ) == 8 ) return static_cast< Ty >( bswap_intrin64( value ) );
+
+  return value;
+}
+
+template < typename Ty > void _store_be( mp_u8 *at, const Ty value ) {
+  auto bytes = value;
+
+  if constexpr ( sizeof( Ty ) == 2 ) bytes = static_cast< Ty >( bswap_intrin16( value ) );
+  if constexpr ( sizeof( Ty ) == 4 ) bytes = static_cast< Ty >( bswap_intrin32( value ) );
+  if constexpr ( sizeof( Ty ) == 8 ) bytes = static_cast< Ty >( bswap_intrin64( value ) );
+
+  mmcpy( at, &bytes, sizeof( bytes ) );
+}
+
+/**
+ * @brief Decode the field value `Marker` introduces at `at` into `member`. Member types must fit
+ * the marker, like `Codec` expects; integers are range checked at run time.
+ * @return `false` if the value does not fit into `member`
+ */
+template < MPMarker Marker, typename Member > bool _load_field( const mp_u8 *at, Member &member ) {
+  constexpr auto family = marker_info( Marker ).family;
+  constexpr auto width = marker_info( Marker ).width;
+
+  if constexpr ( family == MPFamily::Boolean ) {
+    static_assert( std::is_same_v< Member, bool >, "Boolean layout markers need a bool member" );
+
+    member = at[ 0 ] == static_cast< mp_u8 >( MPMarker::True );
+    return true;
+  } else if constexpr ( family == MPFamily::Float ) {
+    static_assert( std::is_same_v< Member, mp_f64 > ||
+                       ( width == 4 && std::is_same_v< Member, mp_f32 > ),
+                   "Float layout markers need a float member at least as wide" );
+
+    if constexpr ( width == 4 ) {
+      const auto bits = _load_be< mp_u32 >( at + 1 );
+      mp_f32     value;
+
+      mmcpy( &value, &bits, sizeof( value ) );
+      member = value;
+    } else {
+      const auto bits = _load_be< mp_u64 >( at + 1 );
+
+      mmcpy( &member, &bits, sizeof( member ) );
+    }
+
+    return true;
+  } else {
+    static_assert( std::is_integral_v< Member > && !std::is_same_v< Member, bool >,
+                   "Integer layout markers need an integer member" );
+
+    if constexpr ( family == MPFamily::Uint ) {
+      mp_u64 value = at[ 0 ];
+
+      if constexpr ( width == 1 ) value = at[ 1 ];
+      if constexpr ( width == 2 ) value = _load_be< mp_u16 >( at + 1 );
+      if constexpr ( width == 4 ) value = _load_be< mp_u32 >( at + 1 );
+      if constexpr ( width == 8 ) value = _load_be< mp_u64 >( at + 1 );
+
+      const auto narrowed = static_cast< Member >( value );
+
+      if ( static_cast< mp_u64 >( narrowed ) != value ) return false;
+
+      if constexpr ( std::is_signed_v< Member > ) {
+        if ( narrowed < 0 ) return false;
+      }
+
+      member = narrowed;
+    } else {
+      mp_i64 value = static_cast< mp_i8 >( at[ 0 ] );
+
+      if constexpr ( width == 1 ) value = static_cast< mp_i8 >( at[ 1 ] );
+      if constexpr ( width == 2 ) value = _load_be< mp_i16 >( at + 1 );
+      if constexpr ( width == 4 ) value = _load_be< mp_i32 >( at + 1 );
+      if constexpr ( width == 8 ) value = _load_be< mp_i64 >( at + 1 );
+
+      const auto narrowed = static_cast< Member >( value );
+
+      if ( static_cast< mp_i64 >( narrowed ) != value ) return false;
+
+      if constexpr ( std::is_unsigned_v< Member > ) {
+        if ( value < 0 ) return false;
+      }
+
+      member = narrowed;
+    }
+
+    return true;
+  }
+}
+
+/**
+ * @brief Encode `member` as `Marker` at `at`, whose leading byte already holds the marker.
+ * @return `false` if the value cannot be represented with `Marker`
+ */
+template < MPMarker Marker, typename Member >
+bool _store_field( mp_u8 *at, const Member &member ) {
+  constexpr auto family = marker_info( Marker ).family;
+  constexpr auto width = marker_info( Marker ).width;
+
+  if constexpr ( family == MPFamily::Boolean ) {
+    static_assert( std::is_same_v< Member, bool >, "Boolean layout markers need a bool member" );
+
+    at[ 0 ] = static_cast< mp_u8 >( member ? MPMarker::True : MPMarker::False );
+    return true;
+  } else if constexpr ( family == MPFamily::Float ) {
+    static_assert( std::is_same_v< Member, mp_f64 > ||
+                       ( width == 4 && std::is_same_v< Member, mp_f32 > ),
+                   "Float layout markers need a float member at least as wide" );
+
+    if constexpr ( width == 4 ) {
+      const auto value = static_cast< mp_f32 >( member );
+      mp_u32     bits;
+
+      if ( value != member ) return false;
+
+      mmcpy( &bits, &value, sizeof( bits ) );
+      _store_be( at + 1, bits );
+    } else {
+      mp_u64 bits;
+
+      mmcpy( &bits, &member, sizeof( bits ) );
+      _store_be( at + 1, bits );
+    }
+
+    return true;
+  } else {
+    static_assert( std::is_integral_v< Member > && !std::is_same_v< Member, bool >,
+                   "Integer layout markers need an integer member" );
+
+    if constexpr ( family == MPFamily::Uint ) {
+      if constexpr ( std::is_signed_v< Member > ) {
+        if ( member < 0 ) return false;
+      }
+
+      const auto value = static_cast< mp_u64 >( member );
+
+      if constexpr ( Marker == MPMarker::PosFixInt ) {
+        if ( value > value_limits::PosFixIntMax ) return false;
+
+        at[ 0 ] = static_cast< mp_u8 >( value );
+      } else if constexpr ( width < 8 ) {
+        if ( value >> ( width * 8 ) ) return false;
+      }
+
+      if constexpr ( width == 1 ) at[ 1 ] = static_cast< mp_u8 >( value );
+      if constexpr ( width == 2 ) _store_be( at + 1, static_cast< mp_u16 >( value ) );
+      if constexpr ( width == 4 ) _store_be( at + 1, static_cast< mp_u32 >( value ) );
+      if constexpr ( width == 8 ) _store_be( at + 1, value );
+    } else {
+      if constexpr ( std::is_unsigned_v< Member > && sizeof( Member ) == 8 ) {
+        if ( member >> 63 ) return false;
+      }
+
+      const auto value = static_cast< mp_i64 >( member );
+
+      if constexpr ( Marker == MPMarker::NegFixInt ) {
+        if ( value < -32 || value > -1 ) return false;
+
+        at[ 0 ] = static_cast< mp_u8 >( value );
+      } else if constexpr ( width < 8 ) {
+        constexpr auto bound = mp_i64{ 1 } << ( width * 8 - 1 );
+
+        if ( value < -bound || value >= bound ) return false;
+      }
+
+      if constexpr ( width == 1 ) at[ 1 ] = static_cast< mp_u8 >( value );
+      if constexpr ( width == 2 ) _store_be( at + 1, static_cast< mp_u16 >( value ) );
+      if constexpr ( width == 4 ) _store_be( at + 1, static_cast< mp_u32 >( value ) );
+      if constexpr ( width == 8 ) _store_be( at + 1, static_cast< mp_u64 >( value ) );
+    }
+
+    return true;
+  }
+}
+
+template < typename Ty, mp_u32 Index, typename List >
+bool _load_fields( const mp_u8 *data, Ty &value, const List &list ) {
+  if constexpr ( List::count > 0 ) {
+    using Compiled = CompiledLayout< Ty >;
+
+    constexpr auto marker = Compiled::Markers::markers[ Index ];
+
+    constexpr auto offset = Compiled::image.offsets[ Index ];
+
+    if ( !_load_field< marker >( data + offset, value.*list.head.member ) ) return false;
+
+    return _load_fields< Ty, Index + 1 >( data, value, list.tail );
+  }
+
+  return true;
+}
+
+template < typename Ty, mp_u32 Index, typename List >
+bool _store_fields( mp_u8 *data, const Ty &value, const List &list ) {
+  if constexpr ( List::count > 0 ) {
+    using Compiled = CompiledLayout< Ty >;
+
+    constexpr auto marker = Compiled::Markers::markers[ Index ];
+
+    constexpr auto offset = Compiled::image.offsets[ Index ];
+
+    if ( !_store_field< marker >( data + offset, value.*list.head.member ) ) return false;
+
+    return _store_fields< Ty, Index + 1 >( data, value, list.tail );
+  }
+
+  return true;
+}
+
+/**
+ * @brief Decode `value` if the next bytes are a message in its exact `Layout`: the header, keys
+ * and markers are checked with one masked compare, then every value is read at its compile-time
+ * offset.
+ * @return `false`, leaving the cursor untouched, if the input does not match the layout or a
+ * value does not fit its member
+ */
+template < typename Pack, typename Ty > bool _decode_layout( Pack &pack, Ty &value ) {
+  using Compiled = CompiledLayout< Ty >;
+
+  const auto start = pack.read_cursor( );
+
+  if ( pack.stream_size( ) - start < Compiled::size ) return false;
+
+  const auto data = pack.read_view( Compiled::size );
+
+  if ( data && _matches_image( data, Compiled::image.bytes, Compiled::image.mask ) &&
+       _load_fields< Ty, 0 >( data, value, Schema< Ty >::fields ) )
+    return true;
+
+  pack.seek_read_cursor( start );
+  return false;
+}
+
+/**
+ * @brief Encode `value` in its exact `Layout` with a single write.
+ * @return `false`, writing nothing, if a value cannot be represented with its layout marker
+ */
+template < typename Pack, typename Ty > bool _encode_layout( Pack &pack, const Ty &value ) {
+  using Compiled = CompiledLayout< Ty >;
+
+  mp_u8 bytes[ Compiled::size ];
+
+  mmcpy( bytes, Compiled::image.bytes, Compiled::size );
+
+  if ( !_store_fields< Ty, 0 >( bytes, value, Schema< Ty >::fields ) ) return false;
+
+  pack.write_encoded( bytes, Compiled::size );
+  return true;
+}
+
+/**
+ * @brief Encode `value` as a map using `Schema< Ty >`. The map header and all keys are encoded at
+ * compile time; only the values are encoded at run time. With a `Layout`, every value is written
+ * with its layout marker unless one does not fit, in which case the whole map is encoded as if
+ * there were no layout.
+ * @tparam Pack Any `BasicMessagePack` instantiation
+ */
+template < typename Pack, typename Ty > void encode( Pack &pack, const Ty &value ) {
+  constexpr auto &list = Schema< Ty >::fields;
+  constexpr auto  header = map_header( std::decay_t< decltype( list ) >::count );
+
+  static_assert( std::decay_t< decltype( list ) >::count <= value_limits::Map16Max );
+  static_assert( unique_hashes( list ), "Two field names of this schema share a hash" );
 
-    return *this;
+  if constexpr ( has_layout< Ty >::value ) {
+    if ( _encode_layout( pack, value ) ) return;
   }
 
-  /**
-   * @brief Write a signed integer to the stream using the smallest possible representation.
-   * @param value Integer value to write to the stream
-   * @return MessagePack&
-   */
-  MessagePack &write_int( const mp::mp_i64 value ) {
-    if ( value >= limits::int8_min && value <= limits::int8_max )
-      write_i8( static_cast< mp::mp_i8 >( value ) );
-    else if ( value >= limits::int16_min && value <= limits::int16_max )
-      write_i16( static_cast< mp::mp_i16 >( value ) );
-    else if ( value >= limits::int32_min && value <= limits::int32_max )
-      write_i32( static_cast< mp::mp_i32 >( value ) );
-    else
-      write_i64( value );
+  pack.write_encoded( header.bytes, header.size );
+  _encode_fields( pack, value, list );
+}
+
+/**
+ * @brief Decode a map written by `encode` (or any encoder using the same keys) into `value`. Keys
+ * are matched by hash; fields missing from the input are left untouched and unknown keys are
+ * skipped. With a `Layout`, a message in exactly that layout is decoded without dispatching on a
+ * single marker; anything else takes this generic path.
+ * @tparam Pack Any `BasicMessagePack` instantiation, `Decoder` or `TrustedDecoder`
+ * @return `false` on malformed or truncated input, or a member value of the wrong type
+ */
+template < typename Pack, typename Ty > bool decode( Pack &pack, Ty &value ) {
+  constexpr auto &list = Schema< Ty >::fields;
 
-    return *this;
-  }
+  static_assert( unique_hashes( list ), "Two field names of this schema share a hash" );
 
-  /**
-   * @brief Write a single unsigned byte to the stream and advance the cursor by 1 if the stream has
-   * not reached its end.
-   * @param value Unsigned byte to write to the stream
-   * @return MessagePack&
-   */
-  MessagePack &write_u8( const mp::mp_u8 value ) {
-    write_raw_value< MPMarker::Uint8 >( value, sizeof( mp::mp_u8 ) );
-    return *this;
+  if constexpr ( has_layout< Ty >::value ) {
+    if ( _decode_layout( pack, value ) ) return true;
   }
 
-  /**
-   * @brief Write a single signed byte to the stream and advance the cursor by 1 if the stream has
-   * not reached its end.
-   * @param value Signed byte to write to the stream
-   * @return MessagePack&
-   */
-  MessagePack &write_i8( const mp::mp_i8 value ) {
-    write_raw_value< MPMarker::Int8 >( value, sizeof( mp::mp_i8 ) );
-    return *this;
-  }
+  const auto map = pack.decode_single( );
 
-  /**
-   * @brief Write a `string` of `length` into the MessagePack byte stream.
-   * @remark Subtract one to remove the null terminator from the total length
-   * @param string Pointer to a C string of `length` characters
-   * @param length Size, in bytes, of the string in memory
-   * @return MessagePack&
-   */
-  MessagePack &write_cstr( const mp::mp_u8 *string, const mp::mp_u64 length ) {
-    write_raw_value< MPMarker::Str8 >( reinterpret_cast< mp::mp_u64 >( string ), length );
-    return *this;
-  }
+  if ( !map.is_map( ) ) return false;
 
-  /**
-   * @brief Write a byte array `bytes` of `count` into the MessagePack byte stream.
-   * @remark Subtract one to remove the null terminator from the total length
-   * @param bytes Pointer to a byte array of `count` bytes
-   * @param count Size, in bytes, of the byte array
-   * @return MessagePack&
-   */
-  MessagePack &write_bytes( const mp::mp_u8 *bytes, const mp::mp_u64 count ) {
-    write_raw_value< MPMarker::Bin8 >( reinterpret_cast< mp::mp_u64 >( bytes ), count );
-    return *this;
-  }
+  for ( mp_u32 pair = 0; pair < map.size; ++pair ) {
+    const auto key = pack.decode_view( );
 
-  /**
-   * @brief Write a marker representing `true` to the stream.
-   * @return MessagePack&
-   */
-  MessagePack &write_true( ) {
-    /*
-     * `data` parameter can be ignored in this instance, because the marker represents the value.
-     */
-    write_raw_value< MPMarker::True >( 0, sizeof( mp_u8 ) );
+    if ( !key.is_str( ) || !key.result.as_view.data ) return false;
 
-    return *this;
-  }
+    bool ok = false;
 
-  /**
-   * @brief Write a marker representing `false` to the stream.
-   * @return MessagePack&
-   */
-  MessagePack &write_false( ) {
-    /*
-     * `data` parameter can be ignored in this instance, because the marker represents the value.
-     */
-    write_raw_value< MPMarker::False >( 0, sizeof( mp_u8 ) );
+    if ( !_decode_field(
+             pack, value, list, key, fnv1a( key.result.as_view.data, key.size ), ok
+         ) ) {
+      ok = pack.skip_value( );
+    }
 
-    return *this;
+    if ( !ok ) return false;
   }
 
-  /**
-   * @brief Write `true` or `false` to the stream depending on `value`.
-   * @param value Boolean value to write
-   * @return MessagePack&
-   */
-  MessagePack &write_boolean( const bool value ) {
-    if ( value )
-      write_true( );
-    else
-      write_false( );
+  return true;
+}
+} // namespace reflect
 
-    return *this;
-  }
+/**
+ * @brief Fixed-capacity store of `PreEncoded` fragments: keys, container headers, FixExt tags or
+ * whole constant subtrees, each encoded once into its exact bytes. Identical fragments are stored
+ * once; asking again for the same key returns the existing bytes through a hash lookup.
+ *
+ * Intern fragments once, e.g. at startup, and keep the returned handles: emitting one is then a
+ * single bulk copy through `write_encoded`. Handles stay valid until `reset( )` or destruction.
+ *
+ * @remark A request that does not fit, in bytes or in slots, returns an empty `PreEncoded`.
+ * @tparam Bytes Capacity, in bytes, of the fragment storage
+ * @tparam Slots Capacity of the lookup table, a power of two. At most 3/4 of it is used.
+ */
+template < mp_u32 Bytes = 0x2000, mp_u32 Slots = 0x100 > struct FragmentCache {
+  static_assert( Slots && ( Slots & ( Slots - 1 ) ) == 0, "Slots must be a power of two" );
 
-  /**
-   * @brief Copy exactly 2 bytes from `byte_array` into the stream. If the length of `byte_array` is
-   * less than 2 the behaviour is undefined.
-   * @param byte_array A byte array at least 2 bytes long
-   * @return MessagePack&
-   */
-  MessagePack &write_fix_ext1( const mp::mp_u8 *byte_array ) {
-    write_raw_value< MPMarker::FixExt1 >(
-        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt1 )
-    );
+private:
+  struct Slot {
+    mp_u32 hash;
+    mp_u32 offset;
+    mp_u32 size; // 0 for an empty slot
+  };
 
-    return *this;
-  }
+  mp_u8  storage_[ Bytes ]{ };
+  Slot   slots_[ Slots ]{ };
+  mp_u32 used_{ 0 };
+  mp_u32 count_{ 0 };
 
   /**
-   * @brief Copy exactly 3 bytes from `byte_array` into the stream. If the length of `byte_array` is
-   * less than 3 the behaviour is undefined.
-   * @param byte_array A byte array at least 3 bytes long
-   * @return MessagePack&
+   * @brief Find or store the fragment made of `header` followed by `body`.
    */
-  MessagePack &write_fix_ext2( const mp::mp_u8 *byte_array ) {
-    write_raw_value< MPMarker::FixExt2 >(
-        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt2 )
-    );
+  PreEncoded _intern(
+      const mp_u8 *header, const mp_u32 header_size, const mp_u8 *body, const mp_u32 body_size
+  ) {
+    const auto size = mp_u64{ header_size } + body_size;
+    const auto hash = reflect::fnv1a( body, body_size, reflect::fnv1a( header, header_size ) );
 
-    return *this;
-  }
+    if ( !size ) return { };
 
-  /**
-   * @brief Copy exactly 5 bytes from `byte_array` into the stream. If the length of `byte_array` is
-   * less than 5 the behaviour is undefined.
-   * @param byte_array A byte array at least 5 bytes long
-   * @return MessagePack&
-   */
-  MessagePack &write_fix_ext4( const mp::mp_u8 *byte_array ) {
-    write_raw_value< MPMarker::FixExt4 >(
-        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt4 )
-    );
+    auto index = hash & ( Slots - 1 );
 
-    return *this;
+    for ( ; slots_[ index ].size; index = ( index + 1 ) & ( Slots - 1 ) ) {
+      const auto &slot = slots_[ index ];
+      const auto  stored = storage_ + slot.offset;
+
+      if ( slot.hash != hash || slot.size != size ) continue;
+
+      if ( ( !header_size || !std::memcmp( stored, header, header_size ) ) &&
+           ( !body_size || !std::memcmp( stored + header_size, body, body_size ) ) )
+        return { stored, slot.size };
+    }
+
+    if ( ( count_ + 1 ) * 4 > Slots * 3 || size > Bytes - used_ ) return { };
+
+    const auto stored = storage_ + used_;
+
+    if ( header_size ) mmcpy( stored, header, header_size );
+
+    // `encode` builds its fragment in place, right where it would be stored.
+    if ( body_size && body != stored + header_size ) mmcpy( stored + header_size, body, body_size );
+
+    slots_[ index ] = { hash, used_, static_cast< mp_u32 >( size ) };
+    used_ += static_cast< mp_u32 >( size );
+    count_++;
+
+    return { stored, static_cast< mp_u32 >( size ) };
   }
 
   /**
-   * @brief Copy exactly 9 bytes from `byte_array` into the stream. If the length of `byte_array` is
-   * less than 9 the behaviour is undefined.
-   * @param byte_array A byte array at least 9 bytes long
-   * @return MessagePack&
+   * @brief Header of a string, binary or container: `fixed` (FixStr, FixMap, ...) for lengths up
+   * to `fixed_max`, then the 8-bit (if `wide8`), 16-bit and 32-bit forms starting at `marker8`.
    */
-  MessagePack &write_fix_ext8( const mp::mp_u8 *byte_array ) {
-    write_raw_value< MPMarker::FixExt8 >(
-        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt8 )
-    );
+  static mp_u32 _header(
+      mp_u8 *out, const mp_u32 length, const MPMarker fixed, const mp_u32 fixed_max,
+      const MPMarker marker8, const bool wide8
+  ) {
+    const auto base = static_cast< mp_u8 >( marker8 );
 
-    return *this;
+    if ( fixed != MPMarker::Unused && length <= fixed_max ) {
+      out[ 0 ] = static_cast< mp_u8 >( static_cast< mp_u8 >( fixed ) | length );
+      return 1;
+    }
+
+    if ( wide8 && length <= limits::uint8_max ) {
+      out[ 0 ] = base;
+      out[ 1 ] = static_cast< mp_u8 >( length );
+      return 2;
+    }
+
+    const auto marker = static_cast< mp_u8 >( wide8 ? base + 1 : base );
+
+    if ( length <= limits::uint16_max ) {
+      out[ 0 ] = marker;
+      out[ 1 ] = static_cast< mp_u8 >( length >> 8 );
+      out[ 2 ] = static_cast< mp_u8 >( length );
+      return 3;
+    }
+
+    out[ 0 ] = static_cast< mp_u8 >( marker + 1 );
+
+    for ( mp_u32 index = 0; index < 4; ++index )
+      out[ 1 + index ] = static_cast< mp_u8 >( length >> ( 24 - index * 8 ) );
+
+    return 5;
   }
 
+public:
   /**
-   * @brief Copy exactly 17 bytes from `byte_array` into the stream. If the length of `byte_array`
-   * is less than 17 the behaviour is undefined.
-   * @param byte_array A byte array at least 17 bytes long
-   * @return MessagePack&
+   * @brief String fragment, typically a map key: FixStr up to 31 bytes, then Str8/16/32.
    */
-  MessagePack &write_fix_ext16( const mp::mp_u8 *byte_array ) {
-    write_raw_value< MPMarker::FixExt16 >(
-        reinterpret_cast< mp::mp_u64 >( byte_array ), sizeof( MPFixExt16 )
+  PreEncoded str( const mp_u8 *string, const mp_u32 length ) {
+    mp_u8 header[ 5 ];
+
+    return _intern(
+        header, _header( header, length, MPMarker::FixStr, 0x1f, MPMarker::Str8, true ), string,
+        length
     );
+  }
 
-    return *this;
+  template < mp_u32 Size > PreEncoded str( const char ( &literal )[ Size ] ) {
+    return str( reinterpret_cast< const mp_u8 * >( literal ), Size - 1 );
   }
 
   /**
-   * @brief Check if a marker, typically returned by `decode_single`, denotes the start of a fixext
-   * type.
-   * @param marker MessagePack marker
-   * @return `true` if `marker` is any MessagePack fixext type, `false` otherwise
+   * @brief Binary fragment: Bin8/16/32.
    */
-  bool is_fixext( const MPMarker marker ) const {
-    return (
-        marker == MPMarker::FixExt1 || marker == MPMarker::FixExt2 || marker == MPMarker::FixExt4 ||
-        marker == MPMarker::FixExt8 || marker == MPMarker::FixExt16
+  PreEncoded bin( const mp_u8 *bytes, const mp_u32 count ) {
+    mp_u8 header[ 5 ];
+
+    return _intern(
+        header, _header( header, count, MPMarker::Unused, 0, MPMarker::Bin8, true ), bytes, count
     );
   }
 
   /**
-   * @brief Check if a marker, typically returned by `decode_single`, denotes the start of an array.
-   * @param marker MessagePack marker
-   * @return `true` if `marker` is any MessagePack array type, `false` otherwise
+   * @brief Map header for `num_pairs` pairs: FixMap, Map16 or Map32.
    */
-  bool is_array( const MPMarker marker ) const {
-    return (
-        marker == MPMarker::FixArray || marker == MPMarker::Array16 || marker == MPMarker::Array32
+  PreEncoded map_header( const mp_u32 num_pairs ) {
+    mp_u8 header[ 5 ];
+
+    return _intern(
+        header,
+        _header( header, num_pairs, MPMarker::FixMap, value_limits::FixMapMax, MPMarker::Map16,
+                 false ),
+        nullptr, 0
     );
   }
 
   /**
-   * @brief Check if a marker, typically returned by `decode_single`, denotes an integer.
-   * @param marker MessagePack marker
-   * @return `true` if `marker` is any MessagePack array type, `false` otherwise
+   * @brief Array header for `num_elem` elements: FixArray, Array16 or Array32.
    */
-  bool is_integer( const MPMarker marker ) const {
-    return (
-        marker == MPMarker::PosFixInt || marker == MPMarker::NegFixInt ||
-        marker == MPMarker::Uint8 || marker == MPMarker::Int8 || marker == MPMarker::Uint16 ||
-        marker == MPMarker::Int16 || marker == MPMarker::Uint32 || marker == MPMarker::Int32 ||
-        marker == MPMarker::Uint64 || marker == MPMarker::Int64
+  PreEncoded array_header( const mp_u32 num_elem ) {
+    mp_u8 header[ 5 ];
+
+    return _intern(
+        header,
+        _header( header, num_elem, MPMarker::FixArray, value_limits::FixArrayMax,
+                 MPMarker::Array16, false ),
+        nullptr, 0
     );
   }
 
   /**
-   * @brief Attempt to read `size` bytes from the stream into `dst`.
-   * @remark Out-of-bounds reads are silently ignored/not reported.
-   * @param dst Buffer of at least `size` bytes to write into
-   * @param size Size, in bytes, of `dst`
-   */
-  void read_bytes( mp::mp_u8 *dst, const mp_u32 size ) { sr_.read( size, dst ); }
-
-  /**
-   * @brief Decode a single value from the stream, advance the cursor and return the marker denoting
-   * its type. If the value cannot be decoded, the destination buffer is too small or the stream is
-   * exhausted return `MPMarker::Unused`
-   * @remark For any dynamically sized type such as Ext8/16/32, Array16/32 and Map16/32 call this
-   * function first to retrieve the marker, size and advance the cursor to the start of the data.
-   * Afterwards call the respective handlers.
-   * @return MPMarker denoting the type of the latest value decoded from the stream and its size
+   * @brief Marker and extension type of a FixExt value with `width` data bytes, to be followed by
+   * exactly `width` bytes of data.
+   * @param width 1, 2, 4, 8 or 16
+   * @param type Extension type
+   * @return An empty fragment for any other `width`
    */
-  MPDecodeResult decode_single( ) {
-    const auto raw = read_u8( );
-
-    MPDecodeResult dr{ };
-
-    const auto mk = static_cast< MPMarker >( raw );
-
-    dr.marker = mk;
-    dr.size = 0;
-    dr.result.as_u64 = 0;
-
-    switch ( dr.marker ) {
-    case MPMarker::PosFixInt: // edge case, handled at the bottom
-    case MPMarker::FixMap:    // edge case, handled at the bottom
-    case MPMarker::FixArray:  // edge case, handled at the bottom
-    case MPMarker::FixStr:    // edge case, handled at the bottom
-    case MPMarker::NegFixInt: // edge case, handled at the bottom
-      break;
-    case MPMarker::Nil:
-    case MPMarker::False: {
-      dr.size = sizeof( mp_u8 );
-      dr.result.as_bool = false;
-
-      break;
-    }
-    case MPMarker::Unused:
-      break;
-    case MPMarker::True: {
-      dr.size = sizeof( mp_u8 );
-      dr.result.as_bool = true;
+  PreEncoded fixext_tag( const mp_u32 width, const mp_i8 type ) {
+    mp_u8 marker = 0;
 
+    switch ( width ) {
+    case 1:
+      marker = static_cast< mp_u8 >( MPMarker::FixExt1 );
       break;
-    }
-    case MPMarker::Str8:
-    case MPMarker::Bin8: {
-      dr.size = read_u8( );
-      break;
-    }
-    case MPMarker::Str16:
-    case MPMarker::Bin16: {
-      dr.size = read_u16( );
-      break;
-    }
-    case MPMarker::Str32:
-    case MPMarker::Bin32: {
-      dr.size = read_u32( );
-      break;
-    }
-    case MPMarker::Ext8: {
-      dr.size = static_cast< mp_u32 >( read_u8( ) );
-      break;
-    }
-    case MPMarker::Ext16: {
-      dr.size = static_cast< mp_u32 >( read_u16( ) );
-      break;
-    }
-    case MPMarker::Ext32: {
-      dr.size = read_u32( );
-      break;
-    }
-    case MPMarker::Float32:
-    case MPMarker::Float64:
-      break;
-    case MPMarker::Uint8: {
-      dr.size = sizeof( mp_u8 );
-      dr.result.as_u8 = read_u8( );
-      break;
-    }
-    case MPMarker::Uint16: {
-      dr.size = sizeof( mp::mp_u16 );
-      dr.result.as_u16 = read_u16( );
-      break;
-    }
-    case MPMarker::Uint32: {
-      dr.size = sizeof( mp::mp_u32 );
-      dr.result.as_u32 = read_u32( );
-      break;
-    }
-    case MPMarker::Uint64: {
-      dr.size = sizeof( mp::mp_u64 );
-      dr.result.as_u64 = read_u64( );
-      break;
-    }
-    case MPMarker::Int8: {
-      dr.size = sizeof( mp_i8 );
-      dr.result.as_i8 = read_i8( );
-      break;
-    }
-    case MPMarker::Int16: {
-      dr.size = sizeof( mp_i16 );
-      dr.result.as_i16 = read_i16( );
-      break;
-    }
-    case MPMarker::Int32: {
-      dr.size = sizeof( mp_i32 );
-      dr.result.as_i32 = read_i32( );
-      break;
-    }
-    case MPMarker::Int64: {
-      dr.size = sizeof( mp_i64 );
-      dr.result.as_i64 = read_i64( );
+    case 2:
+      marker = static_cast< mp_u8 >( MPMarker::FixExt2 );
       break;
-    }
-    case MPMarker::FixExt1: {
-      // spec: fixext 1 stores an integer and a byte array whose length is 1 byte
-      constexpr auto type_size = 2u;
-
-      dr.size = type_size;
-      dr.result.as_fixext1.type = read_u8( );
-      dr.result.as_fixext1.data = read_u8( );
-
+    case 4:
+      marker = static_cast< mp_u8 >( MPMarker::FixExt4 );
       break;
-    }
-    case MPMarker::FixExt2: {
-      // spec: fixext 2 stores an integer and a byte array whose length is 2 bytes
-      constexpr auto type_size = 3u;
-
-      dr.size = type_size;
-      dr.result.as_fixext2.type = read_u8( );
-
-      sr_.read( type_size - 1u, dr.result.as_fixext2.data );
-
+    case 8:
+      marker = static_cast< mp_u8 >( MPMarker::FixExt8 );
       break;
-    }
-    case MPMarker::FixExt4: {
-      // spec: fixext 4 stores an integer and a byte array whose length is 4 bytes
-      constexpr auto type_size = 5u;
-
-      dr.size = type_size;
-      dr.result.as_fixext4.type = read_u8( );
-
-      sr_.read( type_size - 1u, dr.result.as_fixext4.data );
-
+    case 16:
+      marker = static_cast< mp_u8 >( MPMarker::FixExt16 );
       break;
+    default:
+      return { };
     }
-    case MPMarker::FixExt8: {
-      // spec: fixext 8 stores an integer and a byte array whose length is 8 bytes
-      const auto type_size = 9u;
-
-      dr.size = type_size;
-      dr.result.as_fixext8.type = read_u8( );
-
-      sr_.read( type_size - 1u, dr.result.as_fixext8.data );
 
-      break;
-    }
-    case MPMarker::FixExt16: {
-      // spec: fixext 16 stores an integer and a byte array whose length is 16 bytes
-      const auto type_size = 17u;
+    const mp_u8 tag[ 2 ] = { marker, static_cast< mp_u8 >( type ) };
 
-      dr.size = type_size;
-      dr.result.as_fixext8.type = read_u8( );
+    return _intern( tag, 2, nullptr, 0 );
+  }
 
-      sr_.read( type_size - 1u, dr.result.as_fixext8.data );
+  /**
+   * @brief Store `count` bytes that are already MessagePack encoded.
+   */
+  PreEncoded encoded( const mp_u8 *bytes, const mp_u32 count ) {
+    return _intern( nullptr, 0, bytes, count );
+  }
 
-      break;
-    }
-    case MPMarker::Map16:
-    case MPMarker::Array16: {
-      dr.size = static_cast< mp_u32 >( read_u16( ) );
-      break;
-    }
-    case MPMarker::Map32:
-    case MPMarker::Array32: {
-      dr.size = read_u32( );
-      break;
-    }
-    }
+  /**
+   * @brief Encode a constant subtree once. `encoder` receives a `MessagePack` writing straight into
+   * free storage and may write any number of values.
+   * @return An empty fragment if `encoder` wrote nothing or ran out of space
+   */
+  template < typename Encoder > PreEncoded encode( Encoder &&encoder ) {
+    MessagePack pack{ };
 
-    // Edge cases are handled with lower priority to prevent type conflicts.
-    if ( !is_fixext( mk ) && dr.size == 0 ) {
-      if ( ( raw & 0x80 ) == 0 ) {
-        dr.marker = MPMarker::PosFixInt;
-        dr.size = sizeof( mp_u8 );
-        dr.result.as_u8 = static_cast< mp_u8 >( raw & 0x7f );
-        goto ret;
-      }
+    pack.initialize_streams( 0, Bytes - used_, storage_ + used_ );
+    encoder( pack );
 
-      if ( ( raw & 0xe0 ) == 0xe0 ) {
-        dr.marker = MPMarker::NegFixInt;
-        dr.size = sizeof( mp_i8 );
-        dr.result.as_i8 = static_cast< mp_i8 >( ( raw & 0x1F ) - 0x20 );
-        goto ret;
-      }
+    if ( !pack.good( ) ) return { };
 
-      if ( ( raw & 0x90 ) == 0x90 ) {
-        dr.marker = MPMarker::FixArray;
-        dr.size = static_cast< mp_u32 >( raw & 0xf );
-        goto ret;
-      }
+    return _intern( nullptr, 0, storage_ + used_, static_cast< mp_u32 >( pack.write_cursor( ) ) );
+  }
 
-      if ( ( raw & 0x80 ) == 0x80 ) {
-        dr.marker = MPMarker::FixMap;
-        dr.size = static_cast< mp_u32 >( raw & 0xf );
-        goto ret;
-      }
+  /**
+   * @brief Number of distinct fragments stored.
+   */
+  mp_u32 size( ) const { return count_; }
 
-      if ( ( raw & 0xa0 ) == 0xa0 ) {
-        dr.marker = MPMarker::FixStr;
-        dr.size = raw & 0x1flu;
+  /**
+   * @brief Number of storage bytes in use.
+   */
+  mp_u32 bytes_used( ) const { return used_; }
 
-        sr_.read( dr.size, dr.result.as_fixstr );
-      }
-    }
+  /**
+   * @brief Drop every fragment. Previously returned handles become invalid.
+   */
+  void reset( ) {
+    for ( auto &slot : slots_ )
+      slot = Slot{ };
 
-  ret:
-    return dr;
+    used_ = 0;
+    count_ = 0;
   }
 };
 } // namespace mp
+
+/**
+ * @brief Describe `member` of `type` for `mp::reflect::fields`, using the member name as key.
+ */
+#define MP_FIELD( type, member ) ::mp::reflect::field( #member, &type::member )
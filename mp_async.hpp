@@ -0,0 +1,272 @@
+#pragma once
+
+/*
+ * C++20 coroutine adapters for `mp.hpp`: `AsyncDecoder` pulls chunks from an asynchronous source
+ * whenever `IncrementalDecoder` runs dry, and `AsyncEncoder` hands its buffer to an asynchronous
+ * sink on `flush( )`. Neither knows about a particular event loop: sources and sinks are any types
+ * whose `read`/`write` return an awaitable, e.g. thin wrappers over asio or io_uring completions.
+ * Kept apart from the main header, which stays C++17.
+ *
+ * Results of `co_await` are always stored before being tested: GCC 12 miscompiles some coroutines
+ * that await inside an `if` or loop condition.
+ */
+
+#include "mp.hpp"
+
+#if !defined( __cpp_impl_coroutine )
+#error "mp_async.hpp requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception>
+
+namespace mp {
+/**
+ * @brief Lazily started coroutine returning a `Ty`. Awaiting it runs it to completion, resuming the
+ * awaiting coroutine by symmetric transfer; `start( )` runs it from ordinary code, e.g. to spawn a
+ * connection handler on an event loop, until its first suspension.
+ * @remark Nothing in this library throws; an escaping exception terminates.
+ */
+template < typename Ty > struct Task {
+  struct promise_type {
+    Ty                      value{ };
+    std::coroutine_handle<> continuation{ std::noop_coroutine( ) };
+
+    Task get_return_object( ) {
+      return Task{ std::coroutine_handle< promise_type >::from_promise( *this ) };
+    }
+
+    std::suspend_always initial_suspend( ) noexcept { return { }; }
+
+    struct FinalAwaiter {
+      bool await_ready( ) noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend( std::coroutine_handle< promise_type > self ) noexcept {
+        return self.promise( ).continuation;
+      }
+
+      void await_resume( ) noexcept { }
+    };
+
+    FinalAwaiter final_suspend( ) noexcept { return { }; }
+
+    void return_value( Ty result ) { value = static_cast< Ty && >( result ); }
+
+    void unhandled_exception( ) { std::terminate( ); }
+  };
+
+private:
+  std::coroutine_handle< promise_type > handle_{ };
+
+  explicit Task( const std::coroutine_handle< promise_type > handle ) : handle_( handle ) { }
+
+public:
+  Task( ) = default;
+
+  Task( Task &&other ) noexcept : handle_( other.handle_ ) { other.handle_ = nullptr; }
+
+  Task &operator=( Task &&other ) noexcept {
+    if ( this != &other ) {
+      if ( handle_ ) handle_.destroy( );
+      handle_ = other.handle_;
+      other.handle_ = nullptr;
+    }
+
+    return *this;
+  }
+
+  /* Disallow copies. */
+  Task( const Task &other ) = delete;
+  Task &operator=( const Task &other ) = delete;
+
+  ~Task( ) {
+    if ( handle_ ) handle_.destroy( );
+  }
+
+  /**
+   * @brief Run the coroutine until it first suspends or completes.
+   */
+  void start( ) {
+    if ( handle_ && !handle_.done( ) ) handle_.resume( );
+  }
+
+  bool done( ) const { return !handle_ || handle_.done( ); }
+
+  /**
+   * @brief Value returned by the coroutine. Only meaningful once `done( )`.
+   */
+  const Ty &result( ) const { return handle_.promise( ).value; }
+
+  bool await_ready( ) const { return done( ); }
+
+  std::coroutine_handle<> await_suspend( const std::coroutine_handle<> awaiting ) {
+    handle_.promise( ).continuation = awaiting;
+    return handle_;
+  }
+
+  Ty await_resume( ) { return static_cast< Ty && >( handle_.promise( ).value ); }
+};
+
+/**
+ * @brief Bytes delivered by an asynchronous source. An empty chunk means the input ended.
+ */
+struct InputChunk {
+  const mp_u8 *data{ nullptr };
+  mp_u32       size{ 0 };
+};
+
+/**
+ * @brief `IncrementalDecoder` over an asynchronous source, suspending whenever more input is
+ * needed. Chunks are decoded where the source delivered them: only value headers split across
+ * chunks are staged, and payloads can be taken in place with `payload( )`.
+ * @tparam Source Type with a `read( )` member returning an awaitable that yields an `InputChunk`.
+ * A chunk must stay valid until the next `read( )` is awaited
+ */
+template < typename Source > struct AsyncDecoder {
+private:
+  Source            &source_;
+  IncrementalDecoder decoder_{ };
+  bool               ended_{ false };
+
+  /**
+   * @brief Await the next chunk from the source; `false` once it ended.
+   */
+  Task< bool > _refill( ) {
+    if ( ended_ ) co_return false;
+
+    const InputChunk chunk = co_await source_.read( );
+
+    if ( !chunk.size ) {
+      ended_ = true;
+      co_return false;
+    }
+
+    decoder_.feed( chunk.data, chunk.size );
+    co_return true;
+  }
+
+public:
+  explicit AsyncDecoder( Source &source ) : source_( source ) { }
+
+  /* Disallow copies. */
+  AsyncDecoder( const AsyncDecoder &other ) = delete;
+  AsyncDecoder &operator=( const AsyncDecoder &other ) = delete;
+
+  /**
+   * @brief `true` once the source reported the end of the input.
+   */
+  bool ended( ) const { return ended_; }
+
+  /**
+   * @brief The synchronous decoder, e.g. for `payload_remaining( )`.
+   */
+  IncrementalDecoder &decoder( ) { return decoder_; }
+
+  /**
+   * @brief Decode the next value, reading from the source as often as needed. The payload of the
+   * previous value is skipped if it was not read.
+   * @param dr Receives the decoded value
+   * @return `false` if the input ended first, possibly in the middle of a value
+   */
+  Task< bool > next( MPDecodeResult &dr ) {
+    while ( decoder_.next( dr ) == DecodeStatus::NeedMore ) {
+      const bool fed = co_await _refill( );
+
+      if ( !fed ) co_return false;
+    }
+
+    co_return true;
+  }
+
+  /**
+   * @brief Next piece of the latest value's payload, without copying it: a view into the chunk it
+   * arrived in, valid until the next call on this decoder.
+   * @return An empty chunk once the payload was consumed or the input ended
+   */
+  Task< InputChunk > payload( ) {
+    InputChunk piece{ };
+
+    while ( decoder_.payload_remaining( ) ) {
+      piece.data = decoder_.view_payload( piece.size );
+
+      if ( piece.size ) break;
+
+      const bool fed = co_await _refill( );
+
+      if ( !fed ) break;
+    }
+
+    co_return piece;
+  }
+
+  /**
+   * @brief Copy the next `size` bytes of the latest value's payload into `dst`.
+   * @return Number of bytes copied, short only if the payload or the input ended
+   */
+  Task< mp_u32 > read_payload( mp_u8 *dst, const mp_u32 size ) {
+    mp_u32 copied = 0;
+
+    while ( copied < size && decoder_.payload_remaining( ) ) {
+      copied += decoder_.read_payload( dst + copied, size - copied );
+
+      if ( copied == size || !decoder_.payload_remaining( ) ) break;
+
+      const bool fed = co_await _refill( );
+
+      if ( !fed ) break;
+    }
+
+    co_return copied;
+  }
+};
+
+/**
+ * @brief `Encoder` whose buffer is handed to an asynchronous sink on `flush( )`. Existing handlers
+ * taking an `Encoder &` write into it unchanged; nothing is copied between them and the sink.
+ * @tparam Sink Type with a `write( const mp_u8 *data, mp_u32 size )` member returning an awaitable
+ * that yields `true` once all of `data` was accepted. `data` stays untouched until then
+ */
+template < typename Sink > struct AsyncEncoder : Encoder {
+private:
+  Sink &sink_;
+
+public:
+  /**
+   * @param sink Destination of every flush
+   * @param buffer Output buffer, not owned, e.g. memory registered with the event loop
+   * @param size Size, in bytes, of `buffer`
+   */
+  AsyncEncoder( Sink &sink, mp_u8 *buffer, const mp_size size )
+      : Encoder( buffer, size ), sink_( sink ) { }
+
+  /**
+   * @brief Hand everything written since the last flush to the sink, then rewind the buffer. The
+   * bytes go out in order, in as many `write` calls of at most `max_write` bytes as needed: with
+   * `MP_LARGE_STREAMS` the buffer may hold more than a single `mp_u32` sized write.
+   * @param max_write Largest size passed to one `write`, e.g. a socket's send limit. 0 means no
+   * limit beyond that of `mp_u32`
+   * @return `false`, sending nothing, if an encode failed since the last flush (see `error( )`);
+   * `false`, leaving the buffer as it is, if the sink did not accept a write
+   */
+  Task< bool > flush( const mp_u32 max_write = limits::uint32_max ) {
+    if ( !good( ) ) co_return false;
+
+    const mp_size end = write_cursor( );
+    const mp_u32  slice = max_write ? max_write : limits::uint32_max;
+
+    for ( mp_size sent = 0; sent < end; ) {
+      const auto left = end - sent;
+      const auto size = left < slice ? static_cast< mp_u32 >( left ) : slice;
+
+      const bool accepted = co_await sink_.write( stream_buffer( ) + sent, size );
+
+      if ( !accepted ) co_return false;
+
+      sent += size;
+    }
+
+    reset( );
+    co_return true;
+  }
+};
+} // namespace mp
@@ -0,0 +1,580 @@
+#pragma once
+
+/*
+ * Memory-mapped file backends for `mp.hpp`. Kept apart from the main header, which stays OS
+ * agnostic; this one requires POSIX `mmap`.
+ */
+
+#include "mp.hpp"
+
+#if defined( _WIN32 )
+#error "mp_mmap.hpp requires POSIX mmap"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mp {
+/**
+ * @brief Access pattern announced to the kernel through `madvise` for every mapped window.
+ */
+enum class MapAccess : mp_u8 {
+  Sequential, // MADV_SEQUENTIAL: aggressive read-ahead, pages dropped soon after use
+  Random      // MADV_RANDOM: no read-ahead
+};
+
+namespace detail {
+inline mp_u64 page_size( ) {
+  static const auto size = static_cast< mp_u64 >( sysconf( _SC_PAGESIZE ) );
+  return size;
+}
+
+inline mp_u64 round_to_page( const mp_u64 value ) {
+  return ( value + page_size( ) - 1 ) & ~( page_size( ) - 1 );
+}
+
+inline void advise( void *address, const mp_u64 length, const MapAccess access ) {
+  madvise( address, length, access == MapAccess::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM );
+}
+
+/*
+ * A window never exceeds what a stream can address: 4 GB unless `MP_LARGE_STREAMS` is defined.
+ */
+constexpr mp_u64 max_window = static_cast< mp_size >( ~mp_size{ 0 } );
+} // namespace detail
+
+/**
+ * @brief Read-only view of a file of any size through a sliding window. Values are decoded in
+ * place from the mapping; nothing is copied into user space. The window moves forward as the
+ * cursor approaches its end and widens when a single value does not fit.
+ *
+ * `pack( )` exposes the `MessagePack` of the current window for everything else (`find_key`,
+ * `read_typed_array`, ...). Pointers obtained from it, including `decode_view` results, are only
+ * valid until the next call that may move the window. The mapping is read-only, do not write
+ * through `pack( )`.
+ */
+struct MappedReader {
+private:
+  int    fd_{ -1 };
+  mp_u64 file_size_{ 0 };
+
+  mp_u8 *map_{ nullptr };
+  mp_u64 map_offset_{ 0 };
+  mp_u64 map_length_{ 0 };
+
+  mp_u64    window_{ 0x4000000 };
+  MapAccess access_{ MapAccess::Sequential };
+
+  MessagePack pack_{ };
+
+  mp_u64 _end( ) const { return map_offset_ + map_length_; }
+
+  void _unmap( ) {
+    // Not `reset_all( )`: zeroing the stream would write to the read-only mapping.
+    pack_.initialize_streams( 0, 0, nullptr );
+
+    if ( map_ ) munmap( map_, map_length_ );
+
+    map_ = nullptr;
+    map_length_ = 0;
+  }
+
+  /**
+   * @brief Map a window holding at least `length` bytes from `position`, or up to the end of the
+   * file, and put the cursor on `position`.
+   */
+  bool _map( const mp_u64 position, const mp_u64 length ) {
+    _unmap( );
+
+    const auto offset = position & ~( detail::page_size( ) - 1 );
+
+    auto size = position - offset + length;
+
+    if ( size < window_ ) size = window_;
+    if ( size > file_size_ - offset ) size = file_size_ - offset;
+    if ( size > detail::max_window ) size = detail::max_window;
+
+    if ( !size ) {
+      map_offset_ = position;
+      return position == file_size_;
+    }
+
+    map_offset_ = offset;
+
+    const auto address =
+        mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd_, static_cast< off_t >( offset ) );
+
+    if ( address == MAP_FAILED ) return false;
+
+    map_ = static_cast< mp_u8 * >( address );
+    map_length_ = size;
+
+    detail::advise( map_, map_length_, access_ );
+
+    pack_.initialize_streams(
+        static_cast< mp_size >( position - offset ), static_cast< mp_size >( size ), map_
+    );
+
+    return true;
+  }
+
+  template < bool view > MPDecodeResult _decode( ) {
+    const auto start = position( );
+
+    // Large enough for the biggest header: a 31 byte FixStr.
+    ensure( 0x20 );
+
+    auto dr = view ? pack_.decode_view( ) : pack_.decode_single( );
+
+    if ( !dr.truncated || _end( ) >= file_size_ ) return dr;
+
+    /*
+     * The payload continues past the window. The cursor sits right after the header (or the
+     * extension type), so this is exactly the room needed to decode the value in one piece; not a
+     * byte more, or a value ending on the last byte of the file could never be mapped whole.
+     */
+    const auto length = position( ) - start + dr.size;
+
+    if ( !seek( start ) || !ensure( length ) ) return dr;
+
+    return view ? pack_.decode_view( ) : pack_.decode_single( );
+  }
+
+public:
+  MappedReader( ) = default;
+
+  explicit MappedReader( const char *path ) { open( path ); }
+
+  ~MappedReader( ) { close( ); }
+
+  /* Disallow copies. */
+  MappedReader( MappedReader &other ) = delete;
+  MappedReader &operator=( MappedReader &other ) = delete;
+
+  explicit operator bool( ) const { return fd_ >= 0; }
+
+  /**
+   * @brief Open `path` and map the first window.
+   * @return `false` if the file cannot be opened or mapped
+   */
+  bool open( const char *path ) {
+    close( );
+
+    fd_ = ::open( path, O_RDONLY );
+
+    if ( fd_ < 0 ) return false;
+
+    struct stat info{ };
+
+    if ( fstat( fd_, &info ) != 0 ) {
+      close( );
+      return false;
+    }
+
+    file_size_ = static_cast< mp_u64 >( info.st_size );
+
+    if ( !_map( 0, 0 ) ) {
+      close( );
+      return false;
+    }
+
+    return true;
+  }
+
+  void close( ) {
+    _unmap( );
+
+    if ( fd_ >= 0 ) ::close( fd_ );
+
+    fd_ = -1;
+    file_size_ = 0;
+    map_offset_ = 0;
+  }
+
+  /**
+   * @brief Minimum size of the mapped window, rounded up to whole pages. Takes effect on the next
+   * move of the window.
+   */
+  MappedReader &set_window( const mp_u64 size ) {
+    window_ = size ? detail::round_to_page( size ) : detail::page_size( );
+    if ( window_ > detail::max_window )
+      window_ = detail::max_window & ~( detail::page_size( ) - 1 );
+    return *this;
+  }
+
+  MappedReader &set_access( const MapAccess access ) {
+    access_ = access;
+    if ( map_ ) detail::advise( map_, map_length_, access_ );
+    return *this;
+  }
+
+  /**
+   * @brief Size of the file, in bytes.
+   */
+  mp_u64 size( ) const { return file_size_; }
+
+  /**
+   * @brief Absolute position of the cursor in the file.
+   */
+  mp_u64 position( ) const { return map_offset_ + pack_.read_cursor( ); }
+
+  bool eof( ) const { return position( ) >= file_size_; }
+
+  /**
+   * @brief Move the cursor to the absolute `position`, remapping if it lies outside the window.
+   * @return `false` if `position` lies past the end of the file
+   */
+  bool seek( const mp_u64 position ) {
+    if ( position > file_size_ ) return false;
+
+    if ( map_ && position >= map_offset_ && position <= _end( ) )
+      return pack_.seek_read_cursor( static_cast< mp_size >( position - map_offset_ ) );
+
+    return _map( position, 0 );
+  }
+
+  /**
+   * @brief Make sure the `count` bytes after the cursor are mapped, sliding the window if needed.
+   * @return `false` if the file ends before
+   */
+  bool ensure( const mp_u64 count ) {
+    const auto cursor = position( );
+
+    if ( cursor + count <= _end( ) ) return true;
+    if ( _end( ) < file_size_ && !_map( cursor, count ) ) return false;
+
+    return cursor + count <= _end( );
+  }
+
+  /**
+   * @brief `decode_single` on the file. A value truncated by the window is decoded again from a
+   * wider one, so `truncated` is only set at the end of the file.
+   */
+  MPDecodeResult decode_single( ) { return _decode< false >( ); }
+
+  /**
+   * @brief `decode_view` on the file: Str/Bin/Ext payloads point into the mapping.
+   */
+  MPDecodeResult decode_view( ) { return _decode< true >( ); }
+
+  /**
+   * @brief `skip_value` on the file, widening the window until the value fits.
+   */
+  bool skip_value( ) {
+    const auto start = position( );
+
+    for ( ;; ) {
+      if ( pack_.skip_value( ) ) return true;
+      if ( _end( ) >= file_size_ || map_length_ >= detail::max_window ) return false;
+
+      pack_.clear_error( );
+
+      if ( !_map( start, map_length_ * 2 ) ) return false;
+    }
+  }
+
+  /**
+   * @brief Encoder/decoder over the current window.
+   */
+  MessagePack &pack( ) { return pack_; }
+};
+
+/**
+ * @brief Writer backend appending to a file through mapped windows. Plug it into
+ * `BasicMessagePack` (see `MappedMessagePack`) and open the file with `writer( ).open( )` after
+ * `initialize_streams( )`. The file grows a window at a time and is trimmed to the bytes written
+ * on `close( )`.
+ * @remark Failures to grow or map the file raise `error::no_memory` and drop the write.
+ */
+struct MappedStreamWriter {
+private:
+  int    fd_{ -1 };
+  mp_u64 size_{ 0 };
+
+  mp_u8 *map_{ nullptr };
+  mp_u64 map_offset_{ 0 };
+  mp_u64 map_length_{ 0 };
+
+  mp_u64    window_{ 0x4000000 };
+  MapAccess access_{ MapAccess::Sequential };
+  mp_u8     error_{ stream::error::none };
+
+  mp_u64 _available( ) const { return map_ ? map_offset_ + map_length_ - size_ : 0; }
+
+  void _unmap( ) {
+    if ( map_ ) munmap( map_, map_length_ );
+
+    map_ = nullptr;
+    map_length_ = 0;
+  }
+
+  /**
+   * @brief Map a writable window holding at least `length` bytes from the end of the data,
+   * growing the file to cover it.
+   */
+  bool _map( const mp_u64 length ) {
+    _unmap( );
+
+    const auto offset = size_ & ~( detail::page_size( ) - 1 );
+
+    auto size = detail::round_to_page( size_ - offset + length );
+
+    if ( size < window_ ) size = window_;
+
+    if ( fd_ < 0 || ftruncate( fd_, static_cast< off_t >( offset + size ) ) != 0 ) return false;
+
+    const auto address = mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast< off_t >( offset )
+    );
+
+    if ( address == MAP_FAILED ) return false;
+
+    map_ = static_cast< mp_u8 * >( address );
+    map_offset_ = offset;
+    map_length_ = size;
+
+    detail::advise( map_, map_length_, access_ );
+
+    return true;
+  }
+
+  void _write_and_advance( mp_u32 count, const mp_u8 *src ) {
+    if ( !count ) return;
+
+    if ( mp_unlikely( !src || fd_ < 0 ) ) {
+      stats::write_failed( stream::error::unavailable, count );
+      error_ |= stream::error::unavailable;
+      return;
+    }
+
+    while ( count ) {
+      if ( !_available( ) && !_map( count ) ) {
+        stats::write_failed( stream::error::no_memory, count );
+        error_ |= stream::error::no_memory;
+        return;
+      }
+
+      const auto available = _available( );
+      const auto length = count < available ? count : static_cast< mp_u32 >( available );
+
+      mmcpy( map_ + ( size_ - map_offset_ ), src, length );
+
+      size_ += length;
+      src += length;
+      count -= length;
+    }
+  }
+
+public:
+  /* Windows move as the file grows, so reserved bytes cannot be written later on. */
+  static constexpr bool stable = false;
+  static constexpr bool contiguous = false;
+
+  MappedStreamWriter( ) = default;
+
+  ~MappedStreamWriter( ) { close( ); }
+
+  /* Disallow copies. */
+  MappedStreamWriter( MappedStreamWriter &other ) = delete;
+  MappedStreamWriter &operator=( MappedStreamWriter &other ) = delete;
+
+  explicit operator bool( ) const { return fd_ >= 0; }
+
+  /**
+   * @brief Create or open `path` for writing.
+   * @param path File to write
+   * @param append Keep the current content and append to it, instead of truncating the file
+   * @return `false` if the file cannot be opened
+   */
+  bool open( const char *path, const bool append = false ) {
+    close( );
+
+    fd_ = ::open( path, O_RDWR | O_CREAT | ( append ? 0 : O_TRUNC ), 0644 );
+
+    if ( fd_ < 0 ) return false;
+
+    struct stat info{ };
+
+    if ( fstat( fd_, &info ) != 0 ) {
+      close( );
+      return false;
+    }
+
+    size_ = append ? static_cast< mp_u64 >( info.st_size ) : 0;
+    error_ = stream::error::none;
+
+    return true;
+  }
+
+  /**
+   * @brief Unmap the window, trim the file to the bytes written and close it.
+   */
+  void close( ) {
+    _unmap( );
+
+    if ( fd_ >= 0 ) {
+      if ( ftruncate( fd_, static_cast< off_t >( size_ ) ) != 0 ) {
+        stats::write_failed( stream::error::no_memory, 0 );
+        error_ |= stream::error::no_memory;
+      }
+      ::close( fd_ );
+    }
+
+    fd_ = -1;
+    size_ = 0;
+  }
+
+  /**
+   * @brief Schedule the written pages for writeback without waiting (`msync( MS_ASYNC )`).
+   */
+  void flush( ) {
+    if ( map_ ) msync( map_, map_length_, MS_ASYNC );
+  }
+
+  /**
+   * @brief Minimum size of the mapped window, rounded up to whole pages.
+   */
+  MappedStreamWriter &set_window( const mp_u64 size ) {
+    window_ = size ? detail::round_to_page( size ) : detail::page_size( );
+    return *this;
+  }
+
+  MappedStreamWriter &set_access( const MapAccess access ) {
+    access_ = access;
+    return *this;
+  }
+
+  /**
+   * @brief Number of bytes in the file, truncated to `mp_size`. See `size( )`.
+   */
+  mp_size position( ) const { return static_cast< mp_size >( size_ ); }
+
+  /**
+   * @brief Number of bytes in the file.
+   */
+  mp_u64 size( ) const { return size_; }
+
+  mp_u8 error( ) const { return error_; }
+
+  bool good( ) const { return error_ == stream::error::none; }
+
+  void clear_error( ) { error_ = stream::error::none; }
+
+  void fail( const mp_u8 flags ) {
+    stats::write_failed( flags, 0 );
+    error_ |= flags;
+  }
+
+  /*
+   * Stream management as driven by `BasicMessagePack`. The file is chosen with `open( )`; `set`
+   * only clears the error flags, the resets close the file.
+   */
+
+  MappedStreamWriter &set(
+      const mp_size = 0, const mp_size = 0, mp_u8 * = nullptr, const stream::MemoryWriter = nullptr
+  ) {
+    error_ = stream::error::none;
+    return *this;
+  }
+
+  void reset( ) {
+    close( );
+    error_ = stream::error::none;
+  }
+
+  void reset_temporal( ) { reset( ); }
+
+  /**
+   * @brief Discard everything written and start again at the beginning of the file.
+   */
+  void reset_cursor( ) {
+    _unmap( );
+    size_ = 0;
+    error_ = stream::error::none;
+  }
+
+  void clear( ) { reset_cursor( ); }
+
+  template < typename Ty > void write_pod( const Ty value ) {
+    _write_and_advance( sizeof( Ty ), reinterpret_cast< const mp_u8 * >( &value ) );
+  }
+
+  MappedStreamWriter &write_u8( const mp_u8 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_i8( const mp_i8 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_u16( const mp_u16 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_i16( const mp_i16 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_u32( const mp_u32 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_i32( const mp_i32 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_u64( const mp_u64 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write_i64( const mp_i64 value ) {
+    write_pod( value );
+    return *this;
+  }
+
+  MappedStreamWriter &write( const mp_u32 count, mp_u8 *src ) {
+    _write_and_advance( count, src );
+    return *this;
+  }
+
+  /**
+   * @brief Claim the next `count` bytes for direct writing, remapping so they are contiguous.
+   * @return Pointer to the first claimed byte or `nullptr` if the file could not grow
+   */
+  mp_u8 *reserve( const mp_u32 count ) {
+    if ( mp_unlikely( fd_ < 0 ) ) {
+      stats::write_failed( stream::error::unavailable, count );
+      error_ |= stream::error::unavailable;
+      return nullptr;
+    }
+
+    if ( _available( ) < count && !_map( count ) ) {
+      stats::write_failed( stream::error::no_memory, count );
+      error_ |= stream::error::no_memory;
+      return nullptr;
+    }
+
+    const auto start = map_ + ( size_ - map_offset_ );
+
+    size_ += count;
+
+    return start;
+  }
+
+  void unreserve( const mp_u32 count ) { size_ -= count; }
+};
+
+/**
+ * @brief Encoder appending to a memory-mapped file. See `MappedStreamWriter`.
+ */
+using MappedMessagePack = BasicMessagePack< stream::InlineCopy, MappedStreamWriter >;
+} // namespace mp
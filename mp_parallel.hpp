@@ -0,0 +1,363 @@
+#pragma once
+
+/*
+ * Multi-threaded companions to `mp.hpp`: parallel decoding of framed batches (a batch is a buffer
+ * of concatenated top-level messages) and a lock-free ring that many producer threads encode into.
+ * Kept apart from the main header so that only their users pull in `<atomic>` and `<thread>`.
+ */
+
+#include "mp.hpp"
+
+#include <atomic>
+#include <thread>
+
+namespace mp {
+/**
+ * @brief Message boundaries of a batch, as found by `split_batch`. Message `i` spans
+ * `[ start( i ), start( i ) + size( i ) )` of `buffer`.
+ */
+struct Batch {
+  const mp_u8   *buffer{ nullptr };
+  const mp_size *offsets{ nullptr }; // Start of every message, `count` entries
+  mp_size        count{ 0 };
+  mp_size        end{ 0 }; // One past the last complete message
+
+  mp_size start( const mp_size index ) const { return offsets[ index ]; }
+
+  mp_size size( const mp_size index ) const {
+    return ( index + 1 < count ? offsets[ index + 1 ] : end ) - offsets[ index ];
+  }
+
+  /**
+   * @brief `true` if the whole buffer of `size` bytes was split into messages, i.e. it neither
+   * ends with a partial message nor holds more messages than `offsets` had room for.
+   */
+  bool complete( const mp_size size ) const { return end == size; }
+};
+
+/**
+ * @brief Find the messages of a batch with `skip_value`, without decoding them.
+ * @param buffer Concatenated messages
+ * @param size Size, in bytes, of `buffer`
+ * @param offsets Receives the start offset of every message
+ * @param capacity Number of elements of `offsets`
+ * @return The boundaries of the complete messages found, at most `capacity`. A truncated or
+ * malformed message ends the split; `Batch::end` tells where.
+ */
+inline Batch split_batch(
+    const mp_u8 *buffer, const mp_size size, mp_size *offsets, const mp_size capacity
+) {
+  Decoder decoder{ buffer, size };
+  Batch   batch{ buffer, offsets, 0, 0 };
+
+  while ( batch.count < capacity && decoder.read_cursor( ) < size ) {
+    const auto start = decoder.read_cursor( );
+
+    if ( !decoder.skip_value( ) ) break;
+
+    offsets[ batch.count++ ] = start;
+    batch.end = decoder.read_cursor( );
+  }
+
+  return batch;
+}
+
+namespace detail {
+/*
+ * Messages still to be handed out by one worker. The owner and thieves all claim with `fetch_add`
+ * on `next`, so a claim never needs a lock; claims landing past `end` are simply empty.
+ */
+struct alignas( 0x40 ) BatchRange {
+  std::atomic< mp_u64 > next{ 0 };
+  mp_u64                end{ 0 };
+};
+} // namespace detail
+
+/**
+ * @brief Largest number of threads `decode_batch` runs, the caller's included.
+ */
+constexpr mp_u32 max_batch_workers = 0x40;
+
+/**
+ * @brief Decode the messages of `batch` on a small work-stealing pool. Each worker owns an equal
+ * share of the messages and, once done, steals from the others. Every message gets its own
+ * `Decoder`, a read-only cursor over the shared buffer limited to the message's bytes (positions
+ * stay those of the whole batch), and is handed to `callback( index, decoder )`.
+ * @remark `callback` runs concurrently on several threads. It returns `false` to report a message
+ * it failed to decode; the remaining messages are still decoded.
+ * @param batch Boundaries returned by `split_batch`
+ * @param callback Invocable as `bool( mp_size index, Decoder &decoder )`
+ * @param workers Number of threads, the calling one included. 0 picks the hardware concurrency
+ * @return `true` if every callback returned `true`
+ */
+template < typename Callback >
+bool decode_batch( const Batch &batch, Callback &&callback, mp_u32 workers = 0 ) {
+  if ( !workers ) workers = std::thread::hardware_concurrency( );
+  if ( !workers ) workers = 1;
+  if ( workers > max_batch_workers ) workers = max_batch_workers;
+  if ( workers > batch.count ) workers = batch.count ? static_cast< mp_u32 >( batch.count ) : 1;
+
+  detail::BatchRange ranges[ max_batch_workers ];
+
+  for ( mp_u32 index = 0; index < workers; ++index ) {
+    const auto first = mp_u64{ batch.count } * index / workers;
+
+    ranges[ index ].next.store( first, std::memory_order_relaxed );
+    ranges[ index ].end = mp_u64{ batch.count } * ( index + 1 ) / workers;
+  }
+
+  // Small enough to balance uneven messages, large enough to keep the shared counters cold.
+  const auto grain = batch.count / ( mp_u64{ workers } * 0x10 ) + 1;
+
+  std::atomic< bool > failed{ false };
+
+  const auto run = [ & ]( const mp_u32 self ) {
+    Decoder decoder{ };
+
+    for ( mp_u32 offset = 0; offset < workers; ++offset ) {
+      auto &range = ranges[ ( self + offset ) % workers ];
+
+      for ( ;; ) {
+        const auto first = range.next.fetch_add( grain, std::memory_order_relaxed );
+
+        if ( first >= range.end ) break;
+
+        const auto last = first + grain < range.end ? first + grain : range.end;
+
+        for ( auto index = static_cast< mp_size >( first ); index < last; ++index ) {
+          decoder.reset(
+              batch.buffer, batch.start( index ) + batch.size( index ), batch.start( index )
+          );
+
+          if ( !callback( index, decoder ) ) failed.store( true, std::memory_order_relaxed );
+        }
+      }
+    }
+  };
+
+  std::thread threads[ max_batch_workers - 1 ];
+
+  for ( mp_u32 index = 1; index < workers; ++index )
+    threads[ index - 1 ] = std::thread( run, index );
+
+  run( 0 );
+
+  for ( mp_u32 index = 1; index < workers; ++index )
+    threads[ index - 1 ].join( );
+
+  return !failed.load( );
+}
+
+/**
+ * @brief Lock-free ring of encoded messages, written by any number of producer threads and read by
+ * a single consumer, e.g. an I/O thread.
+ *
+ * A producer claims a slot with `reserve( pack, size )`, which points `pack` at `size` bytes of
+ * ring memory, encodes into it with the usual `write_*` calls and makes it visible with
+ * `publish( pack )`. The consumer collects published messages in order with `peek` as `stream::Segment`s
+ * pointing into the ring, ready for `writev`, and hands them back with `release`.
+ *
+ * Every slot starts with an 8-byte header whose state word turns non-zero on publication. The
+ * consumer zeroes the memory it releases, so unpublished slots always read as pending; this keeps
+ * producers free of any handshake beyond one compare-and-swap on the reservation counter. A slot
+ * never wraps: when the space before the end of the ring is too short, a padding slot fills it.
+ * @remark The ring does not own its buffer, which must stay alive and untouched while in use.
+ */
+struct EncoderRing {
+private:
+  static constexpr mp_u32 header_size = 8;
+  static constexpr mp_u32 published = 0x80000000u;
+  static constexpr mp_u32 padding = 0x40000000u;
+  static constexpr mp_u32 length_mask = 0x3fffffffu;
+
+  static_assert(
+      sizeof( std::atomic< mp_u32 > ) == sizeof( mp_u32 ) &&
+          std::atomic< mp_u32 >::is_always_lock_free,
+      "Slot headers overlay ring memory"
+  );
+
+  mp_u8 *buffer_{ nullptr };
+  mp_u64 size_{ 0 };
+
+  alignas( 0x40 ) std::atomic< mp_u64 > head_{ 0 }; // Reservations, shared by the producers
+  alignas( 0x40 ) std::atomic< mp_u64 > tail_{ 0 }; // Released bytes, written by the consumer
+  mp_u64 peeked_{ 0 };                              // Consumer only: where `peek` stopped
+
+  std::atomic< mp_u32 > &_state( const mp_u64 position ) const {
+    return *reinterpret_cast< std::atomic< mp_u32 > * >( buffer_ + ( position & ( size_ - 1 ) ) );
+  }
+
+  mp_u32 &_reserved( const mp_u64 position ) const {
+    return *reinterpret_cast< mp_u32 * >( buffer_ + ( position & ( size_ - 1 ) ) + 4 );
+  }
+
+  static mp_u64 _slot_size( const mp_u32 size ) {
+    return header_size + ( ( size + 7ull ) & ~7ull );
+  }
+
+public:
+  EncoderRing( ) = default;
+
+  /**
+   * @param buffer Ring memory, 8-byte aligned. Zeroed here
+   * @param size Size, in bytes, of `buffer`. A power of two, at least 16
+   */
+  EncoderRing( mp_u8 *buffer, const mp_u64 size ) { set( buffer, size ); }
+
+  /* Disallow copies. */
+  EncoderRing( EncoderRing &other ) = delete;
+  EncoderRing &operator=( EncoderRing &other ) = delete;
+
+  /**
+   * @brief Attach the ring to `buffer` and empty it. Not thread safe: no producer or consumer may
+   * be active.
+   * @return `false`, leaving the ring unusable, if `size` is not a power of two of at least 16
+   */
+  bool set( mp_u8 *buffer, const mp_u64 size ) {
+    const auto valid = buffer && size >= 0x10 && !( size & ( size - 1 ) );
+
+    buffer_ = valid ? buffer : nullptr;
+    size_ = valid ? size : 0;
+    head_.store( 0, std::memory_order_relaxed );
+    tail_.store( 0, std::memory_order_relaxed );
+    peeked_ = 0;
+
+    if ( valid ) mmset( buffer_, 0, size_ );
+
+    return valid;
+  }
+
+  explicit operator bool( ) const { return buffer_ != nullptr; }
+
+  /**
+   * @brief Largest message that can always be reserved once the ring drains. Slots never wrap, so
+   * a slot reached by padding to the end of the ring must fit in the other half.
+   */
+  mp_u32 max_message( ) const {
+    const auto max = size_ / 2 > header_size ? size_ / 2 - header_size : 0;
+
+    return static_cast< mp_u32 >( max < length_mask ? max : length_mask );
+  }
+
+  /**
+   * @brief Producer side: claim a slot of `size` bytes and point `pack` at it. Writes beyond `size`
+   * fail like any stream overflow.
+   * @param pack Encoder owned by the calling thread, e.g. one per producer
+   * @param size Worst-case size of the message, see `max_message( )`
+   * @return `false`, leaving `pack` untouched, if the ring is too full
+   */
+  bool reserve( MessagePack &pack, const mp_u32 size ) {
+    if ( !buffer_ || size > max_message( ) ) return false;
+
+    const auto slot = _slot_size( size );
+
+    auto   head = head_.load( std::memory_order_relaxed );
+    mp_u64 pad = 0;
+
+    for ( ;; ) {
+      const auto offset = head & ( size_ - 1 );
+
+      pad = size_ - offset < slot ? size_ - offset : 0;
+
+      if ( head + pad + slot - tail_.load( std::memory_order_acquire ) > size_ ) return false;
+
+      if ( head_.compare_exchange_weak( head, head + pad + slot, std::memory_order_relaxed ) )
+        break;
+    }
+
+    if ( pad ) {
+      _reserved( head ) = static_cast< mp_u32 >( pad - header_size );
+      _state( head ).store( published | padding, std::memory_order_release );
+    }
+
+    const auto start = head + pad;
+
+    _reserved( start ) = static_cast< mp_u32 >( slot - header_size );
+    pack.initialize_streams( 0, size, buffer_ + ( start & ( size_ - 1 ) ) + header_size );
+
+    return true;
+  }
+
+  /**
+   * @brief Producer side: publish the slot `pack` was pointed at by `reserve`, holding the
+   * `write_cursor( )` bytes written so far. A slot whose writes failed is published as padding
+   * instead, so the consumer skips it.
+   * @return `false` if the message was dropped because it did not fit its slot
+   */
+  bool publish( MessagePack &pack ) {
+    if ( !pack.stream_buffer( ) ) return false;
+
+    const auto header = pack.stream_buffer( ) - header_size;
+    const auto good = pack.good( );
+    const auto state = good ? published | static_cast< mp_u32 >( pack.write_cursor( ) )
+                            : published | padding;
+
+    reinterpret_cast< std::atomic< mp_u32 > * >( header )->store(
+        state, std::memory_order_release
+    );
+    pack.initialize_streams( );
+
+    return good;
+  }
+
+  /**
+   * @brief Producer side: give up a reserved slot without publishing anything.
+   */
+  void cancel( MessagePack &pack ) {
+    pack.writer( ).fail( stream::error::overflow );
+    publish( pack );
+  }
+
+  /**
+   * @brief Consumer side: collect, in publication order, up to `max` published messages following
+   * those already peeked. Stops at the first slot still being written.
+   * @param out Receives a `stream::Segment` per message, pointing into the ring
+   * @param max Capacity of `out`
+   * @return Number of segments written to `out`
+   */
+  mp_u64 peek( stream::Segment *out, const mp_u64 max ) {
+    mp_u64 count = 0;
+
+    while ( buffer_ && count < max ) {
+      const auto state = _state( peeked_ ).load( std::memory_order_acquire );
+
+      if ( !( state & published ) ) break;
+
+      const auto next = peeked_ + header_size + _reserved( peeked_ );
+
+      if ( !( state & padding ) ) {
+        out[ count++ ] = stream::Segment{
+            buffer_ + ( peeked_ & ( size_ - 1 ) ) + header_size, mp_u64{ state & length_mask }
+        };
+      }
+
+      peeked_ = next;
+    }
+
+    return count;
+  }
+
+  /**
+   * @brief Consumer side: hand back every slot up to the end of the last `peek`, invalidating the
+   * segments it returned.
+   */
+  void release( ) {
+    const auto tail = tail_.load( std::memory_order_relaxed );
+
+    if ( peeked_ == tail ) return;
+
+    const auto first = tail & ( size_ - 1 );
+    const auto length = peeked_ - tail;
+
+    // Slots never wrap, but the released range as a whole may.
+    if ( first + length > size_ ) {
+      mmset( buffer_ + first, 0, size_ - first );
+      mmset( buffer_, 0, length - ( size_ - first ) );
+    } else {
+      mmset( buffer_ + first, 0, length );
+    }
+
+    tail_.store( peeked_, std::memory_order_release );
+  }
+};
+} // namespace mp
@@ -1,9 +1,42 @@
-#define _WIN32_LEAN_AND_MEAN
-#include <Windows.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
 
 #include "mp.hpp"
+#include "mp_parallel.hpp"
 #include "gtest/gtest.h"
 
+#if __has_include( <sys/mman.h> )
+#include "mp_mmap.hpp"
+#include <unistd.h>
+#define MP_TEST_MMAP
+#endif
+
+#if defined( __cpp_impl_coroutine ) && __has_include( <coroutine> )
+#include "mp_async.hpp"
+#include <utility>
+#define MP_TEST_ASYNC
+#endif
+
+#if defined( __has_feature )
+#if __has_feature( address_sanitizer ) || __has_feature( undefined_behavior_sanitizer )
+#define MP_TEST_SANITIZED
+#endif
+#endif
+
+/*
+ * `stream::MemoryReader`/`MemoryWriter` passed to the fixtures; `memcpy` itself has another type.
+ */
+static void copy( void *dst, const void *src, const mp::mp_u64 size )
+{
+    memcpy( dst, src, size );
+}
+
 namespace integers
 {
     class IntegerFixture : public testing::Test
@@ -14,12 +47,7 @@ namespace integers
 
         IntegerFixture( )
         {
-            const auto buffer = VirtualAlloc(
-                nullptr,
-                0x200,
-                MEM_COMMIT,
-                PAGE_READWRITE
-            );
+            const auto buffer = std::malloc( 0x200 );
 
             memset( buffer, 0, 0x200 );
 
@@ -27,8 +55,8 @@ namespace integers
                 0,
                 0x200,
                 static_cast< unsigned char* >( buffer ),
-                reinterpret_cast< stream::MemoryReader >( &std::memcpy ),
-                reinterpret_cast< stream::MemoryWriter >( &std::memcpy )
+                &copy,
+                &copy
             );
         }
 
@@ -37,7 +65,7 @@ namespace integers
             const auto stream_buf = mpack.stream_buffer ( );
 
             mpack.reset_all ( );
-            VirtualFree( stream_buf, 0, MEM_RELEASE );
+            std::free( stream_buf );
         }
     };
 
@@ -85,6 +113,74 @@ namespace integers
     }
 }
 
+namespace floats
+{
+    TEST( Floats, RoundTrip )
+    {
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        mpack.write_f32( 1.5f ).write_f64( -2.25 ).write_float( 0.5 ).write_float( 0.1 );
+
+        /* 5 + 9 + 5 + 9 */
+        EXPECT_EQ( mpack.write_cursor( ), 28 );
+        EXPECT_EQ( buffer[ 0 ], 0xca );
+        EXPECT_EQ( buffer[ 1 ], 0x3f );
+        EXPECT_EQ( buffer[ 2 ], 0xc0 );
+
+        auto dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Float32 );
+        EXPECT_TRUE( dr.is_float( ) );
+        EXPECT_EQ( dr.size, 4 );
+        EXPECT_EQ( dr.result.as_f32, 1.5f );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Float64 );
+        EXPECT_EQ( dr.result.as_f64, -2.25 );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Float32 );
+        EXPECT_EQ( dr.result.as_f32, 0.5f );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Float64 );
+        EXPECT_EQ( dr.result.as_f64, 0.1 );
+
+        EXPECT_EQ( mpack.read_cursor( ), mpack.write_cursor( ) );
+    }
+
+    TEST( Floats, ShrinkIsLossless )
+    {
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        mpack.write_float( 1e300 ).write_float( 0.0 / 0.0 ).write_float( -0.0 );
+        mpack.write_float( HUGE_VAL ).write_float( -HUGE_VAL );
+
+        EXPECT_EQ( mpack.decode_single( ).marker, mp::MPMarker::Float64 );
+        EXPECT_EQ( mpack.decode_single( ).marker, mp::MPMarker::Float64 );
+
+        auto dr = mpack.decode_single( );
+
+        EXPECT_EQ( dr.marker, mp::MPMarker::Float32 );
+        EXPECT_TRUE( std::signbit( dr.result.as_f32 ) );
+
+        for ( const auto sign : { 1.0f, -1.0f } )
+        {
+            dr = mpack.decode_single( );
+
+            EXPECT_EQ( dr.marker, mp::MPMarker::Float32 );
+            EXPECT_EQ( dr.result.as_f32, sign * HUGE_VALF );
+        }
+
+        EXPECT_EQ( mpack.write_cursor( ), 9u + 9u + 3u * 5u );
+    }
+}
+
 namespace fixext
 {
     class FixExtFixture : public testing::Test
@@ -95,12 +191,7 @@ namespace fixext
 
         FixExtFixture( )
         {
-            const auto buffer = VirtualAlloc(
-                nullptr,
-                0x200,
-                MEM_COMMIT,
-                PAGE_READWRITE
-            );
+            const auto buffer = std::malloc( 0x200 );
 
             memset( buffer, 0, 0x200 );
 
@@ -108,18 +199,17 @@ namespace fixext
                 0,
                 0x200,
                 static_cast< unsigned char* >( buffer ),
-                reinterpret_cast< stream::MemoryReader >( &std::memcpy ),
-                reinterpret_cast< stream::MemoryWriter >( &std::memcpy )
+                &copy,
+                &copy
             );
         }
 
         ~FixExtFixture( )
         {
             const auto stream_buf = mpack.stream_buffer ( );
-            const auto stream_size = mpack.stream_size ( );
 
             mpack.reset_all ( );
-            VirtualFree( stream_buf, 0, MEM_RELEASE );
+            std::free( stream_buf );
         }
     };
 
@@ -273,116 +363,2785 @@ namespace fixext
         EXPECT_EQ( '\x5f', dr.result.as_fixext16.data[14] );
         EXPECT_EQ( '\x3d', dr.result.as_fixext16.data[15] );
     }
+
+    TEST_F( FixExtFixture, VariableLength )
+    {
+        mp::mp_u8 payload[ 0x120 ] { };
+
+        for ( auto index = 0lu; index < sizeof( payload ); index++ )
+            payload[ index ] = static_cast< mp::mp_u8 >( index );
+
+        mpack.write_ext( 3, payload, 4 ).write_ext( 4, payload, 3 ).write_ext( 5, payload, 0x120 );
+        mpack.write_uint( 1 );
+
+        /* FixExt4, then Ext8 and Ext16; the type byte is consumed with the header. */
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixExt4 );
+        EXPECT_EQ( dr.result.as_fixext4.type, 3 );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Ext8 );
+        EXPECT_EQ( dr.size, 3 );
+        EXPECT_EQ( dr.result.as_view.type, 4 );
+        EXPECT_EQ( mpack.read_cursor( ), 6 + 3 );
+        EXPECT_NE( mpack.read_view( dr.size ), nullptr );
+
+        mp::MPExt value { };
+
+        ASSERT_TRUE( mpack.read_ext( value ) );
+        EXPECT_EQ( value.type, 5 );
+        EXPECT_EQ( value.size, 0x120 );
+        EXPECT_EQ( memcmp( value.data, payload, 0x120 ), 0 );
+
+        /* Not an extension: nothing is consumed. */
+        const auto position = mpack.read_cursor( );
+
+        EXPECT_FALSE( mpack.read_ext( value ) );
+        EXPECT_EQ( mpack.read_cursor( ), position );
+        EXPECT_TRUE( mpack.good( ) );
+    }
+
+    TEST_F( FixExtFixture, Timestamps )
+    {
+        const mp::MPTimestamp stamps[ ] = {
+            { 0x12345678, 0 },            /* timestamp 32 */
+            { 0x3ffffffff, 999999999 },   /* timestamp 64 */
+            { -1, 1 },                   /* timestamp 96 */
+            { 0x400000000, 0 }            /* timestamp 96 */
+        };
+        const mp::mp_size sizes[ ] = { 6, 10, 15, 15 };
+
+        for ( const auto &stamp : stamps )
+            mpack.write_timestamp( stamp );
+
+        mpack.write_timestamp( { 0, 1000000000 } );
+
+        EXPECT_EQ( mpack.error( ), stream::error::overflow );
+        EXPECT_EQ( mpack.write_cursor( ), 6 + 10 + 15 + 15 );
+
+        for ( auto index = 0; index < 4; index++ )
+        {
+            const auto start = mpack.read_cursor( );
+            mp::MPTimestamp out { };
+
+            ASSERT_TRUE( mpack.read_timestamp( out ) );
+            EXPECT_EQ( out.seconds, stamps[ index ].seconds );
+            EXPECT_EQ( out.nanoseconds, stamps[ index ].nanoseconds );
+            EXPECT_EQ( mpack.read_cursor( ) - start, sizes[ index ] );
+        }
+
+        const unsigned char spec[ ] = { 0xd6, 0xff, 0x00, 0x00, 0x00, 0x01 };
+        mp::Decoder decoder { spec, sizeof( spec ) };
+        mp::MPTimestamp out { };
+
+        ASSERT_TRUE( decoder.read_timestamp( out ) );
+        EXPECT_EQ( out.seconds, 1 );
+    }
+
+    struct Event
+    {
+        mp::MPTimestamp time { };
+        mp::mp_u32 point { 0 };
+    };
+
+    struct TimeHandler
+    {
+        static constexpr mp::mp_i8 type = mp::ext::timestamp;
+
+        static bool decode( Event &event, const mp::MPExt &value )
+        {
+            return mp::ext::decode_timestamp( value, event.time );
+        }
+    };
+
+    struct PointHandler
+    {
+        static constexpr mp::mp_i8 type = 7;
+
+        static bool decode( Event &event, const mp::MPExt &value )
+        {
+            if ( value.size != 4 ) return false;
+
+            memcpy( &event.point, value.data, 4 );
+            return true;
+        }
+    };
+
+    TEST_F( FixExtFixture, Registry )
+    {
+        using Registry = mp::ExtRegistry< Event, TimeHandler, PointHandler >;
+
+        static_assert( Registry::handles( -1 ) && Registry::handles( 7 ) && !Registry::handles( 8 ) );
+
+        const mp::mp_u32 point = 0xabcdef;
+
+        mpack.write_timestamp( { 42, 7 } ).write_ext( 7, reinterpret_cast< const mp::mp_u8* >( &point ), 4 );
+        mpack.write_ext( 8, reinterpret_cast< const mp::mp_u8* >( &point ), 4 );
+
+        Event event { };
+
+        EXPECT_TRUE( Registry::decode( mpack, event ) );
+        EXPECT_TRUE( Registry::decode( mpack, event ) );
+        EXPECT_EQ( event.time.seconds, 42 );
+        EXPECT_EQ( event.time.nanoseconds, 7u );
+        EXPECT_EQ( event.point, point );
+
+        /* No handler for type 8: the value stays in the stream. */
+        const auto position = mpack.read_cursor( );
+
+        EXPECT_FALSE( Registry::decode( mpack, event ) );
+        EXPECT_EQ( mpack.read_cursor( ), position );
+    }
 }
 
-/**
- * @brief Test `stream::Stream(Reader|Writer)` behaviour.
- */
-namespace streams
+namespace markers
 {
-    class StreamFixture : public testing::Test
+    TEST( MarkerTable, MatchesDecoder )
+    {
+        for ( auto raw = 0u; raw < 0x100; raw++ )
+        {
+            mp::mp_u8 buffer[ 0x40 ] { };
+            mp::MessagePack mpack { };
+
+            buffer[ 0 ] = static_cast< mp::mp_u8 >( raw );
+            mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+            const auto &info = mp::marker_info( static_cast< mp::mp_u8 >( raw ) );
+
+            EXPECT_EQ( mpack.peek_marker( ), info.marker );
+
+            const auto dr = mpack.decode_single( );
+
+            EXPECT_EQ( dr.marker, info.marker );
+            EXPECT_EQ( mpack.read_cursor( ), mp::header_size( static_cast< mp::mp_u8 >( raw ) ) ) << raw;
+        }
+
+        EXPECT_EQ( mp::marker_info( 0x85 ).marker, mp::MPMarker::FixMap );
+        EXPECT_EQ( mp::marker_info( 0x9f ).marker, mp::MPMarker::FixArray );
+        EXPECT_EQ( mp::marker_info( 0xbf ).marker, mp::MPMarker::FixStr );
+        EXPECT_EQ( mp::marker_info( 0xc1 ).family, mp::MPFamily::Invalid );
+        EXPECT_EQ( mp::marker_info( 0xe5 ).marker, mp::MPMarker::NegFixInt );
+    }
+
+    TEST( MarkerTable, FixValues )
+    {
+        mp::mp_u8 buffer[ 0x10 ] = { 0x8a, 0x93, 0xf0, 0x7e, 0xc3 };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        auto dr = mpack.decode_single( );
+        EXPECT_TRUE( dr.is_map( ) );
+        EXPECT_EQ( dr.size, 10 );
+
+        dr = mpack.decode_single( );
+        EXPECT_TRUE( dr.is_array( ) );
+        EXPECT_EQ( dr.size, 3 );
+
+        dr = mpack.decode_single( );
+        EXPECT_TRUE( dr.is_integer( ) );
+        EXPECT_EQ( dr.result.as_i8, -16 );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::PosFixInt );
+        EXPECT_EQ( dr.result.as_u8, 0x7e );
+
+        dr = mpack.decode_single( );
+        EXPECT_TRUE( dr.is_bool( ) );
+        EXPECT_TRUE( dr.result.as_bool );
+    }
+}
+
+namespace views
+{
+    class ViewFixture : public testing::Test
     {
     protected:
-        stream::StreamReader sr { };
-        stream::StreamWriter wr { };
+        mp::MessagePack mpack { };
+        mp::MPDecodeResult dr { };
 
-        StreamFixture( )
+        ViewFixture( )
         {
-            const auto buffer = VirtualAlloc(
-                nullptr,
-                0x200,
-                MEM_COMMIT,
-                PAGE_READWRITE
-            );
-
-            memset( buffer, 0, 0x200 );
+            const auto buffer = std::malloc( 0x400 );
 
-            sr.set(
-                0,
-                0x200,
-                static_cast< mp::mp_u8* >( buffer ),
-                reinterpret_cast< stream::MemoryReader >( memcpy )
-            );
+            memset( buffer, 0, 0x400 );
 
-            wr.set(
+            mpack.initialize_streams(
                 0,
-                0x200,
-                static_cast< mp::mp_u8* >( buffer ),
-                reinterpret_cast< stream::MemoryWriter >( memcpy )
+                0x400,
+                static_cast< unsigned char* >( buffer ),
+                nullptr,
+                nullptr
             );
         }
 
-        ~StreamFixture( )
+        ~ViewFixture( )
         {
-            const auto stream_size = wr.stream_size ( );
-            const auto stream_buf = wr.start ( );
-
-            wr.reset ( );
-            sr.reset ( );
+            const auto stream_buf = mpack.stream_buffer ( );
 
-            VirtualFree( stream_buf, stream_size, MEM_RELEASE );
+            mpack.reset_all ( );
+            std::free( stream_buf );
         }
     };
 
-    TEST_F( StreamFixture, ReadBytes )
+    TEST_F( ViewFixture, FixStr )
     {
-        unsigned char buf[ ] = { 'a', 'b', 'c' };
+        const unsigned char str[ ] = "fixstr";
 
-        wr.write( ARRAYSIZE( buf ), buf );
+        mpack.write_raw_value< mp::MPMarker::FixStr >( reinterpret_cast< mp::mp_u64 >( str ), 6 );
 
-        EXPECT_EQ( sr.read_u8( ), 'a' );
-        EXPECT_EQ( sr.read_u8( ), 'b' );
-        EXPECT_EQ( sr.read_u8( ), 'c' );
+        dr = mpack.decode_view ( );
 
-        wr.clear ( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixStr );
+        EXPECT_EQ( dr.size, 6 );
+        EXPECT_EQ( dr.result.as_view.data, mpack.stream_buffer ( ) + 1 );
+        EXPECT_EQ( memcmp( dr.result.as_view.data, str, 6 ), 0 );
+        EXPECT_EQ( mpack.read_cursor( ), 7 );
 
-        for ( auto index = 0lu; index < 0x200; index++ )
-            wr.write_u8( 'a' );
+        mpack.reset_cursors ( );
+        mpack.write_raw_value< mp::MPMarker::FixStr >( reinterpret_cast< mp::mp_u64 >( str ), 6 );
 
-        sr.reset_cursor ( );
+        dr = mpack.decode_single ( );
 
-        for ( auto index = 0lu; index < 0x200; index++ )
-            EXPECT_EQ( sr.read_u8( ), 'a' );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixStr );
+        EXPECT_EQ( memcmp( dr.result.as_fixstr, str, 6 ), 0 );
     }
 
-    TEST_F( StreamFixture, ReadOOB )
+    TEST_F( ViewFixture, StrAndBin )
     {
-        /* oob write is tested below */
-        for ( auto index = 0lu; index < 0x400; index++ )
-            wr.write_u8( 'a' );
+        unsigned char payload[ 0x120 ] { };
 
-        for ( auto index = 0lu; index < 0x400; index++ )
+        for ( auto index = 0lu; index < sizeof( payload ); index++ )
+            payload[ index ] = static_cast< unsigned char >( index );
+
+        mpack.write_cstr( payload, 0x40 ).write_bytes( payload, sizeof( payload ) );
+
+        dr = mpack.decode_view ( );
+
+        EXPECT_EQ( dr.marker, mp::MPMarker::Str8 );
+        EXPECT_EQ( dr.size, 0x40 );
+        EXPECT_EQ( dr.result.as_view.data, mpack.stream_buffer ( ) + 2 );
+        EXPECT_EQ( mpack.read_cursor( ), 0x42 );
+
+        dr = mpack.decode_view ( );
+
+        EXPECT_EQ( dr.marker, mp::MPMarker::Bin16 );
+        EXPECT_EQ( dr.size, sizeof( payload ) );
+        EXPECT_EQ( memcmp( dr.result.as_view.data, payload, sizeof( payload ) ), 0 );
+        EXPECT_EQ( mpack.read_cursor( ), mpack.write_cursor( ) );
+    }
+
+    TEST_F( ViewFixture, Ext )
+    {
+        const unsigned char ext8[ ] = { 0xc7, 0x03, 0x05, 'a', 'b', 'c' };
+
+        memcpy( mpack.stream_buffer ( ), ext8, sizeof( ext8 ) );
+
+        dr = mpack.decode_view ( );
+
+        EXPECT_EQ( dr.marker, mp::MPMarker::Ext8 );
+        EXPECT_EQ( dr.size, 3 );
+        EXPECT_EQ( dr.result.as_view.type, 5 );
+        EXPECT_EQ( memcmp( dr.result.as_view.data, "abc", 3 ), 0 );
+        EXPECT_EQ( mpack.read_cursor( ), sizeof( ext8 ) );
+    }
+
+    TEST_F( ViewFixture, Truncated )
+    {
+        const unsigned char str32[ ] = { 0xdb, 0x00, 0x01, 0x00, 0x00 };
+
+        memcpy( mpack.stream_buffer ( ), str32, sizeof( str32 ) );
+
+        dr = mpack.decode_view ( );
+
+        EXPECT_EQ( dr.marker, mp::MPMarker::Str32 );
+        EXPECT_EQ( dr.size, 0x10000 );
+        EXPECT_EQ( dr.result.as_view.data, nullptr );
+        EXPECT_EQ( mpack.read_cursor( ), sizeof( str32 ) );
+    }
+}
+
+namespace chunked
+{
+    struct CountingAllocator
+    {
+        mp::mp_u64 *live { nullptr };
+
+        void *allocate( const mp::mp_u64 size )
         {
-            if ( index < 0x200 )
-                EXPECT_EQ( sr.read_u8( ), 'a' );
-            else
-                EXPECT_EQ( sr.read_u8( ), '\0' ); // sr.read_u8( ) returns 0 for OOB or invalid buffer states
+            ( *live )++;
+            return malloc( size );
+        }
 
-            EXPECT_LE( sr.position( ), sr.stream_size( ) );
+        void deallocate( void *ptr, const mp::mp_u64 )
+        {
+            ( *live )--;
+            free( ptr );
+        }
+    };
+
+    TEST( ChunkedWriter, GrowsAndSegments )
+    {
+        mp::mp_u64 live = 0;
+        mp::mp_u8 head[ 0x10 ] { };
+        unsigned char payload[ 0x100 ] { };
+
+        for ( auto index = 0lu; index < sizeof( payload ); index++ )
+            payload[ index ] = static_cast< unsigned char >( index );
+
+        {
+            mp::ChunkedMessagePack< CountingAllocator > mpack { };
+
+            mpack.initialize_streams( 0, sizeof( head ), head );
+            mpack.writer( ).set_allocator( CountingAllocator { &live } ).set_chunk_size( 0x40 );
+
+            mpack.start_map( 2 );
+            mpack.write_cstr( reinterpret_cast< const mp::mp_u8* >( "key" ), 3 ).write_uint( 0xdeadbeef );
+            mpack.write_cstr( reinterpret_cast< const mp::mp_u8* >( "blob" ), 4 ).write_bytes( payload, sizeof( payload ) );
+
+            const auto total = 1 + ( 2 + 3 ) + 5 + ( 2 + 4 ) + ( 3 + sizeof( payload ) );
+
+            EXPECT_EQ( mpack.writer( ).size( ), total );
+            EXPECT_GT( live, 0 );
+            EXPECT_GT( mpack.writer( ).segment_count( ), 1 );
+
+            stream::Segment segments[ 8 ] { };
+            const auto count = mpack.writer( ).segments( segments, 8 );
+
+            EXPECT_EQ( segments[ 0 ].base, head );
+            EXPECT_EQ( segments[ 0 ].length, sizeof( head ) );
+
+            mp::mp_u8 flat[ 0x200 ] { };
+            mp::mp_u64 offset = 0;
+
+            for ( auto index = 0lu; index < count; index++ )
+            {
+                memcpy( flat + offset, segments[ index ].base, segments[ index ].length );
+                offset += segments[ index ].length;
+            }
+
+            EXPECT_EQ( offset, total );
+
+            mp::MessagePack decoder { };
+
+            decoder.initialize_streams( 0, sizeof( flat ), flat );
+
+            EXPECT_EQ( decoder.decode_single( ).marker, mp::MPMarker::FixMap );
+            EXPECT_EQ( decoder.decode_view( ).size, 3 );
+            EXPECT_EQ( decoder.decode_single( ).result.as_u32, 0xdeadbeef );
+            EXPECT_EQ( decoder.decode_view( ).size, 4 );
+
+            const auto blob = decoder.decode_view( );
+
+            EXPECT_EQ( blob.size, sizeof( payload ) );
+            EXPECT_EQ( memcmp( blob.result.as_view.data, payload, sizeof( payload ) ), 0 );
+
+            mpack.writer( ).reset_cursor( );
+
+            EXPECT_EQ( live, 0 );
+            EXPECT_EQ( mpack.writer( ).size( ), 0 );
+
+            mpack.write_bytes( payload, sizeof( payload ) );
         }
+
+        EXPECT_EQ( live, 0 );
     }
+}
 
-    TEST_F( StreamFixture, WriteOverflow )
+namespace gather
+{
+    struct Pins
     {
-        for ( auto index = 0lu; index < 0x400; index++ )
-            wr.write_u8( 'a' );
+        mp::mp_u64 count { 0 };
+        const mp::mp_u8 *last { nullptr };
+    };
 
-        EXPECT_EQ( wr.position( ), wr.stream_size( ) );
+    void record_pin( void *context, const mp::mp_u8 *data, const mp::mp_u64 )
+    {
+        const auto pins = static_cast< Pins* >( context );
 
-        wr.reset_cursor ( );
-        wr.clear ( );
+        pins->count++;
+        pins->last = data;
+    }
 
-        for ( auto index = 0lu; index < 0x100; index++ )
-            wr.write_u32( 0xbadf00d );
+    TEST( GatherWriter, ReferencesLargePayloads )
+    {
+        static mp::mp_u8 blob[ 0x2000 ];
+        mp::mp_u8 expected[ 0x2100 ] { };
+        mp::mp_u8 head[ 0x40 ] { };
+        stream::Segment table[ 8 ] { };
+        Pins pins { };
 
-        EXPECT_EQ( wr.position( ), wr.stream_size( ) );
+        for ( auto index = 0lu; index < sizeof( blob ); index++ )
+            blob[ index ] = static_cast< mp::mp_u8 >( index * 7 );
 
-        wr.reset_cursor ( );
-        wr.clear ( );
+        mp::MessagePack reference { };
+        mp::GatherMessagePack mpack { };
 
-        for ( auto index = 0lu; index < 0x100; index++ )
-            wr.write_u64( 0xbadf00dbadf00d );
+        reference.initialize_streams( 0, sizeof( expected ), expected );
+        mpack.initialize_streams( 0, sizeof( head ), head );
+        mpack.writer( ).set_segments( table, 8 ).set_threshold( 0x100 ).set_pin( &record_pin, &pins );
 
-        EXPECT_EQ( wr.position( ), wr.stream_size( ) );
+        const auto key = reinterpret_cast< const mp::mp_u8* >( "blob" );
+
+        reference.start_map( 2 ).write_cstr( key, 4 ).write_bytes( blob, sizeof( blob ) );
+        reference.write_cstr( key, 1 ).write_bytes( blob, 0x10 );
+        mpack.start_map( 2 ).write_cstr( key, 4 ).write_bytes( blob, sizeof( blob ) );
+        mpack.write_cstr( key, 1 ).write_bytes( blob, 0x10 );
+
+        ASSERT_TRUE( mpack.good( ) );
+        EXPECT_EQ( mpack.write_cursor( ), reference.write_cursor( ) );
+        EXPECT_EQ( pins.count, 1u );
+        EXPECT_EQ( pins.last, blob );
+
+        /* Header run, the referenced blob, then the trailing run with the small copied body. */
+        ASSERT_EQ( mpack.writer( ).segment_count( ), 3u );
+
+        const auto segments = mpack.writer( ).segments( );
+
+        EXPECT_EQ( segments[ 0 ].base, head );
+        EXPECT_EQ( segments[ 1 ].base, blob );
+        EXPECT_EQ( segments[ 1 ].length, sizeof( blob ) );
+
+        mp::mp_u8 flat[ 0x2100 ] { };
+        mp::mp_u64 offset = 0;
+
+        for ( auto index = 0lu; index < 3; index++ )
+        {
+            memcpy( flat + offset, segments[ index ].base, segments[ index ].length );
+            offset += segments[ index ].length;
+        }
+
+        ASSERT_EQ( offset, reference.write_cursor( ) );
+        EXPECT_EQ( memcmp( flat, expected, offset ), 0 );
+
+        /* Without room in the table the payload is copied, and overflows the small buffer. */
+        mpack.reset_cursors( );
+        mpack.writer( ).set_segments( table, 1 );
+        mpack.write_bytes( blob, sizeof( blob ) );
+
+        EXPECT_EQ( pins.count, 1u );
+        EXPECT_EQ( mpack.error( ), stream::error::overflow );
+    }
+}
+
+namespace arrays
+{
+    class ArrayFixture : public testing::Test
+    {
+    protected:
+        mp::MessagePack mpack { };
+
+        ArrayFixture( )
+        {
+            const auto buffer = std::malloc( 0x1000 );
+
+            memset( buffer, 0, 0x1000 );
+
+            mpack.initialize_streams(
+                0,
+                0x1000,
+                static_cast< unsigned char* >( buffer ),
+                nullptr,
+                nullptr
+            );
+        }
+
+        ~ArrayFixture( )
+        {
+            const auto stream_buf = mpack.stream_buffer ( );
+
+            mpack.reset_all ( );
+            std::free( stream_buf );
+        }
+    };
+
+    TEST_F( ArrayFixture, FixedWidthU32 )
+    {
+        mp::mp_u32 values[ 37 ] { };
+        mp::mp_u32 decoded[ 37 ] { };
+
+        for ( auto index = 0u; index < 37; index++ )
+            values[ index ] = 0x01020304u * index;
+
+        mpack.write_array_u32( values, 37, mp::MPArrayEncoding::FixedWidth );
+
+        /* Array16 header + 37 * ( marker + 4 bytes ) */
+        EXPECT_EQ( mpack.write_cursor( ), 3 + 37 * 5 );
+
+        const auto buf = mpack.stream_buffer ( );
+
+        EXPECT_EQ( buf[ 3 + 5 * 2 ], 0xce );
+        EXPECT_EQ( buf[ 3 + 5 * 2 + 1 ], 0x02 );
+        EXPECT_EQ( buf[ 3 + 5 * 2 + 4 ], 0x08 );
+
+        EXPECT_EQ( mpack.read_array_u32( decoded, 37 ), 37 );
+        EXPECT_EQ( memcmp( values, decoded, sizeof( values ) ), 0 );
+        EXPECT_EQ( mpack.read_cursor( ), mpack.write_cursor( ) );
+    }
+
+    TEST_F( ArrayFixture, FixedWidthAllTypes )
+    {
+        mp::mp_u8 u8[ 40 ] { };
+        mp::mp_i16 i16[ 40 ] { };
+        mp::mp_u64 u64[ 40 ] { };
+
+        for ( auto index = 0; index < 40; index++ )
+        {
+            u8[ index ] = static_cast< mp::mp_u8 >( index * 7 );
+            i16[ index ] = static_cast< mp::mp_i16 >( -1000 * index );
+            u64[ index ] = 0x0102030405060708ull * index;
+        }
+
+        mpack.write_typed_array( u8, 40, mp::MPArrayEncoding::FixedWidth );
+        mpack.write_array_i16( i16, 40, mp::MPArrayEncoding::FixedWidth );
+        mpack.write_array_u64( u64, 40, mp::MPArrayEncoding::FixedWidth );
+
+        mp::mp_u8 u8_out[ 40 ] { };
+        mp::mp_i16 i16_out[ 40 ] { };
+        mp::mp_u64 u64_out[ 40 ] { };
+
+        EXPECT_EQ( mpack.read_typed_array( u8_out, 40 ), 40 );
+        EXPECT_EQ( mpack.read_array_i16( i16_out, 40 ), 40 );
+        EXPECT_EQ( mpack.read_array_u64( u64_out, 40 ), 40 );
+
+        EXPECT_EQ( memcmp( u8, u8_out, sizeof( u8 ) ), 0 );
+        EXPECT_EQ( memcmp( i16, i16_out, sizeof( i16 ) ), 0 );
+        EXPECT_EQ( memcmp( u64, u64_out, sizeof( u64 ) ), 0 );
+    }
+
+    TEST_F( ArrayFixture, CompactAndMixed )
+    {
+        const mp::mp_i16 values[ ] = { 0, -1, 127, -32768, 300, 32767, -33 };
+        mp::mp_i16 decoded[ 7 ] { };
+        mp::mp_i32 widened[ 7 ] { };
+
+        mpack.write_array_i16( values, 7 ).write_array_i16( values, 7 );
+
+        EXPECT_EQ( mpack.read_array_i16( decoded, 7 ), 7 );
+        EXPECT_EQ( memcmp( values, decoded, sizeof( values ) ), 0 );
+
+        EXPECT_EQ( mpack.read_array_i32( widened, 7 ), 7 );
+
+        for ( auto index = 0; index < 7; index++ )
+            EXPECT_EQ( widened[ index ], values[ index ] );
+    }
+
+    TEST_F( ArrayFixture, Rejects )
+    {
+        const mp::mp_i16 values[ ] = { 1, 2, -3 };
+        mp::mp_u16 decoded[ 3 ] { };
+
+        mpack.write_array_i16( values, 3 );
+
+        EXPECT_EQ( mpack.read_array_u16( decoded, 2 ), 0 );
+        EXPECT_EQ( mpack.read_cursor( ), 0 );
+
+        /* -3 does not fit into an unsigned type */
+        EXPECT_EQ( mpack.read_array_u16( decoded, 3 ), 2 );
+        EXPECT_EQ( decoded[ 1 ], 2 );
+    }
+}
+
+namespace incremental
+{
+    TEST( IncrementalDecoder, ByteByByte )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        const unsigned char fix_ext4[ ] = { '\xa', '\xb', '\xc', '\xd', '\xe' };
+        const unsigned char payload[ ] = "partial";
+
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        mpack.start_array( 4 ).write_u64( 0x1122334455667788 ).write_fix_ext4( fix_ext4 );
+        mpack.write_bytes( payload, 7 ).write_int( -2 );
+
+        const auto total = mpack.write_cursor( );
+
+        mp::IncrementalDecoder decoder { };
+        mp::MPDecodeResult results[ 5 ] { };
+        mp::mp_u8 blob[ 7 ] { };
+        mp::mp_u32 decoded = 0, blob_size = 0;
+
+        for ( auto index = 0u; index < total; index++ )
+        {
+            decoder.feed( buffer + index, 1 );
+
+            if ( decoder.payload_remaining( ) )
+            {
+                blob_size += decoder.read_payload( blob + blob_size, 7 - blob_size );
+                continue;
+            }
+
+            while ( decoded < 5 && decoder.next( results[ decoded ] ) == mp::DecodeStatus::Ok )
+                decoded++;
+
+            if ( decoded < 5 && !decoder.payload_remaining( ) )
+            {
+                EXPECT_GT( decoder.missing( ), 0 );
+            }
+        }
+
+        ASSERT_EQ( decoded, 5 );
+
+        EXPECT_EQ( results[ 0 ].marker, mp::MPMarker::FixArray );
+        EXPECT_EQ( results[ 0 ].size, 4 );
+        EXPECT_EQ( results[ 1 ].result.as_u64, 0x1122334455667788 );
+        EXPECT_EQ( results[ 2 ].marker, mp::MPMarker::FixExt4 );
+        EXPECT_EQ( results[ 2 ].result.as_fixext4.data[ 3 ], '\xe' );
+        EXPECT_EQ( results[ 3 ].marker, mp::MPMarker::Bin8 );
+        EXPECT_EQ( results[ 3 ].size, 7 );
+        EXPECT_EQ( memcmp( blob, payload, 7 ), 0 );
+        EXPECT_EQ( results[ 4 ].result.as_i8, -2 );
+    }
+
+    TEST( IncrementalDecoder, SkipsUnreadPayload )
+    {
+        const unsigned char first[ ] = { 0xc4, 0x04, 'a', 'b' };
+        const unsigned char second[ ] = { 'c', 'd', 0xcd, 0x01 };
+        const unsigned char third[ ] = { 0x02 };
+
+        mp::IncrementalDecoder decoder { };
+        mp::MPDecodeResult dr { };
+
+        decoder.feed( first, sizeof( first ) );
+
+        EXPECT_EQ( decoder.next( dr ), mp::DecodeStatus::Ok );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Bin8 );
+        EXPECT_EQ( decoder.next( dr ), mp::DecodeStatus::NeedMore );
+        EXPECT_EQ( decoder.missing( ), 2 );
+
+        decoder.feed( second, sizeof( second ) );
+
+        EXPECT_EQ( decoder.next( dr ), mp::DecodeStatus::NeedMore );
+        EXPECT_EQ( decoder.missing( ), 1 );
+
+        decoder.feed( third, sizeof( third ) );
+
+        EXPECT_EQ( decoder.next( dr ), mp::DecodeStatus::Ok );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Uint16 );
+        EXPECT_EQ( dr.result.as_u16, 0x0102 );
+    }
+
+#if defined( MP_LARGE_STREAMS ) && defined( MP_TEST_MMAP )
+    TEST( IncrementalDecoder, ChunkOverFourGigabytes )
+    {
+        /* A Bin32 with the largest payload, then `true`: only the first and last page are used. */
+        constexpr mp::mp_u64 size = 5 + 0xffffffffull + 1;
+
+        const auto memory = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+
+        if ( memory == MAP_FAILED )
+            GTEST_SKIP( ) << "cannot reserve 4 GB of address space";
+
+        const auto chunk = static_cast< mp::mp_u8* >( memory );
+        const mp::mp_u8 header[ ] = { 0xc6, 0xff, 0xff, 0xff, 0xff };
+
+        copy( chunk, header, sizeof( header ) );
+        chunk[ size - 1 ] = 0xc3;
+
+        mp::IncrementalDecoder decoder { };
+        mp::MPDecodeResult dr { };
+
+        decoder.feed( chunk, size );
+
+        EXPECT_EQ( decoder.remaining( ), size );
+        EXPECT_EQ( decoder.next( dr ), mp::DecodeStatus::Ok );
+        EXPECT_EQ( dr.marker, mp::MPMarker::Bin32 );
+        EXPECT_EQ( decoder.next( dr ), mp::DecodeStatus::Ok );
+        EXPECT_EQ( dr.marker, mp::MPMarker::True );
+        EXPECT_EQ( decoder.remaining( ), 0u );
+
+        munmap( memory, size );
+    }
+#endif
+}
+
+/**
+ * @brief Test `stream::Stream(Reader|Writer)` behaviour.
+ */
+namespace reflection
+{
+    struct Point
+    {
+        mp::mp_i32 x;
+        mp::mp_i32 y;
+    };
+
+    struct Sample
+    {
+        mp::mp_u16 id;
+        bool active;
+        double ratio;
+        Point origin;
+    };
+
+    struct Quote
+    {
+        mp::mp_u32 id;
+        mp::mp_i16 delta;
+        double price;
+        float weight;
+        bool live;
+        mp::mp_u8 level;
+        mp::mp_i8 sign;
+        mp::mp_u64 volume;
+    };
+}
+
+namespace mp::reflect
+{
+    template < > struct Schema< reflection::Point >
+    {
+        static constexpr auto fields = reflect::fields(
+            MP_FIELD( reflection::Point, x ),
+            MP_FIELD( reflection::Point, y )
+        );
+    };
+
+    template < > struct Schema< reflection::Sample >
+    {
+        static constexpr auto fields = reflect::fields(
+            MP_FIELD( reflection::Sample, id ),
+            MP_FIELD( reflection::Sample, active ),
+            MP_FIELD( reflection::Sample, ratio ),
+            reflect::field( "centre", &reflection::Sample::origin )
+        );
+    };
+
+    template < > struct Schema< reflection::Quote >
+    {
+        static constexpr auto fields = reflect::fields(
+            MP_FIELD( reflection::Quote, id ),
+            MP_FIELD( reflection::Quote, delta ),
+            MP_FIELD( reflection::Quote, price ),
+            MP_FIELD( reflection::Quote, weight ),
+            MP_FIELD( reflection::Quote, live ),
+            MP_FIELD( reflection::Quote, level ),
+            MP_FIELD( reflection::Quote, sign ),
+            MP_FIELD( reflection::Quote, volume )
+        );
+
+        using layout = reflect::Layout< MPMarker::Uint32, MPMarker::Int16, MPMarker::Float64,
+            MPMarker::Float32, MPMarker::True, MPMarker::PosFixInt, MPMarker::NegFixInt,
+            MPMarker::Uint64 >;
+    };
+}
+
+namespace reflection
+{
+    TEST( Reflection, PrecomputedKeys )
+    {
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        mp::reflect::encode( mpack, Point { 1, -1 } );
+
+        const mp::mp_u8 expected[ ] = { 0x82, 0xa1, 'x', 0xd0, 0x01, 0xa1, 'y', 0xd0, 0xff };
+
+        ASSERT_EQ( mpack.write_cursor( ), sizeof( expected ) );
+        EXPECT_EQ( memcmp( buffer, expected, sizeof( expected ) ), 0 );
+
+        constexpr auto &key = mp::reflect::Schema< Point >::fields.head;
+
+        static_assert( key.key[ 0 ] == 0xa1 && key.key[ 1 ] == 'x' );
+        static_assert( key.hash == mp::reflect::fnv1a( "x", 1 ) );
+    }
+
+    TEST( Reflection, RoundTrip )
+    {
+        mp::mp_u8 buffer[ 0x80 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const Sample in { 300, true, 0.25, { -70000, 5 } };
+        Sample out { };
+
+        mp::reflect::encode( mpack, in );
+
+        ASSERT_TRUE( mp::reflect::decode( mpack, out ) );
+        EXPECT_EQ( mpack.read_cursor( ), mpack.write_cursor( ) );
+        EXPECT_EQ( out.id, 300 );
+        EXPECT_TRUE( out.active );
+        EXPECT_EQ( out.ratio, 0.25 );
+        EXPECT_EQ( out.origin.x, -70000 );
+        EXPECT_EQ( out.origin.y, 5 );
+    }
+
+    TEST( Reflection, UnknownAndMismatched )
+    {
+        mp::mp_u8 buffer[ 0x80 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const unsigned char extra[ ] = "extra";
+        const unsigned char y[ ] = "y";
+
+        /* Unknown keys are skipped, missing fields are left untouched. */
+        mpack.start_map( 2 );
+        mpack.write_cstr( extra, 5 ).write_cstr( extra, 5 );
+        mpack.write_cstr( y, 1 ).write_int( 7 );
+
+        Point out { 3, 0 };
+
+        ASSERT_TRUE( mp::reflect::decode( mpack, out ) );
+        EXPECT_EQ( out.x, 3 );
+        EXPECT_EQ( out.y, 7 );
+
+        /* A value that does not fit the member type fails the decode. */
+        mpack.start_map( 1 );
+        mpack.write_cstr( y, 1 ).write_uint( 0x100000000ull );
+
+        EXPECT_FALSE( mp::reflect::decode( mpack, out ) );
+    }
+
+    TEST( Reflection, CompiledLayout )
+    {
+        using Compiled = mp::reflect::CompiledLayout< Quote >;
+
+        /* Header, keys and markers: 1 + 45 + 8 bytes, then 4 + 2 + 8 + 4 + 8 value bytes. */
+        static_assert( Compiled::size == 1 + 45 + 8 + 26 );
+        static_assert( Compiled::image.bytes[ 0 ] == 0x88 && Compiled::image.offsets[ 0 ] == 4 );
+
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const Quote in { 7, -300, 101.25, 0.5f, false, 9, -2, 1ull << 40 };
+        Quote out { };
+
+        /* Every value is written with its layout marker, even when a smaller one would do. */
+        mp::reflect::encode( mpack, in );
+
+        ASSERT_EQ( mpack.write_cursor( ), Compiled::size );
+        EXPECT_EQ( buffer[ 4 ], static_cast< mp::mp_u8 >( mp::MPMarker::Uint32 ) );
+
+        ASSERT_TRUE( mp::reflect::decode( mpack, out ) );
+        EXPECT_EQ( mpack.read_cursor( ), Compiled::size );
+        EXPECT_EQ( out.id, 7u );
+        EXPECT_EQ( out.delta, -300 );
+        EXPECT_EQ( out.price, 101.25 );
+        EXPECT_EQ( out.weight, 0.5f );
+        EXPECT_FALSE( out.live );
+        EXPECT_EQ( out.level, 9 );
+        EXPECT_EQ( out.sign, -2 );
+        EXPECT_EQ( out.volume, 1ull << 40 );
+
+        /* The compiled path accepts it from a span too; any truncation is left to the slow one. */
+        Quote fast { };
+        mp::Decoder decoder { buffer, Compiled::size };
+
+        ASSERT_TRUE( mp::reflect::_decode_layout( decoder, fast ) );
+        EXPECT_EQ( decoder.read_cursor( ), Compiled::size );
+        EXPECT_EQ( fast.volume, in.volume );
+
+        mp::Decoder truncated { buffer, Compiled::size - 1 };
+
+        EXPECT_FALSE( mp::reflect::_decode_layout( truncated, fast ) );
+        EXPECT_EQ( truncated.read_cursor( ), 0u );
+        EXPECT_FALSE( mp::reflect::decode( truncated, fast ) );
+    }
+
+    TEST( Reflection, CompiledLayoutFallback )
+    {
+        using Compiled = mp::reflect::CompiledLayout< Quote >;
+
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        /* A value that does not fit its marker (PosFixInt) makes the encoder drop the layout... */
+        const Quote in { 7, -300, 101.25, 0.5f, true, 200, -2, 3 };
+        Quote out { };
+
+        mp::reflect::encode( mpack, in );
+
+        EXPECT_NE( mpack.write_cursor( ), Compiled::size );
+
+        /* ...and the decoder, seeing other markers, takes the generic path. */
+        mp::Decoder decoder { buffer, mpack.write_cursor( ) };
+
+        EXPECT_FALSE( mp::reflect::_decode_layout( decoder, out ) );
+        EXPECT_EQ( decoder.read_cursor( ), 0u );
+        ASSERT_TRUE( mp::reflect::decode( decoder, out ) );
+        EXPECT_EQ( decoder.read_cursor( ), mpack.write_cursor( ) );
+        EXPECT_EQ( out.level, 200 );
+        EXPECT_TRUE( out.live );
+        EXPECT_EQ( out.volume, 3u );
+
+        /* Keys in another order, or a key with another spelling, also miss the layout. */
+        mp::reflect::encode( mpack, Quote { 1, 2, 3.0, 4.0f, true, 5, -6, 7 } );
+
+        const auto size = mpack.write_cursor( ) - decoder.read_cursor( );
+        mp::mp_u8 copy[ Compiled::size ];
+
+        ASSERT_EQ( size, Compiled::size );
+        memcpy( copy, buffer + decoder.read_cursor( ), size );
+        copy[ 2 ] = 'D';
+
+        mp::Decoder renamed { copy, size };
+        Quote partial { };
+
+        EXPECT_FALSE( mp::reflect::_decode_layout( renamed, partial ) );
+        ASSERT_TRUE( mp::reflect::decode( renamed, partial ) );
+        EXPECT_EQ( partial.id, 0u );
+        EXPECT_EQ( partial.delta, 2 );
+        EXPECT_EQ( partial.volume, 7u );
+    }
+}
+
+namespace standalone
+{
+    TEST( Standalone, EncoderMatchesMessagePack )
+    {
+        mp::mp_u8 expected[ 0x40 ] { };
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::MessagePack mpack { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const mp::mp_u8 name[ ] = { 'a', 'b' };
+        const mp::mp_u16 values[ ] = { 1, 0x1234 };
+
+        mpack.initialize_streams( 0, sizeof( expected ), expected );
+
+        mpack.start_map( 2 ).write_cstr( name, 2 ).write_int( -3 );
+        mpack.write_cstr( name, 1 ).write_array_u16( values, 2, mp::MPArrayEncoding::FixedWidth );
+        encoder.start_map( 2 ).write_cstr( name, 2 ).write_int( -3 );
+        encoder.write_cstr( name, 1 ).write_array_u16( values, 2, mp::MPArrayEncoding::FixedWidth );
+
+        ASSERT_EQ( encoder.write_cursor( ), mpack.write_cursor( ) );
+        EXPECT_EQ( memcmp( buffer, expected, sizeof( buffer ) ), 0 );
+        EXPECT_TRUE( encoder.good( ) );
+
+        /* Resetting leaves the buffer alone. */
+        encoder.reset( );
+        EXPECT_EQ( encoder.write_cursor( ), 0u );
+        EXPECT_EQ( memcmp( buffer, expected, sizeof( buffer ) ), 0 );
+
+        mp::mp_u8 small[ 2 ] { };
+        encoder.reset( small, sizeof( small ) );
+        encoder.write_u16( 1 );
+        EXPECT_EQ( encoder.error( ), stream::error::overflow );
+    }
+
+    TEST( Standalone, DecoderForksByCopy )
+    {
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const mp::mp_u8 key[ ] = { 'k' };
+
+        encoder.start_map( 1 ).write_cstr( key, 1 ).write_uint( 7 ).write_true( );
+
+        mp::Decoder decoder { buffer, encoder.write_cursor( ) };
+
+        /* Look ahead on a copy; the original cursor does not move. */
+        auto lookahead = decoder;
+        mp::mp_u32 value = 0;
+
+        ASSERT_TRUE( lookahead.find_key( key, 1 ) );
+        ASSERT_TRUE( lookahead.decode_single( ).as_integer( value ) );
+        EXPECT_EQ( value, 7u );
+        EXPECT_EQ( decoder.read_cursor( ), 0u );
+
+        EXPECT_TRUE( decoder.skip_value( ) );
+        EXPECT_EQ( decoder.read_cursor( ), lookahead.read_cursor( ) );
+        EXPECT_EQ( decoder.decode_single( ).marker, mp::MPMarker::True );
+        EXPECT_TRUE( decoder.good( ) );
+
+        decoder.decode_single( );
+        EXPECT_EQ( decoder.error( ), stream::error::overflow );
+
+        decoder.reset( );
+        EXPECT_TRUE( decoder.good( ) );
+        EXPECT_EQ( decoder.peek_marker( ), mp::MPMarker::FixMap );
+    }
+}
+
+namespace skip
+{
+    TEST( SkipValue, Nested )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const unsigned char name[ ] = "name";
+        const unsigned char blob[ 40 ] { };
+        const mp::mp_u8 ext[ 3 ] = { 5, 1, 2 };
+
+        /* { "name": [ [ 1, 2.5, true ], { "name": blob } ], "id": ext } followed by 7 */
+        mpack.start_map( 2 ).write_cstr( name, 4 );
+        mpack.start_array( 2 ).start_array( 3 ).write_int( 1 ).write_f64( 2.5 ).write_true( );
+        mpack.start_map( 1 ).write_cstr( name, 4 ).write_bytes( blob, sizeof( blob ) );
+        mpack.write_cstr( name, 2 ).write_fix_ext2( ext );
+        mpack.write_uint( 7 );
+
+        const auto end = mpack.write_cursor( ) - 2;
+
+        EXPECT_TRUE( mpack.skip_value( ) );
+        EXPECT_EQ( mpack.read_cursor( ), end );
+        EXPECT_EQ( mpack.decode_single( ).result.as_u8, 7 );
+
+        /* Truncated: the cursor does not move. */
+        mpack.initialize_streams( 0, end - 1, buffer );
+
+        EXPECT_FALSE( mpack.skip_value( ) );
+        EXPECT_EQ( mpack.read_cursor( ), 0 );
+    }
+
+    TEST( SkipValue, FindKey )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const unsigned char outer[ ] = "outer";
+        const unsigned char inner[ ] = "inner";
+
+        /* { 1: "outer", "outer": { "inner": 42 } } */
+        mpack.start_map( 2 ).write_uint( 1 ).write_cstr( outer, 5 );
+        mpack.write_cstr( outer, 5 ).start_map( 1 ).write_cstr( inner, 5 ).write_uint( 42 );
+
+        EXPECT_FALSE( mpack.find_key( inner, 5 ) );
+        EXPECT_EQ( mpack.read_cursor( ), 0 );
+
+        ASSERT_TRUE( mpack.find_key( outer, 5 ) );
+        ASSERT_TRUE( mpack.find_key( inner, 5 ) );
+        EXPECT_EQ( mpack.decode_single( ).result.as_u8, 42 );
+    }
+}
+
+namespace sax
+{
+    /* Renders the events as JSON-like text. */
+    struct Printer : mp::NullVisitor
+    {
+        std::string out { };
+        mp::mp_u64 stop_after { ~0ull };
+
+        /* Pieces are appended one by one: chained `operator+` temporaries trip GCC's -Wrestrict. */
+        bool emit( const char *prefix, const std::string &text = { } )
+        {
+            out += prefix;
+            out += text;
+            out += ' ';
+            return --stop_after != 0;
+        }
+
+        bool on_nil( ) { return emit( "nil" ); }
+        bool on_bool( const bool value ) { return emit( value ? "true" : "false" ); }
+        bool on_uint( const mp::mp_u64 value ) { return emit( "", std::to_string( value ) ); }
+        bool on_int( const mp::mp_i64 value ) { return emit( "", std::to_string( value ) ); }
+        bool on_float( const mp::mp_f64 value ) { return emit( "", std::to_string( value ) ); }
+
+        bool on_str( const mp::mp_u8 *data, const mp::mp_u32 size )
+        {
+            out += '"';
+            out.append( reinterpret_cast< const char* >( data ), size );
+            return emit( "\"" );
+        }
+
+        bool on_bin( const mp::mp_u8 *, const mp::mp_u32 size ) { return emit( "bin", std::to_string( size ) ); }
+        bool on_ext( const mp::MPExt &value ) { return emit( "ext", std::to_string( value.type ) ); }
+        bool on_array_begin( const mp::mp_u32 size ) { return emit( "[", std::to_string( size ) ); }
+        bool on_array_end( ) { return emit( "]" ); }
+        bool on_map_begin( const mp::mp_u32 size ) { return emit( "{", std::to_string( size ) ); }
+        bool on_map_end( ) { return emit( "}" ); }
+    };
+
+    TEST( Visitor, WalksNestedDocument )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const auto text = reinterpret_cast< const mp::mp_u8* >( "abx" );
+
+        encoder.start_map( 3 );
+        encoder.write_cstr( text, 1 ).start_array( 5 ).write_uint( 1 ).write_int( -200 ).write_cstr( text + 2, 1 );
+        encoder.start_map( 0 ).start_array( 1 ).start_array( 0 );
+        encoder.write_cstr( text + 1, 1 ).write_nil( );
+        encoder.write_f64( 1.5 ).write_bytes( text, 3 );
+        encoder.write_ext( 9, text, 2 );
+
+        mp::Decoder decoder { buffer, encoder.write_cursor( ) };
+        Printer printer { };
+
+        EXPECT_TRUE( decoder.parse( printer ) );
+        EXPECT_EQ( printer.out, "{3 \"a\" [5 1 -200 \"x\" {0 } [1 [0 ] ] ] \"b\" nil 1.500000 bin3 } " );
+        EXPECT_EQ( decoder.read_cursor( ), encoder.write_cursor( ) - 4 );
+
+        /* One value per call. */
+        printer.out.clear( );
+        EXPECT_TRUE( decoder.parse( printer ) );
+        EXPECT_EQ( printer.out, "ext9 " );
+
+        /* A handler returning `false` stops the walk. */
+        decoder.reset( );
+        printer = Printer { };
+        printer.stop_after = 3;
+
+        EXPECT_FALSE( decoder.parse( printer ) );
+        EXPECT_EQ( printer.out, "{3 \"a\" [5 " );
+        EXPECT_TRUE( decoder.good( ) );
+    }
+
+    TEST( Visitor, RejectsMalformed )
+    {
+        mp::NullVisitor visitor { };
+
+        /* Truncated array. */
+        const mp::mp_u8 truncated[ ] = { 0x93, 0x01, 0x02 };
+        mp::Decoder decoder { truncated, sizeof( truncated ) };
+
+        EXPECT_FALSE( decoder.parse( visitor ) );
+        EXPECT_FALSE( decoder.good( ) );
+
+        /* Reserved marker. */
+        const mp::mp_u8 reserved[ ] = { 0x91, 0xc1 };
+
+        decoder.reset( reserved, sizeof( reserved ) );
+        EXPECT_FALSE( decoder.parse( visitor ) );
+        EXPECT_EQ( decoder.error( ), stream::error::malformed );
+
+        /* Nested deeper than the stack. */
+        mp::mp_u8 deep[ 0x100 ] { };
+
+        memset( deep, 0x91, sizeof( deep ) );
+        decoder.reset( deep, sizeof( deep ) );
+        EXPECT_FALSE( decoder.parse( visitor ) );
+        EXPECT_EQ( decoder.read_cursor( ), mp::Decoder::max_parse_depth + 1 );
+    }
+}
+
+namespace document
+{
+    TEST( Document, BuildsTreeInArena )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const auto text = reinterpret_cast< const mp::mp_u8* >( "idtagsname" );
+
+        encoder.start_map( 3 );
+        encoder.write_cstr( text, 2 ).write_uint( 42 );
+        encoder.write_cstr( text + 2, 4 ).start_array( 3 ).write_int( -5 ).write_f64( 0.25 ).start_map( 0 );
+        encoder.write_cstr( text + 6, 4 ).write_cstr( text, 6 );
+
+        alignas( 8 ) mp::mp_u8 arena[ 0x200 ];
+        mp::Document document { arena, sizeof( arena ) };
+        mp::Decoder decoder { buffer, encoder.write_cursor( ) };
+
+        ASSERT_TRUE( document.parse( decoder ) );
+        EXPECT_EQ( decoder.read_cursor( ), encoder.write_cursor( ) );
+
+        /* 1 map + 3 * 2 pairs + 3 elements, the root living in the document itself. */
+        EXPECT_EQ( document.bytes_used( ), 9 * sizeof( mp::Value ) );
+
+        const auto &root = document.root( );
+
+        ASSERT_TRUE( root.is_map( ) );
+        EXPECT_EQ( root.size, 3u );
+        EXPECT_EQ( root.find( text, 2 )->as_uint, 42u );
+        EXPECT_EQ( root.find( text, 3 ), nullptr );
+
+        const auto tags = root.find( text + 2, 4 );
+
+        ASSERT_TRUE( tags && tags->is_array( ) );
+        EXPECT_EQ( tags->at( 0 )->as_int, -5 );
+        EXPECT_EQ( tags->at( 1 )->as_float, 0.25 );
+        EXPECT_TRUE( tags->at( 2 )->is_map( ) );
+        EXPECT_EQ( tags->at( 3 ), nullptr );
+
+        /* Payloads are views into the source... */
+        const auto name = root.value( 2 );
+
+        EXPECT_TRUE( root.key( 2 )->is_str( ) );
+        EXPECT_EQ( name->size, 6u );
+        EXPECT_GE( name->data, buffer );
+        EXPECT_LT( name->data, buffer + sizeof( buffer ) );
+
+        /* ...unless copied into the arena. */
+        decoder.reset( );
+        ASSERT_TRUE( document.parse( decoder, true ) );
+        EXPECT_EQ( document.bytes_used( ), 9 * sizeof( mp::Value ) + 2 + 4 + 4 + 6 );
+
+        memset( buffer, 0, sizeof( buffer ) );
+
+        EXPECT_EQ( memcmp( document.root( ).value( 2 )->data, "idtags", 6 ), 0 );
+
+        document.clear( );
+        EXPECT_TRUE( document.root( ).is_nil( ) );
+        EXPECT_EQ( document.bytes_used( ), 0u );
+    }
+
+    TEST( Document, ArenaTooSmall )
+    {
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        encoder.start_array( 4 ).write_uint( 1 ).write_uint( 2 ).write_uint( 3 ).write_uint( 4 );
+
+        alignas( 8 ) mp::mp_u8 arena[ 3 * sizeof( mp::Value ) ];
+        mp::Document document { arena, sizeof( arena ) };
+        mp::Decoder decoder { buffer, encoder.write_cursor( ) };
+
+        EXPECT_FALSE( document.parse( decoder ) );
+        EXPECT_TRUE( document.root( ).is_nil( ) );
+    }
+}
+
+namespace tape
+{
+    TEST( Tape, IndexAndLookup )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const unsigned char users[ ] = "users";
+        const unsigned char name[ ] = "name";
+        const unsigned char alice[ ] = "alice";
+
+        /* { "users": [ 10, { "name": "alice" } ], "name": bin } */
+        mpack.start_map( 2 ).write_cstr( users, 5 );
+        mpack.start_array( 2 ).write_uint( 10 );
+        mpack.start_map( 1 ).write_cstr( name, 4 ).write_cstr( alice, 5 );
+        mpack.write_cstr( name, 4 ).write_bytes( alice, 3 );
+
+        alignas( 8 ) mp::mp_u8 arena[ 0x100 ];
+        mp::Tape tape { arena, sizeof( arena ) };
+
+        ASSERT_TRUE( tape.build( mpack ) );
+        EXPECT_EQ( tape.size( ), 9 );
+        EXPECT_EQ( tape.end( ), mpack.write_cursor( ) );
+
+        const auto array = tape.find( 0, users, 5 );
+        ASSERT_NE( array, mp::Tape::npos );
+        EXPECT_EQ( tape[ array ].marker, mp::MPMarker::FixArray );
+        EXPECT_EQ( tape[ array ].size, 2 );
+
+        const auto value = tape.pointer( "/users/1/name", 13 );
+        ASSERT_NE( value, mp::Tape::npos );
+        EXPECT_EQ( tape[ value ].size, 5 );
+        EXPECT_EQ( memcmp( tape.payload( tape[ value ] ), alice, 5 ), 0 );
+
+        const auto bin = tape.pointer( "/name", 5 );
+        ASSERT_NE( bin, mp::Tape::npos );
+        EXPECT_EQ( tape[ bin ].marker, mp::MPMarker::Bin8 );
+        EXPECT_EQ( memcmp( tape.payload( tape[ bin ] ), alice, 3 ), 0 );
+
+        EXPECT_EQ( tape.pointer( "/users/2", 8 ), mp::Tape::npos );
+        EXPECT_EQ( tape.pointer( "/missing", 8 ), mp::Tape::npos );
+
+        /* Random access decoding through the recorded offset. */
+        ASSERT_TRUE( mpack.seek_read_cursor( tape[ tape.element( array, 0 ) ].offset ) );
+        EXPECT_EQ( mpack.decode_single( ).result.as_u8, 10 );
+    }
+
+    TEST( Tape, Rejects )
+    {
+        mp::mp_u8 buffer[ 0x80 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        for ( auto depth = 0u; depth <= mp::Tape::max_depth; depth++ )
+            mpack.start_array( 1 );
+        mpack.write_uint( 1 );
+
+        mp::mp_u32 arena[ 0x400 ];
+        mp::Tape tape { arena, sizeof( arena ) };
+
+        EXPECT_FALSE( tape.build( buffer, 0, mpack.write_cursor( ) ) );
+        EXPECT_TRUE( tape.build( buffer, 1, mpack.write_cursor( ) ) );
+        EXPECT_FALSE( tape.build( buffer, 1, mpack.write_cursor( ) - 1 ) );
+        EXPECT_EQ( tape.size( ), 0 );
+
+        mp::Tape small { arena, sizeof( mp::TapeEntry ) * 4 };
+
+        EXPECT_FALSE( small.build( buffer, 1, mpack.write_cursor( ) ) );
+    }
+}
+
+namespace reservation
+{
+    TEST( WriteReservation, MatchesEncoder )
+    {
+        mp::mp_u8 expected[ 0x80 ] { };
+        mp::mp_u8 buffer[ 0x80 ] { };
+        mp::MessagePack reference { };
+        mp::MessagePack mpack { };
+
+        reference.initialize_streams( 0, sizeof( expected ), expected );
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const unsigned char key[ ] = "key";
+
+        reference.start_map( 3 ).write_cstr( key, 3 ).write_uint( 0x1234 );
+        reference.write_cstr( key, 3 ).write_int( -0x12345678 );
+        reference.write_cstr( key, 3 ).write_f64( 1.5 );
+        reference.start_array( 2 ).write_boolean( true ).write_bytes( key, 3 );
+
+        {
+            auto record = mpack.reserve( 0x40 );
+
+            ASSERT_TRUE( record );
+
+            record.start_map( 3 ).write_cstr( key, 3 ).write_uint( 0x1234 );
+            record.write_cstr( key, 3 ).write_int( -0x12345678 );
+            record.write_cstr( key, 3 ).write_f64( 1.5 );
+            record.start_array( 2 ).write_boolean( true ).write_bytes( key, 3 );
+
+            EXPECT_EQ( record.remaining( ), 0x40 - reference.write_cursor( ) );
+        }
+
+        /* The unused part of the reservation was given back. */
+        ASSERT_EQ( mpack.write_cursor( ), reference.write_cursor( ) );
+        EXPECT_EQ( memcmp( buffer, expected, sizeof( buffer ) ), 0 );
+
+        EXPECT_FALSE( mpack.reserve( sizeof( buffer ) ) );
+        EXPECT_EQ( mpack.write_cursor( ), reference.write_cursor( ) );
+    }
+
+    TEST( WriteReservation, ChunkedIsContiguous )
+    {
+        mp::mp_u8 head[ 0x10 ] { };
+        mp::ChunkedMessagePack< > mpack { };
+
+        mpack.initialize_streams( 0, sizeof( head ), head );
+        mpack.writer( ).set_chunk_size( 0x20 );
+        mpack.write_u64( 1 );
+
+        {
+            auto record = mpack.reserve( 0x18 );
+
+            ASSERT_TRUE( record );
+            record.write_u64( 2 ).write_u64( 3 );
+        }
+
+        stream::Segment segments[ 4 ] { };
+
+        ASSERT_EQ( mpack.writer( ).segments( segments, 4 ), 2 );
+        EXPECT_EQ( segments[ 0 ].length, 9 );
+        EXPECT_EQ( segments[ 1 ].length, 18 );
+        EXPECT_EQ( segments[ 1 ].base[ 0 ], 0xcf );
+        EXPECT_EQ( segments[ 1 ].base[ 17 ], 3 );
+    }
+}
+
+namespace backpatch
+{
+    TEST( BackPatch, PatchesAndCompacts )
+    {
+        mp::mp_u8 buffer[ 0x100 ] { };
+        mp::mp_u8 expected[ 0x100 ] { };
+        mp::MessagePack mpack { };
+        mp::Encoder reference { expected, sizeof( expected ) };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        /* Without compaction the 32-bit header stays. */
+        const auto rows = mpack.begin_array( );
+
+        ASSERT_TRUE( rows );
+        mpack.write_uint( 1 ).write_uint( 2 ).write_uint( 3 );
+        mpack.end_array( rows, 3 );
+
+        const mp::mp_u8 wide[ ] = { 0xdd, 0x00, 0x00, 0x00, 0x03 };
+
+        reference.write_uint( 1 ).write_uint( 2 ).write_uint( 3 );
+
+        ASSERT_EQ( mpack.write_cursor( ), sizeof( wide ) + reference.write_cursor( ) );
+        EXPECT_EQ( memcmp( buffer, wide, sizeof( wide ) ), 0 );
+        EXPECT_EQ( memcmp( buffer + sizeof( wide ), expected, reference.write_cursor( ) ), 0 );
+        EXPECT_EQ( mpack.decode_single( ).size, 3u );
+
+        reference.reset( );
+
+        /* Compacted, nested containers come out exactly like `start_map`/`start_array`. */
+        mpack.reset_cursors( );
+
+        const auto key = reinterpret_cast< const mp::mp_u8* >( "k" );
+        const auto map = mpack.begin_map( );
+
+        mpack.write_cstr( key, 1 );
+
+        const auto values = mpack.begin_array( );
+
+        for ( auto index = 0u; index < 20; index++ )
+            mpack.write_uint( index * 100 );
+
+        mpack.end_array( values, 20, true ).write_cstr( key, 1 ).write_nil( );
+        mpack.end_map( map, 2, true );
+
+        reference.start_map( 2 ).write_cstr( key, 1 ).start_array( 20 );
+
+        for ( auto index = 0u; index < 20; index++ )
+            reference.write_uint( index * 100 );
+
+        reference.write_cstr( key, 1 ).write_nil( );
+
+        ASSERT_EQ( mpack.write_cursor( ), reference.write_cursor( ) );
+        EXPECT_EQ( memcmp( buffer, expected, reference.write_cursor( ) ), 0 );
+        EXPECT_TRUE( mpack.good( ) );
+
+        /* A header that does not fit is reported and its `end_*` does nothing. */
+        mp::mp_u8 small[ 4 ] { };
+        mp::Encoder encoder { small, sizeof( small ) };
+        const auto failed = encoder.begin_map( );
+
+        EXPECT_FALSE( failed );
+        EXPECT_EQ( encoder.error( ), stream::error::overflow );
+        encoder.end_map( failed, 0, true );
+        EXPECT_EQ( encoder.write_cursor( ), 0u );
+    }
+
+    TEST( BackPatch, ChunkedKeepsWideHeader )
+    {
+        mp::ChunkedMessagePack< > mpack { };
+
+        mpack.writer( ).set_chunk_size( 0x10 );
+
+        const auto rows = mpack.begin_array( );
+
+        for ( auto index = 0u; index < 8; index++ )
+            mpack.write_u32( index );
+
+        mpack.end_array( rows, 8, true );
+
+        stream::Segment segments[ 8 ] { };
+        const auto count = mpack.writer( ).segments( segments, 8 );
+        std::string flat { };
+
+        for ( auto index = 0lu; index < count; index++ )
+            flat.append( reinterpret_cast< const char* >( segments[ index ].base ), segments[ index ].length );
+
+        ASSERT_EQ( flat.size( ), 5 + 8 * 5u );
+
+        mp::Decoder decoder { reinterpret_cast< const mp::mp_u8* >( flat.data( ) ), static_cast< mp::mp_size >( flat.size( ) ) };
+        mp::mp_u32 values[ 8 ] { };
+
+        EXPECT_EQ( decoder.peek_marker( ), mp::MPMarker::Array32 );
+        EXPECT_EQ( decoder.read_array_u32( values, 8 ), 8u );
+        EXPECT_EQ( values[ 7 ], 7u );
+    }
+}
+
+namespace errors
+{
+    TEST( StickyErrors, WriteOverflow )
+    {
+        mp::mp_u8 buffer[ 0x10 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        /* Filling the buffer exactly is not an error. */
+        mpack.write_u64( 1 ).write_u32( 2 ).write_u8( 3 );
+
+        EXPECT_EQ( mpack.write_cursor( ), sizeof( buffer ) );
+        EXPECT_TRUE( mpack.good( ) );
+
+        mpack.write_u8( 4 ).write_u8( 5 );
+
+        EXPECT_FALSE( mpack.good( ) );
+        EXPECT_EQ( mpack.error( ), stream::error::overflow );
+        EXPECT_EQ( mpack.write_cursor( ), sizeof( buffer ) );
+
+        mpack.reset_cursors( );
+        EXPECT_TRUE( mpack.good( ) );
+    }
+
+    TEST( StickyErrors, UnrepresentableLengths )
+    {
+        mp::mp_u8 buffer[ 0x10 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        /* Lengths wider than 32 bits are rejected instead of being truncated. */
+        const auto too_long = 0x100000000ull;
+
+        mpack.start_array( too_long ).start_map( too_long );
+        mpack.write_cstr( buffer, too_long ).write_bytes( buffer, too_long );
+
+        EXPECT_EQ( mpack.write_cursor( ), 0u );
+        EXPECT_EQ( mpack.error( ), stream::error::overflow );
+
+        mpack.reset_cursors( );
+        mpack.start_map( 16 ).start_map( 0x10000 );
+
+        EXPECT_TRUE( mpack.good( ) );
+        EXPECT_EQ( buffer[ 0 ], 0xde );
+        EXPECT_EQ( buffer[ 3 ], 0xdf );
+        EXPECT_EQ( sizeof( mp::mp_size ), sizeof( mpack.stream_size( ) ) );
+    }
+
+    TEST( StickyErrors, TruncatedDecode )
+    {
+        const mp::mp_u8 encoded[ ] = { 0x01, 0xcd, 0x12, 0x34, 0xd9, 0x10, 'a', 'b', 0xcd, 0x12 };
+        mp::mp_u8 buffer[ sizeof( encoded ) ] { };
+        mp::MessagePack mpack { };
+
+        memcpy( buffer, encoded, sizeof( encoded ) );
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        auto dr = mpack.decode_single( );
+        EXPECT_FALSE( dr.truncated );
+
+        dr = mpack.decode_single( );
+        EXPECT_FALSE( dr.truncated );
+        EXPECT_EQ( dr.result.as_u16, 0x1234 );
+        EXPECT_TRUE( mpack.good( ) );
+
+        /* Str8 announcing 16 bytes with only 4 left. */
+        dr = mpack.decode_single( );
+        EXPECT_TRUE( dr.truncated );
+        EXPECT_EQ( mpack.error( ), stream::error::overflow );
+
+        mpack.clear_error( );
+        mpack.seek_read_cursor( 8 );
+
+        /* Uint16 missing its second byte. */
+        dr = mpack.decode_single( );
+        EXPECT_TRUE( dr.truncated );
+        EXPECT_FALSE( mpack.good( ) );
+
+        /* Nothing left at all. */
+        mpack.clear_error( );
+        mpack.seek_read_cursor( sizeof( buffer ) );
+        EXPECT_TRUE( mpack.decode_single( ).truncated );
+    }
+
+    TEST( StickyErrors, Malformed )
+    {
+        mp::mp_u8 buffer[ 4 ] = { 0xc1 };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        EXPECT_EQ( mpack.decode_single( ).marker, mp::MPMarker::Unused );
+        EXPECT_EQ( mpack.error( ), stream::error::malformed );
+    }
+}
+
+namespace fragments
+{
+    TEST( FragmentCache, InternAndEmit )
+    {
+        mp::FragmentCache< 0x100, 0x10 > cache { };
+
+        const auto key = cache.str( "name" );
+        const auto header = cache.map_header( 2 );
+        const auto tag = cache.fixext_tag( 2, 7 );
+
+        ASSERT_TRUE( key && header && tag );
+        EXPECT_EQ( key.size, 5 );
+        EXPECT_EQ( key.data[ 0 ], 0xa4 );
+        EXPECT_EQ( header.size, 1 );
+        EXPECT_EQ( tag.data[ 0 ], 0xd5 );
+
+        /* Identical fragments are stored once. */
+        EXPECT_EQ( cache.str( "name" ).data, key.data );
+        EXPECT_EQ( cache.size( ), 3 );
+
+        const auto subtree = cache.encode( [ ]( mp::MessagePack &pack ) {
+            pack.start_array( 2 ).write_uint( 1 ).write_boolean( false );
+        } );
+
+        ASSERT_TRUE( subtree );
+        EXPECT_EQ( subtree.size, 4 );
+
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const mp::mp_u8 data[ 2 ] = { 1, 2 };
+
+        mpack.write_encoded( header ).write_encoded( key ).write_encoded( subtree );
+        mpack.write_encoded( cache.str( "tag" ) ).write_encoded( tag ).write_encoded( data, 2 );
+
+        auto dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixMap );
+        EXPECT_EQ( dr.size, 2 );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixStr );
+        EXPECT_EQ( memcmp( dr.result.as_fixstr, "name", 4 ), 0 );
+
+        EXPECT_TRUE( mpack.skip_value( ) );
+        EXPECT_TRUE( mpack.skip_value( ) );
+
+        dr = mpack.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixExt2 );
+        EXPECT_EQ( dr.result.as_fixext2.type, 7 );
+        EXPECT_EQ( dr.result.as_fixext2.data[ 1 ], 2 );
+        EXPECT_TRUE( mpack.good( ) );
+    }
+
+    TEST( FragmentCache, Capacity )
+    {
+        mp::FragmentCache< 0x10, 4 > cache { };
+
+        const mp::mp_u8 long_key[ 0x20 ] { };
+
+        EXPECT_FALSE( cache.str( long_key, sizeof( long_key ) ) );
+        EXPECT_TRUE( cache.str( "a" ) );
+        EXPECT_TRUE( cache.str( "b" ) );
+        EXPECT_TRUE( cache.str( "c" ) );
+
+        /* Only 3 of the 4 slots are ever used. */
+        EXPECT_FALSE( cache.str( "d" ) );
+        EXPECT_TRUE( cache.str( "a" ) );
+
+        cache.reset( );
+        EXPECT_TRUE( cache.str( "d" ) );
+        EXPECT_EQ( cache.bytes_used( ), 2 );
+    }
+}
+
+#ifdef MP_TEST_MMAP
+namespace mapped
+{
+    TEST( MappedFile, WriteAndReadBack )
+    {
+        const auto path = testing::TempDir( ) + "mp_mapped.msgpack";
+        const auto page = static_cast< mp::mp_u32 >( sysconf( _SC_PAGESIZE ) );
+
+        /* The blob spans several windows on both sides. */
+        auto blob = static_cast< mp::mp_u8 * >( std::malloc( page * 3 ) );
+        ASSERT_NE( blob, nullptr );
+
+        for ( mp::mp_u32 i = 0; i < page * 3; ++i )
+            blob[ i ] = static_cast< mp::mp_u8 >( i * 7 );
+
+        {
+            mp::MappedMessagePack mpack { };
+
+            mpack.initialize_streams( );
+            mpack.writer( ).set_window( page );
+            ASSERT_TRUE( mpack.writer( ).open( path.c_str( ) ) );
+
+            for ( mp::mp_u32 i = 0; i < page; ++i )
+                mpack.write_uint( i );
+
+            mpack.write_bytes( blob, page * 3 );
+
+            auto record = mpack.reserve( 0x20 );
+            ASSERT_TRUE( record );
+            const mp::mp_u8 tail[ ] = { 't', 'a', 'i', 'l' };
+
+            record.start_array( 2 ).write_cstr( tail, sizeof( tail ) );
+            record.write_boolean( true );
+            record.commit( );
+
+            EXPECT_TRUE( mpack.good( ) );
+            mpack.writer( ).close( );
+        }
+
+        mp::MappedReader reader { };
+
+        ASSERT_TRUE( reader.set_window( page ).open( path.c_str( ) ) );
+        EXPECT_GT( reader.size( ), page * 5ull );
+
+        for ( mp::mp_u32 i = 0; i < page; ++i )
+        {
+            mp::mp_u32 value = 0;
+            ASSERT_TRUE( reader.decode_single( ).as_integer( value ) );
+            ASSERT_EQ( value, i );
+        }
+
+        const auto blob_start = reader.position( );
+
+        auto dr = reader.decode_view( );
+        ASSERT_EQ( dr.marker, mp::MPMarker::Bin16 );
+        ASSERT_FALSE( dr.truncated );
+        ASSERT_EQ( dr.size, page * 3 );
+        EXPECT_EQ( memcmp( dr.result.as_view.data, blob, page * 3 ), 0 );
+
+        dr = reader.decode_single( );
+        EXPECT_EQ( dr.marker, mp::MPMarker::FixArray );
+        EXPECT_EQ( reader.decode_view( ).marker, mp::MPMarker::Str8 );
+        EXPECT_TRUE( reader.decode_single( ).result.as_bool );
+        EXPECT_TRUE( reader.eof( ) );
+        EXPECT_TRUE( reader.decode_single( ).truncated );
+
+        /* Skipping works across windows too. */
+        ASSERT_TRUE( reader.set_window( page ).seek( 0 ) );
+        ASSERT_TRUE( reader.seek( blob_start ) );
+        EXPECT_TRUE( reader.skip_value( ) );
+        EXPECT_EQ( reader.decode_single( ).marker, mp::MPMarker::FixArray );
+
+        reader.close( );
+        std::free( blob );
+        unlink( path.c_str( ) );
+    }
+
+    TEST( MappedFile, PayloadEndingAtEndOfFile )
+    {
+        const auto path = testing::TempDir( ) + "mp_mapped_tail.msgpack";
+        const auto page = static_cast< mp::mp_u32 >( sysconf( _SC_PAGESIZE ) );
+        const std::string blob( page * 2, 'x' );
+
+        {
+            mp::MappedMessagePack mpack { };
+
+            mpack.initialize_streams( );
+            ASSERT_TRUE( mpack.writer( ).open( path.c_str( ) ) );
+
+            mpack.write_cstr( reinterpret_cast< const mp::mp_u8* >( blob.data( ) ), 3 );
+            mpack.write_bytes( reinterpret_cast< const mp::mp_u8* >( blob.data( ) ), page * 2 );
+
+            EXPECT_TRUE( mpack.good( ) );
+            mpack.writer( ).close( );
+        }
+
+        /* The last value starts in the first window and ends on the last byte of the file. */
+        mp::MappedReader reader { };
+
+        ASSERT_TRUE( reader.set_window( page ).open( path.c_str( ) ) );
+        EXPECT_EQ( reader.decode_view( ).size, 3u );
+
+        const auto dr = reader.decode_view( );
+
+        EXPECT_FALSE( dr.truncated );
+        ASSERT_EQ( dr.size, page * 2 );
+        EXPECT_EQ( memcmp( dr.result.as_view.data, blob.data( ), page * 2 ), 0 );
+        EXPECT_TRUE( reader.eof( ) );
+
+        reader.close( );
+        unlink( path.c_str( ) );
+    }
+}
+#endif
+
+namespace batch
+{
+    TEST( Batch, SplitAndDecodeInParallel )
+    {
+        constexpr mp::mp_u32 messages = 0x400;
+
+        static mp::mp_u8 buffer[ 0x8000 ] { };
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer );
+
+        const mp::mp_u8 name[ ] = { 'm', 's', 'g' };
+
+        for ( mp::mp_u32 i = 0; i < messages; ++i )
+            mpack.start_array( 2 ).write_uint( i * 3 ).write_cstr( name, sizeof( name ) );
+
+        /* A trailing partial message is left out of the split. */
+        const auto complete = mpack.write_cursor( );
+        const mp::mp_u8 partial[ ] = { 0xcd, 0x01 };
+        mpack.write_encoded( partial, sizeof( partial ) );
+        const auto size = mpack.write_cursor( );
+
+        static mp::mp_size offsets[ messages + 1 ] { };
+
+        const auto batch = mp::split_batch( buffer, size, offsets, messages + 1 );
+
+        ASSERT_EQ( batch.count, messages );
+        EXPECT_EQ( batch.end, complete );
+        EXPECT_FALSE( batch.complete( size ) );
+        EXPECT_EQ( batch.start( 0 ) + batch.size( 0 ), batch.start( 1 ) );
+
+        static mp::mp_u32 seen[ messages ] { };
+
+        const auto ok = mp::decode_batch(
+            batch,
+            [ & ]( const mp::mp_size index, mp::Decoder &decoder )
+            {
+                mp::mp_u32 value = 0;
+
+                if ( decoder.decode_single( ).size != 2 )
+                    return false;
+
+                if ( !decoder.decode_single( ).as_integer( value ) )
+                    return false;
+
+                decoder.decode_view( );
+                seen[ index ] += value == index * 3 ? 1 : 0x100;
+
+                /* The cursor never leaves the message, and cannot read the next one. */
+                const auto end = batch.start( index ) + batch.size( index );
+
+                return decoder.good( ) && decoder.read_cursor( ) == end && !decoder.skip_value( );
+            },
+            4
+        );
+
+        EXPECT_TRUE( ok );
+
+        for ( mp::mp_u32 i = 0; i < messages; ++i )
+            ASSERT_EQ( seen[ i ], 1u ) << i;
+
+        /* A failing callback is reported without stopping the others. */
+        EXPECT_FALSE( mp::decode_batch(
+            batch, [ ]( const mp::mp_size index, mp::Decoder & ) { return index != 7; }, 3
+        ) );
+    }
+}
+
+namespace ring
+{
+    TEST( EncoderRing, ProducersAndConsumer )
+    {
+        constexpr mp::mp_u32 producers = 4;
+        constexpr mp::mp_u32 messages = 0x800;
+
+        alignas( 8 ) static mp::mp_u8 buffer[ 0x1000 ] { };
+        mp::EncoderRing ring { buffer, sizeof( buffer ) };
+
+        ASSERT_TRUE( ring );
+        EXPECT_EQ( ring.max_message( ), sizeof( buffer ) / 2 - 8 );
+
+        std::thread threads[ producers ];
+
+        for ( mp::mp_u32 producer = 0; producer < producers; ++producer )
+        {
+            threads[ producer ] = std::thread( [ &ring, producer ]( )
+            {
+                mp::MessagePack mpack { };
+                const mp::mp_u8 padding[ 0x40 ] { };
+
+                for ( mp::mp_u32 i = 0; i < messages; ++i )
+                {
+                    while ( !ring.reserve( mpack, 0x60 ) )
+                        std::this_thread::yield( );
+
+                    mpack.start_array( 3 ).write_uint( producer ).write_uint( i );
+                    mpack.write_bytes( padding, ( i * 7 + producer ) % sizeof( padding ) );
+                    ring.publish( mpack );
+                }
+            } );
+        }
+
+        mp::mp_u32 next[ producers ] { };
+        mp::mp_u32 received = 0;
+        bool ordered = true;
+
+        while ( received < producers * messages )
+        {
+            stream::Segment segments[ 0x10 ];
+            const auto count = ring.peek( segments, 0x10 );
+
+            for ( mp::mp_u64 index = 0; index < count; ++index )
+            {
+                mp::MessagePack mpack { };
+                mp::mp_u32 producer = 0, i = 0;
+
+                mpack.initialize_streams( 0, static_cast< mp::mp_size >( segments[ index ].length ),
+                                          segments[ index ].base );
+
+                mpack.decode_single( );
+                mpack.decode_single( ).as_integer( producer );
+                mpack.decode_single( ).as_integer( i );
+                mpack.decode_view( );
+
+                /* Each producer's messages arrive in order, fully written. */
+                const auto whole = mpack.read_cursor( ) == segments[ index ].length;
+
+                ordered = ordered && producer < producers && next[ producer ] == i;
+                ordered = ordered && mpack.good( ) && whole;
+                next[ producer % producers ] = i + 1;
+                received++;
+            }
+
+            ring.release( );
+
+            if ( !count )
+                std::this_thread::yield( );
+        }
+
+        for ( auto &thread : threads )
+            thread.join( );
+
+        EXPECT_TRUE( ordered );
+
+        /* Oversized and dropped messages. */
+        mp::MessagePack mpack { };
+        stream::Segment segment { };
+
+        EXPECT_FALSE( ring.reserve( mpack, sizeof( buffer ) ) );
+        ASSERT_TRUE( ring.reserve( mpack, 2 ) );
+        mpack.write_u32( 1 );
+        EXPECT_FALSE( ring.publish( mpack ) );
+
+        ASSERT_TRUE( ring.reserve( mpack, 2 ) );
+        mpack.write_true( );
+        EXPECT_TRUE( ring.publish( mpack ) );
+
+        ASSERT_EQ( ring.peek( &segment, 1 ), 1u );
+        EXPECT_EQ( segment.length, 1u );
+        EXPECT_EQ( segment.base[ 0 ], 0xc3 );
+        ring.release( );
+        EXPECT_EQ( ring.peek( &segment, 1 ), 0u );
+
+        /* The largest message still fits once the ring drains, wherever the head was left. */
+        for ( mp::mp_u32 round = 0; round < 4; ++round )
+        {
+            ASSERT_TRUE( ring.reserve( mpack, 1 + round * 0x18 ) );
+            mpack.write_nil( );
+            EXPECT_TRUE( ring.publish( mpack ) );
+            ASSERT_EQ( ring.peek( &segment, 1 ), 1u );
+            ring.release( );
+
+            ASSERT_TRUE( ring.reserve( mpack, ring.max_message( ) ) ) << round;
+            mpack.write_nil( );
+            EXPECT_TRUE( ring.publish( mpack ) );
+            ASSERT_EQ( ring.peek( &segment, 1 ), 1u );
+            EXPECT_EQ( segment.length, 1u );
+            ring.release( );
+        }
+    }
+}
+
+namespace validation
+{
+    TEST( Validate, AcceptsWellFormedBuffers )
+    {
+        mp::mp_u8 buffer[ 0x200 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const mp::mp_u8 key[ ] = { 'i', 'd' };
+        const mp::mp_u8 blob[ 0x30 ] { 7 };
+        const mp::mp_u8 stamp[ 4 ] { };
+
+        /* A long run of fixints, then every other kind of value, then a second message. */
+        encoder.start_map( 2 ).write_cstr( key, 2 ).start_array( 100 );
+
+        for ( auto index = 0; index < 100; index++ )
+            encoder.write_int( index % 2 ? -index % 32 : index );
+
+        encoder.write_cstr( key, 1 ).start_array( 6 ).write_bytes( blob, sizeof( blob ) );
+        encoder.write_f64( 1.5 ).write_nil( ).write_ext( 3, stamp, sizeof( stamp ) );
+        encoder.start_map( 0 ).write_u64( 1 );
+        encoder.write_true( );
+
+        const auto size = encoder.write_cursor( );
+        const auto token = mp::validate( buffer, size );
+
+        ASSERT_TRUE( token );
+        EXPECT_EQ( token.values( ), 2u );
+        EXPECT_EQ( token.error( ), stream::error::none );
+
+        /* The trusted decoder yields exactly what the checked one does. */
+        mp::Decoder checked { buffer, size };
+        mp::TrustedDecoder trusted { token };
+
+        for ( ;; )
+        {
+            const auto expected = checked.decode_view( );
+
+            if ( !checked.good( ) )
+                break;
+
+            const auto actual = trusted.decode_view( );
+
+            ASSERT_EQ( actual.marker, expected.marker );
+            ASSERT_EQ( actual.size, expected.size );
+            ASSERT_EQ( actual.result.as_u64, expected.result.as_u64 );
+            ASSERT_EQ( trusted.read_cursor( ), checked.read_cursor( ) );
+
+            if ( checked.read_cursor( ) == size )
+                break;
+        }
+
+        trusted.reset( );
+
+        mp::NullVisitor visitor { };
+
+        EXPECT_TRUE( trusted.parse( visitor ) );
+        EXPECT_TRUE( trusted.skip_value( ) );
+        EXPECT_EQ( trusted.read_cursor( ), size );
+
+        /* Every strict prefix cutting into the first message is rejected as truncated. */
+        mp::Decoder first { buffer, size };
+
+        ASSERT_TRUE( first.skip_value( ) );
+
+        for ( mp::mp_size cut = 1; cut < first.read_cursor( ); cut++ )
+            ASSERT_EQ( mp::validate( buffer, cut ).error( ), stream::error::overflow ) << cut;
+
+        EXPECT_EQ( mp::validate( buffer, first.read_cursor( ) ).values( ), 1u );
+        EXPECT_TRUE( mp::validate( buffer, 0 ) );
+    }
+
+    TEST( Validate, RejectsLengthsDepthsAndCounts )
+    {
+        /* Declared lengths and counts larger than the bytes left. */
+        const mp::mp_u8 str32[ ] = { 0x91, 0xdb, 0xff, 0xff, 0xff, 0xff, 'a' };
+        const mp::mp_u8 array32[ ] = { 0xdd, 0x7f, 0xff, 0xff, 0xff, 0x01, 0x02 };
+        const mp::mp_u8 map16[ ] = { 0xde, 0x00, 0x02, 0x01, 0x02, 0x03 };
+        const mp::mp_u8 header[ ] = { 0x01, 0xcd, 0x01 };
+        const mp::mp_u8 reserved[ ] = { 0x92, 0x01, 0xc1 };
+
+        auto token = mp::validate( str32, sizeof( str32 ) );
+
+        EXPECT_FALSE( token );
+        EXPECT_EQ( token.error( ), stream::error::overflow );
+        EXPECT_EQ( token.offset( ), 1u );
+
+        EXPECT_EQ( mp::validate( array32, sizeof( array32 ) ).error( ), stream::error::overflow );
+        EXPECT_EQ( mp::validate( map16, sizeof( map16 ) ).error( ), stream::error::overflow );
+        EXPECT_EQ( mp::validate( header, sizeof( header ) ).offset( ), 1u );
+
+        token = mp::validate( reserved, sizeof( reserved ) );
+        EXPECT_EQ( token.error( ), stream::error::malformed );
+        EXPECT_EQ( token.offset( ), 2u );
+
+        EXPECT_EQ( mp::validate( nullptr, 0 ).error( ), stream::error::unavailable );
+
+        /* Limits. */
+        mp::mp_u8 nested[ 0x10 ] { };
+
+        for ( auto index = 0; index < 8; index++ )
+            nested[ index ] = 0x91;
+
+        mp::ValidationLimits limits { };
+
+        EXPECT_TRUE( mp::validate( nested, 9, limits ) );
+
+        limits.max_depth = 4;
+        token = mp::validate( nested, 9, limits );
+        EXPECT_EQ( token.error( ), stream::error::malformed );
+        EXPECT_EQ( token.offset( ), 4u );
+
+        const mp::mp_u8 wide[ ] = { 0x93, 0x01, 0x02, 0x03 };
+
+        limits.max_elements = 2;
+        EXPECT_EQ( mp::validate( wide, sizeof( wide ), limits ).error( ), stream::error::malformed );
+        limits.max_elements = 3;
+        EXPECT_TRUE( mp::validate( wide, sizeof( wide ), limits ) );
+    }
+}
+
+namespace instrumentation
+{
+    TEST( Stats, CountsMarkersDepthsAndFailures )
+    {
+        if ( !mp::stats::enabled )
+            GTEST_SKIP( ) << "built without MP_STATS";
+
+        mp::stats::reset( );
+
+        mp::mp_u8 buffer[ 0x40 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const mp::mp_u8 name[ ] = { 'a', 'b', 'c' };
+        const mp::mp_u32 values[ ] = { 1, 2, 3 };
+
+        encoder.start_array( 2 ).write_cstr( name, 3 ).start_map( 1 ).write_int( -1 );
+        encoder.write_array_u32( values, 3, mp::MPArrayEncoding::FixedWidth );
+
+        auto counters = mp::stats::thread_snapshot( );
+
+        EXPECT_EQ( counters.encoded[ 0x92 ], 1u );
+        EXPECT_EQ( counters.encoded[ 0xd9 ], 1u );
+        EXPECT_EQ( counters.encoded[ 0x81 ], 1u );
+        EXPECT_EQ( counters.encoded[ 0xd0 ], 1u );
+        EXPECT_EQ( counters.encoded[ 0x93 ], 1u );
+        EXPECT_EQ( counters.encoded[ 0xce ], 3u );
+        EXPECT_EQ( counters.payloads[ 2 ], 1u );
+
+        /* `parse` counts every value and every container by depth. */
+        mp::Decoder decoder { buffer, encoder.write_cursor( ) };
+        mp::NullVisitor visitor { };
+
+        ASSERT_TRUE( decoder.parse( visitor ) );
+
+        counters = mp::stats::thread_snapshot( );
+
+        EXPECT_EQ( counters.decoded[ 0x92 ], 1u );
+        EXPECT_EQ( counters.decoded[ 0xce ], 3u );
+        EXPECT_EQ( counters.depths[ 0 ], 1u );
+        EXPECT_EQ( counters.depths[ 1 ], 1u );
+        EXPECT_EQ( counters.depths[ 2 ], 1u );
+
+        /* A failed write and a truncated read. */
+        mp::mp_u8 small[ 2 ] { };
+        mp::Encoder tight { small, sizeof( small ) };
+
+        tight.write_u32( 1 );
+
+        mp::Decoder truncated { buffer, 1 };
+        truncated.read_u32( );
+
+        counters = mp::stats::thread_snapshot( );
+
+        EXPECT_EQ( counters.write_failures[ 0 ], 1u );
+        EXPECT_EQ( counters.write_dropped, 4u );
+        EXPECT_EQ( counters.read_failures[ 0 ], 1u );
+        EXPECT_EQ( counters.read_dropped, 4u );
+
+        /* Counters of threads that exited stay in the global snapshot. */
+        std::thread worker( [ ]( )
+        {
+            mp::mp_u8 local[ 0x10 ] { };
+            mp::Encoder other { local, sizeof( local ) };
+
+            other.write_nil( );
+        } );
+
+        worker.join( );
+
+        EXPECT_EQ( mp::stats::thread_snapshot( ).encoded[ 0xc0 ], 0u );
+        EXPECT_EQ( mp::stats::snapshot( ).encoded[ 0xc0 ], 1u );
+
+        mp::stats::reset( );
+        EXPECT_EQ( mp::stats::snapshot( ).encoded[ 0x92 ], 0u );
+    }
+
+    TEST( Stats, CompiledOutByDefault )
+    {
+        if ( mp::stats::enabled )
+            GTEST_SKIP( ) << "built with MP_STATS";
+
+        mp::mp_u8 buffer[ 0x10 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        encoder.write_uint( 1 ).write_u64( 2 ).write_u64( 3 );
+
+        const auto counters = mp::stats::snapshot( );
+
+        EXPECT_EQ( counters.encoded[ 0xcc ], 0u );
+        EXPECT_EQ( counters.write_dropped, 0u );
+    }
+}
+
+#ifdef MP_TEST_ASYNC
+namespace coroutines
+{
+    /*
+     * Stands in for an event loop: `read( )` always suspends, and the test completes the pending
+     * read by hand with `deliver( )`.
+     */
+    struct ManualSource
+    {
+        std::coroutine_handle< > waiting { };
+        mp::InputChunk pending { };
+        int reads { 0 };
+
+        struct Awaiter
+        {
+            ManualSource &source;
+
+            bool await_ready( ) const { return false; }
+            void await_suspend( std::coroutine_handle< > handle ) { source.waiting = handle; }
+            mp::InputChunk await_resume( ) const { return source.pending; }
+        };
+
+        Awaiter read( )
+        {
+            reads++;
+            return { *this };
+        }
+
+        void deliver( const mp::mp_u8 *data, mp::mp_u32 size )
+        {
+            pending = { data, size };
+            std::exchange( waiting, nullptr ).resume( );
+        }
+    };
+
+    /*
+     * Completes every write right away, recording where the bytes were; never reads them.
+     */
+    struct RecordingSink
+    {
+        const mp::mp_u8 *data { nullptr };
+        mp::mp_u32 size { 0 };
+        mp::mp_u64 total { 0 };
+        mp::mp_u32 writes { 0 };
+        bool contiguous { true };
+
+        struct Awaiter
+        {
+            bool await_ready( ) const { return true; }
+            void await_suspend( std::coroutine_handle< > ) { }
+            bool await_resume( ) const { return true; }
+        };
+
+        Awaiter write( const mp::mp_u8 *bytes, mp::mp_u32 count )
+        {
+            contiguous = contiguous && ( !writes || bytes == data + size );
+            data = bytes;
+            size = count;
+            total += count;
+            writes++;
+            return { };
+        }
+    };
+
+    mp::Task< int > consume( mp::AsyncDecoder< ManualSource > &decoder, std::string &text )
+    {
+        mp::MPDecodeResult dr { };
+        int values = 0;
+
+        /* Awaited results go to locals first, see `mp_async.hpp`. */
+        for ( ;; )
+        {
+            const bool decoded = co_await decoder.next( dr );
+
+            if ( !decoded )
+                break;
+
+            values++;
+
+            while ( dr.marker == mp::MPMarker::Str8 )
+            {
+                const auto piece = co_await decoder.payload( );
+
+                if ( !piece.size )
+                    break;
+
+                text.append( reinterpret_cast< const char* >( piece.data ), piece.size );
+            }
+        }
+
+        co_return values;
+    }
+
+    TEST( Coroutines, DecoderSuspendsForInput )
+    {
+        mp::mp_u8 buffer[ 0x80 ] { };
+        mp::Encoder encoder { buffer, sizeof( buffer ) };
+
+        const std::string text( 40, 'x' );
+
+        encoder.start_array( 2 ).write_uint( 0x1234 );
+        encoder.write_cstr( reinterpret_cast< const mp::mp_u8* >( text.data( ) ), 40 );
+        encoder.write_true( );
+
+        const auto size = static_cast< mp::mp_u32 >( encoder.write_cursor( ) );
+
+        ManualSource source { };
+        mp::AsyncDecoder< ManualSource > decoder { source };
+        std::string received;
+
+        auto task = consume( decoder, received );
+
+        task.start( );
+        ASSERT_FALSE( task.done( ) );
+
+        /* Split inside the Uint16 header and inside the string payload. */
+        const mp::mp_u32 cuts[ ] = { 2, 10, size };
+        mp::mp_u32 from = 0;
+
+        for ( const auto cut : cuts )
+        {
+            source.deliver( buffer + from, cut - from );
+            from = cut;
+            ASSERT_FALSE( task.done( ) );
+        }
+
+        source.deliver( nullptr, 0 );
+
+        ASSERT_TRUE( task.done( ) );
+        EXPECT_EQ( task.result( ), 4 );
+        EXPECT_EQ( source.reads, 4 );
+        EXPECT_EQ( received, text );
+        EXPECT_TRUE( decoder.ended( ) );
+    }
+
+    mp::Task< bool > respond( mp::AsyncEncoder< RecordingSink > &encoder )
+    {
+        encoder.start_map( 1 ).write_uint( 1 ).write_true( );
+
+        const bool flushed = co_await encoder.flush( );
+
+        co_return flushed;
+    }
+
+    TEST( Coroutines, EncoderFlushesInPlace )
+    {
+        mp::mp_u8 buffer[ 0x10 ] { };
+        RecordingSink sink { };
+        mp::AsyncEncoder< RecordingSink > encoder { sink, buffer, sizeof( buffer ) };
+
+        auto task = respond( encoder );
+
+        task.start( );
+
+        ASSERT_TRUE( task.done( ) );
+        EXPECT_TRUE( task.result( ) );
+        EXPECT_EQ( sink.data, buffer );
+        EXPECT_EQ( sink.size, 4u );
+        EXPECT_EQ( encoder.write_cursor( ), 0u );
+
+        /* A failed encode is not sent. */
+        const mp::mp_u8 blob[ 0x20 ] { };
+
+        sink = { };
+        encoder.write_bytes( blob, sizeof( blob ) );
+
+        auto failed = encoder.flush( );
+
+        failed.start( );
+        ASSERT_TRUE( failed.done( ) );
+        EXPECT_FALSE( failed.result( ) );
+        EXPECT_EQ( sink.data, nullptr );
+    }
+
+    TEST( Coroutines, EncoderFlushesInSlices )
+    {
+        mp::mp_u8 buffer[ 0x20 ] { };
+        const mp::mp_u8 blob[ 0x12 ] { };
+        RecordingSink sink { };
+        mp::AsyncEncoder< RecordingSink > encoder { sink, buffer, sizeof( buffer ) };
+
+        encoder.write_bytes( blob, sizeof( blob ) );
+
+        auto task = encoder.flush( 7 );
+
+        task.start( );
+
+        ASSERT_TRUE( task.done( ) );
+        EXPECT_TRUE( task.result( ) );
+        EXPECT_EQ( sink.writes, 3u );
+        EXPECT_EQ( sink.total, 2u + sizeof( blob ) );
+        EXPECT_TRUE( sink.contiguous );
+        EXPECT_EQ( sink.data, buffer + 14 );
+        EXPECT_EQ( sink.size, 6u );
+    }
+
+#if defined( MP_LARGE_STREAMS ) && defined( MP_TEST_MMAP )
+    TEST( Coroutines, EncoderFlushIsNeverShort )
+    {
+        /* Address space only: nothing but the last page is ever touched. */
+        constexpr mp::mp_u64 size = 0x200000000ull + 0x1000;
+
+        const auto memory = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+
+        if ( memory == MAP_FAILED )
+            GTEST_SKIP( ) << "cannot reserve 8 GB of address space";
+
+        /* Advances the cursor without writing the bytes it skips. */
+        struct SkippingEncoder : mp::AsyncEncoder< RecordingSink >
+        {
+            using AsyncEncoder::AsyncEncoder;
+
+            bool skip( mp::mp_u32 count ) { return wr_.reserve( count ) != nullptr; }
+        };
+
+        const auto buffer = static_cast< mp::mp_u8* >( memory );
+        RecordingSink sink { };
+        SkippingEncoder encoder { sink, buffer, size };
+
+        /* Claim well over 4 GB, then encode a value at the end. */
+        ASSERT_TRUE( encoder.skip( limits::uint32_max ) );
+        ASSERT_TRUE( encoder.skip( limits::uint32_max ) );
+        encoder.write_true( );
+
+        const auto end = encoder.write_cursor( );
+
+        ASSERT_EQ( end, 2ull * limits::uint32_max + 1 );
+
+        auto task = encoder.flush( );
+
+        task.start( );
+
+        ASSERT_TRUE( task.done( ) );
+        EXPECT_TRUE( task.result( ) );
+        EXPECT_EQ( sink.total, end );
+        EXPECT_EQ( sink.writes, 3u );
+        EXPECT_TRUE( sink.contiguous );
+        EXPECT_EQ( sink.data + sink.size, buffer + end );
+        EXPECT_EQ( encoder.write_cursor( ), 0u );
+
+        munmap( memory, size );
+    }
+#endif
+}
+#endif
+
+/*
+ * Every global allocation is counted, so that the regression tests can check the codec itself
+ * never allocates.
+ */
+namespace
+{
+    std::atomic< mp::mp_u64 > heap_allocations { 0 };
+
+    void *counted_allocation( const std::size_t size )
+    {
+        heap_allocations.fetch_add( 1, std::memory_order_relaxed );
+
+        if ( const auto memory = std::malloc( size ? size : 1 ) )
+            return memory;
+
+        throw std::bad_alloc( );
+    }
+}
+
+void *operator new( const std::size_t size )
+{
+    return counted_allocation( size );
+}
+
+void *operator new[ ]( const std::size_t size )
+{
+    return counted_allocation( size );
+}
+
+void operator delete( void *memory ) noexcept
+{
+    std::free( memory );
+}
+
+void operator delete[ ]( void *memory ) noexcept
+{
+    std::free( memory );
+}
+
+void operator delete( void *memory, std::size_t ) noexcept
+{
+    std::free( memory );
+}
+
+void operator delete[ ]( void *memory, std::size_t ) noexcept
+{
+    std::free( memory );
+}
+
+namespace regression
+{
+    /*
+     * Reference corpus: a batch of messages covering every family, written again and again until
+     * the buffer is full.
+     */
+    mp::mp_size write_corpus( mp::mp_u8 *buffer, const mp::mp_size size )
+    {
+        static const mp::mp_u8 text[ 0x100 ] { 'i', 'd' };
+        mp::Encoder encoder { buffer, size };
+        mp::mp_size end = 0;
+
+        for ( mp::mp_u32 index = 0; encoder.good( ); index++ )
+        {
+            end = encoder.write_cursor( );
+
+            encoder.start_map( 4 );
+            encoder.write_cstr( text, 2 ).write_uint( index * 0x10001ull );
+            encoder.write_cstr( text, 4 ).start_array( 6 ).write_int( -static_cast< int >( index ) );
+            encoder.write_f64( index * 0.5 ).write_nil( ).write_true( ).write_uint( index % 100 );
+            encoder.write_timestamp( { index, 0 } );
+            encoder.write_cstr( text, 8 ).write_cstr( text, index % 0x40 );
+            encoder.write_cstr( text, 3 ).write_bytes( text, index % 0x100 );
+        }
+
+        return end;
+    }
+
+    /*
+     * Re-encode what was decoded, value for value, through the given writer.
+     */
+    template < typename Writing >
+    void reencode( const mp::mp_u8 *data, const mp::mp_size size, Writing &writer )
+    {
+        mp::Decoder decoder { data, size };
+
+        while ( decoder.read_cursor( ) < size )
+        {
+            const auto dr = decoder.decode_view( );
+            const auto &info = mp::marker_info( dr.marker );
+
+            if ( info.family == mp::MPFamily::Array )
+                writer.start_array( dr.size );
+            else if ( info.family == mp::MPFamily::Map )
+                writer.start_map( dr.size );
+            else if ( info.family == mp::MPFamily::Str )
+                writer.write_cstr( dr.result.as_view.data, dr.size );
+            else if ( info.family == mp::MPFamily::Bin )
+                writer.write_bytes( dr.result.as_view.data, dr.size );
+            else if ( info.family == mp::MPFamily::Ext )
+                writer.write_ext( dr.result.as_view.type, dr.result.as_view.data, dr.size );
+            else if ( info.family == mp::MPFamily::Float )
+                writer.write_f64( dr.result.as_f64 );
+            else
+                writer.write_uint( dr.result.as_u8 );
+        }
+    }
+
+    /*
+     * One pass of every read path over the corpus.
+     */
+    mp::mp_u64 read_everything( const mp::mp_u8 *data, const mp::mp_size size )
+    {
+        mp::mp_u64 values = 0;
+
+        mp::Decoder decoder { data, size };
+
+        while ( decoder.good( ) && decoder.read_cursor( ) < size )
+            values += decoder.decode_single( ).size;
+
+        mp::Decoder skipper { data, size };
+
+        while ( skipper.read_cursor( ) < size && skipper.skip_value( ) )
+            values++;
+
+        mp::NullVisitor visitor { };
+        const auto token = mp::validate( data, size );
+        mp::TrustedDecoder trusted { token };
+
+        while ( trusted.read_cursor( ) < size && trusted.parse( visitor ) )
+            values++;
+
+        return values + token.values( );
+    }
+
+    TEST( Regression, NoHeapAllocations )
+    {
+        static mp::mp_u8 input[ 0x10000 ];
+        static mp::mp_u8 output[ 0x10000 ];
+        alignas( 8 ) static mp::mp_u8 arena[ 0x10000 ];
+
+        const auto size = write_corpus( input, sizeof( input ) );
+        mp::mp_u64 allocations[ 6 ];
+
+        /* Warm up first: thread-local state may allocate on first use (e.g. under `MP_STATS`). */
+        read_everything( input, size );
+
+        allocations[ 0 ] = heap_allocations.load( );
+
+        EXPECT_EQ( write_corpus( output, sizeof( output ) ), size );
+        allocations[ 1 ] = heap_allocations.load( );
+
+        mp::Encoder encoder { output, sizeof( output ) };
+
+        reencode( input, size, encoder );
+        allocations[ 2 ] = heap_allocations.load( );
+
+        mp::MessagePack mpack { };
+
+        mpack.initialize_streams( 0, sizeof( output ), output );
+        reencode( input, size, mpack );
+        allocations[ 3 ] = heap_allocations.load( );
+
+        const auto values = read_everything( input, size );
+        allocations[ 4 ] = heap_allocations.load( );
+
+        mp::Decoder decoder { input, size };
+        mp::Document document { arena, sizeof( arena ) };
+        mp::mp_u32 documents = 0;
+
+        while ( decoder.read_cursor( ) < size && document.parse( decoder ) )
+            documents++;
+
+        allocations[ 5 ] = heap_allocations.load( );
+
+        EXPECT_TRUE( encoder.good( ) );
+        EXPECT_TRUE( mpack.good( ) );
+        EXPECT_EQ( mpack.write_cursor( ), encoder.write_cursor( ) );
+        EXPECT_GT( values, 0u );
+        EXPECT_EQ( decoder.read_cursor( ), size );
+        EXPECT_GT( documents, 0u );
+
+        for ( auto index = 1; index < 6; index++ )
+            EXPECT_EQ( allocations[ index ], allocations[ 0 ] ) << "pass " << index;
+    }
+
+    TEST( Regression, ThroughputBudget )
+    {
+        if ( mp::stats::enabled )
+            GTEST_SKIP( ) << "built with MP_STATS, which times every decode";
+
+        static mp::mp_u8 input[ 0x10000 ];
+
+        const auto size = write_corpus( input, sizeof( input ) );
+
+        /* Best of several passes, in nanoseconds per byte. */
+        const auto best_of = [ size ]( const auto &pass )
+        {
+            double best = 1e300;
+
+            for ( auto round = 0; round < 7; round++ )
+            {
+                const auto start = std::chrono::steady_clock::now( );
+
+                pass( );
+
+                const std::chrono::duration< double, std::nano > elapsed =
+                    std::chrono::steady_clock::now( ) - start;
+
+                best = std::min( best, elapsed.count( ) / size );
+            }
+
+            return best;
+        };
+
+        /*
+         * The budget is a ratio to a byte-wise FNV-1a pass over the same buffer, compiled with the
+         * same flags. Each `read_everything` walks the buffer four times (decode_single, skip_value,
+         * validate and a trusted parse) and costs about 3 passes of FNV-1a when optimised, 10 to 15
+         * unoptimised or sanitised, where the hash loses less than the decoders do.
+         */
+#if defined( __OPTIMIZE__ ) && !defined( __SANITIZE_ADDRESS__ ) && !defined( MP_TEST_SANITIZED )
+        constexpr double budget_ratio = 8.0;
+#else
+        constexpr double budget_ratio = 32.0;
+#endif
+        volatile mp::mp_u32 sink = 0;
+        mp::mp_u64 values = 0;
+
+        const auto baseline = best_of( [ & ]( ) { sink = mp::reflect::fnv1a( input, size ); } );
+        const auto decoding = best_of( [ & ]( ) { values += read_everything( input, size ); } );
+
+        EXPECT_GT( values, 0u );
+        EXPECT_LT( decoding / baseline, budget_ratio ) << decoding << " ns per byte against "
+                                                       << baseline << " for FNV-1a";
+        RecordProperty( "ns_per_byte", std::to_string( decoding ) );
+        RecordProperty( "baseline_ns_per_byte", std::to_string( baseline ) );
+    }
+}
+
+namespace streams
+{
+    class StreamFixture : public testing::Test
+    {
+    protected:
+        stream::StreamReader sr { };
+        stream::StreamWriter wr { };
+
+        StreamFixture( )
+        {
+            const auto buffer = std::malloc( 0x200 );
+
+            memset( buffer, 0, 0x200 );
+
+            sr.set(
+                0,
+                0x200,
+                static_cast< mp::mp_u8* >( buffer ),
+                &copy
+            );
+
+            wr.set(
+                0,
+                0x200,
+                static_cast< mp::mp_u8* >( buffer ),
+                &copy
+            );
+        }
+
+        ~StreamFixture( )
+        {
+            const auto stream_buf = wr.start ( );
+
+            wr.reset ( );
+            sr.reset ( );
+
+            std::free( stream_buf );
+        }
+    };
+
+    TEST_F( StreamFixture, ReadBytes )
+    {
+        unsigned char buf[ ] = { 'a', 'b', 'c' };
+
+        wr.write( sizeof( buf ), buf );
+
+        EXPECT_EQ( sr.read_u8( ), 'a' );
+        EXPECT_EQ( sr.read_u8( ), 'b' );
+        EXPECT_EQ( sr.read_u8( ), 'c' );
+
+        wr.clear ( );
+
+        for ( auto index = 0lu; index < 0x200; index++ )
+            wr.write_u8( 'a' );
+
+        sr.reset_cursor ( );
+
+        for ( auto index = 0lu; index < 0x200; index++ )
+            EXPECT_EQ( sr.read_u8( ), 'a' );
+    }
+
+    TEST_F( StreamFixture, ReadOOB )
+    {
+        /* oob write is tested below */
+        for ( auto index = 0lu; index < 0x400; index++ )
+            wr.write_u8( 'a' );
+
+        for ( auto index = 0lu; index < 0x400; index++ )
+        {
+            if ( index < 0x200 )
+                EXPECT_EQ( sr.read_u8( ), 'a' );
+            else
+                EXPECT_EQ( sr.read_u8( ), '\0' ); // sr.read_u8( ) returns 0 for OOB or invalid buffer states
+
+            EXPECT_LE( sr.position( ), sr.stream_size( ) );
+        }
+    }
+
+    TEST_F( StreamFixture, WriteOverflow )
+    {
+        for ( auto index = 0lu; index < 0x400; index++ )
+            wr.write_u8( 'a' );
+
+        EXPECT_EQ( wr.position( ), wr.stream_size( ) );
+
+        wr.reset_cursor ( );
+        wr.clear ( );
+
+        for ( auto index = 0lu; index < 0x100; index++ )
+            wr.write_u32( 0xbadf00d );
+
+        EXPECT_EQ( wr.position( ), wr.stream_size( ) );
+
+        wr.reset_cursor ( );
+        wr.clear ( );
+
+        for ( auto index = 0lu; index < 0x100; index++ )
+            wr.write_u64( 0xbadf00dbadf00d );
+
+        EXPECT_EQ( wr.position( ), wr.stream_size( ) );
+    }
+
+    static mp::mp_u64 copied_bytes = 0;
+
+    static void counting_copy( void *dst, const void *src, mp::mp_u64 size )
+    {
+        copied_bytes += size;
+        memcpy( dst, src, size );
+    }
+
+    TEST( StreamPolicy, FunctionCopy )
+    {
+        mp::mp_u8 buffer[ 0x20 ] { };
+
+        mp::BasicMessagePack< stream::FunctionCopy > mpack { };
+
+        mpack.initialize_streams( 0, sizeof( buffer ), buffer, &counting_copy, &counting_copy );
+
+        copied_bytes = 0;
+
+        mpack.write_u16( 0xbeef );
+
+        EXPECT_EQ( copied_bytes, 3 );
+        EXPECT_EQ( mpack.decode_single( ).result.as_u16, 0xbeef );
+        EXPECT_EQ( copied_bytes, 6 );
+
+        /* Without a registered function the stream refuses to copy anything. */
+        stream::BasicStreamWriter< stream::FunctionCopy > wr { 0, sizeof( buffer ), buffer };
+
+        wr.write_u8( 0xa );
+
+        EXPECT_FALSE( wr );
+        EXPECT_EQ( wr.position( ), 0 );
     }
 }
\ No newline at end of file